@@ -1,24 +1,47 @@
 #ifndef SORA_ALIGNED_ENCODER_ADAPTER_H_
 #define SORA_ALIGNED_ENCODER_ADAPTER_H_
 
+#include <atomic>
 #include <cstdint>
 #include <memory>
 #include <vector>
 
 // WebRTC
 #include <api/fec_controller_override.h>
+#include <api/scoped_refptr.h>
 #include <api/video/video_frame.h>
+#include <api/video/video_frame_buffer.h>
 #include <api/video/video_frame_type.h>
 #include <api/video_codecs/video_codec.h>
 #include <api/video_codecs/video_encoder.h>
+#include <common_video/include/video_frame_buffer_pool.h>
 
 namespace sora {
 
+// フレームの幅と高さを指定したアライメントに揃えてからエンコーダに渡すアダプタ
+//
+// allow_crop_view が true で、揃えるために数ピクセル削るだけの場合は、
+// 元のバッファの画素を参照するだけでコピーしない。この場合、エンコーダに渡すバッファのストライドは
+// 元のバッファのままで、各プレーンも連続していないので、それを扱えるエンコーダでのみ有効にすること。
+// それ以外の場合は、詰めたバッファに切り出して縮小し、そのバッファを webrtc::VideoFrameBufferPool で使い回す。
 class AlignedEncoderAdapter : public webrtc::VideoEncoder {
  public:
+  // フレームをどの方法で揃えたかの回数
+  struct Stats {
+    // 揃える必要が無かった
+    uint64_t passthrough_frames = 0;
+    // 元のバッファを参照して切り出した
+    uint64_t crop_view_frames = 0;
+    // プールのバッファに切り出したり縮小した
+    uint64_t pooled_scale_frames = 0;
+    // kNative などのバッファの CropAndScale を呼んだ
+    uint64_t other_scale_frames = 0;
+  };
+
   AlignedEncoderAdapter(std::shared_ptr<webrtc::VideoEncoder> encoder,
                         int horizontal_alignment,
-                        int vertical_alignment);
+                        int vertical_alignment,
+                        bool allow_crop_view = false);
 
   void SetFecControllerOverride(
       webrtc::FecControllerOverride* fec_controller_override) override;
@@ -36,12 +59,27 @@ class AlignedEncoderAdapter : public webrtc::VideoEncoder {
 
   EncoderInfo GetEncoderInfo() const override;
 
+  Stats GetStats() const;
+
  private:
+  webrtc::scoped_refptr<webrtc::VideoFrameBuffer> CropAndScale(
+      webrtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer,
+      int offset_x,
+      int offset_y,
+      int crop_width,
+      int crop_height);
+
   std::shared_ptr<webrtc::VideoEncoder> encoder_;
   int horizontal_alignment_;
   int vertical_alignment_;
+  bool allow_crop_view_;
   int width_;
   int height_;
+  webrtc::VideoFrameBufferPool buffer_pool_;
+  std::atomic<uint64_t> passthrough_frames_{0};
+  std::atomic<uint64_t> crop_view_frames_{0};
+  std::atomic<uint64_t> pooled_scale_frames_{0};
+  std::atomic<uint64_t> other_scale_frames_{0};
 };
 
 }  // namespace sora
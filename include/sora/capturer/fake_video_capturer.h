@@ -1,6 +1,7 @@
 #ifndef FAKE_VIDEO_CAPTURER_H_INCLUDED
 #define FAKE_VIDEO_CAPTURER_H_INCLUDED
 
+#include <cstdint>
 #include <functional>
 
 // WebRTC
@@ -11,12 +12,39 @@
 
 namespace sora {
 
+// 負荷試験モードでのフレームの送信タイミングの統計情報
+struct FakeVideoCapturerPacingStats {
+  // 送信したフレーム数
+  uint64_t frames = 0;
+  // 送信が間に合わずに飛ばしたフレーム数
+  uint64_t skipped_frames = 0;
+  // 予定時刻からの遅れ
+  double average_jitter_ms = 0;
+  double max_jitter_ms = 0;
+};
+
 struct FakeVideoCapturerConfig : ScalableVideoTrackSourceConfig {
   int width = 640;
   int height = 480;
   int fps = 30;
   // 円が一周した時に呼ばれるコールバック
   std::function<void()> on_tick;
+  // true の場合、I420 ではなく NV12 のフレームを送る
+  bool nv12 = false;
+  // true の場合、映像の下端にフレーム ID とキャプチャ時刻を埋め込む
+  // 受信側では FrameStampDetector で読み取れる
+  bool frame_stamp = false;
+  // 負荷試験モード
+  // 開始時に pre_render_frames 枚のフレームを描画して変換しておき、それを繰り返し送る。
+  // フレームは絶対時刻を基準に送り、同じプロセス内の負荷試験モードのキャプチャラとタイミングを揃える。
+  // 時計の表示は事前に描画した範囲を繰り返す。
+  bool load_generation = false;
+  // 負荷試験モードで事前に描画するフレーム数。0 以下の場合は 8。
+  // 1 フレームあたり width * height * 1.5 バイト（4K で約 12MB）のメモリを使うので、
+  // 大きくする場合は解像度とキャプチャラの数に注意すること。
+  int pre_render_frames = 8;
+  // 負荷試験モードで 1 秒ごとに呼ばれるコールバック
+  std::function<void(const FakeVideoCapturerPacingStats&)> on_pacing_stats;
 };
 
 class FakeVideoCapturer : public ScalableVideoTrackSource {
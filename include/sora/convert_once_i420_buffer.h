@@ -0,0 +1,53 @@
+#ifndef SORA_CONVERT_ONCE_I420_BUFFER_H_
+#define SORA_CONVERT_ONCE_I420_BUFFER_H_
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+// WebRTC
+#include <api/scoped_refptr.h>
+#include <api/video/video_frame_buffer.h>
+
+namespace sora {
+
+// kNative なバッファを、最初に画素が読まれた時に 1 回だけ I420 に変換するバッファ。
+//
+// サイマルキャストの各レイヤーやシンクが同じバッファを何度読んでも、元のバッファは 1 回しか読まない。
+// 全てのレイヤーでフレームが捨てられた場合は変換しない。
+// 変換した後は元のバッファを解放する。
+class ConvertOnceI420Buffer : public webrtc::I420BufferInterface {
+ public:
+  static webrtc::scoped_refptr<ConvertOnceI420Buffer> Create(
+      webrtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer);
+
+  int width() const override { return width_; }
+  int height() const override { return height_; }
+  const uint8_t* DataY() const override { return Get()->DataY(); }
+  const uint8_t* DataU() const override { return Get()->DataU(); }
+  const uint8_t* DataV() const override { return Get()->DataV(); }
+  int StrideY() const override { return Get()->StrideY(); }
+  int StrideU() const override { return Get()->StrideU(); }
+  int StrideV() const override { return Get()->StrideV(); }
+
+  // 既に変換したかどうか
+  bool converted() const;
+
+ protected:
+  explicit ConvertOnceI420Buffer(
+      webrtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer);
+
+ private:
+  const webrtc::I420BufferInterface* Get() const;
+
+  int width_;
+  int height_;
+  mutable std::once_flag once_;
+  mutable webrtc::scoped_refptr<webrtc::VideoFrameBuffer> source_;
+  mutable webrtc::scoped_refptr<webrtc::I420BufferInterface> i420_;
+  mutable std::atomic<bool> converted_{false};
+};
+
+}  // namespace sora
+
+#endif
@@ -1,10 +1,13 @@
 #ifndef SORA_DATA_CHANNEL_H_
 #define SORA_DATA_CHANNEL_H_
 
+#include <cstddef>
 #include <cstdint>
+#include <deque>
 #include <functional>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 
 // Boost
@@ -18,6 +21,19 @@
 
 namespace sora {
 
+// DataChannel の送信バッファによるフロー制御の設定
+//
+// buffered_amount が high_threshold 以上になったら、送信せずに
+// 最大 max_queued_bytes バイトまでキューに積んでおき、
+// buffered_amount が減ったタイミングでキューから送信する。
+// キューを全て送信し終わって buffered_amount が low_threshold 以下になったら
+// 書き込み可能になったことを通知する。
+struct DataChannelFlowControl {
+  uint64_t high_threshold = 1024 * 1024;
+  uint64_t low_threshold = 256 * 1024;
+  size_t max_queued_bytes = 4 * 1024 * 1024;
+};
+
 class DataChannelObserver {
  public:
   ~DataChannelObserver() {}
@@ -26,6 +42,9 @@ class DataChannelObserver {
   virtual void OnMessage(
       webrtc::scoped_refptr<webrtc::DataChannelInterface> data_channel,
       const webrtc::DataBuffer& buffer) = 0;
+  // フロー制御が設定されたラベルが、書き込み不可の状態から書き込み可能になった
+  virtual void OnWritable(
+      webrtc::scoped_refptr<webrtc::DataChannelInterface> data_channel) {}
 };
 
 // 複数の DataChannel を纏めてコールバックで受け取るためのクラス
@@ -43,8 +62,17 @@ class DataChannel : public std::enable_shared_from_this<DataChannel> {
   DataChannel(boost::asio::io_context& ioc,
               std::weak_ptr<DataChannelObserver> observer);
   ~DataChannel();
+  // IsOpen, Send, SetFlowControl, IsWritable は任意のスレッドから呼び出せる
   bool IsOpen(std::string label) const;
+  // フロー制御が設定されたラベルの場合、送信バッファが一杯ならキューに積む。
+  // キューも一杯の場合は false を返す。
   bool Send(std::string label, const webrtc::DataBuffer& data);
+  // ラベルにフロー制御を設定する。AddDataChannel の前に呼ぶこと。
+  void SetFlowControl(std::string label, const DataChannelFlowControl& config);
+  // 送信してもキューに積まれずにすぐ送られる状態かどうか。
+  // false を返した場合、書き込み可能になった時に OnWritable が呼ばれる。
+  bool IsWritable(std::string label);
+  // Close と SetOnClose は ioc のスレッドから呼び出すこと
   void Close(const webrtc::DataBuffer& disconnect_message,
              std::function<void(boost::system::error_code)> on_close,
              double disconnect_wait_timeout);
@@ -59,14 +87,39 @@ class DataChannel : public std::enable_shared_from_this<DataChannel> {
                  const webrtc::DataBuffer& buffer);
   void OnBufferedAmountChange(std::shared_ptr<Thunk> thunk,
                               uint64_t previous_amount);
+  // ioc_ のスレッドで、送信バッファに空きがある分だけキューから送信する
+  void SendQueued(
+      webrtc::scoped_refptr<webrtc::DataChannelInterface> data_channel);
+  // ラベルに対応する DataChannel を返す。無い場合は nullptr
+  webrtc::scoped_refptr<webrtc::DataChannelInterface> GetDataChannel(
+      const std::string& label) const;
 
  private:
   boost::asio::io_context* ioc_;
   std::map<std::shared_ptr<Thunk>,
            webrtc::scoped_refptr<webrtc::DataChannelInterface>>
       thunks_;
+  // labels_ は ioc_ のスレッドで追加・削除して、任意のスレッドから参照するので labels_mutex_ で保護する。
+  // flows_mutex_ と同様に、labels_mutex_ をロックしたまま DataChannelInterface の関数を呼んではいけない。
+  mutable std::mutex labels_mutex_;
   std::map<std::string, webrtc::scoped_refptr<webrtc::DataChannelInterface>>
       labels_;
+  struct FlowState {
+    DataChannelFlowControl config;
+    std::deque<webrtc::DataBuffer> queue;
+    size_t queued_bytes = 0;
+    // 書き込み不可の状態を返したかどうか。
+    // 書き込み可能になった時に OnWritable を呼ぶために使う。
+    bool blocked = false;
+    // ioc_ のスレッドがキューから取り出して送信している最中かどうか。
+    // 送信中に Send されたデータが追い越さないようにキューに積むために使う。
+    bool sending = false;
+  };
+  // flows_ は Send を呼んだスレッドと ioc_ のスレッドから触るので flows_mutex_ で保護する。
+  // webrtc::DataChannelInterface::Send の中から OnBufferedAmountChange が呼ばれることがあるので、
+  // flows_mutex_ をロックしたまま Send や buffered_amount を呼んではいけない。
+  std::mutex flows_mutex_;
+  std::map<std::string, FlowState> flows_;
   std::weak_ptr<DataChannelObserver> observer_;
   std::function<void(boost::system::error_code)> on_close_;
   boost::asio::deadline_timer timer_;
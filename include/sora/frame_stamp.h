@@ -0,0 +1,74 @@
+#ifndef SORA_FRAME_STAMP_H_
+#define SORA_FRAME_STAMP_H_
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+// WebRTC
+#include <api/video/i420_buffer.h>
+#include <api/video/nv12_buffer.h>
+#include <api/video/video_frame.h>
+#include <api/video/video_sink_interface.h>
+#include <rtc_base/synchronization/mutex.h>
+
+namespace sora {
+
+// 映像の下端に埋め込む、機械で読み取れるフレームの情報。
+//
+// 映像の下端 12% の領域を 4 行 32 列のブロックに分割し、
+// 白と黒の基準ブロックに続けて、フレーム ID、キャプチャ時刻、CRC-16 を 1 ブロック 1 ビットで書き込む。
+// ブロックの位置は映像のサイズに対する割合で決まるので、縮小された映像からも読み取れる。
+struct FrameStamp {
+  uint32_t frame_id = 0;
+  // キャプチャした時刻（UNIX 時間のマイクロ秒）
+  int64_t capture_time_us = 0;
+};
+
+// 現在の UNIX 時間のマイクロ秒
+int64_t GetFrameStampTimeUs();
+
+void WriteFrameStamp(const FrameStamp& stamp, webrtc::I420Buffer* buffer);
+void WriteFrameStamp(const FrameStamp& stamp, webrtc::NV12Buffer* buffer);
+// 読み取れなかった場合は std::nullopt を返す
+std::optional<FrameStamp> ReadFrameStamp(const webrtc::VideoFrame& frame);
+
+// 受信したフレームから FrameStamp を読み取って、キャプチャから受信までの遅延を集計する。
+// 送信側と受信側の時計は合っている必要がある。
+class FrameStampDetector
+    : public webrtc::VideoSinkInterface<webrtc::VideoFrame> {
+ public:
+  struct Stats {
+    // FrameStamp を読み取れたフレーム数
+    uint64_t frames = 0;
+    // FrameStamp を読み取れなかったフレーム数
+    uint64_t undetected_frames = 0;
+    // 最後に読み取ったフレーム ID から飛んでいたフレーム数
+    uint64_t missing_frames = 0;
+    double min_ms = 0;
+    double max_ms = 0;
+    double p50_ms = 0;
+    double p95_ms = 0;
+    double p99_ms = 0;
+  };
+
+  FrameStampDetector();
+
+  void OnFrame(const webrtc::VideoFrame& frame) override;
+
+  Stats GetStats() const;
+  void Reset();
+
+ private:
+  double Percentile(double p) const;
+
+  mutable webrtc::Mutex mutex_;
+  // 1ms 単位のヒストグラム。最後の要素はそれ以上の遅延
+  std::vector<uint32_t> histogram_;
+  Stats stats_;
+  std::optional<uint32_t> last_frame_id_;
+};
+
+}  // namespace sora
+
+#endif
@@ -15,6 +15,10 @@
 namespace sora {
 
 // kNative なフレームを I420 にするアダプタ
+//
+// 複数のレイヤーでエンコードする場合は、ConvertOnceI420Buffer で包んで、
+// 最初に読まれた時に 1 回だけ I420 に変換する。
+// エンコードするレイヤーが 1 つの場合は元のバッファが 1 回しか読まれないので、そのまま渡す。
 class I420EncoderAdapter : public webrtc::VideoEncoder {
  public:
   I420EncoderAdapter(std::shared_ptr<webrtc::VideoEncoder> encoder);
@@ -36,6 +40,10 @@ class I420EncoderAdapter : public webrtc::VideoEncoder {
 
  private:
   std::shared_ptr<webrtc::VideoEncoder> encoder_;
+  // サイマルキャストのストリームの数
+  int simulcast_streams_ = 0;
+  // エンコードするレイヤーの数
+  int active_layers_ = 0;
 };
 
 }  // namespace sora
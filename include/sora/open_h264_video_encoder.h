@@ -10,9 +10,12 @@
 
 namespace sora {
 
+// parallel_simulcast が true の場合、サイマルキャストの各レイヤーを
+// ワーカースレッドで並列に縮小・エンコードし、エンコードが終わったレイヤーから順にコールバックする。
 std::unique_ptr<webrtc::VideoEncoder> CreateOpenH264VideoEncoder(
     const webrtc::SdpVideoFormat& format,
-    std::string openh264);
+    std::string openh264,
+    bool parallel_simulcast = false);
 
 }  // namespace sora
 
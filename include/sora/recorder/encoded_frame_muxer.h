@@ -0,0 +1,106 @@
+#ifndef SORA_RECORDER_ENCODED_FRAME_MUXER_H_
+#define SORA_RECORDER_ENCODED_FRAME_MUXER_H_
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+// WebRTC
+#include <api/array_view.h>
+
+namespace sora {
+
+// RTP タイムスタンプを最初のフレームからの経過時間に変換する
+class RtpTimestampUnwrapper {
+ public:
+  int64_t Unwrap(uint32_t timestamp);
+
+ private:
+  bool initialized_ = false;
+  uint32_t last_ = 0;
+  int64_t elapsed_ = 0;
+};
+
+// エンコード済みのフレームをコンテナの形式に変換する。
+// EncodedTrackRecorder で使う。書き込めるのは IVF と Ogg だけ。
+class EncodedFrameMuxer {
+ public:
+  struct Frame {
+    webrtc::ArrayView<const uint8_t> data;
+    uint32_t rtp_timestamp = 0;
+    std::string mime_type;
+    // 以下は映像の場合だけ使う。width と height はキーフレームの場合だけ設定すればいい
+    bool key_frame = false;
+    int width = 0;
+    int height = 0;
+  };
+
+  virtual ~EncodedFrameMuxer() = default;
+  // out にファイルに書き込むデータを追加する。
+  // フレームを書き込めない場合は false を返す。
+  virtual bool Mux(const Frame& frame, std::string& out) = 0;
+  // 書き込み待ちのデータが多すぎてフレームを捨てた時に呼ばれる
+  virtual void OnDropped() {}
+  // 録画を終了する時に呼ばれる。out にファイルの最後に書き込むデータを追加する。
+  virtual void Finish(std::string& out) {}
+};
+
+// IVF
+// https://wiki.multimedia.cx/index.php/Duck_IVF
+//
+// 最初のキーフレームでファイルヘッダーを書き込む。
+// キーフレームが来るまでと、OnDropped() の後は次のキーフレームまでフレームを捨てる。
+class IvfMuxer : public EncodedFrameMuxer {
+ public:
+  bool Mux(const Frame& frame, std::string& out) override;
+  void OnDropped() override;
+
+ private:
+  static const char* GetFourCC(const std::string& mime_type);
+
+  bool header_written_ = false;
+  bool wait_key_frame_ = true;
+  RtpTimestampUnwrapper unwrapper_;
+};
+
+// Ogg Opus
+// https://datatracker.ietf.org/doc/html/rfc7845
+//
+// 1 ページに 1 パケットだけ入れる。
+// 最後のページに EOS フラグを付けるために、パケットは 1 つ遅らせて書き込む。
+class OggOpusMuxer : public EncodedFrameMuxer {
+ public:
+  // serial はストリームのシリアル番号。省略した場合はランダムに決める
+  OggOpusMuxer();
+  explicit OggOpusMuxer(uint32_t serial);
+
+  bool Mux(const Frame& frame, std::string& out) override;
+  void Finish(std::string& out) override;
+
+  // Ogg のページの CRC (多項式 0x04c11db7, 初期値 0, 反転無し)
+  static uint32_t Crc(std::string_view data);
+
+  static constexpr uint8_t kBeginOfStream = 0x02;
+  static constexpr uint8_t kEndOfStream = 0x04;
+
+ private:
+  // RFC 6716 3.1. The TOC Byte
+  static int GetSamples(const uint8_t* data, size_t size);
+  void WritePage(std::string& out,
+                 std::string_view packet,
+                 uint64_t granule,
+                 uint8_t header_type);
+
+  uint32_t serial_;
+  uint32_t sequence_ = 0;
+  bool header_written_ = false;
+  RtpTimestampUnwrapper unwrapper_;
+  // まだ書き込んでいない最後のパケット
+  std::optional<std::string> pending_packet_;
+  uint64_t pending_granule_ = 0;
+};
+
+}  // namespace sora
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef SORA_RECORDER_ENCODED_TRACK_RECORDER_H_
+#define SORA_RECORDER_ENCODED_TRACK_RECORDER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// WebRTC
+#include <api/rtp_receiver_interface.h>
+#include <api/scoped_refptr.h>
+
+namespace sora {
+
+struct EncodedTrackRecorderConfig {
+  // 出力先のファイル
+  // 映像は IVF、音声 (Opus) は Ogg で書き込む
+  std::string path;
+  // ファイルへの書き込みを待っているデータの上限
+  // 上限を超えた場合、映像は次のキーフレームまで、音声はそのパケットを捨てる
+  size_t max_queued_bytes = 8 * 1024 * 1024;
+  // true の場合、記録したフレームを WebRTC に戻さずに捨てる。
+  // デコードしないので録画だけしたい場合に CPU を節約できるが、
+  // このトラックのシンクにはフレームが届かなくなる。
+  bool record_only = false;
+};
+
+// 受信したトラックを、デコードせずにエンコード済みのままファイルに書き込む。
+//
+// SoraSignalingObserver::OnTrack で渡された transceiver->receiver() に対して作成する。
+// receiver にフレームトランスフォーマーを設定してエンコード済みのフレームを取得し、
+// 取得したフレームは record_only でなければそのまま WebRTC に戻す。
+// ファイルへの書き込みは専用のスレッドで行う。
+class EncodedTrackRecorder {
+ public:
+  struct Stats {
+    uint64_t frames_written = 0;
+    uint64_t frames_dropped = 0;
+    uint64_t bytes_written = 0;
+  };
+
+  // ファイルを開けなかった場合は nullptr を返す
+  static std::shared_ptr<EncodedTrackRecorder> Create(
+      webrtc::scoped_refptr<webrtc::RtpReceiverInterface> receiver,
+      EncodedTrackRecorderConfig config);
+  virtual ~EncodedTrackRecorder() = default;
+
+  // 書き込み待ちのデータを全て書き込んでファイルを閉じる。
+  // Ogg の場合は最後のページに EOS フラグを付ける。
+  // Stop() 以降に受信したフレームは書き込まない。
+  virtual void Stop() = 0;
+  virtual Stats GetStats() const = 0;
+};
+
+}  // namespace sora
+
+#endif
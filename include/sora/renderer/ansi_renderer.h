@@ -1,6 +1,8 @@
 #ifndef ANSI_RENDERER_H_
 #define ANSI_RENDERER_H_
 
+#include <array>
+#include <atomic>
 #include <cstdint>
 #include <string>
 #include <vector>
@@ -14,6 +16,9 @@ class AnsiRenderer : public BaseRenderer {
   AnsiRenderer(int width, int height, int fps = 10);
   ~AnsiRenderer() override;
 
+  // true の場合、前回から色が変わった文字だけを出力する
+  void SetDeltaMode(bool enabled);
+
   void RenderThreadStarted() override;
   void RenderThreadFinished() override;
   void Render(uint8_t* image,
@@ -22,13 +27,35 @@ class AnsiRenderer : public BaseRenderer {
               const std::vector<SinkInfo>& sink_infos) override;
 
  private:
-  void OutputAnsi(const uint8_t* rgb_data, int width, int height);
+  // 1 文字分の前景色と背景色
+  struct Cell {
+    uint8_t fg;
+    uint8_t bg;
+    bool operator==(const Cell& other) const {
+      return fg == other.fg && bg == other.bg;
+    }
+  };
+
+  // top は画像より上に出力している行数
+  void OutputAnsi(const uint8_t* rgb_data, int width, int height, int top);
+  void UpdateCells(const uint8_t* rgb_data, int width, int height);
+  void AppendCell(const Cell& cell, int& fg, int& bg);
   void ClearScreen();
-  void MoveCursorToTop();
   std::string RgbToAnsi(uint8_t r, uint8_t g, uint8_t b);
 
   // ANSI 256色パレットへの変換用
   int RgbToAnsi256(uint8_t r, uint8_t g, uint8_t b);
+
+  std::array<std::string, 256> fg_escapes_;
+  std::array<std::string, 256> bg_escapes_;
+  std::atomic<bool> delta_mode_;
+  // 以下は描画スレッドだけが使う
+  std::string output_;
+  std::vector<Cell> cells_;
+  std::vector<Cell> prev_cells_;
+  int prev_width_ = 0;
+  int prev_height_ = 0;
+  int prev_top_ = 0;
 };
 
 }  // namespace sora
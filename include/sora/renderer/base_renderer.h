@@ -13,6 +13,7 @@
 #include <api/scoped_refptr.h>
 #include <api/video/video_frame.h>
 #include <api/video/video_sink_interface.h>
+#include <common_video/include/video_frame_buffer_pool.h>
 #include <rtc_base/synchronization/mutex.h>
 
 namespace sora {
@@ -27,6 +28,9 @@ class BaseRenderer {
 
   void SetSize(int width, int height);
   webrtc::Mutex* GetMutex();
+  // true の場合、新しいフレームが届いたトラックの領域だけを描き直し、
+  // 何も変化が無かった場合は Render を呼ばない
+  void SetIncrementalComposite(bool enabled);
 
   void AddTrack(webrtc::VideoTrackInterface* track);
   void RemoveTrack(webrtc::VideoTrackInterface* track);
@@ -34,7 +38,7 @@ class BaseRenderer {
   struct SinkInfo {
     int offset_x;
     int offset_y;
-    // 入力フレームそのままのサイズ
+    // 入力フレームそのままのサイズ（回転が指定されている場合は回転後のサイズ）
     int input_width;
     int input_height;
     // イメージ領域のサイズ
@@ -43,6 +47,8 @@ class BaseRenderer {
     // 分割された領域のサイズ
     int width;
     int height;
+    // 前回の Render から画像が更新されたかどうか
+    bool updated;
   };
   virtual void RenderThreadStarted() = 0;
   virtual void RenderThreadFinished() = 0;
@@ -54,6 +60,30 @@ class BaseRenderer {
  private:
   class Sink : public webrtc::VideoSinkInterface<webrtc::VideoFrame> {
    public:
+    // 変換済みのフレーム
+    struct Frame {
+      std::unique_ptr<uint8_t[]> image;
+      size_t capacity = 0;
+      // 分割された領域内でのオフセット
+      int offset_x = 0;
+      int offset_y = 0;
+      int input_width = 0;
+      int input_height = 0;
+      int frame_width = 0;
+      int frame_height = 0;
+      int width = 0;
+      int height = 0;
+      // このフレームを変換した時の領域の世代
+      uint64_t outline_generation = 0;
+    };
+    // 描画スレッドが最後に描画した範囲
+    struct DrawnRect {
+      int x = 0;
+      int y = 0;
+      int width = 0;
+      int height = 0;
+    };
+
     Sink(BaseRenderer* renderer, webrtc::VideoTrackInterface* track);
     ~Sink();
 
@@ -61,17 +91,16 @@ class BaseRenderer {
 
     void SetOutlineRect(int x, int y, int width, int height);
 
-    webrtc::Mutex* GetMutex();
-    bool GetOutlineChanged();
-    int GetOffsetX();
-    int GetOffsetY();
-    int GetInputWidth();
-    int GetInputHeight();
-    int GetFrameWidth();
-    int GetFrameHeight();
-    int GetWidth();
-    int GetHeight();
-    uint8_t* GetImage();
+    // 描画スレッドから呼ぶ。
+    // 新しいフレームが届いていれば描画用のフレームと交換して true を返す。
+    bool AcquireFrame();
+    const Frame& GetFrame() const;
+    int GetOutlineOffsetX() const;
+    int GetOutlineOffsetY() const;
+    int GetOutlineWidth() const;
+    int GetOutlineHeight() const;
+    uint64_t GetOutlineGeneration() const;
+    DrawnRect& GetDrawnRect();
 
    private:
     BaseRenderer* renderer_;
@@ -82,15 +111,29 @@ class BaseRenderer {
     int outline_width_;
     int outline_height_;
     bool outline_changed_;
+    uint64_t outline_generation_;
     float outline_aspect_;
     int input_width_;
     int input_height_;
     bool scaled_;
-    std::unique_ptr<uint8_t[]> image_;
     int offset_x_;
     int offset_y_;
     int width_;
     int height_;
+    // 縮小と回転に使う作業用のバッファ
+    webrtc::VideoFrameBufferPool scale_pool_;
+    webrtc::VideoFrameBufferPool rotate_pool_;
+
+    // トリプルバッファ
+    // back_ は OnFrame のスレッド、front_ は描画スレッドだけが触る。
+    // middle_ は受け渡し用で、kNewFrame が立っていれば新しいフレームが入っている。
+    static constexpr int kIndexMask = 0x3;
+    static constexpr int kNewFrame = 0x4;
+    Frame frames_[3];
+    int back_;
+    std::atomic<int> middle_;
+    int front_;
+    DrawnRect drawn_rect_;
   };
 
  private:
@@ -103,7 +146,10 @@ class BaseRenderer {
       std::pair<webrtc::VideoTrackInterface*, std::unique_ptr<Sink>>>
       VideoTrackSinkVector;
   VideoTrackSinkVector sinks_;
+  // SetOutlines を呼ぶたびに増える
+  uint64_t layout_version_;
   std::atomic<bool> running_;
+  std::atomic<bool> incremental_composite_;
   std::unique_ptr<std::thread> thread_;
   int width_;
   int height_;
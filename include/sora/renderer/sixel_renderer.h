@@ -1,8 +1,11 @@
 #ifndef SIXEL_RENDERER_H_
 #define SIXEL_RENDERER_H_
 
+#include <array>
+#include <atomic>
 #include <cstdint>
 #include <map>
+#include <string>
 #include <vector>
 
 #include "base_renderer.h"
@@ -14,6 +17,9 @@ class SixelRenderer : public BaseRenderer {
   SixelRenderer(int width, int height, int fps = 10);
   ~SixelRenderer() override;
 
+  // true の場合、前回から変化した 6 行単位のバンドだけを出力する
+  void SetDiffMode(bool enabled);
+
   void RenderThreadStarted() override;
   void RenderThreadFinished() override;
   void Render(uint8_t* image,
@@ -24,12 +30,29 @@ class SixelRenderer : public BaseRenderer {
  private:
   void OutputSixel(const uint8_t* rgb_data, int width, int height);
   void ClearScreen();
-  void MoveCursorToTop();
   void InitializeColorLookupTable();
+  void InitializePaletteHeader();
+  void AppendSixelLine(const uint8_t* bits, int width);
+  // output_ を標準出力に書き込む
+  void Flush();
 
   // 色変換用ルックアップテーブル
   std::vector<uint8_t> color_lookup_table_;
   std::map<uint32_t, int> palette_map_;
+  std::string palette_header_;
+
+  std::atomic<bool> diff_mode_;
+  // 以下は描画スレッドだけが使う作業用のバッファ
+  std::string output_;
+  std::vector<uint8_t> indexed_image_;
+  std::vector<uint8_t> prev_indexed_image_;
+  int prev_width_ = 0;
+  int prev_height_ = 0;
+  // 色ごとのバンド 1 行分の Sixel のビット
+  std::vector<uint8_t> band_bits_;
+  // バンドに含まれる色と、その色が既に含まれているかどうか
+  std::vector<uint8_t> band_colors_;
+  std::array<bool, 256> color_used_;
 };
 
 }  // namespace sora
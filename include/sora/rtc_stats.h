@@ -2,6 +2,10 @@
 #define SORA_RTC_STATS_H_
 
 #include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
 
 // WebRTC
 #include <api/scoped_refptr.h>
@@ -31,6 +35,42 @@ class RTCStatsCallback : public webrtc::RTCStatsCollectorCallback {
   ResultCallback result_callback_;
 };
 
+// RTCStatsReport を JSON に変換してシグナリングで送るためのクラス
+//
+// RTCStatsReport::ToJson() の結果を文字列結合するのではなく、
+// 使い回すバッファに必要な統計情報だけを直接書き込む。
+class RTCStatsExporter {
+ public:
+  struct Config {
+    // 設定されている場合、ここに含まれる type の統計情報だけを出力する
+    std::optional<std::vector<std::string>> types;
+    // true の場合、前回出力した時からタイムスタンプ以外の値が
+    // 変化していない統計情報を出力しない
+    bool changed_only = false;
+  };
+
+  RTCStatsExporter();
+  explicit RTCStatsExporter(Config config);
+
+  // prefix + 統計情報の JSON 配列 + suffix を返す。
+  // 例えば prefix に {"type":"pong","stats": を、suffix に } を指定する。
+  std::string Export(
+      const webrtc::scoped_refptr<const webrtc::RTCStatsReport>& report,
+      std::string_view prefix,
+      std::string_view suffix);
+
+  // 前回出力した統計情報を忘れる
+  void Reset();
+
+ private:
+  bool IsTargetType(const char* type) const;
+
+  Config config_;
+  webrtc::scoped_refptr<const webrtc::RTCStatsReport> last_report_;
+  // 前回出力したサイズ。次回のバッファの確保サイズに使う。
+  size_t last_size_ = 0;
+};
+
 }  // namespace sora
 
 #endif
@@ -16,7 +16,11 @@
 
 // WebRTC
 #include <api/media_stream_interface.h>
+#include <api/scoped_refptr.h>
 #include <api/video/video_frame.h>
+#include <api/video/video_frame_buffer.h>
+#include <api/video/video_rotation.h>
+#include <common_video/include/video_frame_buffer_pool.h>
 #include <media/base/adapted_video_track_source.h>
 #include <rtc_base/timestamp_aligner.h>
 
@@ -38,8 +42,27 @@ class ScalableVideoTrackSource : public webrtc::AdaptedVideoTrackSource {
   bool OnCapturedFrame(const webrtc::VideoFrame& frame);
 
  private:
+  // 回転後の座標系で指定された範囲を切り出して縮小し、回転したバッファを pool から確保して返す。
+  // 何もする必要が無い場合は buffer をそのまま返す。
+  webrtc::scoped_refptr<webrtc::VideoFrameBuffer> CropScaleRotate(
+      webrtc::VideoFrameBufferPool& pool,
+      webrtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer,
+      webrtc::VideoRotation rotation,
+      int crop_x,
+      int crop_y,
+      int crop_width,
+      int crop_height,
+      int adapted_width,
+      int adapted_height);
+
   ScalableVideoTrackSourceConfig config_;
   webrtc::TimestampAligner timestamp_aligner_;
+  // 出力するフレームのバッファ
+  webrtc::VideoFrameBufferPool buffer_pool_;
+  // on_frame に渡す回転済みのフレームのバッファ
+  webrtc::VideoFrameBufferPool rotated_buffer_pool_;
+  // 縮小してから回転する場合の中間バッファ
+  webrtc::VideoFrameBufferPool scale_buffer_pool_;
 };
 
 }  // namespace sora
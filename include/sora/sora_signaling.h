@@ -9,11 +9,13 @@
 #include <mutex>
 #include <optional>
 #include <string>
+#include <utility>
 #include <vector>
 
 // Boost
 #include <boost/asio/deadline_timer.hpp>
 #include <boost/asio/io_context.hpp>
+#include <boost/beast/websocket/option.hpp>
 #include <boost/beast/websocket/rfc6455.hpp>
 #include <boost/system/detail/error_code.hpp>
 
@@ -28,13 +30,18 @@
 #include <api/rtp_transceiver_interface.h>
 #include <api/scoped_refptr.h>
 #include <api/stats/rtc_stats_report.h>
+#include <rtc_base/copy_on_write_buffer.h>
 #include <rtc_base/network.h>
+#include <rtc_base/thread.h>
 
 #include "sora/boost_json_iwyu.h"
 #include "sora/data_channel.h"
+#include "sora/rtc_stats.h"
+#include "sora/session_description.h"
 #include "sora/url_parts.h"
 #include "sora/version.h"
 #include "sora/websocket.h"
+#include "sora/zlib_helper.h"
 
 namespace sora {
 
@@ -75,6 +82,16 @@ class SoraSignalingObserver {
   virtual void OnNotify(std::string text) = 0;
   virtual void OnPush(std::string text) = 0;
   virtual void OnMessage(std::string label, std::string data) = 0;
+  // ユーザ定義ラベルのメッセージを受信した時に呼ばれる。
+  // 圧縮されていないメッセージは受信したバッファをコピーせずに共有して渡すので、
+  // コピーを避けたい場合はこちらをオーバーライドする。
+  // デフォルトの実装は std::string にコピーして OnMessage を呼ぶ。
+  virtual void OnMessageBuffer(std::string label,
+                               webrtc::CopyOnWriteBuffer data) {
+    OnMessage(std::move(label),
+              std::string((const char*)data.cdata(),
+                          (const char*)data.cdata() + data.size()));
+  }
   virtual void OnRpc(std::string data) {}
   virtual void OnSwitched(std::string text) {}
   virtual void OnSignalingMessage(SoraSignalingType type,
@@ -88,6 +105,8 @@ class SoraSignalingObserver {
       webrtc::scoped_refptr<webrtc::RtpReceiverInterface> receiver) = 0;
 
   virtual void OnDataChannel(std::string label) = 0;
+  // flow_control が設定されたラベルが、書き込み不可の状態から書き込み可能になった時に呼ばれる
+  virtual void OnDataChannelWritable(std::string label) {}
 };
 
 struct SoraSignalingConfig {
@@ -139,6 +158,9 @@ struct SoraSignalingConfig {
     std::optional<std::string> protocol;
     std::optional<bool> compress;
     std::optional<std::vector<boost::json::value>> header;
+    // 設定した場合、送信バッファによるフロー制御を行う。
+    // SDK 内部で使うだけで、Sora には送信しない。
+    std::optional<DataChannelFlowControl> flow_control;
   };
   std::vector<DataChannel> data_channels;
 
@@ -173,12 +195,32 @@ struct SoraSignalingConfig {
   webrtc::NetworkManager* network_manager = nullptr;
   webrtc::PacketSocketFactory* socket_factory = nullptr;
 
+  // PeerConnection の signaling スレッド（SoraClientContext::signaling_thread()）。
+  // 設定した場合、SetRemoteDescription, CreateAnswer, GetStats をこのスレッドで非同期に実行する。
+  // 設定しない場合は io_context のスレッドから呼び出すので、PeerConnection のプロキシが
+  // signaling スレッドの処理を同期的に待つ間 io_context がブロックされる。
+  // 1 つの io_context で多数の接続を扱う場合は設定すること。
+  webrtc::Thread* signaling_thread = nullptr;
+
   bool disable_signaling_url_randomization = false;
 
   std::optional<http_header_value> user_agent;
 
+  // シグナリングの WebSocket で permessage-deflate 拡張を利用する場合に設定する。
+  // client_enable を true にすること。
+  // ウィンドウサイズ (client_max_window_bits)、メモリレベル (memLevel)、
+  // コンテキストの引き継ぎ (client_no_context_takeover) などもここで指定する。
+  std::optional<boost::beast::websocket::permessage_deflate>
+      websocket_permessage_deflate;
+
   std::optional<webrtc::DegradationPreference> degradation_preference;
   std::optional<bool> cpu_adaptation;
+
+  // type: pong や type: stats で Sora に送る統計情報の type を制限する。
+  // 設定しない場合は全ての統計情報を送る。
+  std::optional<std::vector<std::string>> stats_types;
+  // true の場合、前回送った時から値が変化していない統計情報を送らない。
+  bool send_changed_stats_only = false;
 };
 
 class SoraSignaling : public std::enable_shared_from_this<SoraSignaling>,
@@ -197,13 +239,20 @@ class SoraSignaling : public std::enable_shared_from_this<SoraSignaling>,
 
   void Connect();
   void Disconnect();
+  // flow_control が設定されたラベルで送信キューが一杯の場合は false を返す
   bool SendDataChannel(const std::string& label, const std::string& data);
+  // 送信してもキューに積まれずにすぐ送られる状態かどうか。
+  // false を返した場合、書き込み可能になった時に OnDataChannelWritable が呼ばれる。
+  bool IsDataChannelWritable(const std::string& label);
 
   std::string GetConnectionID() const;
   std::string GetSelectedSignalingURL() const;
   std::string GetConnectedSignalingURL() const;
   bool IsConnectedDataChannel() const;
   bool IsConnectedWebsocket() const;
+  // 接続中のシグナリングの WebSocket の送受信バイト数。
+  // 圧縮前のペイロードと実際に送受信したバイト数から圧縮率が分かる。
+  std::optional<Websocket::Stats> GetWebsocketStats() const;
 
  private:
   static bool ParseURL(const std::string& url, URLParts& parts, bool& ssl);
@@ -225,6 +274,17 @@ class SoraSignaling : public std::enable_shared_from_this<SoraSignaling>,
   webrtc::scoped_refptr<webrtc::PeerConnectionInterface> CreatePeerConnection(
       boost::json::value jconfig);
 
+  // config_.signaling_thread が設定されていればそのスレッドに投げ、
+  // 設定されていなければその場で実行する
+  void RunOnSignalingThread(std::function<void()> f);
+  // pc_ に対する操作を RunOnSignalingThread で実行する
+  void SetOffer(const std::string& sdp,
+                OnSessionSetSuccessFunc on_success,
+                OnSessionSetFailureFunc on_failure);
+  void CreateAnswer(OnSessionCreateSuccessFunc on_success,
+                    OnSessionCreateFailureFunc on_failure);
+  void GetStats(RTCStatsCallback::ResultCallback callback);
+
  private:
   // 出来るだけサーバに type: disconnect を送ってから閉じる
   // force_error_code が設定されていない場合、NO-ERROR でサーバに送信し、ユーザにはデフォルトのエラーコードとメッセージでコールバックする。reason や message は無視される。
@@ -296,6 +356,8 @@ class SoraSignaling : public std::enable_shared_from_this<SoraSignaling>,
   void OnMessage(
       webrtc::scoped_refptr<webrtc::DataChannelInterface> data_channel,
       const webrtc::DataBuffer& buffer) override;
+  void OnWritable(webrtc::scoped_refptr<webrtc::DataChannelInterface>
+                      data_channel) override;
 
  private:
   SoraSignalingConfig config_;
@@ -325,6 +387,22 @@ class SoraSignaling : public std::enable_shared_from_this<SoraSignaling>,
   };
   atomic_string selected_signaling_url_;
   atomic_string connected_signaling_url_;
+  struct atomic_websocket {
+    std::shared_ptr<Websocket> load() const {
+      std::lock_guard<std::mutex> lock(m);
+      return ws;
+    }
+    void store(std::shared_ptr<Websocket> ws) {
+      std::lock_guard<std::mutex> lock(m);
+      this->ws = ws;
+    }
+
+   private:
+    std::shared_ptr<Websocket> ws;
+    mutable std::mutex m;
+  };
+  // GetWebsocketStats で別スレッドから参照するための ws_
+  atomic_websocket stats_ws_;
   std::shared_ptr<Websocket> ws_;
   std::shared_ptr<DataChannel> dc_;
   bool using_datachannel_ = false;
@@ -332,11 +410,20 @@ class SoraSignaling : public std::enable_shared_from_this<SoraSignaling>,
   struct DataChannelInfo {
     bool compressed = false;
     bool notified = false;
+    // compressed の場合に使う圧縮器と展開器。
+    // z_stream を使い回すために、最初に使う時に作ってラベルごとに保持しておく。
+    // 圧縮は SendDataChannel を呼んだスレッドと io_context のスレッドの両方から行われるので、
+    // それぞれ mutex で保護する。
+    std::mutex compressor_mutex;
+    std::unique_ptr<ZlibCompressor> compressor;
+    std::mutex uncompressor_mutex;
+    std::unique_ptr<ZlibUncompressor> uncompressor;
   };
   std::map<std::string, DataChannelInfo> dc_labels_;
 
   webrtc::scoped_refptr<webrtc::PeerConnectionInterface> pc_;
   std::vector<webrtc::RtpEncodingParameters> encodings_;
+  RTCStatsExporter stats_exporter_;
   std::string video_mid_;
   std::string audio_mid_;
 
@@ -127,7 +127,10 @@ struct VideoCodecCapabilityConfig {
 VideoCodecCapability GetVideoCodecCapability(VideoCodecCapabilityConfig config);
 
 struct VideoCodecPreference {
-  struct Parameters {};
+  struct Parameters {
+    // kCiscoOpenH264 エンコーダでサイマルキャストの各レイヤーを並列にエンコードするかどうか
+    std::optional<bool> openh264_parallel_simulcast;
+  };
   struct Codec {
     Codec() : type(webrtc::kVideoCodecGeneric) {}
     explicit Codec(
@@ -54,6 +54,10 @@ struct VideoEncoderConfig {
       create_video_encoder;
   std::shared_ptr<webrtc::VideoEncoderFactory> factory;
   int alignment = 0;
+  // エンコーダが I420/NV12 のバッファの StrideY() などを正しく扱い、
+  // 各プレーンが連続していないバッファも読める場合は true にする。
+  // true の場合、アライメントを揃える時にバッファをコピーせずに切り出す。
+  bool strided_input = false;
 };
 
 struct SoraVideoEncoderFactoryConfig {
@@ -74,6 +78,10 @@ struct SoraVideoEncoderFactoryConfig {
   - しかしこの場合、非サイマルキャストで kNative なバッファーをエンコードする時にも I420 への変換が走ることになって、解像度や性能によってはフレームレートが出ないことがある
   - この I420 への変換は、 Sora の設定も含めて利用者が非サイマルキャストだと保証できる場合、あるいはサイマルキャストであっても複数回読める kNative なバッファーを利用している場合には不要な処理になる
   - そのような場合に I420 への変換を無効にするための設定として force_i420_conversion フラグが用意された
+
+  現在は、エンコードするレイヤーが 1 つの場合は I420 に変換せずに kNative なバッファーをそのまま渡し、
+  複数の場合は最初に読まれた時に 1 回だけ I420 に変換して全てのレイヤーで使い回す（ConvertOnceI420Buffer）。
+  そのため force_i420_conversion = true のままでも、非サイマルキャストでの変換の負荷はかからない。
   */
   bool force_i420_conversion = true;
 
@@ -98,6 +106,9 @@ class SoraVideoEncoderFactory : public webrtc::VideoEncoderFactory {
       const webrtc::Environment& env,
       const webrtc::SdpVideoFormat& format,
       int& alignment);
+  // format のエンコーダに使う設定を返す。見つからない場合は nullptr を返す
+  const VideoEncoderConfig* FindVideoEncoderConfig(
+      const webrtc::SdpVideoFormat& format) const;
 
  private:
   SoraVideoEncoderFactoryConfig config_;
@@ -1,23 +1,37 @@
 #ifndef SORA_SSL_VERIFIER_H_
 #define SORA_SSL_VERIFIER_H_
 
+#include <memory>
 #include <optional>
 #include <string>
 
 // openssl
 #include <openssl/ssl.h>
 #include <openssl/stack.h>
+#include <openssl/x509.h>
 
 namespace sora {
 
 // 自前で SSL の証明書検証を行うためのクラス
+//
+// ルート証明書を読み込んだ X509_STORE は ca_cert ごとに 1 回だけ作ってプロセス全体で共有する。
+// また、最近検証に成功した証明書チェーンを覚えておき、同じチェーンは検証を省略する。
 class SSLVerifier {
  public:
   static bool VerifyX509(X509* x509,
                          STACK_OF(X509) * chain,
                          const std::optional<std::string>& ca_cert);
 
+  // 共有している X509_STORE と検証結果のキャッシュを破棄する。
+  // システムのルート証明書を更新した場合などに呼び出す。
+  static void ClearCache();
+
  private:
+  // ca_cert に対応する X509_STORE を返す。作れなかった場合は nullptr を返す
+  static std::shared_ptr<X509_STORE> GetStore(
+      const std::optional<std::string>& ca_cert);
+  static std::shared_ptr<X509_STORE> CreateStore(
+      const std::optional<std::string>& ca_cert);
   // PEM 形式のルート証明書を追加する
   static bool AddCert(const std::string& pem, X509_STORE* store);
   // WebRTC の組み込みルート証明書を追加する
@@ -0,0 +1,109 @@
+#ifndef SORA_V4L2_MJPEG_DECODE_STAGE_H_
+#define SORA_V4L2_MJPEG_DECODE_STAGE_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+// WebRTC
+#include <api/scoped_refptr.h>
+#include <api/video/i420_buffer.h>
+#include <api/video/video_frame.h>
+#include <common_video/include/video_frame_buffer_pool.h>
+
+namespace sora {
+
+struct MJPEGDecodeStageConfig {
+  // デコードするスレッドの数
+  int threads = 2;
+  // デコードを待っているフレームの上限
+  // 上限を超えた場合は、古いフレームから捨てる
+  int max_pending_frames = 4;
+  // data を buffer にデコードする関数。失敗した場合は false を返す。
+  // 複数のスレッドから同時に呼ばれる。nullptr の場合は libyuv でデコードする
+  std::function<bool(const uint8_t* data,
+                     size_t size,
+                     webrtc::I420Buffer* buffer)>
+      decode;
+};
+
+// MJPEG のフレームを複数のスレッドでデコードする。
+//
+// Submit() は圧縮されたデータをコピーしてすぐに戻るので、
+// キャプチャスレッドはデコードを待たずにバッファをデバイスに戻せる。
+// デコードしたフレームは Submit() した順番に、1 つずつ on_frame に渡す。
+// on_frame はデコードするスレッドから呼ばれる。
+class MJPEGDecodeStage {
+ public:
+  struct Stats {
+    uint64_t frames_submitted = 0;
+    uint64_t frames_decoded = 0;
+    // デコードが追いつかずに捨てたフレームの数
+    uint64_t frames_dropped = 0;
+    // デコードに失敗したフレームの数
+    uint64_t frames_failed = 0;
+  };
+
+  typedef std::function<void(const webrtc::VideoFrame& frame)> on_frame_t;
+
+  MJPEGDecodeStage(const MJPEGDecodeStageConfig& config, on_frame_t on_frame);
+  // デコード中のフレームを渡し終わるまで待ち、デコードを待っているフレームは捨てる
+  ~MJPEGDecodeStage();
+
+  // data を width x height の MJPEG のフレームとしてデコードする
+  void Submit(const uint8_t* data,
+              size_t size,
+              int width,
+              int height,
+              int64_t timestamp_us);
+  // Submit() した全てのフレームを on_frame に渡し終わるまで待つ
+  void Flush();
+  Stats GetStats() const;
+
+ private:
+  struct Job {
+    uint64_t sequence = 0;
+    std::vector<uint8_t> data;
+    int width = 0;
+    int height = 0;
+    int64_t timestamp_us = 0;
+  };
+
+  void DecodeThread();
+  webrtc::scoped_refptr<webrtc::I420Buffer> Decode(const Job& job);
+  // 順番が来たフレームを on_frame に渡す
+  void Deliver(std::unique_lock<std::mutex>& lock);
+
+  MJPEGDecodeStageConfig config_;
+  on_frame_t on_frame_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable cond_;
+  std::condition_variable done_cond_;
+  bool stop_ = false;
+  std::deque<Job> pending_;
+  // 使い終わった圧縮データのバッファ
+  std::vector<std::vector<uint8_t>> free_data_;
+  uint64_t next_sequence_ = 0;
+  // 次に on_frame に渡すフレームの番号
+  uint64_t next_deliver_ = 0;
+  // デコードが終わって順番を待っているフレーム。
+  // 捨てたフレームと失敗したフレームは、順番を進めるために std::nullopt を入れる
+  std::map<uint64_t, std::optional<webrtc::VideoFrame>> results_;
+  bool delivering_ = false;
+  Stats stats_;
+  webrtc::VideoFrameBufferPool buffer_pool_;
+
+  std::vector<std::thread> threads_;
+};
+
+}  // namespace sora
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef SORA_V4L2_CAPTURE_BACKEND_H_
+#define SORA_V4L2_CAPTURE_BACKEND_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "sora/v4l2/v4l2_device.h"
+
+namespace sora {
+
+// V4L2VideoCapturer がデバイスを操作する時に使うインターフェース。
+//
+// デフォルトの実装は open/ioctl/mmap をそのまま呼び出す。
+// 差し替えることでカメラが無い環境でも V4L2VideoCapturer を動かせる。
+class V4L2CaptureBackend {
+ public:
+  virtual ~V4L2CaptureBackend() {}
+
+  virtual std::optional<std::vector<V4L2Device>> EnumDevices() = 0;
+  // 返す fd は、VIDIOC_DQBUF で取り出せるバッファがある時に読み込み可能になること。
+  // V4L2VideoCapturer はこの fd を epoll で待つ。
+  virtual int Open(const std::string& path) = 0;
+  virtual int Close(int fd) = 0;
+  // 失敗した場合は -1 を返して errno を設定する
+  virtual int Ioctl(int fd, unsigned long request, void* arg) = 0;
+  // 失敗した場合は MAP_FAILED を返す
+  virtual void* Mmap(int fd, size_t length, off_t offset) = 0;
+  virtual int Munmap(void* addr, size_t length) = 0;
+};
+
+// 実際のデバイスを操作するバックエンドを作る
+std::shared_ptr<V4L2CaptureBackend> CreateV4L2CaptureBackend();
+
+}  // namespace sora
+
+#endif
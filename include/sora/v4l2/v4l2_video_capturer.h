@@ -13,16 +13,22 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <memory>
+#include <optional>
 #include <string>
 
 // WebRTC
 #include <api/scoped_refptr.h>
+#include <api/video/nv12_buffer.h>
+#include <common_video/include/video_frame_buffer_pool.h>
 #include <common_video/libyuv/include/webrtc_libyuv.h>
 #include <rtc_base/platform_thread.h>
 #include <rtc_base/synchronization/mutex.h>
 #include <rtc_base/thread_annotations.h>
 
 #include "sora/scalable_track_source.h"
+#include "sora/v4l2/v4l2_capture_backend.h"
+#include "sora/v4l2/mjpeg_decode_stage.h"
 #include "sora/v4l2/v4l2_device.h"
 
 namespace sora {
@@ -36,8 +42,24 @@ struct V4L2VideoCapturerConfig : ScalableVideoTrackSourceConfig {
   bool force_yuy2 = false;
   bool force_nv12 = false;
   bool use_native = false;
+  // NV12 でキャプチャする場合に、V4L2 のバッファをコピーせずにそのままフレームとして渡す。
+  // バッファはフレームが全て破棄されてからデバイスに戻すので、
+  // 受け取った側がフレームを長く保持する場合はバッファを max_buffers まで増やす。
+  // ドライバによってはキャッシュされないメモリが使われて読み込みが遅くなるので、その場合は無効にすること。
+  bool zero_copy = false;
+  // zero_copy の場合に使うバッファの最大数
+  int max_buffers = 16;
+  // デバイスの操作に使うバックエンド。nullptr の場合は実際のデバイスを使う
+  std::shared_ptr<V4L2CaptureBackend> backend;
+  // MJPEG でキャプチャする場合に、キャプチャスレッドとは別のスレッドでデコードする。
+  // 0 の場合はキャプチャスレッドでデコードする
+  int mjpeg_decode_threads = 0;
+  // デコードを待っているフレームの上限。超えた場合は古いフレームから捨てる
+  int mjpeg_max_pending_frames = 4;
 };
 
+class V4L2BufferRing;
+
 class V4L2VideoCapturer : public ScalableVideoTrackSource {
  public:
   static webrtc::scoped_refptr<V4L2VideoCapturer> Create(
@@ -45,6 +67,9 @@ class V4L2VideoCapturer : public ScalableVideoTrackSource {
   V4L2VideoCapturer(const V4L2VideoCapturerConfig& config);
   ~V4L2VideoCapturer();
 
+  // mjpeg_decode_threads が有効な場合の統計情報
+  std::optional<MJPEGDecodeStage::Stats> GetMJPEGDecodeStats();
+
  protected:
   virtual int32_t Init();
 
@@ -68,13 +93,31 @@ class V4L2VideoCapturer : public ScalableVideoTrackSource {
   virtual int32_t StartCapture();
 
   enum { kNoOfV4L2Bufffers = 4 };
+  // zero_copy の場合に、デバイスに最低限渡しておくバッファの数
+  enum { kMinQueuedBuffers = 2 };
 
   static void CaptureThread(void*);
   bool CaptureProcess();
+  // 取り出したバッファをコピーせずにフレームとして渡す。
+  // 渡せなかった場合は false を返すので、呼び出し元でバッファをデバイスに戻す。
+  bool OnCapturedZeroCopy(uint32_t index, uint32_t bytesused);
+  // NV12 への変換先のバッファを作る。zero_copy の場合はプールから取り出す
+  webrtc::scoped_refptr<webrtc::NV12Buffer> CreateNV12Buffer();
 
  private:
   V4L2VideoCapturerConfig config_;
+  std::shared_ptr<V4L2CaptureBackend> backend_;
   V4L2Device device_;
+  // 1 行のバイト数（VIDIOC_S_FMT で決まった値）
+  int32_t bytes_per_line_ = 0;
+  // zero_copy が有効な場合のバッファ
+  std::shared_ptr<V4L2BufferRing> ring_;
+  // キャプチャスレッドで epoll を使ってデバイスと停止の通知を待つ
+  int epoll_fd_ = -1;
+  int stop_event_fd_ = -1;
+  webrtc::VideoFrameBufferPool capture_buffer_pool_;
+  // capture_lock_ を取った状態で操作する
+  std::unique_ptr<MJPEGDecodeStage> mjpeg_decode_stage_;
 
   webrtc::PlatformThread _captureThread;
   webrtc::Mutex capture_lock_;
@@ -1,9 +1,13 @@
 #ifndef SORA_WEBSOCKET_H_
 #define SORA_WEBSOCKET_H_
 
+#include <atomic>
 #include <cstddef>
+#include <cstdint>
 #include <functional>
+#include <limits>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
 #include <vector>
@@ -15,12 +19,15 @@
 #include <boost/asio/ssl/context.hpp>
 #include <boost/asio/ssl/stream.hpp>
 #include <boost/asio/strand.hpp>
+#include <boost/beast/core/basic_stream.hpp>
 #include <boost/beast/core/flat_buffer.hpp>
 #include <boost/beast/core/multi_buffer.hpp>
 #include <boost/beast/http/empty_body.hpp>
 #include <boost/beast/http/message_fwd.hpp>
 #include <boost/beast/http/parser_fwd.hpp>
 #include <boost/beast/http/string_body_fwd.hpp>
+#include <boost/beast/core/rate_policy.hpp>
+#include <boost/beast/websocket/option.hpp>
 #include <boost/beast/websocket/rfc6455.hpp>
 #include <boost/beast/websocket/stream.hpp>
 #include <boost/system/detail/error_code.hpp>
@@ -30,16 +37,51 @@
 
 namespace sora {
 
+// TCP で実際に送受信したバイト数を数えるための boost::beast::basic_stream の RatePolicy。
+// 帯域の制限は行わない。
+class WebsocketTrafficCounter {
+ public:
+  struct Counters {
+    std::atomic<uint64_t> read_bytes{0};
+    std::atomic<uint64_t> written_bytes{0};
+  };
+  // basic_stream の非同期処理は Websocket より長生きすることがあるので共有で持つ
+  std::shared_ptr<Counters> counters;
+
+ private:
+  friend class boost::beast::rate_policy_access;
+
+  std::size_t available_read_bytes() const noexcept {
+    return (std::numeric_limits<std::size_t>::max)();
+  }
+  std::size_t available_write_bytes() const noexcept {
+    return (std::numeric_limits<std::size_t>::max)();
+  }
+  void transfer_read_bytes(std::size_t n) noexcept {
+    if (counters) {
+      counters->read_bytes.fetch_add(n, std::memory_order_relaxed);
+    }
+  }
+  void transfer_write_bytes(std::size_t n) noexcept {
+    if (counters) {
+      counters->written_bytes.fetch_add(n, std::memory_order_relaxed);
+    }
+  }
+  void on_timer() {}
+};
+
 // SSL+クライアント、非SSL+クライアント、サーバで大体同じように扱える WebSocket。
 //
 // 任意のスレッドから WriteText を呼ぶことで書き込みができ、
 // 書き込み完了のコールバックを待たずに次の WriteText を呼ぶことができる。
 class Websocket {
  public:
-  typedef boost::beast::websocket::stream<boost::asio::ip::tcp::socket>
-      websocket_t;
-  typedef boost::beast::websocket::stream<
-      boost::asio::ssl::stream<boost::asio::ip::tcp::socket>>
+  typedef boost::beast::basic_stream<boost::asio::ip::tcp,
+                                     boost::asio::any_io_executor,
+                                     WebsocketTrafficCounter>
+      tcp_stream_t;
+  typedef boost::beast::websocket::stream<tcp_stream_t> websocket_t;
+  typedef boost::beast::websocket::stream<boost::asio::ssl::stream<tcp_stream_t>>
       ssl_websocket_t;
   typedef std::function<void(boost::system::error_code ec)> connect_callback_t;
   typedef std::function<void(boost::system::error_code ec,
@@ -81,6 +123,23 @@ class Websocket {
   ~Websocket();
 
   void SetUserAgent(http_header_value user_agent);
+  // permessage-deflate 拡張の設定。Connect や Accept の前に呼ぶこと。
+  void SetPermessageDeflate(
+      const boost::beast::websocket::permessage_deflate& pmd);
+
+  struct Stats {
+    // permessage-deflate 拡張のネゴシエーションに成功したかどうか（クライアントのみ）
+    bool permessage_deflate = false;
+    // 送受信した WebSocket メッセージのペイロードのバイト数（圧縮前）
+    uint64_t sent_payload_bytes = 0;
+    uint64_t received_payload_bytes = 0;
+    // TCP で実際に送受信したバイト数。
+    // WebSocket のフレームヘッダーや TLS のレコード、ハンドシェイクも含む。
+    uint64_t sent_wire_bytes = 0;
+    uint64_t received_wire_bytes = 0;
+  };
+  // 任意のスレッドから呼び出せる
+  Stats GetStats() const;
 
   // WebSocket クライアントの接続確立
   void Connect(const std::string& url, connect_callback_t on_connect);
@@ -121,6 +180,9 @@ class Websocket {
               boost::system::error_code ec,
               std::size_t bytes_transferred);
 
+  void InitTrafficCounter(tcp_stream_t& stream);
+  void ApplyPermessageDeflate();
+
   void DoClose(close_callback_t on_close, int timeout_seconds);
   void OnClose(close_callback_t on_close, boost::system::error_code ec);
 
@@ -135,7 +197,6 @@ class Websocket {
   void OnReadProxy(boost::system::error_code ec, std::size_t bytes_transferred);
 
  private:
-  void DoWriteText(std::string text, write_callback_t on_write);
   void DoWrite();
   void OnWrite(boost::system::error_code ec, std::size_t bytes_transferred);
 
@@ -143,27 +204,42 @@ class Websocket {
   std::unique_ptr<websocket_t> ws_;
   std::unique_ptr<ssl_websocket_t> wss_;
 
-  std::unique_ptr<boost::asio::ip::tcp::resolver> resolver_;
   connect_callback_t on_connect_;
   URLParts parts_;
 
   bool insecure_ = false;
+  // WebsocketConnectionCache で他の Websocket と共有している
   std::shared_ptr<boost::asio::ssl::context> ssl_ctx_;
 
   boost::asio::strand<websocket_t::executor_type> strand_;
 
   boost::beast::multi_buffer read_buffer_;
   struct WriteData {
-    boost::beast::flat_buffer buffer;
+    std::string text;
     write_callback_t callback;
-    bool text;
   };
-  std::vector<std::unique_ptr<WriteData>> write_data_;
+  // WriteText で積まれて、まだ書き込みを開始していないデータ。
+  // 任意のスレッドから積まれるので write_mutex_ で保護する。
+  std::mutex write_mutex_;
+  std::vector<WriteData> write_queue_;
+  // 書き込みループが動いているかどうか。write_mutex_ で保護する。
+  bool writing_ = false;
+  // write_queue_ からまとめて取り出した書き込み中のデータ。strand_ 上でのみ触る。
+  std::vector<WriteData> write_batch_;
+  std::size_t write_index_ = 0;
 
   boost::asio::deadline_timer close_timeout_timer_;
 
   http_header_value user_agent_;
 
+  std::optional<boost::beast::websocket::permessage_deflate> pmd_;
+  boost::beast::websocket::response_type handshake_response_;
+  std::atomic<bool> pmd_negotiated_{false};
+  std::atomic<uint64_t> sent_payload_bytes_{0};
+  std::atomic<uint64_t> received_payload_bytes_{0};
+  std::shared_ptr<WebsocketTrafficCounter::Counters> traffic_ =
+      std::make_shared<WebsocketTrafficCounter::Counters>();
+
   bool https_proxy_ = false;
   std::string proxy_url_;
   std::string proxy_username_;
@@ -0,0 +1,150 @@
+#ifndef SORA_WEBSOCKET_CONNECTION_CACHE_H_
+#define SORA_WEBSOCKET_CONNECTION_CACHE_H_
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+// Boost
+#include <boost/asio/any_io_executor.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/ssl/context.hpp>
+#include <boost/system/detail/error_code.hpp>
+
+// OpenSSL
+#include <openssl/ssl.h>
+
+namespace sora {
+
+// 全ての Websocket で共有する、接続の確立にかかる処理のキャッシュ。
+//
+// - クライアント証明書の設定が同じ ssl::context を使い回す
+// - ホストと証明書の検証の設定ごとに TLS のセッションを保持して、次の接続でセッションを再開する
+// - DNS の解決結果を dns_ttl の間だけ保持する。同じホストを同時に解決しようとした場合は 1 回にまとめる
+//
+// リダイレクトや、Sora の再起動後にまとめて再接続する場合に、
+// DNS の問い合わせと TLS のフルハンドシェイクを省略できる。
+//
+// 全ての関数は任意のスレッドから呼び出せる。
+class WebsocketConnectionCache {
+ public:
+  struct Config {
+    // ssl::context を使い回す
+    bool ssl_context_cache = true;
+    // TLS のセッションを再開する。ssl_context_cache が false の場合は無効
+    bool tls_session_resumption = true;
+    // ホストごとに保持する TLS のセッションの数
+    int max_sessions_per_host = 4;
+    // DNS の解決結果を保持する時間。0 の場合はキャッシュしない
+    std::chrono::seconds dns_ttl = std::chrono::seconds(30);
+  };
+
+  struct Stats {
+    uint64_t dns_cache_hits = 0;
+    uint64_t dns_cache_misses = 0;
+    // 解決中の問い合わせに相乗りした回数
+    uint64_t dns_coalesced = 0;
+    uint64_t ssl_contexts_created = 0;
+    uint64_t tls_sessions_resumed = 0;
+    uint64_t tls_full_handshakes = 0;
+  };
+
+  typedef std::function<void(
+      boost::system::error_code ec,
+      boost::asio::ip::tcp::resolver::results_type results)>
+      resolve_callback_t;
+
+  static WebsocketConnectionCache& Instance();
+
+  // 設定を変更する。変更前にキャッシュしたものは Clear() するまで残る
+  void SetConfig(const Config& config);
+  Config GetConfig() const;
+  Stats GetStats() const;
+  // 全てのキャッシュを破棄する
+  void Clear();
+
+  // クライアント証明書の設定に対応する ssl::context を返す
+  std::shared_ptr<boost::asio::ssl::context> GetSSLContext(
+      const std::optional<std::string>& client_cert,
+      const std::optional<std::string>& client_key);
+
+  // ハンドシェイクの前に呼び出して、保持している TLS セッションを ssl に設定する。
+  //
+  // セッションを再開した場合は証明書の検証が行われないので、
+  // セッションは insecure と ca_cert が同じ接続でしか使い回さない。
+  // この関数を呼び出さなかった ssl のセッションは保持しない。
+  void ApplyTLSSession(SSL* ssl,
+                       const std::string& host,
+                       bool insecure,
+                       const std::optional<std::string>& ca_cert);
+  // ハンドシェイクが終わった後に呼び出して、結果を統計情報に反映する。
+  // 失敗した場合は、再開したセッションが原因の可能性があるので同じ設定のセッションを破棄する。
+  void OnTLSHandshake(SSL* ssl, boost::system::error_code ec);
+
+  // host:port を解決する。on_resolve は ex 上で呼ばれる
+  void Resolve(const boost::asio::any_io_executor& ex,
+               const std::string& host,
+               const std::string& port,
+               resolve_callback_t on_resolve);
+  // 解決したアドレスに接続できなかった場合に呼び出して、キャッシュを破棄する
+  void InvalidateResolve(const std::string& host, const std::string& port);
+
+ private:
+  WebsocketConnectionCache() = default;
+
+  static int OnNewSession(SSL* ssl, SSL_SESSION* session);
+  void AddTLSSession(SSL_CTX* ctx,
+                     const std::string& session_key,
+                     SSL_SESSION* session);
+  // ApplyTLSSession で ssl に設定したセッションのキーを返す
+  static const std::string* GetSessionKey(SSL* ssl);
+  // 解決中の問い合わせを破棄する。id が一致しない場合は何もしない
+  void RemovePendingResolve(
+      const std::tuple<std::string, std::string, void*>& key,
+      uint64_t id);
+
+  struct SessionDeleter {
+    void operator()(SSL_SESSION* session) const { SSL_SESSION_free(session); }
+  };
+  typedef std::unique_ptr<SSL_SESSION, SessionDeleter> session_ptr;
+
+  struct DnsEntry {
+    boost::asio::ip::tcp::resolver::results_type results;
+    std::chrono::steady_clock::time_point expires_at;
+  };
+  struct PendingResolve {
+    uint64_t id = 0;
+    std::vector<resolve_callback_t> callbacks;
+  };
+
+  mutable std::mutex mutex_;
+  Config config_;
+  Stats stats_;
+  // キーはクライアント証明書と秘密鍵
+  std::map<std::pair<std::string, std::string>,
+           std::shared_ptr<boost::asio::ssl::context>>
+      ssl_contexts_;
+  // セッションは作った SSL_CTX でしか使えないので SSL_CTX ごとに分ける。
+  // キーの文字列は host と証明書の検証の設定
+  std::map<std::pair<SSL_CTX*, std::string>, std::vector<session_ptr>>
+      sessions_;
+  // キーは host と port
+  std::map<std::pair<std::string, std::string>, DnsEntry> dns_;
+  // 同じ io_context 上での解決中の問い合わせ。キーは host, port と io_context。
+  // io_context が破棄されてハンドラが呼ばれなかった場合も、ハンドラの破棄と同時に削除する。
+  std::map<std::tuple<std::string, std::string, void*>, PendingResolve>
+      pending_resolves_;
+  uint64_t next_resolve_id_ = 0;
+};
+
+}  // namespace sora
+
+#endif
@@ -3,12 +3,16 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <functional>
 #include <string>
 
 // zlib
 #include <chromeconf.h>
 #include <zlib.h>
 
+// WebRTC
+#include <rtc_base/copy_on_write_buffer.h>
+
 // この define 名が邪魔してるので undef しておく
 #undef compress
 
@@ -26,6 +30,79 @@ class ZlibHelper {
   static std::string Uncompress(const uint8_t* input_buf, size_t input_size);
 };
 
+// z_stream をメッセージ間で使い回す圧縮器
+//
+// ZlibHelper::Compress と同じ zlib フォーマットで出力するが、
+// 毎回 deflateInit/deflateEnd せずに deflateReset で状態を初期化し、
+// deflateBound で必要なサイズを確保してから 1 パスで圧縮する。
+//
+// スレッドセーフではないので、同じスレッドから呼び出すこと。
+class ZlibCompressor {
+ public:
+  explicit ZlibCompressor(int level = Z_DEFAULT_COMPRESSION);
+  ~ZlibCompressor();
+  ZlibCompressor(const ZlibCompressor&) = delete;
+  ZlibCompressor& operator=(const ZlibCompressor&) = delete;
+
+  // input_size バイトのデータを圧縮した時の最大サイズを返す
+  size_t CompressBound(size_t input_size);
+  // output_buf に圧縮したデータを書き込んで、書き込んだサイズを返す。
+  // output_size が CompressBound(input_size) 以上あれば必ず成功する。
+  size_t Compress(const uint8_t* input_buf,
+                  size_t input_size,
+                  uint8_t* output_buf,
+                  size_t output_size);
+  // output の内容を圧縮後のデータで置き換える。
+  // output の容量は再利用されるので、同じバッファを渡し続けると再確保が減る。
+  void Compress(const uint8_t* input_buf,
+                size_t input_size,
+                std::string& output);
+  std::string Compress(const uint8_t* input_buf, size_t input_size);
+  std::string Compress(const std::string& input);
+
+ private:
+  z_stream stream_;
+};
+
+// z_stream をメッセージ間で使い回す展開器
+//
+// 出力バッファが足りなくなった場合は最初からやり直さずに、
+// バッファを拡張してそのまま展開を続ける。
+//
+// スレッドセーフではないので、同じスレッドから呼び出すこと。
+class ZlibUncompressor {
+ public:
+  ZlibUncompressor();
+  ~ZlibUncompressor();
+  ZlibUncompressor(const ZlibUncompressor&) = delete;
+  ZlibUncompressor& operator=(const ZlibUncompressor&) = delete;
+
+  // output の内容を展開後のデータで置き換える。
+  // output の容量は再利用されるので、同じバッファを渡し続けると再確保が減る。
+  void Uncompress(const uint8_t* input_buf,
+                  size_t input_size,
+                  std::string& output);
+  // CopyOnWriteBuffer に直接展開する。
+  // 展開したデータをそのまま webrtc のバッファとして渡したい場合に、コピーを 1 回減らせる。
+  void Uncompress(const uint8_t* input_buf,
+                  size_t input_size,
+                  webrtc::CopyOnWriteBuffer& output);
+  std::string Uncompress(const uint8_t* input_buf, size_t input_size);
+  std::string Uncompress(const std::string& input);
+
+ private:
+  // resize(size) で出力バッファを size バイトに広げながら展開して、展開したサイズを返す。
+  // resize は広げたバッファの先頭を返し、それまでに書き込んだ内容を保持すること。
+  size_t Inflate(const uint8_t* input_buf,
+                 size_t input_size,
+                 size_t capacity,
+                 const std::function<uint8_t*(size_t size)>& resize);
+
+  z_stream stream_;
+  // 直前に展開したメッセージのサイズ。次の展開時の初期バッファサイズの目安にする。
+  size_t last_output_size_ = 0;
+};
+
 }  // namespace sora
 
-#endif
\ No newline at end of file
+#endif
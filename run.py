@@ -1102,11 +1102,17 @@ def _build(
                     cmake_args.append("-DTEST_CONNECT_DISCONNECT=ON")
                     cmake_args.append("-DTEST_DATACHANNEL=ON")
                     cmake_args.append("-DTEST_DEVICE_LIST=ON")
+                    cmake_args.append("-DTEST_CODEC_BENCH=ON")
+                    cmake_args.append("-DTEST_SIGNALING_BENCH=ON")
+                if platform.target.os == "ubuntu":
+                    cmake_args.append("-DTEST_MJPEG_DECODE_BENCH=ON")
+                    cmake_args.append("-DTEST_UNIT_V4L2=ON")
                 if (
                     platform.build.os == platform.target.os
                     and platform.build.arch == platform.target.arch
                 ):
                     cmake_args.append("-DTEST_E2E=ON")
+                    cmake_args.append("-DTEST_UNIT=ON")
 
                 cmd(["cmake", os.path.join(BASE_DIR, "test")] + cmake_args)
                 cmd(
@@ -1127,6 +1133,16 @@ def _build(
                         os.path.join(test_build_dir, "libcamerac.so"),
                     )
 
+                if (
+                    platform.build.os == platform.target.os
+                    and platform.build.arch == platform.target.arch
+                ):
+                    # unit_test は Sora に接続しないので、ビルドしたら常に実行する
+                    if platform.target.os == "windows":
+                        cmd([os.path.join(test_build_dir, configuration, "unit_test.exe")])
+                    else:
+                        cmd([os.path.join(test_build_dir, "unit_test")])
+
                 if run_e2e_test:
                     if (
                         platform.build.os == platform.target.os
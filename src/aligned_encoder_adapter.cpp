@@ -6,10 +6,20 @@
 
 // WebRTC
 #include <api/fec_controller_override.h>
+#include <api/make_ref_counted.h>
+#include <api/scoped_refptr.h>
+#include <api/video/i420_buffer.h>
+#include <api/video/nv12_buffer.h>
 #include <api/video/video_frame.h>
+#include <api/video/video_frame_buffer.h>
 #include <api/video/video_frame_type.h>
 #include <api/video_codecs/video_codec.h>
 #include <api/video_codecs/video_encoder.h>
+#include <common_video/include/video_frame_buffer.h>
+#include <rtc_base/logging.h>
+
+// libyuv
+#include <libyuv/convert.h>
 
 namespace sora {
 
@@ -17,19 +27,109 @@ static int Align(int size, int alignment) {
   return size - (size % alignment);
 }
 
+// エンコーダが保持している間に返ってこないバッファがあるので、少し多めにしておく
+static const size_t kMaxPooledBuffers = 8;
+
+// NV12 のバッファの一部分を参照するバッファ
+class NV12CropView : public webrtc::NV12BufferInterface {
+ public:
+  NV12CropView(webrtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer,
+               int width,
+               int height,
+               int offset_x,
+               int offset_y)
+      : buffer_(buffer), width_(width), height_(height) {
+    const webrtc::NV12BufferInterface* src = buffer->GetNV12();
+    stride_y_ = src->StrideY();
+    stride_uv_ = src->StrideUV();
+    data_y_ = src->DataY() + stride_y_ * offset_y + offset_x;
+    data_uv_ = src->DataUV() + stride_uv_ * (offset_y / 2) + offset_x;
+  }
+
+  int width() const override { return width_; }
+  int height() const override { return height_; }
+  const uint8_t* DataY() const override { return data_y_; }
+  const uint8_t* DataUV() const override { return data_uv_; }
+  int StrideY() const override { return stride_y_; }
+  int StrideUV() const override { return stride_uv_; }
+
+  webrtc::scoped_refptr<webrtc::I420BufferInterface> ToI420() override {
+    auto i420_buffer = webrtc::I420Buffer::Create(width_, height_);
+    libyuv::NV12ToI420(data_y_, stride_y_, data_uv_, stride_uv_,
+                       i420_buffer->MutableDataY(), i420_buffer->StrideY(),
+                       i420_buffer->MutableDataU(), i420_buffer->StrideU(),
+                       i420_buffer->MutableDataV(), i420_buffer->StrideV(),
+                       width_, height_);
+    return i420_buffer;
+  }
+
+ private:
+  webrtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer_;
+  int width_;
+  int height_;
+  const uint8_t* data_y_;
+  const uint8_t* data_uv_;
+  int stride_y_;
+  int stride_uv_;
+};
+
+// buffer の (offset_x, offset_y) から width x height の範囲を、コピーせずに参照するバッファを返す。
+// 対応していないバッファの場合は nullptr を返す。
+static webrtc::scoped_refptr<webrtc::VideoFrameBuffer> CropView(
+    webrtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer,
+    int width,
+    int height,
+    int offset_x,
+    int offset_y) {
+  // 色差のプレーンの位置がずれないように偶数にする
+  offset_x &= ~1;
+  offset_y &= ~1;
+  if (buffer->type() == webrtc::VideoFrameBuffer::Type::kI420) {
+    const webrtc::I420BufferInterface* src = buffer->GetI420();
+    return webrtc::WrapI420Buffer(
+        width, height,
+        src->DataY() + src->StrideY() * offset_y + offset_x, src->StrideY(),
+        src->DataU() + src->StrideU() * (offset_y / 2) + offset_x / 2,
+        src->StrideU(),
+        src->DataV() + src->StrideV() * (offset_y / 2) + offset_x / 2,
+        src->StrideV(),
+        // 参照している間は元のバッファを解放しない
+        [buffer]() {});
+  }
+  if (buffer->type() == webrtc::VideoFrameBuffer::Type::kNV12) {
+    return webrtc::make_ref_counted<NV12CropView>(buffer, width, height,
+                                                  offset_x, offset_y);
+  }
+  return nullptr;
+}
+
 AlignedEncoderAdapter::AlignedEncoderAdapter(
     std::shared_ptr<webrtc::VideoEncoder> encoder,
     int horizontal_alignment,
-    int vertical_alignment)
+    int vertical_alignment,
+    bool allow_crop_view)
     : encoder_(encoder),
       horizontal_alignment_(horizontal_alignment),
-      vertical_alignment_(vertical_alignment) {}
+      vertical_alignment_(vertical_alignment),
+      allow_crop_view_(allow_crop_view),
+      buffer_pool_(false, kMaxPooledBuffers) {}
 
 void AlignedEncoderAdapter::SetFecControllerOverride(
     webrtc::FecControllerOverride* fec_controller_override) {
   encoder_->SetFecControllerOverride(fec_controller_override);
 }
 int AlignedEncoderAdapter::Release() {
+  Stats stats = GetStats();
+  if (stats.passthrough_frames + stats.crop_view_frames +
+          stats.pooled_scale_frames + stats.other_scale_frames >
+      0) {
+    RTC_LOG(LS_INFO) << "AlignedEncoderAdapter: passthrough="
+                     << stats.passthrough_frames
+                     << " crop_view=" << stats.crop_view_frames
+                     << " pooled_scale=" << stats.pooled_scale_frames
+                     << " other_scale=" << stats.other_scale_frames;
+  }
+  buffer_pool_.Release();
   return encoder_->Release();
 }
 int AlignedEncoderAdapter::InitEncode(
@@ -67,6 +167,17 @@ int AlignedEncoderAdapter::Encode(
   }
   auto crop_x = (frame.width() - crop_width) / 2;
   auto crop_y = (frame.height() - crop_height) / 2;
+  auto offset_x = crop_x / 2;
+  auto offset_y = crop_y / 2;
+  // 揃えるために削るのがアライメント未満の場合は、縮小せずに中央を切り出す
+  if (frame.width() >= width_ && frame.height() >= height_ &&
+      frame.width() - width_ < horizontal_alignment_ &&
+      frame.height() - height_ < vertical_alignment_) {
+    crop_width = width_;
+    crop_height = height_;
+    offset_x = (frame.width() - width_) / 2;
+    offset_y = (frame.height() - height_) / 2;
+  }
   // RTC_LOG(LS_INFO) << "type=" << frame.video_frame_buffer()->type()
   //                  << " crop_x=" << crop_x << " crop_y=" << crop_y
   //                  << " crop_width=" << crop_width
@@ -75,14 +186,56 @@ int AlignedEncoderAdapter::Encode(
   //                  << " frame_height=" << frame.height();
   if (crop_x != 0 || crop_y != 0 || frame.width() != width_ ||
       frame.height() != height_) {
-    auto buffer = frame.video_frame_buffer()->CropAndScale(
-        crop_x / 2, crop_y / 2, crop_width, crop_height, width_, height_);
+    auto buffer = CropAndScale(frame.video_frame_buffer(), offset_x, offset_y,
+                               crop_width, crop_height);
     frame.set_video_frame_buffer(buffer);
+  } else {
+    passthrough_frames_++;
   }
 
   return encoder_->Encode(frame, frame_types);
 }
 
+webrtc::scoped_refptr<webrtc::VideoFrameBuffer>
+AlignedEncoderAdapter::CropAndScale(
+    webrtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer,
+    int offset_x,
+    int offset_y,
+    int crop_width,
+    int crop_height) {
+  // 縮小しない場合は元のバッファを参照する
+  if (allow_crop_view_ && crop_width == width_ && crop_height == height_) {
+    auto view = CropView(buffer, width_, height_, offset_x, offset_y);
+    if (view != nullptr) {
+      crop_view_frames_++;
+      return view;
+    }
+  }
+
+  if (buffer->type() == webrtc::VideoFrameBuffer::Type::kI420) {
+    auto dst = buffer_pool_.CreateI420Buffer(width_, height_);
+    if (dst != nullptr) {
+      dst->CropAndScaleFrom(*buffer->GetI420(), offset_x, offset_y, crop_width,
+                            crop_height);
+      pooled_scale_frames_++;
+      return dst;
+    }
+  } else if (buffer->type() == webrtc::VideoFrameBuffer::Type::kNV12) {
+    auto dst = buffer_pool_.CreateNV12Buffer(width_, height_);
+    if (dst != nullptr) {
+      dst->CropAndScaleFrom(*buffer->GetNV12(), offset_x, offset_y, crop_width,
+                            crop_height);
+      pooled_scale_frames_++;
+      return dst;
+    }
+  }
+
+  // kNative のバッファは独自の CropAndScale を持っていることがあるので、それに任せる
+  other_scale_frames_++;
+  return buffer->CropAndScale(offset_x, offset_y, crop_width, crop_height,
+                              width_, height_);
+}
+
 int AlignedEncoderAdapter::RegisterEncodeCompleteCallback(
     webrtc::EncodedImageCallback* callback) {
   return encoder_->RegisterEncodeCompleteCallback(callback);
@@ -106,4 +259,13 @@ webrtc::VideoEncoder::EncoderInfo AlignedEncoderAdapter::GetEncoderInfo()
   return encoder_->GetEncoderInfo();
 }
 
+AlignedEncoderAdapter::Stats AlignedEncoderAdapter::GetStats() const {
+  Stats stats;
+  stats.passthrough_frames = passthrough_frames_.load();
+  stats.crop_view_frames = crop_view_frames_.load();
+  stats.pooled_scale_frames = pooled_scale_frames_.load();
+  stats.other_scale_frames = other_scale_frames_.load();
+  return stats;
+}
+
 }  // namespace sora
\ No newline at end of file
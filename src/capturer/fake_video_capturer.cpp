@@ -1,6 +1,7 @@
 #include "sora/capturer/fake_video_capturer.h"
 
 #include <math.h>
+#include <algorithm>
 #include <atomic>
 #include <chrono>
 #include <cmath>
@@ -9,17 +10,25 @@
 #include <memory>
 #include <thread>
 #include <utility>
+#include <vector>
 
 // WebRTC
 #include <api/make_ref_counted.h>
 #include <api/scoped_refptr.h>
 #include <api/video/i420_buffer.h>
+#include <api/video/nv12_buffer.h>
 #include <api/video/video_frame.h>
+#include <api/video/video_frame_buffer.h>
 #include <api/video/video_rotation.h>
+#include <common_video/include/video_frame_buffer_pool.h>
 #include <rtc_base/logging.h>
 
 // libyuv
 #include <libyuv/convert.h>
+#include <libyuv/convert_from_argb.h>
+#include <libyuv/planar_functions.h>
+
+#include "sora/frame_stamp.h"
 
 #include "../blend2d_iwyu.h"
 
@@ -28,7 +37,9 @@ namespace sora {
 class FakeVideoCapturerImpl : public FakeVideoCapturer {
  public:
   FakeVideoCapturerImpl(FakeVideoCapturerConfig config)
-      : FakeVideoCapturer(config), config_(config) {
+      : FakeVideoCapturer(config),
+        config_(config),
+        buffer_pool_(false, 300 /* max_number_of_buffers*/) {
     StartCapture();
   }
 
@@ -43,8 +54,13 @@ class FakeVideoCapturerImpl : public FakeVideoCapturer {
     frame_counter_ = 0;
     start_time_ = std::chrono::high_resolution_clock::now();
 
-    capture_thread_ =
-        std::make_unique<std::thread>([this] { CaptureThread(); });
+    capture_thread_ = std::make_unique<std::thread>([this] {
+      if (config_.load_generation) {
+        LoadGenerationThread();
+      } else {
+        CaptureThread();
+      }
+    });
   }
 
   void StopCapture() {
@@ -71,25 +87,14 @@ class FakeVideoCapturerImpl : public FakeVideoCapturer {
       // 画像を更新
       UpdateImage(now);
 
-      // Blend2D イメージから I420 バッファへ変換
-      BLImageData data;
-      BLResult result = image_.get_data(&data);
-      if (result != BL_SUCCESS) {
-        RTC_LOG(LS_ERROR) << "Failed to get image data from Blend2D: "
-                          << result;
+      // Blend2D イメージから I420 か NV12 のバッファへ変換
+      webrtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer =
+          ConvertImage(true, config_.frame_stamp);
+      if (buffer == nullptr) {
         RTC_LOG(LS_ERROR) << "Stopping capture thread";
         break;
       }
 
-      webrtc::scoped_refptr<webrtc::I420Buffer> buffer =
-          webrtc::I420Buffer::Create(config_.width, config_.height);
-
-      libyuv::ABGRToI420((const uint8_t*)data.pixel_data, data.stride,
-                         buffer->MutableDataY(), buffer->StrideY(),
-                         buffer->MutableDataU(), buffer->StrideU(),
-                         buffer->MutableDataV(), buffer->StrideV(),
-                         config_.width, config_.height);
-
       // タイムスタンプを計算
       int64_t timestamp_us =
           std::chrono::duration_cast<std::chrono::microseconds>(now -
@@ -116,6 +121,184 @@ class FakeVideoCapturerImpl : public FakeVideoCapturer {
     }
   }
 
+  // 開始時に描画したフレームを、絶対時刻を基準に繰り返し送る
+  void LoadGenerationThread() {
+    image_.create(config_.width, config_.height, BL_FORMAT_PRGB32);
+
+    // 事前に描画するフレームはメモリに保持し続けるので、少ない枚数を繰り返す
+    static const int kDefaultPreRenderFrames = 8;
+    const int num_frames = config_.pre_render_frames > 0
+                               ? config_.pre_render_frames
+                               : kDefaultPreRenderFrames;
+    const std::chrono::nanoseconds period(1000000000LL / config_.fps);
+    std::vector<webrtc::scoped_refptr<webrtc::VideoFrameBuffer>> frames;
+    frames.reserve(num_frames);
+    pre_rendering_ = true;
+    for (int i = 0; i < num_frames && !stop_capture_; i++) {
+      frame_counter_ = i;
+      UpdateImage(start_time_ + period * i);
+      // 送ったフレームのバッファは使い回さないので、プールからは確保しない
+      webrtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer =
+          ConvertImage(false, false);
+      if (buffer == nullptr) {
+        RTC_LOG(LS_ERROR) << "Stopping capture thread";
+        return;
+      }
+      frames.push_back(buffer);
+    }
+    pre_rendering_ = false;
+    RTC_LOG(LS_INFO) << "Pre-rendered " << frames.size() << " frames";
+
+    // 周期の倍数の時刻から始めて、同じプロセス内の他のキャプチャラとタイミングを揃える
+    auto now = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point next(
+        (now.time_since_epoch() / period + 1) * period);
+
+    uint64_t index = 0;
+    FakeVideoCapturerPacingStats stats;
+    std::chrono::nanoseconds total_jitter(0);
+    std::chrono::nanoseconds max_jitter(0);
+    uint64_t jitter_count = 0;
+
+    while (!stop_capture_) {
+      std::this_thread::sleep_until(next);
+      auto lateness = std::chrono::steady_clock::now() - next;
+      total_jitter += lateness;
+      max_jitter = std::max<std::chrono::nanoseconds>(max_jitter, lateness);
+      jitter_count++;
+      // 1 周期以上遅れた場合は、間に合わなかったフレームを飛ばす
+      if (lateness >= period) {
+        int64_t skip = lateness / period;
+        next += period * skip;
+        index += skip;
+        stats.skipped_frames += skip;
+      }
+
+      int64_t timestamp_us =
+          std::chrono::duration_cast<std::chrono::microseconds>(
+              std::chrono::high_resolution_clock::now() - start_time_)
+              .count();
+      webrtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer =
+          frames[index % frames.size()];
+      if (config_.frame_stamp) {
+        // 事前に描画したバッファは書き換えられないので、コピーしてから埋め込む
+        buffer = CopyWithFrameStamp(buffer);
+      }
+      OnCapturedFrame(webrtc::VideoFrame::Builder()
+                          .set_video_frame_buffer(buffer)
+                          .set_rotation(webrtc::kVideoRotation_0)
+                          .set_timestamp_us(timestamp_us)
+                          .build());
+      stats.frames++;
+
+      if (config_.on_tick && index % config_.fps == 0) {
+        config_.on_tick();
+      }
+
+      if (config_.on_pacing_stats && jitter_count >= (uint64_t)config_.fps) {
+        stats.average_jitter_ms =
+            std::chrono::duration<double, std::milli>(total_jitter).count() /
+            jitter_count;
+        stats.max_jitter_ms =
+            std::chrono::duration<double, std::milli>(max_jitter).count();
+        config_.on_pacing_stats(stats);
+        total_jitter = std::chrono::nanoseconds(0);
+        max_jitter = std::chrono::nanoseconds(0);
+        jitter_count = 0;
+      }
+
+      index++;
+      next += period;
+    }
+  }
+
+  FrameStamp NextFrameStamp() {
+    FrameStamp stamp;
+    stamp.frame_id = frame_stamp_id_++;
+    stamp.capture_time_us = GetFrameStampTimeUs();
+    return stamp;
+  }
+
+  webrtc::scoped_refptr<webrtc::VideoFrameBuffer> CopyWithFrameStamp(
+      webrtc::scoped_refptr<webrtc::VideoFrameBuffer> src) {
+    if (src->type() == webrtc::VideoFrameBuffer::Type::kNV12) {
+      const webrtc::NV12BufferInterface* nv12 = src->GetNV12();
+      webrtc::scoped_refptr<webrtc::NV12Buffer> buffer =
+          buffer_pool_.CreateNV12Buffer(nv12->width(), nv12->height());
+      if (!buffer) {
+        buffer = webrtc::NV12Buffer::Create(nv12->width(), nv12->height());
+      }
+      libyuv::NV12Copy(nv12->DataY(), nv12->StrideY(), nv12->DataUV(),
+                       nv12->StrideUV(), buffer->MutableDataY(),
+                       buffer->StrideY(), buffer->MutableDataUV(),
+                       buffer->StrideUV(), nv12->width(), nv12->height());
+      WriteFrameStamp(NextFrameStamp(), buffer.get());
+      return buffer;
+    }
+    webrtc::scoped_refptr<webrtc::I420BufferInterface> i420 = src->ToI420();
+    webrtc::scoped_refptr<webrtc::I420Buffer> buffer =
+        buffer_pool_.CreateI420Buffer(i420->width(), i420->height());
+    if (!buffer) {
+      buffer = webrtc::I420Buffer::Create(i420->width(), i420->height());
+    }
+    libyuv::I420Copy(i420->DataY(), i420->StrideY(), i420->DataU(),
+                     i420->StrideU(), i420->DataV(), i420->StrideV(),
+                     buffer->MutableDataY(), buffer->StrideY(),
+                     buffer->MutableDataU(), buffer->StrideU(),
+                     buffer->MutableDataV(), buffer->StrideV(), i420->width(),
+                     i420->height());
+    WriteFrameStamp(NextFrameStamp(), buffer.get());
+    return buffer;
+  }
+
+  // Blend2D のイメージを I420 か NV12 のバッファに変換する
+  // frame_stamp が true の場合は FrameStamp を埋め込む
+  webrtc::scoped_refptr<webrtc::VideoFrameBuffer> ConvertImage(
+      bool use_pool,
+      bool frame_stamp) {
+    BLImageData data;
+    BLResult result = image_.get_data(&data);
+    if (result != BL_SUCCESS) {
+      RTC_LOG(LS_ERROR) << "Failed to get image data from Blend2D: " << result;
+      return nullptr;
+    }
+
+    if (config_.nv12) {
+      webrtc::scoped_refptr<webrtc::NV12Buffer> buffer;
+      if (use_pool) {
+        buffer = buffer_pool_.CreateNV12Buffer(config_.width, config_.height);
+      }
+      if (!buffer) {
+        buffer = webrtc::NV12Buffer::Create(config_.width, config_.height);
+      }
+      libyuv::ABGRToNV12((const uint8_t*)data.pixel_data, data.stride,
+                         buffer->MutableDataY(), buffer->StrideY(),
+                         buffer->MutableDataUV(), buffer->StrideUV(),
+                         config_.width, config_.height);
+      if (frame_stamp) {
+        WriteFrameStamp(NextFrameStamp(), buffer.get());
+      }
+      return buffer;
+    }
+
+    webrtc::scoped_refptr<webrtc::I420Buffer> buffer;
+    if (use_pool) {
+      buffer = buffer_pool_.CreateI420Buffer(config_.width, config_.height);
+    }
+    if (!buffer) {
+      buffer = webrtc::I420Buffer::Create(config_.width, config_.height);
+    }
+    libyuv::ABGRToI420((const uint8_t*)data.pixel_data, data.stride,
+                       buffer->MutableDataY(), buffer->StrideY(),
+                       buffer->MutableDataU(), buffer->StrideU(),
+                       buffer->MutableDataV(), buffer->StrideV(),
+                       config_.width, config_.height);
+    if (frame_stamp) {
+      WriteFrameStamp(NextFrameStamp(), buffer.get());
+    }
+    return buffer;
+  }
+
   void UpdateImage(std::chrono::high_resolution_clock::time_point now) {
     BLContext ctx(image_);
 
@@ -155,7 +338,8 @@ class FakeVideoCapturerImpl : public FakeVideoCapturer {
                  (current_frame % fps) / static_cast<float>(fps) * 2 * M_PI);
 
     // 円が一周したときにコールバックする
-    if (config_.on_tick) {
+    // 負荷試験モードでは、フレームを送る時にコールバックする
+    if (config_.on_tick && !pre_rendering_) {
       // 0度になったかチェック
       if (current_frame % fps == 0) {
         config_.on_tick();
@@ -393,6 +577,10 @@ class FakeVideoCapturerImpl : public FakeVideoCapturer {
   // Blend2D 関連
   BLImage image_;
   uint32_t frame_counter_ = 0;
+  bool pre_rendering_ = false;
+  uint32_t frame_stamp_id_ = 0;
+
+  webrtc::VideoFrameBufferPool buffer_pool_;
 };
 
 webrtc::scoped_refptr<FakeVideoCapturer> FakeVideoCapturer::Create(
@@ -0,0 +1,52 @@
+#include "sora/convert_once_i420_buffer.h"
+
+#include <atomic>
+#include <mutex>
+
+// WebRTC
+#include <api/make_ref_counted.h>
+#include <api/scoped_refptr.h>
+#include <api/video/i420_buffer.h>
+#include <api/video/video_frame_buffer.h>
+#include <rtc_base/logging.h>
+
+namespace sora {
+
+webrtc::scoped_refptr<ConvertOnceI420Buffer> ConvertOnceI420Buffer::Create(
+    webrtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer) {
+  return webrtc::make_ref_counted<ConvertOnceI420Buffer>(buffer);
+}
+
+ConvertOnceI420Buffer::ConvertOnceI420Buffer(
+    webrtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer)
+    : width_(buffer->width()), height_(buffer->height()), source_(buffer) {}
+
+bool ConvertOnceI420Buffer::converted() const {
+  return converted_.load();
+}
+
+const webrtc::I420BufferInterface* ConvertOnceI420Buffer::Get() const {
+  std::call_once(once_, [this]() {
+    // 変換せずに I420 として読めるならそれを使う
+    webrtc::VideoFrameBuffer::Type types[] = {
+        webrtc::VideoFrameBuffer::Type::kI420};
+    auto mapped = source_->GetMappedFrameBuffer(types);
+    if (mapped != nullptr) {
+      i420_ = mapped->GetI420();
+    }
+    if (i420_ == nullptr) {
+      i420_ = source_->ToI420();
+    }
+    if (i420_ == nullptr) {
+      RTC_LOG(LS_ERROR) << "Failed to convert the frame buffer to I420";
+      auto black = webrtc::I420Buffer::Create(width_, height_);
+      webrtc::I420Buffer::SetBlack(black.get());
+      i420_ = black;
+    }
+    source_ = nullptr;
+    converted_ = true;
+  });
+  return i420_.get();
+}
+
+}  // namespace sora
@@ -3,6 +3,8 @@
 #include <cstdint>
 #include <functional>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
 #include <utility>
 
@@ -38,22 +40,31 @@ DataChannel::DataChannel(boost::asio::io_context& ioc,
 DataChannel::~DataChannel() {
   RTC_LOG(LS_INFO) << "dtor DataChannel";
 }
-bool DataChannel::IsOpen(std::string label) const {
+webrtc::scoped_refptr<webrtc::DataChannelInterface>
+DataChannel::GetDataChannel(const std::string& label) const {
+  std::lock_guard<std::mutex> lock(labels_mutex_);
   auto it = labels_.find(label);
   if (it == labels_.end()) {
+    return nullptr;
+  }
+  return it->second;
+}
+bool DataChannel::IsOpen(std::string label) const {
+  auto data_channel = GetDataChannel(label);
+  if (data_channel == nullptr) {
     return false;
   }
-  if (it->second->state() != webrtc::DataChannelInterface::kOpen) {
+  if (data_channel->state() != webrtc::DataChannelInterface::kOpen) {
     return false;
   }
   return true;
 }
 bool DataChannel::Send(std::string label, const webrtc::DataBuffer& data) {
-  auto it = labels_.find(label);
-  if (it == labels_.end()) {
+  auto data_channel = GetDataChannel(label);
+  if (data_channel == nullptr) {
     return false;
   }
-  if (it->second->state() != webrtc::DataChannelInterface::kOpen) {
+  if (data_channel->state() != webrtc::DataChannelInterface::kOpen) {
     return false;
   }
   if (!data.binary) {
@@ -61,15 +72,70 @@ bool DataChannel::Send(std::string label, const webrtc::DataBuffer& data) {
                     (const char*)data.data.cdata() + data.size());
     RTC_LOG(LS_INFO) << "Send DataChannel label=" << label << " data=" << str;
   }
-  auto data_channel = it->second;
+
+  {
+    uint64_t buffered_amount = data_channel->buffered_amount();
+    std::lock_guard<std::mutex> lock(flows_mutex_);
+    auto fit = flows_.find(label);
+    if (fit != flows_.end()) {
+      auto& flow = fit->second;
+      // 順序を保つため、キューに何か残っている場合は必ずキューに積む
+      if (!flow.queue.empty() || flow.sending ||
+          buffered_amount >= flow.config.high_threshold) {
+        flow.blocked = true;
+        if (flow.queued_bytes + data.size() > flow.config.max_queued_bytes) {
+          RTC_LOG(LS_WARNING) << "DataChannel send queue is full: label="
+                              << label << " queued_bytes=" << flow.queued_bytes
+                              << " size=" << data.size();
+          return false;
+        }
+        flow.queue.push_back(data);
+        flow.queued_bytes += data.size();
+        // 積む直前に送信バッファが空いていた場合は OnBufferedAmountChange が
+        // もう呼ばれないかもしれないので、ioc_ のスレッドで改めて確認する
+        boost::asio::post(*ioc_, [self = shared_from_this(), data_channel]() {
+          self->SendQueued(data_channel);
+        });
+        return true;
+      }
+    }
+  }
+
   data_channel->Send(data);
   return true;
 }
+void DataChannel::SetFlowControl(std::string label,
+                                 const DataChannelFlowControl& config) {
+  std::lock_guard<std::mutex> lock(flows_mutex_);
+  flows_[label].config = config;
+}
+bool DataChannel::IsWritable(std::string label) {
+  auto data_channel = GetDataChannel(label);
+  if (data_channel == nullptr) {
+    return false;
+  }
+  if (data_channel->state() != webrtc::DataChannelInterface::kOpen) {
+    return false;
+  }
+  uint64_t buffered_amount = data_channel->buffered_amount();
+  std::lock_guard<std::mutex> lock(flows_mutex_);
+  auto fit = flows_.find(label);
+  if (fit == flows_.end()) {
+    return true;
+  }
+  auto& flow = fit->second;
+  if (!flow.queue.empty() || flow.sending ||
+      buffered_amount >= flow.config.high_threshold) {
+    flow.blocked = true;
+    return false;
+  }
+  return true;
+}
 void DataChannel::Close(const webrtc::DataBuffer& disconnect_message,
                         std::function<void(boost::system::error_code)> on_close,
                         double disconnect_wait_timeout) {
-  auto it = labels_.find("signaling");
-  if (it == labels_.end()) {
+  auto data_channel = GetDataChannel("signaling");
+  if (data_channel == nullptr) {
     on_close(boost::system::errc::make_error_code(
         boost::system::errc::not_connected));
     return;
@@ -86,7 +152,6 @@ void DataChannel::Close(const webrtc::DataBuffer& disconnect_message,
   });
 
   on_close_ = on_close;
-  auto data_channel = it->second;
   data_channel->Send(disconnect_message);
 }
 void DataChannel::SetOnClose(
@@ -102,7 +167,11 @@ void DataChannel::AddDataChannel(
     thunk->dc = data_channel;
     data_channel->RegisterObserver(thunk.get());
     self->thunks_.insert(std::make_pair(thunk, data_channel));
-    self->labels_.insert(std::make_pair(data_channel->label(), data_channel));
+    auto label = data_channel->label();
+    {
+      std::lock_guard<std::mutex> lock(self->labels_mutex_);
+      self->labels_.insert(std::make_pair(label, data_channel));
+    }
     // 初期状態以外だったら OnStateChange を呼ぶ
     if (data_channel->state() != webrtc::DataChannelInterface::kConnecting) {
       self->OnStateChange(thunk);
@@ -123,7 +192,20 @@ void DataChannel::OnStateChange(std::shared_ptr<Thunk> thunk) {
       RTC_LOG(LS_INFO) << "DataChannel opened label=" << label;
     }
     if (state == webrtc::DataChannelInterface::kClosed) {
-      self->labels_.erase(label);
+      {
+        std::lock_guard<std::mutex> lock(self->flows_mutex_);
+        auto fit = self->flows_.find(label);
+        if (fit != self->flows_.end()) {
+          fit->second.queue.clear();
+          fit->second.queued_bytes = 0;
+          fit->second.blocked = false;
+          fit->second.sending = false;
+        }
+      }
+      {
+        std::lock_guard<std::mutex> lock(self->labels_mutex_);
+        self->labels_.erase(label);
+      }
       self->thunks_.erase(thunk);
       data_channel->UnregisterObserver();
       RTC_LOG(LS_INFO) << "DataChannel closed label=" << label;
@@ -163,6 +245,67 @@ void DataChannel::OnMessage(std::shared_ptr<Thunk> thunk,
   });
 }
 void DataChannel::OnBufferedAmountChange(std::shared_ptr<Thunk> thunk,
-                                         uint64_t previous_amount) {}
+                                         uint64_t previous_amount) {
+  // 送信する度に呼ばれるので、フロー制御を設定していないラベルの場合は何もしない
+  {
+    std::lock_guard<std::mutex> lock(flows_mutex_);
+    if (flows_.find(thunk->dc->label()) == flows_.end()) {
+      return;
+    }
+  }
+  boost::asio::post(*ioc_, [self = shared_from_this(), thunk]() {
+    if (self->thunks_.find(thunk) == self->thunks_.end()) {
+      return;
+    }
+    self->SendQueued(self->thunks_.at(thunk));
+  });
+}
+
+void DataChannel::SendQueued(
+    webrtc::scoped_refptr<webrtc::DataChannelInterface> data_channel) {
+  if (data_channel->state() != webrtc::DataChannelInterface::kOpen) {
+    return;
+  }
+
+  // 送信バッファに空きがある分だけキューから送信する。
+  // ロックしたまま Send や buffered_amount を呼べないので、1 つずつ取り出して送信する。
+  // キューから取り出すのは ioc_ のスレッドだけなので順序は変わらない。
+  auto label = data_channel->label();
+  bool writable = false;
+  while (true) {
+    std::optional<webrtc::DataBuffer> data;
+    uint64_t buffered_amount = data_channel->buffered_amount();
+    {
+      std::lock_guard<std::mutex> lock(flows_mutex_);
+      auto fit = flows_.find(label);
+      if (fit == flows_.end()) {
+        return;
+      }
+      auto& flow = fit->second;
+      if (flow.queue.empty() || buffered_amount >= flow.config.high_threshold) {
+        flow.sending = false;
+        if (flow.blocked && flow.queue.empty() &&
+            buffered_amount <= flow.config.low_threshold) {
+          flow.blocked = false;
+          writable = true;
+        }
+        break;
+      }
+      data = std::move(flow.queue.front());
+      flow.queued_bytes -= data->size();
+      flow.queue.pop_front();
+      flow.sending = true;
+    }
+    data_channel->Send(*data);
+  }
+
+  if (!writable) {
+    return;
+  }
+  auto ob = observer_.lock();
+  if (ob != nullptr) {
+    ob->OnWritable(data_channel);
+  }
+}
 
 }  // namespace sora
@@ -0,0 +1,282 @@
+#include "sora/frame_stamp.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+// WebRTC
+#include <api/scoped_refptr.h>
+#include <api/video/i420_buffer.h>
+#include <api/video/nv12_buffer.h>
+#include <api/video/video_frame.h>
+#include <api/video/video_frame_buffer.h>
+#include <rtc_base/synchronization/mutex.h>
+
+namespace sora {
+
+namespace {
+
+constexpr int kRows = 4;
+constexpr int kCols = 32;
+// 下端から何 % の領域を使うか
+constexpr int kHeightPercent = 12;
+// 白と黒の基準ブロックの後に、ペイロード 12 バイトと CRC 2 バイトを書き込む
+constexpr int kPayloadBytes = 12;
+constexpr int kDataBits = (kPayloadBytes + 2) * 8;
+constexpr int kDataOffset = 2;
+static_assert(kDataOffset + kDataBits <= kRows * kCols, "too many bits");
+
+constexpr uint8_t kWhite = 235;
+constexpr uint8_t kBlack = 16;
+// 1ms 単位で 10 秒まで集計する
+constexpr size_t kHistogramSize = 10001;
+
+struct Rect {
+  int x0;
+  int y0;
+  int x1;
+  int y1;
+};
+
+int StripTop(int height) {
+  return height - (height * kHeightPercent + 99) / 100;
+}
+
+Rect CellRect(int index, int width, int height) {
+  int top = StripTop(height);
+  int row = index / kCols;
+  int col = index % kCols;
+  Rect r;
+  r.x0 = width * col / kCols;
+  r.x1 = width * (col + 1) / kCols;
+  r.y0 = top + (height - top) * row / kRows;
+  r.y1 = top + (height - top) * (row + 1) / kRows;
+  return r;
+}
+
+uint16_t Crc16(const uint8_t* data, size_t size) {
+  // CRC-16/CCITT-FALSE
+  uint16_t crc = 0xffff;
+  for (size_t i = 0; i < size; i++) {
+    crc ^= static_cast<uint16_t>(data[i]) << 8;
+    for (int j = 0; j < 8; j++) {
+      crc = (crc & 0x8000) != 0 ? (crc << 1) ^ 0x1021 : (crc << 1);
+    }
+  }
+  return crc;
+}
+
+// ブロックごとの値（true が白）を作る
+std::vector<bool> EncodeCells(const FrameStamp& stamp) {
+  uint8_t bytes[kPayloadBytes + 2];
+  for (int i = 0; i < 4; i++) {
+    bytes[i] = static_cast<uint8_t>(stamp.frame_id >> (24 - i * 8));
+  }
+  uint64_t t = static_cast<uint64_t>(stamp.capture_time_us);
+  for (int i = 0; i < 8; i++) {
+    bytes[4 + i] = static_cast<uint8_t>(t >> (56 - i * 8));
+  }
+  uint16_t crc = Crc16(bytes, kPayloadBytes);
+  bytes[kPayloadBytes] = static_cast<uint8_t>(crc >> 8);
+  bytes[kPayloadBytes + 1] = static_cast<uint8_t>(crc);
+
+  std::vector<bool> cells(kRows * kCols);
+  cells[0] = true;
+  cells[1] = false;
+  for (int i = 0; i < kDataBits; i++) {
+    cells[kDataOffset + i] = ((bytes[i / 8] >> (7 - i % 8)) & 1) != 0;
+  }
+  // 残りのブロックは白黒交互に埋める
+  for (int i = kDataOffset + kDataBits; i < kRows * kCols; i++) {
+    cells[i] = i % 2 == 0;
+  }
+  return cells;
+}
+
+void WriteLuma(const FrameStamp& stamp,
+               uint8_t* y,
+               int stride_y,
+               int width,
+               int height) {
+  std::vector<bool> cells = EncodeCells(stamp);
+  for (int i = 0; i < kRows * kCols; i++) {
+    Rect r = CellRect(i, width, height);
+    uint8_t value = cells[i] ? kWhite : kBlack;
+    for (int yy = r.y0; yy < r.y1; yy++) {
+      std::fill(y + yy * stride_y + r.x0, y + yy * stride_y + r.x1, value);
+    }
+  }
+}
+
+// ブロックの中央付近の平均の明るさ
+int ReadCell(const uint8_t* y, int stride_y, const Rect& r) {
+  int mx = (r.x1 - r.x0) / 4;
+  int my = (r.y1 - r.y0) / 4;
+  int x0 = r.x0 + mx;
+  int x1 = std::max(x0 + 1, r.x1 - mx);
+  int y0 = r.y0 + my;
+  int y1 = std::max(y0 + 1, r.y1 - my);
+  int sum = 0;
+  for (int yy = y0; yy < y1; yy++) {
+    for (int xx = x0; xx < x1; xx++) {
+      sum += y[yy * stride_y + xx];
+    }
+  }
+  return sum / ((x1 - x0) * (y1 - y0));
+}
+
+std::optional<FrameStamp> ReadLuma(const uint8_t* y,
+                                   int stride_y,
+                                   int width,
+                                   int height) {
+  // 1 ブロックが 1 ピクセル未満になるサイズでは読み取れない
+  if (width < kCols || height - StripTop(height) < kRows) {
+    return std::nullopt;
+  }
+  int white = ReadCell(y, stride_y, CellRect(0, width, height));
+  int black = ReadCell(y, stride_y, CellRect(1, width, height));
+  if (white - black < 64) {
+    return std::nullopt;
+  }
+  int threshold = (white + black) / 2;
+
+  uint8_t bytes[kPayloadBytes + 2] = {};
+  for (int i = 0; i < kDataBits; i++) {
+    int v = ReadCell(y, stride_y, CellRect(kDataOffset + i, width, height));
+    if (v > threshold) {
+      bytes[i / 8] |= 1 << (7 - i % 8);
+    }
+  }
+  uint16_t crc = (static_cast<uint16_t>(bytes[kPayloadBytes]) << 8) |
+                 bytes[kPayloadBytes + 1];
+  if (Crc16(bytes, kPayloadBytes) != crc) {
+    return std::nullopt;
+  }
+
+  FrameStamp stamp;
+  for (int i = 0; i < 4; i++) {
+    stamp.frame_id = (stamp.frame_id << 8) | bytes[i];
+  }
+  uint64_t t = 0;
+  for (int i = 0; i < 8; i++) {
+    t = (t << 8) | bytes[4 + i];
+  }
+  stamp.capture_time_us = static_cast<int64_t>(t);
+  return stamp;
+}
+
+}  // namespace
+
+int64_t GetFrameStampTimeUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+void WriteFrameStamp(const FrameStamp& stamp, webrtc::I420Buffer* buffer) {
+  int width = buffer->width();
+  int height = buffer->height();
+  WriteLuma(stamp, buffer->MutableDataY(), buffer->StrideY(), width, height);
+  // 色が付かないように、領域の色差を中間値にする
+  int top = StripTop(height) / 2;
+  int chroma_width = (width + 1) / 2;
+  int chroma_height = (height + 1) / 2;
+  for (int y = top; y < chroma_height; y++) {
+    std::fill_n(buffer->MutableDataU() + y * buffer->StrideU(), chroma_width,
+                128);
+    std::fill_n(buffer->MutableDataV() + y * buffer->StrideV(), chroma_width,
+                128);
+  }
+}
+
+void WriteFrameStamp(const FrameStamp& stamp, webrtc::NV12Buffer* buffer) {
+  int width = buffer->width();
+  int height = buffer->height();
+  WriteLuma(stamp, buffer->MutableDataY(), buffer->StrideY(), width, height);
+  int top = StripTop(height) / 2;
+  int chroma_height = (height + 1) / 2;
+  for (int y = top; y < chroma_height; y++) {
+    std::fill_n(buffer->MutableDataUV() + y * buffer->StrideUV(),
+                (width + 1) / 2 * 2, 128);
+  }
+}
+
+std::optional<FrameStamp> ReadFrameStamp(const webrtc::VideoFrame& frame) {
+  webrtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer =
+      frame.video_frame_buffer();
+  if (buffer->type() == webrtc::VideoFrameBuffer::Type::kNV12) {
+    const webrtc::NV12BufferInterface* nv12 = buffer->GetNV12();
+    return ReadLuma(nv12->DataY(), nv12->StrideY(), nv12->width(),
+                    nv12->height());
+  }
+  webrtc::scoped_refptr<webrtc::I420BufferInterface> i420 = buffer->ToI420();
+  if (i420 == nullptr) {
+    return std::nullopt;
+  }
+  return ReadLuma(i420->DataY(), i420->StrideY(), i420->width(),
+                  i420->height());
+}
+
+FrameStampDetector::FrameStampDetector() : histogram_(kHistogramSize) {}
+
+void FrameStampDetector::OnFrame(const webrtc::VideoFrame& frame) {
+  int64_t now_us = GetFrameStampTimeUs();
+  std::optional<FrameStamp> stamp = ReadFrameStamp(frame);
+
+  webrtc::MutexLock lock(&mutex_);
+  if (!stamp) {
+    stats_.undetected_frames++;
+    return;
+  }
+  double latency_ms = (now_us - stamp->capture_time_us) / 1000.0;
+  size_t bucket = static_cast<size_t>(
+      std::clamp<int64_t>((now_us - stamp->capture_time_us) / 1000, 0,
+                          kHistogramSize - 1));
+  histogram_[bucket]++;
+  if (stats_.frames == 0 || latency_ms < stats_.min_ms) {
+    stats_.min_ms = latency_ms;
+  }
+  if (stats_.frames == 0 || latency_ms > stats_.max_ms) {
+    stats_.max_ms = latency_ms;
+  }
+  stats_.frames++;
+  if (last_frame_id_ && stamp->frame_id > *last_frame_id_ + 1) {
+    stats_.missing_frames += stamp->frame_id - *last_frame_id_ - 1;
+  }
+  last_frame_id_ = stamp->frame_id;
+}
+
+FrameStampDetector::Stats FrameStampDetector::GetStats() const {
+  webrtc::MutexLock lock(&mutex_);
+  Stats stats = stats_;
+  stats.p50_ms = Percentile(0.50);
+  stats.p95_ms = Percentile(0.95);
+  stats.p99_ms = Percentile(0.99);
+  return stats;
+}
+
+void FrameStampDetector::Reset() {
+  webrtc::MutexLock lock(&mutex_);
+  std::fill(histogram_.begin(), histogram_.end(), 0);
+  stats_ = Stats();
+  last_frame_id_ = std::nullopt;
+}
+
+double FrameStampDetector::Percentile(double p) const {
+  if (stats_.frames == 0) {
+    return 0;
+  }
+  uint64_t target = static_cast<uint64_t>(p * (stats_.frames - 1)) + 1;
+  uint64_t count = 0;
+  for (size_t i = 0; i < histogram_.size(); i++) {
+    count += histogram_[i];
+    if (count >= target) {
+      return static_cast<double>(i);
+    }
+  }
+  return static_cast<double>(histogram_.size() - 1);
+}
+
+}  // namespace sora
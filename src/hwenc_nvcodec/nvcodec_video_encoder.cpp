@@ -16,6 +16,7 @@
 // WebRTC
 #include <api/scoped_refptr.h>
 #include <api/video/encoded_image.h>
+#include <api/video/i420_buffer.h>
 #include <api/video/nv12_buffer.h>
 #include <api/video/render_resolution.h>
 #include <api/video/video_codec_type.h>
@@ -355,10 +356,24 @@ int32_t NvCodecVideoEncoderImpl::Encode(
   //                 << " frame_width=" << frame.video_frame_buffer()->width()
   //                 << " frame_height=" << frame.video_frame_buffer()->height();
 
+  // cuda_->Copy は各プレーンが隙間なく並んだバッファしか扱えないので、
+  // V4L2 のバッファや切り出したバッファのようにストライドに余白がある場合は詰め直す
   if (frame.video_frame_buffer()->type() ==
       webrtc::VideoFrameBuffer::Type::kNV12) {
-    webrtc::NV12Buffer* buffer =
-        static_cast<webrtc::NV12Buffer*>(frame.video_frame_buffer().get());
+    webrtc::scoped_refptr<const webrtc::NV12BufferInterface> buffer(
+        frame.video_frame_buffer()->GetNV12());
+    if (buffer->StrideY() != buffer->width() ||
+        buffer->StrideUV() != buffer->width() ||
+        buffer->DataUV() !=
+            buffer->DataY() + buffer->StrideY() * buffer->height()) {
+      auto packed =
+          webrtc::NV12Buffer::Create(buffer->width(), buffer->height());
+      libyuv::NV12Copy(buffer->DataY(), buffer->StrideY(), buffer->DataUV(),
+                       buffer->StrideUV(), packed->MutableDataY(),
+                       packed->StrideY(), packed->MutableDataUV(),
+                       packed->StrideUV(), buffer->width(), buffer->height());
+      buffer = packed;
+    }
     try {
       cuda_->Copy(nv_encoder_.get(), buffer->DataY(), width_, height_);
     } catch (const NVENCException& e) {
@@ -368,6 +383,17 @@ int32_t NvCodecVideoEncoderImpl::Encode(
   } else {
     webrtc::scoped_refptr<const webrtc::I420BufferInterface> frame_buffer =
         frame.video_frame_buffer()->ToI420();
+    if (frame_buffer->StrideY() != frame_buffer->width() ||
+        frame_buffer->StrideU() != frame_buffer->ChromaWidth() ||
+        frame_buffer->StrideV() != frame_buffer->ChromaWidth() ||
+        frame_buffer->DataU() !=
+            frame_buffer->DataY() +
+                frame_buffer->StrideY() * frame_buffer->height() ||
+        frame_buffer->DataV() !=
+            frame_buffer->DataU() +
+                frame_buffer->StrideU() * frame_buffer->ChromaHeight()) {
+      frame_buffer = webrtc::I420Buffer::Copy(*frame_buffer);
+    }
     cuda_->Copy(nv_encoder_.get(), frame_buffer->DataY(), frame_buffer->width(),
                 frame_buffer->height());
   }
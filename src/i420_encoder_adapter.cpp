@@ -5,12 +5,16 @@
 #include <vector>
 
 #include <api/fec_controller_override.h>
+#include <api/video/video_bitrate_allocation.h>
+#include <api/video/video_codec_constants.h>
 #include <api/video/video_frame.h>
 #include <api/video/video_frame_buffer.h>
 #include <api/video/video_frame_type.h>
 #include <api/video_codecs/video_codec.h>
 #include <api/video_codecs/video_encoder.h>
 
+#include "sora/convert_once_i420_buffer.h"
+
 namespace sora {
 
 I420EncoderAdapter::I420EncoderAdapter(
@@ -27,6 +31,17 @@ int I420EncoderAdapter::Release() {
 int I420EncoderAdapter::InitEncode(
     const webrtc::VideoCodec* codec_settings,
     const webrtc::VideoEncoder::Settings& settings) {
+  simulcast_streams_ = codec_settings->numberOfSimulcastStreams;
+  active_layers_ = 0;
+  if (codec_settings->numberOfSimulcastStreams <= 1) {
+    active_layers_ = 1;
+  } else {
+    for (int i = 0; i < codec_settings->numberOfSimulcastStreams; i++) {
+      if (codec_settings->simulcastStream[i].active) {
+        active_layers_++;
+      }
+    }
+  }
   return encoder_->InitEncode(codec_settings, settings);
 }
 int I420EncoderAdapter::Encode(
@@ -34,8 +49,9 @@ int I420EncoderAdapter::Encode(
     const std::vector<webrtc::VideoFrameType>* frame_types) {
   auto frame = input_image;
   auto buffer = frame.video_frame_buffer();
-  if (buffer->type() == webrtc::VideoFrameBuffer::Type::kNative) {
-    frame.set_video_frame_buffer(buffer->ToI420());
+  if (buffer->type() == webrtc::VideoFrameBuffer::Type::kNative &&
+      active_layers_ > 1) {
+    frame.set_video_frame_buffer(ConvertOnceI420Buffer::Create(buffer));
   }
   return encoder_->Encode(frame, frame_types);
 }
@@ -45,6 +61,20 @@ int I420EncoderAdapter::RegisterEncodeCompleteCallback(
   return encoder_->RegisterEncodeCompleteCallback(callback);
 }
 void I420EncoderAdapter::SetRates(const RateControlParameters& parameters) {
+  // サイマルキャストでない場合、ビットレートの割り当ては SVC の空間レイヤーごとなので、
+  // 何個割り当てられていてもエンコードするのは 1 つのストリームになる
+  if (simulcast_streams_ <= 1) {
+    active_layers_ = 1;
+  } else {
+    // ビットレートが割り当てられていないストリームはエンコードされない
+    int active_layers = 0;
+    for (size_t i = 0; i < webrtc::kMaxSpatialLayers; i++) {
+      if (parameters.bitrate.GetSpatialLayerSum(i) > 0) {
+        active_layers++;
+      }
+    }
+    active_layers_ = active_layers;
+  }
   encoder_->SetRates(parameters);
 }
 void I420EncoderAdapter::OnPacketLossRateUpdate(float packet_loss_rate) {
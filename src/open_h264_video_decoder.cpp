@@ -23,6 +23,7 @@
 #include <api/video_codecs/sdp_video_format.h>
 #include <api/video_codecs/video_decoder.h>
 #include <common_video/h264/h264_bitstream_parser.h>
+#include <common_video/include/video_frame_buffer_pool.h>
 #include <modules/video_coding/codecs/h264/include/h264.h>
 #include <modules/video_coding/include/video_error_codes.h>
 #include <rtc_base/logging.h>
@@ -65,6 +66,7 @@ class OpenH264VideoDecoder : public H264Decoder {
   DecodedImageCallback* callback_ = nullptr;
   ISVCDecoder* decoder_ = nullptr;
   webrtc::H264BitstreamParser h264_bitstream_parser_;
+  webrtc::VideoFrameBufferPool buffer_pool_;
 
   std::string openh264_;
 #if defined(_WIN32)
@@ -79,7 +81,8 @@ class OpenH264VideoDecoder : public H264Decoder {
 };
 
 OpenH264VideoDecoder::OpenH264VideoDecoder(std::string openh264)
-    : openh264_(std::move(openh264)) {}
+    : buffer_pool_(false, 300 /* max_number_of_buffers*/),
+      openh264_(std::move(openh264)) {}
 OpenH264VideoDecoder::~OpenH264VideoDecoder() {
   Release();
 }
@@ -147,6 +150,8 @@ bool OpenH264VideoDecoder::Configure(const Settings& settings) {
   return true;
 }
 int32_t OpenH264VideoDecoder::Release() {
+  buffer_pool_.Release();
+
   if (decoder_ != nullptr) {
     decoder_->Uninitialize();
     destroy_decoder_(decoder_);
@@ -200,8 +205,12 @@ int32_t OpenH264VideoDecoder::Decode(const EncodedImage& input_image,
   int height_uv = (height_y + 1) / 2;
   int stride_y = info.UsrData.sSystemBuffer.iStride[0];
   int stride_uv = info.UsrData.sSystemBuffer.iStride[1];
-  webrtc::scoped_refptr<webrtc::I420Buffer> i420_buffer(
-      webrtc::I420Buffer::Create(width_y, height_y));
+  // 解像度が変わらない間はプールのバッファを使い回す
+  webrtc::scoped_refptr<webrtc::I420Buffer> i420_buffer =
+      buffer_pool_.CreateI420Buffer(width_y, height_y);
+  if (!i420_buffer) {
+    i420_buffer = webrtc::I420Buffer::Create(width_y, height_y);
+  }
   libyuv::I420Copy(yuv[0], stride_y, yuv[1], stride_uv, yuv[2], stride_uv,
                    i420_buffer->MutableDataY(), i420_buffer->StrideY(),
                    i420_buffer->MutableDataU(), i420_buffer->StrideU(),
@@ -15,13 +15,17 @@
 #include "sora/open_h264_video_encoder.h"
 
 #include <algorithm>
+#include <condition_variable>
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
+#include <functional>
 #include <limits>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -82,6 +86,29 @@ class ISVCEncoder;
 
 namespace webrtc {
 
+// 渡されたタスクを呼び出し元のスレッドとワーカースレッドで並列に実行する
+class OpenH264LayerWorkers {
+ public:
+  explicit OpenH264LayerWorkers(int num_threads);
+  ~OpenH264LayerWorkers();
+
+  // 全てのタスクが終わるまで待つ
+  void Run(const std::vector<std::function<void()>>& tasks);
+
+ private:
+  void Work();
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::condition_variable done_cond_;
+  const std::vector<std::function<void()>>* tasks_ = nullptr;
+  size_t next_ = 0;
+  size_t pending_ = 0;
+  uint64_t generation_ = 0;
+  bool stop_ = false;
+  std::vector<std::thread> threads_;
+};
+
 class OpenH264VideoEncoder : public VideoEncoder {
  public:
   struct LayerConfig {
@@ -102,7 +129,8 @@ class OpenH264VideoEncoder : public VideoEncoder {
 
   OpenH264VideoEncoder(const Environment& env,
                        H264EncoderSettings settings,
-                       std::string openh264);
+                       std::string openh264,
+                       bool parallel_simulcast);
 
   ~OpenH264VideoEncoder() override;
 
@@ -136,6 +164,16 @@ class OpenH264VideoEncoder : public VideoEncoder {
  private:
   SEncParamExt CreateEncoderParams(size_t i) const;
 
+  // i 番目のレイヤーを縮小してエンコードし、コールバックに渡す。
+  // src は縮小元の画像で、i == 0 の場合は使わない。
+  int32_t EncodeLayer(size_t i,
+                      const SSourcePicture& src,
+                      int src_width,
+                      int src_height,
+                      const VideoFrame& input_frame,
+                      const std::vector<VideoFrameType>* frame_types,
+                      bool is_keyframe_needed);
+
   webrtc::H264BitstreamParser h264_bitstream_parser_;
   // Reports statistics with histograms.
   void ReportInit();
@@ -163,6 +201,13 @@ class OpenH264VideoEncoder : public VideoEncoder {
 
   std::vector<uint8_t> tl0sync_limit_;
 
+  // サイマルキャストの各レイヤーを並列にエンコードするかどうか
+  bool parallel_simulcast_;
+  std::unique_ptr<OpenH264LayerWorkers> layer_workers_;
+  // 並列エンコード時に h264_bitstream_parser_ と
+  // encoded_image_callback_ の呼び出しを保護する
+  std::mutex callback_mutex_;
+
  private:
   bool InitOpenH264();
   void ReleaseOpenH264();
@@ -261,6 +306,74 @@ std::optional<ScalabilityMode> ScalabilityModeFromTemporalLayers(
 
 }  // namespace
 
+OpenH264LayerWorkers::OpenH264LayerWorkers(int num_threads) {
+  for (int i = 0; i < num_threads; ++i) {
+    threads_.emplace_back([this]() {
+      uint64_t generation = 0;
+      while (true) {
+        {
+          std::unique_lock<std::mutex> lock(mutex_);
+          cond_.wait(lock,
+                     [&]() { return stop_ || generation_ != generation; });
+          if (stop_) {
+            return;
+          }
+          generation = generation_;
+        }
+        Work();
+      }
+    });
+  }
+}
+
+OpenH264LayerWorkers::~OpenH264LayerWorkers() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cond_.notify_all();
+  for (auto& th : threads_) {
+    th.join();
+  }
+}
+
+void OpenH264LayerWorkers::Run(
+    const std::vector<std::function<void()>>& tasks) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tasks_ = &tasks;
+    next_ = 0;
+    pending_ = tasks.size();
+    ++generation_;
+  }
+  cond_.notify_all();
+  // 呼び出し元のスレッドもタスクを処理する
+  Work();
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_cond_.wait(lock, [this]() { return pending_ == 0; });
+  tasks_ = nullptr;
+}
+
+void OpenH264LayerWorkers::Work() {
+  while (true) {
+    size_t index;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (tasks_ == nullptr || next_ >= tasks_->size()) {
+        return;
+      }
+      index = next_++;
+    }
+    (*tasks_)[index]();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (--pending_ == 0) {
+        done_cond_.notify_all();
+      }
+    }
+  }
+}
+
 // Helper method used by OpenH264VideoEncoder::Encode.
 // Copies the encoded bytes from `info` to `encoded_image`. The
 // `encoded_image->_buffer` may be deleted and reallocated if a bigger buffer is
@@ -314,7 +427,8 @@ static void RtpFragmentize(EncodedImage* encoded_image, SFrameBSInfo* info) {
 
 OpenH264VideoEncoder::OpenH264VideoEncoder(const Environment& env,
                                            H264EncoderSettings settings,
-                                           std::string openh264)
+                                           std::string openh264,
+                                           bool parallel_simulcast)
     : env_(env),
       packetization_mode_(settings.packetization_mode),
       max_payload_size_(0),
@@ -322,6 +436,7 @@ OpenH264VideoEncoder::OpenH264VideoEncoder(const Environment& env,
       encoded_image_callback_(nullptr),
       has_reported_init_(false),
       has_reported_error_(false),
+      parallel_simulcast_(parallel_simulcast),
       openh264_(std::move(openh264)) {
   downscaled_buffers_.reserve(kMaxSimulcastStreams - 1);
   encoded_images_.reserve(kMaxSimulcastStreams);
@@ -530,6 +645,11 @@ int32_t OpenH264VideoEncoder::InitEncode(
     }
   }
 
+  if (parallel_simulcast_ && number_of_streams > 1) {
+    // 1 レイヤーは呼び出し元のスレッドでエンコードする
+    layer_workers_.reset(new OpenH264LayerWorkers(number_of_streams - 1));
+  }
+
   SimulcastRateAllocator init_allocator(env_, codec_);
   VideoBitrateAllocation allocation =
       init_allocator.Allocate(VideoBitrateAllocationParameters(
@@ -539,6 +659,7 @@ int32_t OpenH264VideoEncoder::InitEncode(
 }
 
 int32_t OpenH264VideoEncoder::Release() {
+  layer_workers_.reset();
   while (!encoders_.empty()) {
     ISVCEncoder* openh264_encoder = encoders_.back();
     if (openh264_encoder) {
@@ -649,160 +770,212 @@ int32_t OpenH264VideoEncoder::Encode(
   RTC_DCHECK_EQ(configurations_[0].width, frame_buffer->width());
   RTC_DCHECK_EQ(configurations_[0].height, frame_buffer->height());
 
-  // Encode image for each layer.
+  pictures_[0] = {0};
+  pictures_[0].iPicWidth = configurations_[0].width;
+  pictures_[0].iPicHeight = configurations_[0].height;
+  pictures_[0].iColorFormat = EVideoFormatType::videoFormatI420;
+  pictures_[0].uiTimeStamp = input_frame.ntp_time_ms();
+  pictures_[0].iStride[0] = frame_buffer->StrideY();
+  pictures_[0].iStride[1] = frame_buffer->StrideU();
+  pictures_[0].iStride[2] = frame_buffer->StrideV();
+  pictures_[0].pData[0] = const_cast<uint8_t*>(frame_buffer->DataY());
+  pictures_[0].pData[1] = const_cast<uint8_t*>(frame_buffer->DataU());
+  pictures_[0].pData[2] = const_cast<uint8_t*>(frame_buffer->DataV());
+
+  if (layer_workers_ == nullptr) {
+    // Encode image for each layer.
+    // Downscale images on second and ongoing layers from the previous layer.
+    for (size_t i = 0; i < encoders_.size(); ++i) {
+      const SSourcePicture& src = pictures_[i == 0 ? 0 : i - 1];
+      int src_width = configurations_[i == 0 ? 0 : i - 1].width;
+      int src_height = configurations_[i == 0 ? 0 : i - 1].height;
+      int32_t ret = EncodeLayer(i, src, src_width, src_height, input_frame,
+                                frame_types, is_keyframe_needed);
+      if (ret != WEBRTC_VIDEO_CODEC_OK) {
+        ReportError();
+        return ret;
+      }
+    }
+    return WEBRTC_VIDEO_CODEC_OK;
+  }
+
+  // 各レイヤーを並列にエンコードする。
+  // 全てのレイヤーを元の解像度の画像から直接縮小するので、レイヤー間の依存は無い。
+  std::vector<int32_t> results(encoders_.size(), WEBRTC_VIDEO_CODEC_OK);
+  std::vector<std::function<void()>> tasks;
+  tasks.reserve(encoders_.size());
   for (size_t i = 0; i < encoders_.size(); ++i) {
-    // EncodeFrame input.
+    tasks.push_back([this, i, &results, &input_frame, frame_types,
+                     is_keyframe_needed]() {
+      results[i] = EncodeLayer(i, pictures_[0], configurations_[0].width,
+                               configurations_[0].height, input_frame,
+                               frame_types, is_keyframe_needed);
+    });
+  }
+  layer_workers_->Run(tasks);
+  for (int32_t ret : results) {
+    if (ret != WEBRTC_VIDEO_CODEC_OK) {
+      ReportError();
+      return ret;
+    }
+  }
+  return WEBRTC_VIDEO_CODEC_OK;
+}
+
+int32_t OpenH264VideoEncoder::EncodeLayer(
+    size_t i,
+    const SSourcePicture& src,
+    int src_width,
+    int src_height,
+    const VideoFrame& input_frame,
+    const std::vector<VideoFrameType>* frame_types,
+    bool is_keyframe_needed) {
+  bool skip = !configurations_[i].sending;
+  if (frame_types != nullptr && i < frame_types->size()) {
+    // Skip frame?
+    if ((*frame_types)[i] == VideoFrameType::kEmptyFrame) {
+      skip = true;
+    }
+  }
+
+  // EncodeFrame input.
+  if (i > 0) {
     pictures_[i] = {0};
     pictures_[i].iPicWidth = configurations_[i].width;
     pictures_[i].iPicHeight = configurations_[i].height;
     pictures_[i].iColorFormat = EVideoFormatType::videoFormatI420;
     pictures_[i].uiTimeStamp = input_frame.ntp_time_ms();
-    // Downscale images on second and ongoing layers.
-    if (i == 0) {
-      pictures_[i].iStride[0] = frame_buffer->StrideY();
-      pictures_[i].iStride[1] = frame_buffer->StrideU();
-      pictures_[i].iStride[2] = frame_buffer->StrideV();
-      pictures_[i].pData[0] = const_cast<uint8_t*>(frame_buffer->DataY());
-      pictures_[i].pData[1] = const_cast<uint8_t*>(frame_buffer->DataU());
-      pictures_[i].pData[2] = const_cast<uint8_t*>(frame_buffer->DataV());
-    } else {
-      pictures_[i].iStride[0] = downscaled_buffers_[i - 1]->StrideY();
-      pictures_[i].iStride[1] = downscaled_buffers_[i - 1]->StrideU();
-      pictures_[i].iStride[2] = downscaled_buffers_[i - 1]->StrideV();
-      pictures_[i].pData[0] =
-          const_cast<uint8_t*>(downscaled_buffers_[i - 1]->DataY());
-      pictures_[i].pData[1] =
-          const_cast<uint8_t*>(downscaled_buffers_[i - 1]->DataU());
-      pictures_[i].pData[2] =
-          const_cast<uint8_t*>(downscaled_buffers_[i - 1]->DataV());
-      // Scale the image down a number of times by downsampling factor.
-      libyuv::I420Scale(pictures_[i - 1].pData[0], pictures_[i - 1].iStride[0],
-                        pictures_[i - 1].pData[1], pictures_[i - 1].iStride[1],
-                        pictures_[i - 1].pData[2], pictures_[i - 1].iStride[2],
-                        configurations_[i - 1].width,
-                        configurations_[i - 1].height, pictures_[i].pData[0],
+    pictures_[i].iStride[0] = downscaled_buffers_[i - 1]->StrideY();
+    pictures_[i].iStride[1] = downscaled_buffers_[i - 1]->StrideU();
+    pictures_[i].iStride[2] = downscaled_buffers_[i - 1]->StrideV();
+    pictures_[i].pData[0] =
+        const_cast<uint8_t*>(downscaled_buffers_[i - 1]->DataY());
+    pictures_[i].pData[1] =
+        const_cast<uint8_t*>(downscaled_buffers_[i - 1]->DataU());
+    pictures_[i].pData[2] =
+        const_cast<uint8_t*>(downscaled_buffers_[i - 1]->DataV());
+    // 順番にエンコードする場合、次のレイヤーの縮小元になるので
+    // このレイヤーを送らない場合でも縮小しておく
+    if (!skip || layer_workers_ == nullptr) {
+      libyuv::I420Scale(src.pData[0], src.iStride[0], src.pData[1],
+                        src.iStride[1], src.pData[2], src.iStride[2],
+                        src_width, src_height, pictures_[i].pData[0],
                         pictures_[i].iStride[0], pictures_[i].pData[1],
                         pictures_[i].iStride[1], pictures_[i].pData[2],
                         pictures_[i].iStride[2], configurations_[i].width,
                         configurations_[i].height, libyuv::kFilterBox);
     }
+  }
 
-    if (!configurations_[i].sending) {
-      continue;
-    }
-    if (frame_types != nullptr && i < frame_types->size()) {
-      // Skip frame?
-      if ((*frame_types)[i] == VideoFrameType::kEmptyFrame) {
-        continue;
-      }
-    }
-    // Send a key frame either when this layer is configured to require one
-    // or we have explicitly been asked to.
-    const size_t simulcast_idx =
-        static_cast<size_t>(configurations_[i].simulcast_idx);
-    bool send_key_frame =
-        is_keyframe_needed ||
-        (frame_types && simulcast_idx < frame_types->size() &&
-         (*frame_types)[simulcast_idx] == VideoFrameType::kVideoFrameKey);
-    if (send_key_frame) {
-      // API doc says ForceIntraFrame(false) does nothing, but calling this
-      // function forces a key frame regardless of the `bIDR` argument's value.
-      // (If every frame is a key frame we get lag/delays.)
-      encoders_[i]->ForceIntraFrame(true);
-      configurations_[i].key_frame_request = false;
-    }
-    // EncodeFrame output.
-    SFrameBSInfo info;
-    memset(&info, 0, sizeof(SFrameBSInfo));
-
-    std::vector<ScalableVideoController::LayerFrameConfig> layer_frames;
-    if (svc_controllers_[i]) {
-      layer_frames = svc_controllers_[i]->NextFrameConfig(send_key_frame);
-      RTC_CHECK_EQ(layer_frames.size(), 1);
-    }
+  if (skip) {
+    return WEBRTC_VIDEO_CODEC_OK;
+  }
+  // Send a key frame either when this layer is configured to require one
+  // or we have explicitly been asked to.
+  const size_t simulcast_idx =
+      static_cast<size_t>(configurations_[i].simulcast_idx);
+  bool send_key_frame =
+      is_keyframe_needed ||
+      (frame_types && simulcast_idx < frame_types->size() &&
+       (*frame_types)[simulcast_idx] == VideoFrameType::kVideoFrameKey);
+  if (send_key_frame) {
+    // API doc says ForceIntraFrame(false) does nothing, but calling this
+    // function forces a key frame regardless of the `bIDR` argument's value.
+    // (If every frame is a key frame we get lag/delays.)
+    encoders_[i]->ForceIntraFrame(true);
+    configurations_[i].key_frame_request = false;
+  }
+  // EncodeFrame output.
+  SFrameBSInfo info;
+  memset(&info, 0, sizeof(SFrameBSInfo));
+
+  std::vector<ScalableVideoController::LayerFrameConfig> layer_frames;
+  if (svc_controllers_[i]) {
+    layer_frames = svc_controllers_[i]->NextFrameConfig(send_key_frame);
+    RTC_CHECK_EQ(layer_frames.size(), 1);
+  }
 
-    // Encode!
-    int enc_ret = encoders_[i]->EncodeFrame(&pictures_[i], &info);
-    if (enc_ret != 0) {
-      RTC_LOG(LS_ERROR)
-          << "OpenH264 frame encoding failed, EncodeFrame returned " << enc_ret
-          << ".";
-      ReportError();
-      return WEBRTC_VIDEO_CODEC_ERROR;
-    }
+  // Encode!
+  int enc_ret = encoders_[i]->EncodeFrame(&pictures_[i], &info);
+  if (enc_ret != 0) {
+    RTC_LOG(LS_ERROR) << "OpenH264 frame encoding failed, EncodeFrame returned "
+                      << enc_ret << ".";
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
 
-    encoded_images_[i]._encodedWidth = configurations_[i].width;
-    encoded_images_[i]._encodedHeight = configurations_[i].height;
-    encoded_images_[i].SetRtpTimestamp(input_frame.rtp_timestamp());
-    encoded_images_[i].SetColorSpace(input_frame.color_space());
-    encoded_images_[i]._frameType = ConvertToVideoFrameType(info.eFrameType);
-    encoded_images_[i].SetSimulcastIndex(configurations_[i].simulcast_idx);
-
-    // Split encoded image up into fragments. This also updates
-    // `encoded_image_`.
-    RtpFragmentize(&encoded_images_[i], &info);
-
-    // Encoder can skip frames to save bandwidth in which case
-    // `encoded_images_[i]._length` == 0.
-    if (encoded_images_[i].size() > 0) {
-      // Parse QP.
-      h264_bitstream_parser_.ParseBitstream(encoded_images_[i]);
-      encoded_images_[i].qp_ =
-          h264_bitstream_parser_.GetLastSliceQp().value_or(-1);
-
-      // Deliver encoded image.
-      CodecSpecificInfo codec_specific;
-      codec_specific.codecType = kVideoCodecH264;
-      codec_specific.codecSpecific.H264.packetization_mode =
-          packetization_mode_;
-      codec_specific.codecSpecific.H264.temporal_idx = kNoTemporalIdx;
-      codec_specific.codecSpecific.H264.idr_frame =
-          info.eFrameType == videoFrameTypeIDR;
-      codec_specific.codecSpecific.H264.base_layer_sync = false;
-      if (configurations_[i].num_temporal_layers > 1) {
-        const uint8_t tid = info.sLayerInfo[0].uiTemporalId;
-        codec_specific.codecSpecific.H264.temporal_idx = tid;
-        codec_specific.codecSpecific.H264.base_layer_sync =
-            tid > 0 && tid < tl0sync_limit_[i];
-        if (svc_controllers_[i]) {
-          if (encoded_images_[i]._frameType == VideoFrameType::kVideoFrameKey) {
-            // Reset the ScalableVideoController on key frame
-            // to reset the expected dependency structure.
-            layer_frames =
-                svc_controllers_[i]->NextFrameConfig(/* restart= */ true);
-            RTC_CHECK_EQ(layer_frames.size(), 1);
-            RTC_DCHECK_EQ(layer_frames[0].TemporalId(), 0);
-            RTC_DCHECK_EQ(layer_frames[0].IsKeyframe(), true);
-          }
+  encoded_images_[i]._encodedWidth = configurations_[i].width;
+  encoded_images_[i]._encodedHeight = configurations_[i].height;
+  encoded_images_[i].SetRtpTimestamp(input_frame.rtp_timestamp());
+  encoded_images_[i].SetColorSpace(input_frame.color_space());
+  encoded_images_[i]._frameType = ConvertToVideoFrameType(info.eFrameType);
+  encoded_images_[i].SetSimulcastIndex(configurations_[i].simulcast_idx);
+
+  // Split encoded image up into fragments. This also updates
+  // `encoded_image_`.
+  RtpFragmentize(&encoded_images_[i], &info);
+
+  // Encoder can skip frames to save bandwidth in which case
+  // `encoded_images_[i]._length` == 0.
+  if (encoded_images_[i].size() == 0) {
+    return WEBRTC_VIDEO_CODEC_OK;
+  }
 
-          if (layer_frames[0].TemporalId() != tid) {
-            RTC_LOG(LS_WARNING)
-                << "Encoder produced a frame with temporal id " << tid
-                << ", expected " << layer_frames[0].TemporalId() << ".";
-            continue;
-          }
-          encoded_images_[i].SetTemporalIndex(tid);
-        }
-        if (codec_specific.codecSpecific.H264.base_layer_sync) {
-          tl0sync_limit_[i] = tid;
-        }
-        if (tid == 0) {
-          tl0sync_limit_[i] = configurations_[i].num_temporal_layers;
-        }
+  // 並列エンコード時は、エンコードが終わったレイヤーから順にコールバックする
+  std::lock_guard<std::mutex> lock(callback_mutex_);
+
+  // Parse QP.
+  h264_bitstream_parser_.ParseBitstream(encoded_images_[i]);
+  encoded_images_[i].qp_ = h264_bitstream_parser_.GetLastSliceQp().value_or(-1);
+
+  // Deliver encoded image.
+  CodecSpecificInfo codec_specific;
+  codec_specific.codecType = kVideoCodecH264;
+  codec_specific.codecSpecific.H264.packetization_mode = packetization_mode_;
+  codec_specific.codecSpecific.H264.temporal_idx = kNoTemporalIdx;
+  codec_specific.codecSpecific.H264.idr_frame =
+      info.eFrameType == videoFrameTypeIDR;
+  codec_specific.codecSpecific.H264.base_layer_sync = false;
+  if (configurations_[i].num_temporal_layers > 1) {
+    const uint8_t tid = info.sLayerInfo[0].uiTemporalId;
+    codec_specific.codecSpecific.H264.temporal_idx = tid;
+    codec_specific.codecSpecific.H264.base_layer_sync =
+        tid > 0 && tid < tl0sync_limit_[i];
+    if (svc_controllers_[i]) {
+      if (encoded_images_[i]._frameType == VideoFrameType::kVideoFrameKey) {
+        // Reset the ScalableVideoController on key frame
+        // to reset the expected dependency structure.
+        layer_frames =
+            svc_controllers_[i]->NextFrameConfig(/* restart= */ true);
+        RTC_CHECK_EQ(layer_frames.size(), 1);
+        RTC_DCHECK_EQ(layer_frames[0].TemporalId(), 0);
+        RTC_DCHECK_EQ(layer_frames[0].IsKeyframe(), true);
       }
-      if (svc_controllers_[i]) {
-        codec_specific.generic_frame_info =
-            svc_controllers_[i]->OnEncodeDone(layer_frames[0]);
-        if (send_key_frame && codec_specific.generic_frame_info.has_value()) {
-          codec_specific.template_structure =
-              svc_controllers_[i]->DependencyStructure();
-        }
-        codec_specific.scalability_mode = scalability_modes_[i];
+
+      if (layer_frames[0].TemporalId() != tid) {
+        RTC_LOG(LS_WARNING)
+            << "Encoder produced a frame with temporal id " << tid
+            << ", expected " << layer_frames[0].TemporalId() << ".";
+        return WEBRTC_VIDEO_CODEC_OK;
       }
-      encoded_image_callback_->OnEncodedImage(encoded_images_[i],
-                                              &codec_specific);
+      encoded_images_[i].SetTemporalIndex(tid);
+    }
+    if (codec_specific.codecSpecific.H264.base_layer_sync) {
+      tl0sync_limit_[i] = tid;
+    }
+    if (tid == 0) {
+      tl0sync_limit_[i] = configurations_[i].num_temporal_layers;
+    }
+  }
+  if (svc_controllers_[i]) {
+    codec_specific.generic_frame_info =
+        svc_controllers_[i]->OnEncodeDone(layer_frames[0]);
+    if (send_key_frame && codec_specific.generic_frame_info.has_value()) {
+      codec_specific.template_structure =
+          svc_controllers_[i]->DependencyStructure();
     }
+    codec_specific.scalability_mode = scalability_modes_[i];
   }
+  encoded_image_callback_->OnEncodedImage(encoded_images_[i], &codec_specific);
   return WEBRTC_VIDEO_CODEC_OK;
 }
 
@@ -937,7 +1110,8 @@ namespace sora {
 
 std::unique_ptr<webrtc::VideoEncoder> CreateOpenH264VideoEncoder(
     const webrtc::SdpVideoFormat& format,
-    std::string openh264) {
+    std::string openh264,
+    bool parallel_simulcast) {
   webrtc::H264EncoderSettings settings;
   if (auto it = format.parameters.find(webrtc::kH264FmtpPacketizationMode);
       it != format.parameters.end()) {
@@ -951,7 +1125,8 @@ std::unique_ptr<webrtc::VideoEncoder> CreateOpenH264VideoEncoder(
   }
 
   return absl::make_unique<webrtc::OpenH264VideoEncoder>(
-      webrtc::CreateEnvironment(), settings, std::move(openh264));
+      webrtc::CreateEnvironment(), settings, std::move(openh264),
+      parallel_simulcast);
 }
 
 }  // namespace sora
@@ -0,0 +1,243 @@
+#include "sora/recorder/encoded_frame_muxer.h"
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+
+// WebRTC
+#include <api/array_view.h>
+#include <rtc_base/logging.h>
+
+namespace sora {
+
+namespace {
+
+void PutLE16(std::string& s, uint16_t v) {
+  s.push_back(static_cast<char>(v & 0xff));
+  s.push_back(static_cast<char>((v >> 8) & 0xff));
+}
+void PutLE32(std::string& s, uint32_t v) {
+  for (int i = 0; i < 4; i++) {
+    s.push_back(static_cast<char>((v >> (i * 8)) & 0xff));
+  }
+}
+void PutLE64(std::string& s, uint64_t v) {
+  for (int i = 0; i < 8; i++) {
+    s.push_back(static_cast<char>((v >> (i * 8)) & 0xff));
+  }
+}
+
+}  // namespace
+
+int64_t RtpTimestampUnwrapper::Unwrap(uint32_t timestamp) {
+  if (!initialized_) {
+    initialized_ = true;
+    last_ = timestamp;
+    return 0;
+  }
+  elapsed_ += static_cast<int32_t>(timestamp - last_);
+  last_ = timestamp;
+  return elapsed_;
+}
+
+bool IvfMuxer::Mux(const Frame& frame, std::string& out) {
+  // 途中から書き込むとデコードできないので、キーフレームを待つ
+  if (wait_key_frame_) {
+    if (!frame.key_frame) {
+      return false;
+    }
+    wait_key_frame_ = false;
+  }
+
+  int64_t pts = unwrapper_.Unwrap(frame.rtp_timestamp);
+  if (!header_written_) {
+    const char* fourcc = GetFourCC(frame.mime_type);
+    if (fourcc == nullptr) {
+      RTC_LOG(LS_ERROR) << "Unsupported codec for IVF: " << frame.mime_type;
+      wait_key_frame_ = true;
+      return false;
+    }
+    out.append("DKIF", 4);
+    PutLE16(out, 0);
+    PutLE16(out, 32);
+    out.append(fourcc, 4);
+    PutLE16(out, frame.width);
+    PutLE16(out, frame.height);
+    // タイムベースは RTP と同じ 1/90000
+    PutLE32(out, 90000);
+    PutLE32(out, 1);
+    // ストリーミングで書き込むのでフレーム数は分からない
+    PutLE32(out, 0);
+    PutLE32(out, 0);
+    header_written_ = true;
+  }
+  PutLE32(out, static_cast<uint32_t>(frame.data.size()));
+  PutLE64(out, static_cast<uint64_t>(pts));
+  out.append(reinterpret_cast<const char*>(frame.data.data()),
+             frame.data.size());
+  return true;
+}
+
+void IvfMuxer::OnDropped() {
+  wait_key_frame_ = true;
+}
+
+const char* IvfMuxer::GetFourCC(const std::string& mime_type) {
+  if (mime_type == "video/VP8") {
+    return "VP80";
+  } else if (mime_type == "video/VP9") {
+    return "VP90";
+  } else if (mime_type == "video/AV1") {
+    return "AV01";
+  } else if (mime_type == "video/H264") {
+    return "H264";
+  } else if (mime_type == "video/H265") {
+    return "H265";
+  }
+  return nullptr;
+}
+
+OggOpusMuxer::OggOpusMuxer()
+    : OggOpusMuxer(static_cast<uint32_t>(std::random_device()())) {}
+OggOpusMuxer::OggOpusMuxer(uint32_t serial) : serial_(serial) {}
+
+bool OggOpusMuxer::Mux(const Frame& frame, std::string& out) {
+  webrtc::ArrayView<const uint8_t> data = frame.data;
+  if (data.empty()) {
+    return false;
+  }
+  if (!header_written_) {
+    if (frame.mime_type != "audio/opus") {
+      RTC_LOG(LS_ERROR) << "Unsupported codec for Ogg: " << frame.mime_type;
+      return false;
+    }
+    // TOC のステレオフラグでチャンネル数を決める
+    uint8_t channels = (data[0] & 0x04) != 0 ? 2 : 1;
+    std::string head;
+    head.append("OpusHead", 8);
+    head.push_back(1);
+    head.push_back(static_cast<char>(channels));
+    PutLE16(head, 0);
+    PutLE32(head, 48000);
+    PutLE16(head, 0);
+    head.push_back(0);
+    WritePage(out, head, 0, kBeginOfStream);
+
+    static const char kVendor[] = "Sora C++ SDK";
+    std::string tags;
+    tags.append("OpusTags", 8);
+    PutLE32(tags, sizeof(kVendor) - 1);
+    tags.append(kVendor, sizeof(kVendor) - 1);
+    PutLE32(tags, 0);
+    WritePage(out, tags, 0, 0);
+    header_written_ = true;
+  }
+  // 1 ページに 1 パケットだけ入れるので、255 * 255 バイトを超えるパケットは書き込めない
+  if (data.size() >= 255 * 255) {
+    return false;
+  }
+
+  // グラニュール位置はこのパケットの最後のサンプルの位置
+  // Opus の RTP タイムスタンプは 48kHz なのでそのまま使える
+  int64_t granule = unwrapper_.Unwrap(frame.rtp_timestamp) +
+                    GetSamples(data.data(), data.size());
+  // 最後のページに EOS フラグを付けるために、1 パケット遅らせて書き込む
+  if (pending_packet_) {
+    WritePage(out, *pending_packet_, pending_granule_, 0);
+  }
+  pending_packet_.emplace(reinterpret_cast<const char*>(data.data()),
+                          data.size());
+  pending_granule_ = static_cast<uint64_t>(granule);
+  return true;
+}
+
+void OggOpusMuxer::Finish(std::string& out) {
+  if (pending_packet_) {
+    WritePage(out, *pending_packet_, pending_granule_, kEndOfStream);
+    pending_packet_ = std::nullopt;
+  } else if (header_written_) {
+    // ヘッダーしか書いていない場合は、空のパケットで EOS を伝える
+    WritePage(out, std::string_view(), 0, kEndOfStream);
+  }
+}
+
+int OggOpusMuxer::GetSamples(const uint8_t* data, size_t size) {
+  uint8_t toc = data[0];
+  int config = toc >> 3;
+  int frame_samples;
+  if (config < 12) {
+    static const int kSilk[] = {480, 960, 1920, 2880};
+    frame_samples = kSilk[config & 3];
+  } else if (config < 16) {
+    frame_samples = (config & 1) == 0 ? 480 : 960;
+  } else {
+    static const int kCelt[] = {120, 240, 480, 960};
+    frame_samples = kCelt[config & 3];
+  }
+  int frames;
+  switch (toc & 3) {
+    case 0:
+      frames = 1;
+      break;
+    case 1:
+    case 2:
+      frames = 2;
+      break;
+    default:
+      frames = size >= 2 ? (data[1] & 0x3f) : 0;
+      break;
+  }
+  return frame_samples * frames;
+}
+
+uint32_t OggOpusMuxer::Crc(std::string_view data) {
+  static const std::array<uint32_t, 256> table = []() {
+    std::array<uint32_t, 256> t;
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t r = i << 24;
+      for (int j = 0; j < 8; j++) {
+        r = (r & 0x80000000) != 0 ? (r << 1) ^ 0x04c11db7 : (r << 1);
+      }
+      t[i] = r;
+    }
+    return t;
+  }();
+  uint32_t crc = 0;
+  for (unsigned char c : data) {
+    crc = (crc << 8) ^ table[((crc >> 24) & 0xff) ^ c];
+  }
+  return crc;
+}
+
+void OggOpusMuxer::WritePage(std::string& out,
+                             std::string_view packet,
+                             uint64_t granule,
+                             uint8_t header_type) {
+  std::string page;
+  page.reserve(27 + 255 + packet.size());
+  page.append("OggS", 4);
+  page.push_back(0);
+  page.push_back(static_cast<char>(header_type));
+  PutLE64(page, granule);
+  PutLE32(page, serial_);
+  PutLE32(page, sequence_++);
+  // CRC は後で埋める
+  PutLE32(page, 0);
+  size_t segments = packet.size() / 255 + 1;
+  page.push_back(static_cast<char>(segments));
+  for (size_t i = 0; i < segments - 1; i++) {
+    page.push_back(static_cast<char>(255));
+  }
+  page.push_back(static_cast<char>(packet.size() % 255));
+  page.append(packet.data(), packet.size());
+  uint32_t crc = Crc(page);
+  for (int i = 0; i < 4; i++) {
+    page[22 + i] = static_cast<char>((crc >> (i * 8)) & 0xff);
+  }
+  out.append(page);
+}
+
+}  // namespace sora
@@ -0,0 +1,249 @@
+#include "sora/recorder/encoded_track_recorder.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+// WebRTC
+#include <api/frame_transformer_interface.h>
+#include <api/make_ref_counted.h>
+#include <api/media_types.h>
+#include <api/rtp_receiver_interface.h>
+#include <api/scoped_refptr.h>
+#include <rtc_base/logging.h>
+
+#include "sora/recorder/encoded_frame_muxer.h"
+
+namespace sora {
+
+namespace {
+
+// WebRTC のフレームを EncodedFrameMuxer に渡す形式にする
+EncodedFrameMuxer::Frame ToMuxerFrame(
+    webrtc::TransformableFrameInterface& frame,
+    bool video) {
+  EncodedFrameMuxer::Frame f;
+  f.data = frame.GetData();
+  f.rtp_timestamp = frame.GetTimestamp();
+  f.mime_type = frame.GetMimeType();
+  if (video) {
+    auto& video_frame =
+        static_cast<webrtc::TransformableVideoFrameInterface&>(frame);
+    f.key_frame = video_frame.IsKeyFrame();
+    // 解像度は IVF のヘッダーを書く時にしか使わないので、キーフレームの時だけ取り出す
+    if (f.key_frame) {
+      auto metadata = video_frame.Metadata();
+      f.width = metadata.GetWidth();
+      f.height = metadata.GetHeight();
+    }
+  }
+  return f;
+}
+
+class EncodedTrackRecorderImpl : public EncodedTrackRecorder {
+ public:
+  EncodedTrackRecorderImpl(EncodedTrackRecorderConfig config,
+                           FILE* fp,
+                           bool video,
+                           std::unique_ptr<EncodedFrameMuxer> muxer)
+      : config_(std::move(config)),
+        fp_(fp),
+        video_(video),
+        muxer_(std::move(muxer)) {
+    thread_ = std::thread([this]() { WriteLoop(); });
+  }
+  ~EncodedTrackRecorderImpl() override { Stop(); }
+
+  void Stop() override {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (stopped_) {
+        return;
+      }
+      stopped_ = true;
+      std::string data;
+      muxer_->Finish(data);
+      if (!data.empty()) {
+        queued_bytes_ += data.size();
+        queue_.push_back(std::move(data));
+      }
+    }
+    cond_.notify_all();
+    thread_.join();
+    fclose(fp_);
+    fp_ = nullptr;
+  }
+
+  Stats GetStats() const override {
+    Stats stats;
+    stats.frames_written = frames_written_.load();
+    stats.frames_dropped = frames_dropped_.load();
+    stats.bytes_written = bytes_written_.load();
+    return stats;
+  }
+
+  // WebRTC のスレッドから呼ばれる
+  void Record(webrtc::TransformableFrameInterface& frame) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stopped_) {
+      return;
+    }
+    if (queued_bytes_ + frame.GetData().size() > config_.max_queued_bytes) {
+      muxer_->OnDropped();
+      frames_dropped_++;
+      return;
+    }
+    std::string data;
+    if (!muxer_->Mux(ToMuxerFrame(frame, video_), data)) {
+      frames_dropped_++;
+      return;
+    }
+    frames_written_++;
+    // 書き込みを遅らせているフレームの場合は何も追加されない
+    if (data.empty()) {
+      return;
+    }
+    queued_bytes_ += data.size();
+    queue_.push_back(std::move(data));
+    cond_.notify_one();
+  }
+
+ private:
+  void WriteLoop() {
+    std::deque<std::string> batch;
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.wait(lock, [this]() { return stopped_ || !queue_.empty(); });
+        if (queue_.empty()) {
+          // stopped_ かつ書き込むデータが無い
+          return;
+        }
+        batch.swap(queue_);
+      }
+      size_t written = 0;
+      for (const auto& data : batch) {
+        if (fwrite(data.data(), 1, data.size(), fp_) != data.size()) {
+          RTC_LOG(LS_ERROR) << "Failed to write recording: "
+                            << config_.path;
+        }
+        written += data.size();
+      }
+      fflush(fp_);
+      batch.clear();
+      bytes_written_ += written;
+      std::lock_guard<std::mutex> lock(mutex_);
+      queued_bytes_ -= written;
+    }
+  }
+
+  EncodedTrackRecorderConfig config_;
+  FILE* fp_;
+  const bool video_;
+  std::unique_ptr<EncodedFrameMuxer> muxer_;
+  std::thread thread_;
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::deque<std::string> queue_;
+  size_t queued_bytes_ = 0;
+  bool stopped_ = false;
+
+  std::atomic<uint64_t> frames_written_{0};
+  std::atomic<uint64_t> frames_dropped_{0};
+  std::atomic<uint64_t> bytes_written_{0};
+};
+
+// 受け取ったフレームを記録して、record_only でなければそのまま WebRTC に戻す
+class RecorderFrameTransformer : public webrtc::FrameTransformerInterface {
+ public:
+  RecorderFrameTransformer(std::weak_ptr<EncodedTrackRecorderImpl> recorder,
+                           bool record_only)
+      : recorder_(std::move(recorder)), record_only_(record_only) {}
+
+  void Transform(
+      std::unique_ptr<webrtc::TransformableFrameInterface> frame) override {
+    if (auto recorder = recorder_.lock()) {
+      recorder->Record(*frame);
+    }
+    // 戻さなければデコーダにフレームが渡らない
+    if (record_only_) {
+      return;
+    }
+    webrtc::scoped_refptr<webrtc::TransformedFrameCallback> callback;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto it = sink_callbacks_.find(frame->GetSsrc());
+      callback = it != sink_callbacks_.end() ? it->second : callback_;
+    }
+    if (callback) {
+      callback->OnTransformedFrame(std::move(frame));
+    }
+  }
+  void RegisterTransformedFrameCallback(
+      webrtc::scoped_refptr<webrtc::TransformedFrameCallback> callback)
+      override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    callback_ = callback;
+  }
+  void RegisterTransformedFrameSinkCallback(
+      webrtc::scoped_refptr<webrtc::TransformedFrameCallback> callback,
+      uint32_t ssrc) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    sink_callbacks_[ssrc] = callback;
+  }
+  void UnregisterTransformedFrameCallback() override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    callback_ = nullptr;
+  }
+  void UnregisterTransformedFrameSinkCallback(uint32_t ssrc) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    sink_callbacks_.erase(ssrc);
+  }
+
+ private:
+  std::weak_ptr<EncodedTrackRecorderImpl> recorder_;
+  const bool record_only_;
+  std::mutex mutex_;
+  webrtc::scoped_refptr<webrtc::TransformedFrameCallback> callback_;
+  std::map<uint32_t, webrtc::scoped_refptr<webrtc::TransformedFrameCallback>>
+      sink_callbacks_;
+};
+
+}  // namespace
+
+std::shared_ptr<EncodedTrackRecorder> EncodedTrackRecorder::Create(
+    webrtc::scoped_refptr<webrtc::RtpReceiverInterface> receiver,
+    EncodedTrackRecorderConfig config) {
+  bool video = receiver->media_type() == webrtc::MediaType::VIDEO;
+  std::unique_ptr<EncodedFrameMuxer> muxer;
+  if (video) {
+    muxer.reset(new IvfMuxer());
+  } else {
+    muxer.reset(new OggOpusMuxer());
+  }
+
+  FILE* fp = fopen(config.path.c_str(), "wb");
+  if (fp == nullptr) {
+    RTC_LOG(LS_ERROR) << "Failed to open: " << config.path;
+    return nullptr;
+  }
+
+  bool record_only = config.record_only;
+  auto recorder = std::make_shared<EncodedTrackRecorderImpl>(
+      std::move(config), fp, video, std::move(muxer));
+  receiver->SetDepacketizerToDecoderFrameTransformer(
+      webrtc::make_ref_counted<RecorderFrameTransformer>(recorder,
+                                                         record_only));
+  return recorder;
+}
+
+}  // namespace sora
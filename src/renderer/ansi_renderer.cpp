@@ -10,7 +10,12 @@
 namespace sora {
 
 AnsiRenderer::AnsiRenderer(int width, int height, int fps)
-    : BaseRenderer(width, height, fps) {
+    : BaseRenderer(width, height, fps), delta_mode_(false) {
+  // 256 色分のエスケープシーケンスを事前に作っておく
+  for (int i = 0; i < 256; i++) {
+    fg_escapes_[i] = "\033[38;5;" + std::to_string(i) + "m";
+    bg_escapes_[i] = "\033[48;5;" + std::to_string(i) + "m";
+  }
   Start();
 }
 
@@ -18,6 +23,10 @@ AnsiRenderer::~AnsiRenderer() {
   Stop();
 }
 
+void AnsiRenderer::SetDeltaMode(bool enabled) {
+  delta_mode_ = enabled;
+}
+
 void AnsiRenderer::RenderThreadStarted() {}
 void AnsiRenderer::RenderThreadFinished() {}
 
@@ -25,25 +34,29 @@ void AnsiRenderer::Render(uint8_t* image,
                           int width,
                           int height,
                           const std::vector<SinkInfo>& sink_infos) {
-  MoveCursorToTop();
+  output_.clear();
+  output_ += "\033[H";
   // オリジナルサイズを表示
   for (const auto& sink_info : sink_infos) {
-    std::cout << "\033[2K" << "(" << sink_info.offset_x << ","
-              << sink_info.offset_y << ")"
-              << " の元のサイズ: " << sink_info.input_width << "x"
-              << sink_info.input_height << std::endl;
+    output_ += "\033[2K(";
+    output_ += std::to_string(sink_info.offset_x);
+    output_ += ",";
+    output_ += std::to_string(sink_info.offset_y);
+    output_ += ") の元のサイズ: ";
+    output_ += std::to_string(sink_info.input_width);
+    output_ += "x";
+    output_ += std::to_string(sink_info.input_height);
+    output_ += "\n";
   }
-  OutputAnsi(image, width, height);
+  OutputAnsi(image, width, height, static_cast<int>(sink_infos.size()));
+  // 一括出力
+  std::cout << output_ << std::flush;
 }
 
 void AnsiRenderer::ClearScreen() {
   std::cout << "\033[2J\033[H" << std::flush;
 }
 
-void AnsiRenderer::MoveCursorToTop() {
-  std::cout << "\033[H" << std::flush;
-}
-
 int AnsiRenderer::RgbToAnsi256(uint8_t r, uint8_t g, uint8_t b) {
   // 216色キューブ（6x6x6）を使用
   // RGB値を0-5の範囲に変換
@@ -61,14 +74,13 @@ std::string AnsiRenderer::RgbToAnsi(uint8_t r, uint8_t g, uint8_t b) {
   return "\033[48;5;" + std::to_string(color_code) + "m";
 }
 
-void AnsiRenderer::OutputAnsi(const uint8_t* rgb_data, int width, int height) {
-  std::string output;
-  output.reserve(width * height * 20);  // 大体のサイズを予約
-
+void AnsiRenderer::UpdateCells(const uint8_t* rgb_data,
+                               int width,
+                               int height) {
   // 2x1ピクセルを1文字で表現（上半分と下半分の色を使用）
+  int rows = (height + 1) / 2;
+  cells_.resize(width * rows);
   for (int y = 0; y < height; y += 2) {
-    output += "\033[2K";  // 行をクリア
-
     for (int x = 0; x < width; x++) {
       // 上のピクセル（y）
       int upper_offset = (y * width + x) * 4;
@@ -86,22 +98,101 @@ void AnsiRenderer::OutputAnsi(const uint8_t* rgb_data, int width, int height) {
       }
 
       // 上半分の色を前景色、下半分の色を背景色として設定
-      int upper_color = RgbToAnsi256(upper_r, upper_g, upper_b);
-      int lower_color = RgbToAnsi256(lower_r, lower_g, lower_b);
-
-      // 上半分ブロック文字（▀）を使用
-      output += "\033[38;5;";
-      output += std::to_string(upper_color);
-      output += "m\033[48;5;";
-      output += std::to_string(lower_color);
-      output += "m▀";
+      Cell& cell = cells_[(y / 2) * width + x];
+      cell.fg = RgbToAnsi256(upper_r, upper_g, upper_b);
+      cell.bg = RgbToAnsi256(lower_r, lower_g, lower_b);
     }
+  }
+}
 
-    output += "\033[0m\n";  // 色をリセットして改行
+void AnsiRenderer::AppendCell(const Cell& cell, int& fg, int& bg) {
+  // 直前のセルと同じ色の場合はエスケープシーケンスを省略する
+  if (cell.fg != fg) {
+    output_ += fg_escapes_[cell.fg];
+    fg = cell.fg;
   }
+  if (cell.bg != bg) {
+    output_ += bg_escapes_[cell.bg];
+    bg = cell.bg;
+  }
+  // 上半分ブロック文字（▀）を使用
+  output_ += "▀";
+}
 
-  // 一括出力
-  std::cout << output << std::flush;
+void AnsiRenderer::OutputAnsi(const uint8_t* rgb_data,
+                              int width,
+                              int height,
+                              int top) {
+  UpdateCells(rgb_data, width, height);
+  int rows = (height + 1) / 2;
+
+  const bool delta = delta_mode_ && prev_width_ == width &&
+                     prev_height_ == height && prev_top_ == top &&
+                     prev_cells_.size() == cells_.size();
+
+  if (!delta) {
+    for (int row = 0; row < rows; row++) {
+      output_ += "\033[2K";  // 行をクリア
+      int fg = -1;
+      int bg = -1;
+      for (int x = 0; x < width; x++) {
+        AppendCell(cells_[row * width + x], fg, bg);
+      }
+      output_ += "\033[0m\n";  // 色をリセットして改行
+    }
+  } else {
+    // 変化したセルだけを、カーソルを移動して出力する
+    // 離れている変化の間が短い場合は、カーソルを移動するより間のセルも出力した方が短い
+    static constexpr int kMaxGap = 4;
+    int fg = -1;
+    int bg = -1;
+    for (int row = 0; row < rows; row++) {
+      const Cell* cur = cells_.data() + row * width;
+      const Cell* prev = prev_cells_.data() + row * width;
+      int x = 0;
+      while (x < width) {
+        if (cur[x] == prev[x]) {
+          x++;
+          continue;
+        }
+        // 変化したセルの続く範囲を探す
+        int end = x + 1;
+        int gap = 0;
+        for (int i = end; i < width && gap <= kMaxGap; i++) {
+          if (cur[i] == prev[i]) {
+            gap++;
+          } else {
+            end = i + 1;
+            gap = 0;
+          }
+        }
+        output_ += "\033[";
+        output_ += std::to_string(top + row + 1);
+        output_ += ";";
+        output_ += std::to_string(x + 1);
+        output_ += "H";
+        for (int i = x; i < end; i++) {
+          AppendCell(cur[i], fg, bg);
+        }
+        x = end;
+      }
+    }
+    output_ += "\033[0m";
+    // 次のフレームの出力位置がずれないように、画像の下にカーソルを移動しておく
+    output_ += "\033[";
+    output_ += std::to_string(top + rows + 1);
+    output_ += ";1H";
+  }
+
+  if (delta_mode_) {
+    prev_cells_.swap(cells_);
+    prev_width_ = width;
+    prev_height_ = height;
+    prev_top_ = top;
+  } else {
+    prev_width_ = 0;
+    prev_height_ = 0;
+  }
 }
 
 }  // namespace sora
@@ -14,6 +14,7 @@
 #include <api/media_stream_interface.h>
 #include <api/scoped_refptr.h>
 #include <api/video/i420_buffer.h>
+#include <api/video/nv12_buffer.h>
 #include <api/video/video_frame.h>
 #include <api/video/video_frame_buffer.h>
 #include <api/video/video_rotation.h>
@@ -22,17 +23,54 @@
 #include <rtc_base/synchronization/mutex.h>
 
 // libyuv
-#include <libyuv/convert_from.h>
+#include <libyuv/convert_argb.h>
 #include <libyuv/planar_functions.h>
-#include <libyuv/video_common.h>
+#include <libyuv/rotate.h>
 
 namespace sora {
 
+namespace {
+
+// NV12 か I420 のバッファを ARGB に変換する
+void ConvertToARGB(const webrtc::VideoFrameBuffer& buffer,
+                   uint8_t* dst,
+                   int dst_stride) {
+  if (buffer.type() == webrtc::VideoFrameBuffer::Type::kNV12) {
+    const webrtc::NV12BufferInterface* src = buffer.GetNV12();
+    libyuv::NV12ToARGB(src->DataY(), src->StrideY(), src->DataUV(),
+                       src->StrideUV(), dst, dst_stride, src->width(),
+                       src->height());
+  } else {
+    const webrtc::I420BufferInterface* src = buffer.GetI420();
+    libyuv::I420ToARGB(src->DataY(), src->StrideY(), src->DataU(),
+                       src->StrideU(), src->DataV(), src->StrideV(), dst,
+                       dst_stride, src->width(), src->height());
+  }
+}
+
+libyuv::RotationMode ToRotationMode(webrtc::VideoRotation rotation) {
+  switch (rotation) {
+    case webrtc::kVideoRotation_90:
+      return libyuv::kRotate90;
+    case webrtc::kVideoRotation_180:
+      return libyuv::kRotate180;
+    case webrtc::kVideoRotation_270:
+      return libyuv::kRotate270;
+    case webrtc::kVideoRotation_0:
+    default:
+      return libyuv::kRotate0;
+  }
+}
+
+}  // namespace
+
 static constexpr float STD_ASPECT = 1.33f;   // 4:3
 static constexpr float WIDE_ASPECT = 1.78f;  // 16:9
 
 BaseRenderer::BaseRenderer(int width, int height, int fps)
-    : running_(false),
+    : layout_version_(0),
+      running_(false),
+      incremental_composite_(false),
       width_(width),
       height_(height),
       fps_(fps),
@@ -61,6 +99,10 @@ webrtc::Mutex* BaseRenderer::GetMutex() {
   return &sinks_lock_;
 }
 
+void BaseRenderer::SetIncrementalComposite(bool enabled) {
+  incremental_composite_ = enabled;
+}
+
 void BaseRenderer::SetSize(int width, int height) {
   webrtc::MutexLock lock(&sinks_lock_);
   width_ = width;
@@ -71,50 +113,101 @@ void BaseRenderer::SetSize(int width, int height) {
 void BaseRenderer::RenderThread() {
   RenderThreadStarted();
 
-  std::unique_ptr<uint8_t[]> image(new uint8_t[width_ * height_ * 4]);
+  std::unique_ptr<uint8_t[]> image;
+  int image_width = 0;
+  int image_height = 0;
+  uint64_t layout_version = 0;
 
   while (running_) {
-    memset(image.get(), 0, width_ * height_ * 4);
-
     auto frame_start = std::chrono::steady_clock::now();
     std::vector<SinkInfo> sink_infos;
+    const bool incremental = incremental_composite_;
+    bool updated = false;
     {
       webrtc::MutexLock lock(&sinks_lock_);
+      bool full = !incremental || layout_version != layout_version_;
+      if (image == nullptr || image_width != width_ ||
+          image_height != height_) {
+        image.reset(new uint8_t[width_ * height_ * 4]);
+        image_width = width_;
+        image_height = height_;
+        full = true;
+      }
+      if (full) {
+        memset(image.get(), 0, image_width * image_height * 4);
+        layout_version = layout_version_;
+        updated = true;
+      }
+
       for (const VideoTrackSinkVector::value_type& sinks : sinks_) {
         Sink* sink = sinks.second.get();
 
-        webrtc::MutexLock frame_lock(sink->GetMutex());
+        // フレームはアトミックに受け取るので、シンクのロックは取らない
+        bool acquired = sink->AcquireFrame();
+        const Sink::Frame& frame = sink->GetFrame();
 
-        if (sink->GetOutlineChanged()) {
+        // 領域が変わる前に変換されたフレームは描画しない
+        if (frame.image == nullptr ||
+            frame.outline_generation != sink->GetOutlineGeneration()) {
           continue;
         }
 
-        int width = sink->GetFrameWidth();
-        int height = sink->GetFrameHeight();
+        int width = frame.frame_width;
+        int height = frame.frame_height;
 
         if (width == 0 || height == 0) {
           continue;
         }
 
-        libyuv::ARGBCopy(sink->GetImage(), width * 4,
-                         image.get() + sink->GetOffsetX() * 4 +
-                             sink->GetOffsetY() * width_ * 4,
-                         width_ * 4, width, height);
+        int x = sink->GetOutlineOffsetX() + frame.offset_x;
+        int y = sink->GetOutlineOffsetY() + frame.offset_y;
+        if (x < 0 || y < 0 || x + width > image_width ||
+            y + height > image_height) {
+          continue;
+        }
+
+        Sink::DrawnRect& drawn = sink->GetDrawnRect();
+        if (full || acquired) {
+          if (!full && (drawn.x != x || drawn.y != y || drawn.width != width ||
+                        drawn.height != height)) {
+            // 描画する範囲が変わった場合は、前のフレームが残らないように領域全体を消す
+            int outline_width = std::min(sink->GetOutlineWidth(),
+                                         image_width - sink->GetOutlineOffsetX());
+            int outline_height =
+                std::min(sink->GetOutlineHeight(),
+                         image_height - sink->GetOutlineOffsetY());
+            libyuv::ARGBRect(image.get(), image_width * 4,
+                             sink->GetOutlineOffsetX(),
+                             sink->GetOutlineOffsetY(), outline_width,
+                             outline_height, 0);
+          }
+          libyuv::ARGBCopy(frame.image.get(), width * 4,
+                           image.get() + x * 4 + y * image_width * 4,
+                           image_width * 4, width, height);
+          drawn.x = x;
+          drawn.y = y;
+          drawn.width = width;
+          drawn.height = height;
+          updated = true;
+        }
 
         SinkInfo info;
-        info.offset_x = sink->GetOffsetX();
-        info.offset_y = sink->GetOffsetY();
-        info.input_width = sink->GetInputWidth();
-        info.input_height = sink->GetInputHeight();
-        info.frame_width = sink->GetFrameWidth();
-        info.frame_height = sink->GetFrameHeight();
-        info.width = sink->GetWidth();
-        info.height = sink->GetHeight();
+        info.offset_x = x;
+        info.offset_y = y;
+        info.input_width = frame.input_width;
+        info.input_height = frame.input_height;
+        info.frame_width = width;
+        info.frame_height = height;
+        info.width = frame.width;
+        info.height = frame.height;
+        info.updated = full || acquired;
         sink_infos.push_back(info);
       }
     }
 
-    Render(image.get(), width_, height_, sink_infos);
+    if (updated) {
+      Render(image.get(), image_width, image_height, sink_infos);
+    }
 
     // フレームレート制御
     auto frame_end = std::chrono::steady_clock::now();
@@ -140,11 +233,17 @@ BaseRenderer::Sink::Sink(BaseRenderer* renderer,
       outline_width_(0),
       outline_height_(0),
       outline_changed_(false),
+      outline_generation_(0),
       input_width_(0),
       input_height_(0),
       scaled_(false),
       width_(0),
-      height_(0) {
+      height_(0),
+      scale_pool_(false, 2 /* max_number_of_buffers*/),
+      rotate_pool_(false, 2 /* max_number_of_buffers*/),
+      back_(0),
+      middle_(1),
+      front_(2) {
   track_->AddOrUpdateSink(this, webrtc::VideoSinkWants());
 }
 
@@ -157,11 +256,16 @@ void BaseRenderer::Sink::OnFrame(const webrtc::VideoFrame& frame) {
     return;
   if (frame.width() == 0 || frame.height() == 0)
     return;
-  webrtc::MutexLock lock(GetMutex());
-  if (outline_changed_ || frame.width() != input_width_ ||
-      frame.height() != input_height_) {
+  // 回転後のサイズでレイアウトする
+  const bool swap_size = frame.rotation() == webrtc::kVideoRotation_90 ||
+                         frame.rotation() == webrtc::kVideoRotation_270;
+  const int display_width = swap_size ? frame.height() : frame.width();
+  const int display_height = swap_size ? frame.width() : frame.height();
+  webrtc::MutexLock lock(&frame_params_lock_);
+  if (outline_changed_ || display_width != input_width_ ||
+      display_height != input_height_) {
     int width, height;
-    float frame_aspect = (float)frame.width() / (float)frame.height();
+    float frame_aspect = (float)display_width / (float)display_height;
     if (frame_aspect > outline_aspect_) {
       width = outline_width_;
       height = width / frame_aspect;
@@ -177,34 +281,95 @@ void BaseRenderer::Sink::OnFrame(const webrtc::VideoFrame& frame) {
       width_ = width;
       height_ = height;
     }
-    input_width_ = frame.width();
-    input_height_ = frame.height();
+    input_width_ = display_width;
+    input_height_ = display_height;
     scaled_ = width_ < input_width_;
-    if (scaled_) {
-      image_.reset(new uint8_t[width_ * height_ * 4]);
-    } else {
-      image_.reset(new uint8_t[input_width_ * input_height_ * 4]);
-    }
     RTC_LOG(LS_VERBOSE) << __FUNCTION__ << ": scaled_=" << scaled_;
     outline_changed_ = false;
   }
-  webrtc::scoped_refptr<webrtc::I420BufferInterface> buffer_if;
+
+  Frame& dst = frames_[back_];
+  dst.offset_x = offset_x_;
+  dst.offset_y = offset_y_;
+  dst.input_width = input_width_;
+  dst.input_height = input_height_;
+  dst.frame_width = scaled_ ? width_ : input_width_;
+  dst.frame_height = scaled_ ? height_ : input_height_;
+  dst.width = width_;
+  dst.height = height_;
+  dst.outline_generation = outline_generation_;
+  if (dst.frame_width <= 0 || dst.frame_height <= 0) {
+    return;
+  }
+  size_t size = dst.frame_width * dst.frame_height * 4;
+  if (dst.capacity < size) {
+    dst.image.reset(new uint8_t[size]);
+    dst.capacity = size;
+  }
+
+  // NV12 と I420 はそのまま読む
+  webrtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer =
+      frame.video_frame_buffer();
+  if (buffer->type() != webrtc::VideoFrameBuffer::Type::kNV12 &&
+      buffer->type() != webrtc::VideoFrameBuffer::Type::kI420) {
+    buffer = buffer->ToI420();
+  }
+
+  // 先に縮小して、回転と変換をする画素数を減らす
   if (scaled_) {
-    webrtc::scoped_refptr<webrtc::I420Buffer> buffer =
-        webrtc::I420Buffer::Create(width_, height_);
-    buffer->ScaleFrom(*frame.video_frame_buffer()->ToI420());
-    if (frame.rotation() != webrtc::kVideoRotation_0) {
-      buffer = webrtc::I420Buffer::Rotate(*buffer, frame.rotation());
+    int scaled_width = swap_size ? dst.frame_height : dst.frame_width;
+    int scaled_height = swap_size ? dst.frame_width : dst.frame_height;
+    if (buffer->type() == webrtc::VideoFrameBuffer::Type::kNV12) {
+      webrtc::scoped_refptr<webrtc::NV12Buffer> scaled =
+          scale_pool_.CreateNV12Buffer(scaled_width, scaled_height);
+      if (!scaled) {
+        scaled = webrtc::NV12Buffer::Create(scaled_width, scaled_height);
+      }
+      scaled->CropAndScaleFrom(*buffer->GetNV12(), 0, 0, buffer->width(),
+                               buffer->height());
+      buffer = scaled;
+    } else {
+      webrtc::scoped_refptr<webrtc::I420Buffer> scaled =
+          scale_pool_.CreateI420Buffer(scaled_width, scaled_height);
+      if (!scaled) {
+        scaled = webrtc::I420Buffer::Create(scaled_width, scaled_height);
+      }
+      scaled->ScaleFrom(*buffer->GetI420());
+      buffer = scaled;
     }
-    buffer_if = buffer;
-  } else {
-    buffer_if = frame.video_frame_buffer()->ToI420();
   }
-  libyuv::ConvertFromI420(
-      buffer_if->DataY(), buffer_if->StrideY(), buffer_if->DataU(),
-      buffer_if->StrideU(), buffer_if->DataV(), buffer_if->StrideV(),
-      image_.get(), (scaled_ ? width_ : input_width_) * 4, buffer_if->width(),
-      buffer_if->height(), libyuv::FOURCC_ARGB);
+
+  if (frame.rotation() != webrtc::kVideoRotation_0) {
+    webrtc::scoped_refptr<webrtc::I420Buffer> rotated =
+        rotate_pool_.CreateI420Buffer(dst.frame_width, dst.frame_height);
+    if (!rotated) {
+      rotated = webrtc::I420Buffer::Create(dst.frame_width, dst.frame_height);
+    }
+    libyuv::RotationMode mode = ToRotationMode(frame.rotation());
+    if (buffer->type() == webrtc::VideoFrameBuffer::Type::kNV12) {
+      const webrtc::NV12BufferInterface* src = buffer->GetNV12();
+      libyuv::NV12ToI420Rotate(
+          src->DataY(), src->StrideY(), src->DataUV(), src->StrideUV(),
+          rotated->MutableDataY(), rotated->StrideY(), rotated->MutableDataU(),
+          rotated->StrideU(), rotated->MutableDataV(), rotated->StrideV(),
+          src->width(), src->height(), mode);
+    } else {
+      const webrtc::I420BufferInterface* src = buffer->GetI420();
+      libyuv::I420Rotate(src->DataY(), src->StrideY(), src->DataU(),
+                         src->StrideU(), src->DataV(), src->StrideV(),
+                         rotated->MutableDataY(), rotated->StrideY(),
+                         rotated->MutableDataU(), rotated->StrideU(),
+                         rotated->MutableDataV(), rotated->StrideV(),
+                         src->width(), src->height(), mode);
+    }
+    buffer = rotated;
+  }
+
+  // タイルに直接書き込む
+  ConvertToARGB(*buffer, dst.image.get(), dst.frame_width * 4);
+
+  // 書き込んだバッファを受け渡し用のバッファと交換して、描画スレッドに渡す
+  back_ = middle_.exchange(back_ | kNewFrame) & kIndexMask;
 }
 
 void BaseRenderer::Sink::SetOutlineRect(int x, int y, int width, int height) {
@@ -213,57 +378,50 @@ void BaseRenderer::Sink::SetOutlineRect(int x, int y, int width, int height) {
   if (outline_width_ == width && outline_height_ == height) {
     return;
   }
-  webrtc::MutexLock lock(GetMutex());
+  webrtc::MutexLock lock(&frame_params_lock_);
   offset_y_ = 0;
   offset_x_ = 0;
   outline_width_ = width;
   outline_height_ = height;
   outline_aspect_ = (float)outline_width_ / (float)outline_height_;
   outline_changed_ = true;
+  outline_generation_++;
 }
 
-webrtc::Mutex* BaseRenderer::Sink::GetMutex() {
-  return &frame_params_lock_;
-}
-
-bool BaseRenderer::Sink::GetOutlineChanged() {
-  return outline_changed_;
-}
-
-int BaseRenderer::Sink::GetOffsetX() {
-  return outline_offset_x_ + offset_x_;
-}
-
-int BaseRenderer::Sink::GetOffsetY() {
-  return outline_offset_y_ + offset_y_;
+bool BaseRenderer::Sink::AcquireFrame() {
+  if ((middle_.load() & kNewFrame) == 0) {
+    return false;
+  }
+  front_ = middle_.exchange(front_) & kIndexMask;
+  return true;
 }
 
-int BaseRenderer::Sink::GetInputWidth() {
-  return input_width_;
+const BaseRenderer::Sink::Frame& BaseRenderer::Sink::GetFrame() const {
+  return frames_[front_];
 }
 
-int BaseRenderer::Sink::GetInputHeight() {
-  return input_height_;
+int BaseRenderer::Sink::GetOutlineOffsetX() const {
+  return outline_offset_x_;
 }
 
-int BaseRenderer::Sink::GetFrameWidth() {
-  return scaled_ ? width_ : input_width_;
+int BaseRenderer::Sink::GetOutlineOffsetY() const {
+  return outline_offset_y_;
 }
 
-int BaseRenderer::Sink::GetFrameHeight() {
-  return scaled_ ? height_ : input_height_;
+int BaseRenderer::Sink::GetOutlineWidth() const {
+  return outline_width_;
 }
 
-int BaseRenderer::Sink::GetWidth() {
-  return width_;
+int BaseRenderer::Sink::GetOutlineHeight() const {
+  return outline_height_;
 }
 
-int BaseRenderer::Sink::GetHeight() {
-  return height_;
+uint64_t BaseRenderer::Sink::GetOutlineGeneration() const {
+  return outline_generation_;
 }
 
-uint8_t* BaseRenderer::Sink::GetImage() {
-  return image_.get();
+BaseRenderer::Sink::DrawnRect& BaseRenderer::Sink::GetDrawnRect() {
+  return drawn_rect_;
 }
 
 void BaseRenderer::SetOutlines() {
@@ -311,6 +469,7 @@ void BaseRenderer::SetOutlines() {
   }
   rows_ = rows;
   cols_ = cols;
+  layout_version_++;
 }
 
 void BaseRenderer::AddTrack(webrtc::VideoTrackInterface* track) {
@@ -1,18 +1,30 @@
 #include "sora/renderer/sixel_renderer.h"
 
+#include <algorithm>
+#include <cerrno>
 #include <climits>
 #include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
 #include <string>
 #include <vector>
 
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
 #include "sora/renderer/base_renderer.h"
 
 namespace sora {
 
 SixelRenderer::SixelRenderer(int width, int height, int fps)
-    : BaseRenderer(width, height, fps) {
+    : BaseRenderer(width, height, fps), diff_mode_(false) {
   InitializeColorLookupTable();
+  InitializePaletteHeader();
+  color_used_.fill(false);
   Start();
 }
 
@@ -22,29 +34,37 @@ SixelRenderer::~SixelRenderer() {
 
 void SixelRenderer::RenderThreadStarted() {}
 void SixelRenderer::RenderThreadFinished() {}
+void SixelRenderer::SetDiffMode(bool enabled) {
+  diff_mode_ = enabled;
+}
+
 void SixelRenderer::Render(uint8_t* image,
                            int width,
                            int height,
                            const std::vector<SinkInfo>& sink_infos) {
-  MoveCursorToTop();
+  output_.reserve(width * height * 2);
+  output_ += "\033[H";
   // オリジナルサイズを表示
   for (const auto& sink_info : sink_infos) {
-    std::cout << "\033[2K" << "(" << sink_info.offset_x << ","
-              << sink_info.offset_y << ")"
-              << " の元のサイズ: " << sink_info.input_width << "x"
-              << sink_info.input_height << std::endl;
+    output_ += "\033[2K(";
+    output_ += std::to_string(sink_info.offset_x);
+    output_ += ",";
+    output_ += std::to_string(sink_info.offset_y);
+    output_ += ") の元のサイズ: ";
+    output_ += std::to_string(sink_info.input_width);
+    output_ += "x";
+    output_ += std::to_string(sink_info.input_height);
+    output_ += "\n";
   }
   OutputSixel(image, width, height);
+  // 一括出力
+  Flush();
 }
 
 void SixelRenderer::ClearScreen() {
   std::cout << "\033[2J\033[H" << std::flush;
 }
 
-void SixelRenderer::MoveCursorToTop() {
-  std::cout << "\033[H" << std::flush;
-}
-
 void SixelRenderer::InitializeColorLookupTable() {
   // 固定の216色パレット（6x6x6 RGB）を作成
   palette_map_.clear();
@@ -114,14 +134,35 @@ void SixelRenderer::InitializeColorLookupTable() {
   }
 }
 
+void SixelRenderer::InitializePaletteHeader() {
+  // パレットは固定なので、定義は最初に 1 回だけ作っておく
+  palette_header_.clear();
+  for (const auto& [color, index] : palette_map_) {
+    int r = (color >> 16) & 0xFF;
+    int g = (color >> 8) & 0xFF;
+    int b = color & 0xFF;
+
+    // RGB値を0-100の範囲に変換
+    int r_percent = (r * 100) / 255;
+    int g_percent = (g * 100) / 255;
+    int b_percent = (b * 100) / 255;
+
+    palette_header_ += "#";
+    palette_header_ += std::to_string(index);
+    palette_header_ += ";2;";
+    palette_header_ += std::to_string(r_percent);
+    palette_header_ += ";";
+    palette_header_ += std::to_string(g_percent);
+    palette_header_ += ";";
+    palette_header_ += std::to_string(b_percent);
+  }
+}
+
 void SixelRenderer::OutputSixel(const uint8_t* rgb_data,
                                 int width,
                                 int height) {
-  std::string output;
-  output.reserve(width * height * 10);  // 大体のサイズを予約
-
   // 減色された画像データを作成（ルックアップテーブルを使用）
-  std::vector<uint8_t> indexed_image(width * height);
+  indexed_image_.resize(width * height);
   for (int y = 0; y < height; y++) {
     for (int x = 0; x < width; x++) {
       int pixel_offset = (y * width + x) * 4;
@@ -136,81 +177,127 @@ void SixelRenderer::OutputSixel(const uint8_t* rgb_data,
 
       // ルックアップテーブルから色インデックスを取得
       int lookup_index = (r5 << 10) | (g5 << 5) | b5;
-      indexed_image[y * width + x] = color_lookup_table_[lookup_index];
+      indexed_image_[y * width + x] = color_lookup_table_[lookup_index];
     }
   }
 
+  // 差分モードでは、前回と同じ内容のバンドは出力しない
+  const bool diff = diff_mode_ && prev_width_ == width &&
+                    prev_height_ == height &&
+                    prev_indexed_image_.size() == indexed_image_.size();
+
   // Sixelフォーマットでの出力開始
-  output += "\033Pq\"1;1;";
-  output += std::to_string(width);
-  output += ";";
-  output += std::to_string(height);
+  // 差分モードでは P2=1 で、出力しなかった画素に前回の画像を残す
+  output_ += diff ? "\033P0;1q\"1;1;" : "\033Pq\"1;1;";
+  output_ += std::to_string(width);
+  output_ += ";";
+  output_ += std::to_string(height);
 
   // グローバルカラーパレットを定義
-  for (const auto& [color, index] : palette_map_) {
-    int r = (color >> 16) & 0xFF;
-    int g = (color >> 8) & 0xFF;
-    int b = color & 0xFF;
+  output_ += palette_header_;
 
-    // RGB値を0-100の範囲に変換
-    int r_percent = (r * 100) / 255;
-    int g_percent = (g * 100) / 255;
-    int b_percent = (b * 100) / 255;
-
-    output += "#";
-    output += std::to_string(index);
-    output += ";2;";
-    output += std::to_string(r_percent);
-    output += ";";
-    output += std::to_string(g_percent);
-    output += ";";
-    output += std::to_string(b_percent);
-  }
+  band_bits_.resize(palette_map_.size() * width);
 
   // 6行ずつ処理
   for (int y = 0; y < height; y += 6) {
-    // 各色について6行分のデータを出力
-    for (const auto& [color, index] : palette_map_) {
-      std::vector<uint8_t> sixel_line;
-      bool has_pixels = false;
+    const int band_height = std::min(6, height - y);
+    if (diff && memcmp(indexed_image_.data() + y * width,
+                       prev_indexed_image_.data() + y * width,
+                       band_height * width) == 0) {
+      output_ += "-";
+      continue;
+    }
 
-      // この色の行データを作成
+    // バンド内の画素を 1 回だけ走査して、色ごとのビットを立てる
+    band_colors_.clear();
+    for (int dy = 0; dy < band_height; dy++) {
+      const uint8_t* row = indexed_image_.data() + (y + dy) * width;
       for (int x = 0; x < width; x++) {
-        uint8_t sixel_byte = 0;
-
-        for (int dy = 0; dy < 6 && y + dy < height; dy++) {
-          int pixel_index = (y + dy) * width + x;
-          if (indexed_image[pixel_index] == index) {
-            sixel_byte |= (1 << dy);
-            has_pixels = true;
-          }
+        uint8_t index = row[x];
+        uint8_t* bits = band_bits_.data() + index * width;
+        if (!color_used_[index]) {
+          color_used_[index] = true;
+          band_colors_.push_back(index);
+          memset(bits, 0, width);
         }
-
-        sixel_line.push_back(sixel_byte);
+        bits[x] |= 1 << dy;
       }
+    }
 
-      // この色にピクセルがある場合のみ出力
-      if (has_pixels) {
-        output += "$";  // 行の最初に戻る
-
-        output += "#";
-        output += std::to_string(index);
-
-        for (uint8_t sixel_byte : sixel_line) {
-          // Sixel文字として出力（63を加える）
-          output += static_cast<char>(sixel_byte + 63);
-        }
+    // バンドに含まれる色だけを出力する
+    for (size_t i = 0; i < band_colors_.size(); i++) {
+      uint8_t index = band_colors_[i];
+      color_used_[index] = false;
+      if (i != 0) {
+        output_ += "$";  // 行の最初に戻る
       }
+      output_ += "#";
+      output_ += std::to_string(index);
+      AppendSixelLine(band_bits_.data() + index * width, width);
     }
 
-    output += "-";  // 次の6行へ
+    output_ += "-";  // 次の6行へ
   }
 
   // Sixel終了
-  output += "\033\\";
+  output_ += "\033\\";
+
+  if (diff_mode_) {
+    prev_indexed_image_.swap(indexed_image_);
+    prev_width_ = width;
+    prev_height_ = height;
+  } else {
+    prev_width_ = 0;
+    prev_height_ = 0;
+  }
+}
 
-  // 一括出力
-  std::cout << output << std::flush;
+void SixelRenderer::AppendSixelLine(const uint8_t* bits, int width) {
+  // 末尾の空白は出力しなくて良い
+  while (width > 0 && bits[width - 1] == 0) {
+    width--;
+  }
+  // 同じ値が続く場合はランレングスで出力する
+  int x = 0;
+  while (x < width) {
+    uint8_t sixel_byte = bits[x];
+    int run = 1;
+    while (x + run < width && bits[x + run] == sixel_byte) {
+      run++;
+    }
+    // Sixel文字として出力（63を加える）
+    char c = static_cast<char>(sixel_byte + 63);
+    if (run > 3) {
+      output_ += "!";
+      output_ += std::to_string(run);
+      output_ += c;
+    } else {
+      output_.append(run, c);
+    }
+    x += run;
+  }
+}
+
+void SixelRenderer::Flush() {
+  const char* p = output_.data();
+  size_t size = output_.size();
+  while (size > 0) {
+#if defined(_WIN32)
+    int n = _write(_fileno(stdout), p, static_cast<unsigned int>(size));
+#else
+    ssize_t n = write(STDOUT_FILENO, p, size);
+#endif
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    p += n;
+    size -= n;
+  }
+  // 確保した領域は次のフレームで使い回す
+  output_.clear();
 }
 
 }  // namespace sora
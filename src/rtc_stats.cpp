@@ -1,10 +1,14 @@
 #include "sora/rtc_stats.h"
 
+#include <algorithm>
+#include <string>
+#include <string_view>
 #include <utility>
 
 // WebRTC
 #include <api/make_ref_counted.h>
 #include <api/scoped_refptr.h>
+#include <api/stats/rtc_stats.h>
 #include <api/stats/rtc_stats_report.h>
 
 namespace sora {
@@ -22,4 +26,57 @@ void RTCStatsCallback::OnStatsDelivered(
 RTCStatsCallback::RTCStatsCallback(ResultCallback result_callback)
     : result_callback_(std::move(result_callback)) {}
 
+RTCStatsExporter::RTCStatsExporter() {}
+RTCStatsExporter::RTCStatsExporter(Config config)
+    : config_(std::move(config)) {}
+
+std::string RTCStatsExporter::Export(
+    const webrtc::scoped_refptr<const webrtc::RTCStatsReport>& report,
+    std::string_view prefix,
+    std::string_view suffix) {
+  std::string out;
+  out.reserve(std::max(last_size_, prefix.size() + suffix.size() + 2));
+  out.append(prefix);
+  out.push_back('[');
+  bool first = true;
+  for (const auto& stats : *report) {
+    if (!IsTargetType(stats.type())) {
+      continue;
+    }
+    if (config_.changed_only && last_report_ != nullptr) {
+      // RTCStats の比較はタイムスタンプを含まない
+      const webrtc::RTCStats* last = last_report_->Get(stats.id());
+      if (last != nullptr && *last == stats) {
+        continue;
+      }
+    }
+    if (!first) {
+      out.push_back(',');
+    }
+    first = false;
+    out.append(stats.ToJson());
+  }
+  out.push_back(']');
+  out.append(suffix);
+
+  if (config_.changed_only) {
+    last_report_ = report;
+  }
+  last_size_ = out.size();
+  return out;
+}
+
+void RTCStatsExporter::Reset() {
+  last_report_ = nullptr;
+  last_size_ = 0;
+}
+
+bool RTCStatsExporter::IsTargetType(const char* type) const {
+  if (!config_.types) {
+    return true;
+  }
+  return std::find(config_.types->begin(), config_.types->end(), type) !=
+         config_.types->end();
+}
+
 }  // namespace sora
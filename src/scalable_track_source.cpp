@@ -17,9 +17,11 @@
 #include <api/media_stream_interface.h>
 #include <api/scoped_refptr.h>
 #include <api/video/i420_buffer.h>
+#include <api/video/nv12_buffer.h>
 #include <api/video/video_frame.h>
 #include <api/video/video_frame_buffer.h>
 #include <api/video/video_rotation.h>
+#include <common_video/include/video_frame_buffer_pool.h>
 #include <media/base/adapted_video_track_source.h>
 #include <rtc_base/time_utils.h>
 
@@ -28,9 +30,95 @@
 
 namespace sora {
 
+namespace {
+
+webrtc::scoped_refptr<webrtc::I420Buffer> CreateI420Buffer(
+    webrtc::VideoFrameBufferPool& pool,
+    int width,
+    int height) {
+  webrtc::scoped_refptr<webrtc::I420Buffer> buffer =
+      pool.CreateI420Buffer(width, height);
+  // プールのバッファを使い切った場合は新しく確保する
+  if (!buffer) {
+    buffer = webrtc::I420Buffer::Create(width, height);
+  }
+  return buffer;
+}
+
+webrtc::scoped_refptr<webrtc::NV12Buffer> CreateNV12Buffer(
+    webrtc::VideoFrameBufferPool& pool,
+    int width,
+    int height) {
+  webrtc::scoped_refptr<webrtc::NV12Buffer> buffer =
+      pool.CreateNV12Buffer(width, height);
+  if (!buffer) {
+    buffer = webrtc::NV12Buffer::Create(width, height);
+  }
+  return buffer;
+}
+
+// buffer の指定した範囲を切り出して縮小する。
+// buffer が NV12 の場合は NV12 のまま、それ以外は I420 で返す。
+webrtc::scoped_refptr<webrtc::VideoFrameBuffer> CropAndScale(
+    webrtc::VideoFrameBufferPool& pool,
+    const webrtc::scoped_refptr<webrtc::VideoFrameBuffer>& buffer,
+    int crop_x,
+    int crop_y,
+    int crop_width,
+    int crop_height,
+    int scaled_width,
+    int scaled_height) {
+  if (buffer->type() == webrtc::VideoFrameBuffer::Type::kNV12) {
+    webrtc::scoped_refptr<webrtc::NV12Buffer> nv12 =
+        CreateNV12Buffer(pool, scaled_width, scaled_height);
+    nv12->CropAndScaleFrom(*buffer->GetNV12(), crop_x, crop_y, crop_width,
+                           crop_height);
+    return nv12;
+  }
+  webrtc::scoped_refptr<webrtc::I420Buffer> i420 =
+      CreateI420Buffer(pool, scaled_width, scaled_height);
+  i420->CropAndScaleFrom(*buffer->ToI420(), crop_x, crop_y, crop_width,
+                         crop_height);
+  return i420;
+}
+
+// buffer の指定した範囲を切り出しながら回転して dst に書き込む
+void CropAndRotate(
+    const webrtc::scoped_refptr<webrtc::VideoFrameBuffer>& buffer,
+    int crop_x,
+    int crop_y,
+    int crop_width,
+    int crop_height,
+    libyuv::RotationMode mode,
+    webrtc::I420Buffer* dst) {
+  if (buffer->type() == webrtc::VideoFrameBuffer::Type::kNV12) {
+    const webrtc::NV12BufferInterface* src = buffer->GetNV12();
+    libyuv::NV12ToI420Rotate(
+        src->DataY() + crop_y * src->StrideY() + crop_x, src->StrideY(),
+        src->DataUV() + crop_y / 2 * src->StrideUV() + crop_x,
+        src->StrideUV(), dst->MutableDataY(), dst->StrideY(),
+        dst->MutableDataU(), dst->StrideU(), dst->MutableDataV(),
+        dst->StrideV(), crop_width, crop_height, mode);
+    return;
+  }
+  webrtc::scoped_refptr<webrtc::I420BufferInterface> src = buffer->ToI420();
+  libyuv::I420Rotate(
+      src->DataY() + crop_y * src->StrideY() + crop_x, src->StrideY(),
+      src->DataU() + crop_y / 2 * src->StrideU() + crop_x / 2, src->StrideU(),
+      src->DataV() + crop_y / 2 * src->StrideV() + crop_x / 2, src->StrideV(),
+      dst->MutableDataY(), dst->StrideY(), dst->MutableDataU(), dst->StrideU(),
+      dst->MutableDataV(), dst->StrideV(), crop_width, crop_height, mode);
+}
+
+}  // namespace
+
 ScalableVideoTrackSource::ScalableVideoTrackSource(
     ScalableVideoTrackSourceConfig config)
-    : AdaptedVideoTrackSource(4), config_(config) {}
+    : AdaptedVideoTrackSource(4),
+      config_(config),
+      buffer_pool_(false, 300 /* max_number_of_buffers*/),
+      rotated_buffer_pool_(false, 300 /* max_number_of_buffers*/),
+      scale_buffer_pool_(false, 4 /* max_number_of_buffers*/) {}
 ScalableVideoTrackSource::~ScalableVideoTrackSource() {}
 
 bool ScalableVideoTrackSource::is_screencast() const {
@@ -58,43 +146,12 @@ bool ScalableVideoTrackSource::OnCapturedFrame(
   const int64_t translated_timestamp_us =
       timestamp_aligner_.TranslateTimestamp(timestamp_us, webrtc::TimeMicros());
 
-  // 回転が必要
-  if (frame.rotation() != webrtc::kVideoRotation_0) {
-    int width;
-    int height;
-    libyuv::RotationMode mode;
-    switch (frame.rotation()) {
-      case webrtc::kVideoRotation_180:
-        width = frame.width();
-        height = frame.height();
-        mode = libyuv::kRotate180;
-        break;
-      case webrtc::kVideoRotation_90:
-        width = frame.height();
-        height = frame.width();
-        mode = libyuv::kRotate90;
-        break;
-      case webrtc::kVideoRotation_270:
-      default:
-        width = frame.height();
-        height = frame.width();
-        mode = libyuv::kRotate270;
-        break;
-    }
-
-    webrtc::scoped_refptr<webrtc::I420Buffer> rotated =
-        webrtc::I420Buffer::Create(width, height);
-    webrtc::scoped_refptr<webrtc::I420BufferInterface> src =
-        frame.video_frame_buffer()->ToI420();
-    libyuv::I420Rotate(src->DataY(), src->StrideY(), src->DataU(),
-                       src->StrideU(), src->DataV(), src->StrideV(),
-                       rotated->MutableDataY(), rotated->StrideY(),
-                       rotated->MutableDataU(), rotated->StrideU(),
-                       rotated->MutableDataV(), rotated->StrideV(),
-                       frame.width(), frame.height(), mode);
-    frame.set_video_frame_buffer(rotated);
-    frame.set_rotation(webrtc::kVideoRotation_0);
-  }
+  // 回転、切り出し、縮小は後でまとめて行うので、ここでは回転後のサイズだけ計算する
+  webrtc::VideoRotation rotation = frame.rotation();
+  const bool swap_size = rotation == webrtc::kVideoRotation_90 ||
+                         rotation == webrtc::kVideoRotation_270;
+  const int width = swap_size ? frame.height() : frame.width();
+  const int height = swap_size ? frame.width() : frame.height();
 
   int adapted_width;
   int adapted_height;
@@ -102,41 +159,131 @@ bool ScalableVideoTrackSource::OnCapturedFrame(
   int crop_height;
   int crop_x;
   int crop_y;
-  if (!AdaptFrame(frame.width(), frame.height(), timestamp_us, &adapted_width,
-                  &adapted_height, &crop_width, &crop_height, &crop_x,
-                  &crop_y)) {
+  if (!AdaptFrame(width, height, timestamp_us, &adapted_width, &adapted_height,
+                  &crop_width, &crop_height, &crop_x, &crop_y)) {
     return false;
   }
 
+  webrtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer =
+      frame.video_frame_buffer();
+
   if (config_.on_frame) {
+    // on_frame には回転済みで切り出しや縮小をしていないフレームを渡す
+    if (rotation != webrtc::kVideoRotation_0) {
+      buffer = CropScaleRotate(rotated_buffer_pool_, buffer, rotation, 0, 0,
+                               width, height, width, height);
+      rotation = webrtc::kVideoRotation_0;
+      frame.set_video_frame_buffer(buffer);
+      frame.set_rotation(rotation);
+    }
     config_.on_frame(frame);
   }
 
-  if (frame.video_frame_buffer()->type() ==
-      webrtc::VideoFrameBuffer::Type::kNative) {
+  if (rotation == webrtc::kVideoRotation_0 &&
+      buffer->type() == webrtc::VideoFrameBuffer::Type::kNative) {
     OnFrame(frame);
     return true;
   }
 
-  webrtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer =
-      frame.video_frame_buffer();
-
-  if (adapted_width != frame.width() || adapted_height != frame.height()) {
-    // Video adapter has requested a down-scale. Allocate a new buffer and
-    // return scaled version.
-    webrtc::scoped_refptr<webrtc::I420Buffer> i420_buffer =
-        webrtc::I420Buffer::Create(adapted_width, adapted_height);
-    i420_buffer->ScaleFrom(*buffer->ToI420());
-    buffer = i420_buffer;
-  }
+  buffer = CropScaleRotate(buffer_pool_, buffer, rotation, crop_x, crop_y,
+                           crop_width, crop_height, adapted_width,
+                           adapted_height);
 
   OnFrame(webrtc::VideoFrame::Builder()
               .set_video_frame_buffer(buffer)
-              .set_rotation(frame.rotation())
+              .set_rotation(webrtc::kVideoRotation_0)
               .set_timestamp_us(translated_timestamp_us)
               .build());
 
   return true;
 }
 
+webrtc::scoped_refptr<webrtc::VideoFrameBuffer>
+ScalableVideoTrackSource::CropScaleRotate(
+    webrtc::VideoFrameBufferPool& pool,
+    webrtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer,
+    webrtc::VideoRotation rotation,
+    int crop_x,
+    int crop_y,
+    int crop_width,
+    int crop_height,
+    int adapted_width,
+    int adapted_height) {
+  // NV12 と I420 以外は I420 に変換してから処理する
+  if (buffer->type() != webrtc::VideoFrameBuffer::Type::kNV12 &&
+      buffer->type() != webrtc::VideoFrameBuffer::Type::kI420) {
+    buffer = buffer->ToI420();
+  }
+
+  if (rotation == webrtc::kVideoRotation_0) {
+    if (crop_x == 0 && crop_y == 0 && crop_width == buffer->width() &&
+        crop_height == buffer->height() && adapted_width == buffer->width() &&
+        adapted_height == buffer->height()) {
+      return buffer;
+    }
+    return CropAndScale(pool, buffer, crop_x, crop_y, crop_width,
+                        crop_height, adapted_width, adapted_height);
+  }
+
+  // 回転後の座標系の切り出し範囲を、回転前の座標系に変換する
+  const int src_width = buffer->width();
+  const int src_height = buffer->height();
+  int x;
+  int y;
+  int w;
+  int h;
+  int scaled_width;
+  int scaled_height;
+  libyuv::RotationMode mode;
+  switch (rotation) {
+    case webrtc::kVideoRotation_180:
+      x = src_width - crop_x - crop_width;
+      y = src_height - crop_y - crop_height;
+      w = crop_width;
+      h = crop_height;
+      scaled_width = adapted_width;
+      scaled_height = adapted_height;
+      mode = libyuv::kRotate180;
+      break;
+    case webrtc::kVideoRotation_90:
+      x = crop_y;
+      y = src_height - crop_x - crop_width;
+      w = crop_height;
+      h = crop_width;
+      scaled_width = adapted_height;
+      scaled_height = adapted_width;
+      mode = libyuv::kRotate90;
+      break;
+    case webrtc::kVideoRotation_270:
+    default:
+      x = src_width - crop_y - crop_height;
+      y = crop_x;
+      w = crop_height;
+      h = crop_width;
+      scaled_width = adapted_height;
+      scaled_height = adapted_width;
+      mode = libyuv::kRotate270;
+      break;
+  }
+  // 色差のサンプル位置がずれないように偶数に揃える
+  x &= ~1;
+  y &= ~1;
+
+  if (w != scaled_width || h != scaled_height) {
+    // libyuv には縮小と回転を同時に行う関数が無いので、
+    // 先に縮小して回転する画素数を減らす
+    buffer = CropAndScale(scale_buffer_pool_, buffer, x, y, w, h,
+                          scaled_width, scaled_height);
+    x = 0;
+    y = 0;
+    w = scaled_width;
+    h = scaled_height;
+  }
+
+  webrtc::scoped_refptr<webrtc::I420Buffer> rotated =
+      CreateI420Buffer(pool, adapted_width, adapted_height);
+  CropAndRotate(buffer, x, y, w, h, mode, rotated.get());
+  return rotated;
+}
+
 }  // namespace sora
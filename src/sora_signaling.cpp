@@ -44,6 +44,7 @@
 #include <rtc_base/proxy_info_revive.h>
 #include <rtc_base/socket_address.h>
 #include <rtc_base/ssl_certificate.h>
+#include <rtc_base/thread.h>
 
 #include "sora/boost_json_iwyu.h"
 #include "sora/data_channel.h"
@@ -67,6 +68,8 @@ const char kOperatorIsNotIn[] = "is_not_in";
 
 SoraSignaling::SoraSignaling(const SoraSignalingConfig& config)
     : config_(config),
+      stats_exporter_(RTCStatsExporter::Config{config_.stats_types,
+                                               config_.send_changed_stats_only}),
       connection_timeout_timer_(*config_.io_context),
       closing_timeout_timer_(*config_.io_context) {}
 
@@ -107,6 +110,13 @@ bool SoraSignaling::IsConnectedDataChannel() const {
 bool SoraSignaling::IsConnectedWebsocket() const {
   return ws_connected_;
 }
+std::optional<Websocket::Stats> SoraSignaling::GetWebsocketStats() const {
+  auto ws = stats_ws_.load();
+  if (ws == nullptr) {
+    return std::nullopt;
+  }
+  return ws->GetStats();
+}
 
 void SoraSignaling::Connect() {
   RTC_LOG(LS_INFO) << "SoraSignaling::Connect";
@@ -225,6 +235,10 @@ void SoraSignaling::Redirect(std::string url) {
       } else {
         new_ws.reset(new Websocket(*self->config_.io_context));
       }
+      if (self->config_.websocket_permessage_deflate) {
+        new_ws->SetPermessageDeflate(
+            *self->config_.websocket_permessage_deflate);
+      }
       new_ws->Connect(url, std::bind(&SoraSignaling::OnRedirect, self,
                                      std::placeholders::_1, url, new_ws));
     };
@@ -260,6 +274,7 @@ void SoraSignaling::OnRedirect(boost::system::error_code ec,
 
   state_ = State::Connected;
   ws_ = ws;
+  stats_ws_.store(ws);
   ws_connected_ = true;
   connected_signaling_url_.store(url);
   RTC_LOG(LS_INFO) << "Redirected: url=" << url;
@@ -497,13 +512,14 @@ void SoraSignaling::DoSendPong() {
 
 void SoraSignaling::DoSendPong(
     const webrtc::scoped_refptr<const webrtc::RTCStatsReport>& report) {
-  std::string stats = report->ToJson();
   if (dc_ && using_datachannel_ && dc_->IsOpen("stats")) {
     // DataChannel が使える場合は type: stats で DataChannel に送る
-    std::string str = R"({"type":"stats","reports":)" + stats + "}";
+    std::string str =
+        stats_exporter_.Export(report, R"({"type":"stats","reports":)", "}");
     SendDataChannel("stats", str);
   } else if (ws_) {
-    std::string str = R"({"type":"pong","stats":)" + stats + "}";
+    std::string str =
+        stats_exporter_.Export(report, R"({"type":"pong","stats":)", "}");
     ws_->WriteText(std::move(str), [self = shared_from_this(), ws = ws_](
                                        boost::system::error_code, size_t) {});
   }
@@ -854,6 +870,7 @@ void SoraSignaling::OnConnect(boost::system::error_code ec,
   RTC_LOG(LS_INFO) << "Signaling Websocket is connected: url=" << url;
   state_ = State::Connected;
   ws_ = ws;
+  stats_ws_.store(ws);
   ws_connected_ = true;
   selected_signaling_url_.store(url);
   connected_signaling_url_.store(url);
@@ -1004,9 +1021,12 @@ void SoraSignaling::OnRead(boost::system::error_code ec,
         const auto& ar = it->value().as_array();
         for (const auto& v : ar) {
           std::string label = v.at("label").as_string().c_str();
-          DataChannelInfo info;
-          info.compressed = v.at("compress").as_bool();
-          dc_labels_.insert(std::make_pair(label, info));
+          // DataChannelInfo は mutex を持っていてムーブできないので、その場で作る。
+          // 同じラベルが複数ある場合は最初のものを使う
+          auto [label_it, inserted] = dc_labels_.try_emplace(label);
+          if (inserted) {
+            label_it->second.compressed = v.at("compress").as_bool();
+          }
         }
       }
     }
@@ -1015,8 +1035,8 @@ void SoraSignaling::OnRead(boost::system::error_code ec,
 
     pc_ = CreatePeerConnection(m.at("config"));
 
-    SessionDescription::SetOffer(
-        pc_.get(), sdp,
+    SetOffer(
+        sdp,
         [self = shared_from_this(), m, text]() {
           boost::asio::post(*self->config_.io_context, [self, m, text]() {
             if (self->state_ != State::Connected) {
@@ -1091,8 +1111,7 @@ void SoraSignaling::OnRead(boost::system::error_code ec,
                                           std::move(encoding_parameters));
             }
 
-            SessionDescription::CreateAnswer(
-                self->pc_.get(),
+            self->CreateAnswer(
                 [self](webrtc::SessionDescriptionInterface* desc) {
                   if (self->config_.degradation_preference) {
                     self->SetDegradationPreference(
@@ -1132,8 +1151,8 @@ void SoraSignaling::OnRead(boost::system::error_code ec,
       return;
     }
 
-    SessionDescription::SetOffer(
-        pc_.get(), sdp,
+    SetOffer(
+        sdp,
         [self = shared_from_this(), type, answer_type]() {
           boost::asio::post(*self->config_.io_context, [self, type,
                                                         answer_type]() {
@@ -1146,8 +1165,7 @@ void SoraSignaling::OnRead(boost::system::error_code ec,
               self->ResetEncodingParameters();
             }
 
-            SessionDescription::CreateAnswer(
-                self->pc_.get(),
+            self->CreateAnswer(
                 [self, answer_type](webrtc::SessionDescriptionInterface* desc) {
                   if (self->config_.degradation_preference) {
                     self->SetDegradationPreference(
@@ -1185,19 +1203,16 @@ void SoraSignaling::OnRead(boost::system::error_code ec,
   } else if (type == "ping") {
     auto it = m.as_object().find("stats");
     if (it != m.as_object().end() && it->value().as_bool()) {
-      pc_->GetStats(
-          RTCStatsCallback::Create(
-              [self = shared_from_this()](
-                  const webrtc::scoped_refptr<const webrtc::RTCStatsReport>&
-                      report) {
-                boost::asio::post(*self->config_.io_context, [self, report]() {
-                  if (self->state_ != State::Connected) {
-                    return;
-                  }
-                  self->DoSendPong(report);
-                });
-              })
-              .get());
+      GetStats([self = shared_from_this()](
+                   const webrtc::scoped_refptr<const webrtc::RTCStatsReport>&
+                       report) {
+        boost::asio::post(*self->config_.io_context, [self, report]() {
+          if (self->state_ != State::Connected) {
+            return;
+          }
+          self->DoSendPong(report);
+        });
+      });
     } else {
       DoSendPong();
     }
@@ -1230,6 +1245,11 @@ void SoraSignaling::DoConnect() {
   }
 
   dc_.reset(new DataChannel(*config_.io_context, shared_from_this()));
+  for (const auto& d : config_.data_channels) {
+    if (d.flow_control) {
+      dc_->SetFlowControl(d.label, *d.flow_control);
+    }
+  }
 
   // 接続タイムアウト用の処理
   connection_timeout_timer_.expires_from_now(boost::posix_time::seconds(30));
@@ -1281,6 +1301,9 @@ void SoraSignaling::DoConnect() {
     if (config_.user_agent != std::nullopt) {
       ws->SetUserAgent(*config_.user_agent);
     }
+    if (config_.websocket_permessage_deflate) {
+      ws->SetPermessageDeflate(*config_.websocket_permessage_deflate);
+    }
     ws->Connect(url, std::bind(&SoraSignaling::OnConnect, shared_from_this(),
                                std::placeholders::_1, url, ws));
     connecting_wss_.push_back(ws);
@@ -1291,6 +1314,38 @@ void SoraSignaling::DoConnect() {
   }
 }
 
+void SoraSignaling::RunOnSignalingThread(std::function<void()> f) {
+  if (config_.signaling_thread == nullptr) {
+    f();
+    return;
+  }
+  config_.signaling_thread->PostTask(std::move(f));
+}
+
+void SoraSignaling::SetOffer(const std::string& sdp,
+                             OnSessionSetSuccessFunc on_success,
+                             OnSessionSetFailureFunc on_failure) {
+  // pc_ は io_context のスレッドでしか触らないので、ここで参照を取っておく
+  RunOnSignalingThread([pc = pc_, sdp, on_success = std::move(on_success),
+                        on_failure = std::move(on_failure)]() {
+    SessionDescription::SetOffer(pc.get(), sdp, on_success, on_failure);
+  });
+}
+
+void SoraSignaling::CreateAnswer(OnSessionCreateSuccessFunc on_success,
+                                 OnSessionCreateFailureFunc on_failure) {
+  RunOnSignalingThread([pc = pc_, on_success = std::move(on_success),
+                        on_failure = std::move(on_failure)]() {
+    SessionDescription::CreateAnswer(pc.get(), on_success, on_failure);
+  });
+}
+
+void SoraSignaling::GetStats(RTCStatsCallback::ResultCallback callback) {
+  RunOnSignalingThread([pc = pc_, callback = std::move(callback)]() {
+    pc->GetStats(RTCStatsCallback::Create(callback).get());
+  });
+}
+
 void SoraSignaling::SetEncodingParameters(
     std::string mid,
     std::vector<webrtc::RtpEncodingParameters> encodings) {
@@ -1474,8 +1529,22 @@ webrtc::DataBuffer SoraSignaling::ConvertToDataBuffer(
   bool compressed = it != dc_labels_.end() && it->second.compressed;
   RTC_LOG(LS_INFO) << "Convert to DataChannel label=" << label
                    << " compressed=" << compressed << " input=" << input;
-  const std::string& str = compressed ? ZlibHelper::Compress(input) : input;
-  return webrtc::DataBuffer(webrtc::CopyOnWriteBuffer(str), true);
+  if (!compressed) {
+    return webrtc::DataBuffer(webrtc::CopyOnWriteBuffer(input), true);
+  }
+
+  std::lock_guard<std::mutex> lock(it->second.compressor_mutex);
+  auto& compressor = it->second.compressor;
+  if (compressor == nullptr) {
+    compressor = std::make_unique<ZlibCompressor>();
+  }
+  // 送信用のバッファに直接圧縮する
+  webrtc::CopyOnWriteBuffer buf(compressor->CompressBound(input.size()));
+  size_t size = compressor->Compress((const uint8_t*)input.data(),
+                                     input.size(), buf.MutableData(),
+                                     buf.size());
+  buf.SetSize(size);
+  return webrtc::DataBuffer(std::move(buf), true);
 }
 
 bool SoraSignaling::SendDataChannel(const std::string& label,
@@ -1485,8 +1554,14 @@ bool SoraSignaling::SendDataChannel(const std::string& label,
   }
 
   webrtc::DataBuffer data = ConvertToDataBuffer(label, input);
-  dc_->Send(label, data);
-  return true;
+  return dc_->Send(label, data);
+}
+
+bool SoraSignaling::IsDataChannelWritable(const std::string& label) {
+  if (dc_ == nullptr) {
+    return false;
+  }
+  return dc_->IsWritable(label);
 }
 
 void SoraSignaling::Clear() {
@@ -1499,10 +1574,12 @@ void SoraSignaling::Clear() {
   pc_ = nullptr;
   ws_connected_ = false;
   ws_ = nullptr;
+  stats_ws_.store(nullptr);
   using_datachannel_ = false;
   dc_ = nullptr;
   dc_labels_.clear();
   encodings_.clear();
+  stats_exporter_.Reset();
   video_mid_.clear();
   on_ws_close_ = nullptr;
   ice_state_ = webrtc::PeerConnectionInterface::kIceConnectionNew;
@@ -1648,6 +1725,13 @@ void SoraSignaling::OnStateChange(
     }
   }
 }
+void SoraSignaling::OnWritable(
+    webrtc::scoped_refptr<webrtc::DataChannelInterface> data_channel) {
+  auto ob = config_.observer.lock();
+  if (ob != nullptr) {
+    ob->OnDataChannelWritable(data_channel->label());
+  }
+}
 void SoraSignaling::OnMessage(
     webrtc::scoped_refptr<webrtc::DataChannelInterface> data_channel,
     const webrtc::DataBuffer& buffer) {
@@ -1658,9 +1742,37 @@ void SoraSignaling::OnMessage(
   std::string label = data_channel->label();
   auto it = dc_labels_.find(label);
   bool compressed = it != dc_labels_.end() && it->second.compressed;
+  // data は std::string か webrtc::CopyOnWriteBuffer
+  auto uncompress = [&it](const webrtc::DataBuffer& buffer, auto& data) {
+    std::lock_guard<std::mutex> lock(it->second.uncompressor_mutex);
+    auto& uncompressor = it->second.uncompressor;
+    if (uncompressor == nullptr) {
+      uncompressor = std::make_unique<ZlibUncompressor>();
+    }
+    uncompressor->Uncompress(buffer.data.cdata(), buffer.size(), data);
+  };
+
+  // ユーザ定義のラベルは JSON ではないので JSON パース前に処理して終わる。
+  // 圧縮されていない場合は受信したバッファを参照カウントで共有してそのまま渡す。
+  if (!label.empty() && label[0] == '#') {
+    webrtc::CopyOnWriteBuffer data;
+    if (compressed) {
+      // 展開先のバッファをそのまま渡す
+      uncompress(buffer, data);
+    } else {
+      data = buffer.data;
+    }
+    RTC_LOG(LS_VERBOSE) << "label=" << label << " size=" << data.size();
+    auto ob = config_.observer.lock();
+    if (ob != nullptr) {
+      ob->OnMessageBuffer(std::move(label), std::move(data));
+    }
+    return;
+  }
+
   std::string data;
   if (compressed) {
-    data = ZlibHelper::Uncompress(buffer.data.cdata(), buffer.size());
+    uncompress(buffer, data);
   } else {
     data.assign((const char*)buffer.data.cdata(),
                 (const char*)buffer.data.cdata() + buffer.size());
@@ -1669,19 +1781,10 @@ void SoraSignaling::OnMessage(
 
   // ハンドリングする必要のあるラベル以外は何もしない
   if (label != "signaling" && label != "stats" && label != "push" &&
-      label != "notify" && label != "rpc" &&
-      (label.empty() || label[0] != '#')) {
+      label != "notify" && label != "rpc") {
     return;
   }
 
-  // ユーザ定義のラベルは JSON ではないので JSON パース前に処理して終わる
-  if (!label.empty() && label[0] == '#') {
-    auto ob = config_.observer.lock();
-    if (ob != nullptr) {
-      ob->OnMessage(std::move(label), std::move(data));
-    }
-    return;
-  }
   // rpc ラベルはユーザー定義のラベルと同じような処理をする
   if (label == "rpc") {
     auto ob = config_.observer.lock();
@@ -1709,8 +1812,8 @@ void SoraSignaling::OnMessage(
         return;
       }
 
-      SessionDescription::SetOffer(
-          pc_.get(), sdp,
+      SetOffer(
+          sdp,
           [self = shared_from_this()]() {
             boost::asio::post(*self->config_.io_context, [self]() {
               if (self->state_ != State::Connected) {
@@ -1722,8 +1825,7 @@ void SoraSignaling::OnMessage(
                 self->ResetEncodingParameters();
               }
 
-              SessionDescription::CreateAnswer(
-                  self->pc_.get(),
+              self->CreateAnswer(
                   [self](webrtc::SessionDescriptionInterface* desc) {
                     if (self->config_.degradation_preference) {
                       self->SetDegradationPreference(
@@ -1770,19 +1872,16 @@ void SoraSignaling::OnMessage(
   if (label == "stats") {
     const std::string type = json.at("type").as_string().c_str();
     if (type == "req-stats") {
-      pc_->GetStats(
-          RTCStatsCallback::Create(
-              [self = shared_from_this()](
-                  const webrtc::scoped_refptr<const webrtc::RTCStatsReport>&
-                      report) {
-                boost::asio::post(*self->config_.io_context, [self, report]() {
-                  if (self->state_ != State::Connected) {
-                    return;
-                  }
-                  self->DoSendPong(report);
-                });
-              })
-              .get());
+      GetStats([self = shared_from_this()](
+                   const webrtc::scoped_refptr<const webrtc::RTCStatsReport>&
+                       report) {
+        boost::asio::post(*self->config_.io_context, [self, report]() {
+          if (self->state_ != State::Connected) {
+            return;
+          }
+          self->DoSendPong(report);
+        });
+      });
     }
     return;
   }
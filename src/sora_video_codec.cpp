@@ -460,12 +460,20 @@ void VideoCodecPreference::Merge(const VideoCodecPreference& preference) {
 void tag_invoke(const boost::json::value_from_tag&,
                 boost::json::value& jv,
                 const VideoCodecPreference::Parameters& v) {
-  jv.emplace_object();
+  auto& jo = jv.emplace_object();
+  if (v.openh264_parallel_simulcast) {
+    jo["openh264_parallel_simulcast"] = *v.openh264_parallel_simulcast;
+  }
 }
 VideoCodecPreference::Parameters tag_invoke(
     const boost::json::value_to_tag<VideoCodecPreference::Parameters>&,
     boost::json::value const& jv) {
   VideoCodecPreference::Parameters r;
+  const auto& jo = jv.as_object();
+  if (jo.contains("openh264_parallel_simulcast")) {
+    r.openh264_parallel_simulcast =
+        jo.at("openh264_parallel_simulcast").as_bool();
+  }
   return r;
 }
 // VideoCodecPreference::Codec
@@ -139,12 +139,17 @@ std::optional<SoraVideoCodecFactory> CreateVideoCodecFactory(
       } else if (*codec.encoder == VideoCodecImplementation::kCiscoOpenH264) {
         assert(config.capability_config.openh264_path);
         auto create_video_encoder =
-            [openh264_path = *config.capability_config.openh264_path](
+            [openh264_path = *config.capability_config.openh264_path,
+             parallel_simulcast =
+                 codec.parameters.openh264_parallel_simulcast.value_or(false)](
                 const webrtc::SdpVideoFormat& format) {
-              return CreateOpenH264VideoEncoder(format, openh264_path);
+              return CreateOpenH264VideoEncoder(format, openh264_path,
+                                                parallel_simulcast);
             };
-        encoder_factory_config.encoders.push_back(
-            VideoEncoderConfig(codec.type, create_video_encoder, 16));
+        VideoEncoderConfig encoder_config(codec.type, create_video_encoder,
+                                          16);
+        encoder_config.strided_input = true;
+        encoder_factory_config.encoders.push_back(encoder_config);
       } else if (*codec.encoder == VideoCodecImplementation::kIntelVpl) {
 #if defined(USE_VPL_ENCODER)
         auto create_video_encoder = [](const webrtc::SdpVideoFormat& format) {
@@ -152,8 +157,10 @@ std::optional<SoraVideoCodecFactory> CreateVideoCodecFactory(
               VplSession::Create(),
               webrtc::PayloadStringToCodecType(format.name));
         };
-        encoder_factory_config.encoders.push_back(
-            VideoEncoderConfig(codec.type, create_video_encoder, 16));
+        VideoEncoderConfig encoder_config(codec.type, create_video_encoder,
+                                          16);
+        encoder_config.strided_input = true;
+        encoder_factory_config.encoders.push_back(encoder_config);
 #endif
       } else if (*codec.encoder ==
                  VideoCodecImplementation::kNvidiaVideoCodec) {
@@ -185,8 +192,10 @@ std::optional<SoraVideoCodecFactory> CreateVideoCodecFactory(
           auto type = webrtc::PayloadStringToCodecType(format.name);
           return AMFVideoEncoder::Create(amf_context, type);
         };
-        encoder_factory_config.encoders.push_back(
-            VideoEncoderConfig(codec.type, create_video_encoder, 16));
+        VideoEncoderConfig encoder_config(codec.type, create_video_encoder,
+                                          16);
+        encoder_config.strided_input = true;
+        encoder_factory_config.encoders.push_back(encoder_config);
 #endif
       } else if (*codec.encoder == VideoCodecImplementation::kRaspiV4L2M2M) {
 #if defined(USE_V4L2_ENCODER)
@@ -135,6 +135,21 @@ SoraVideoEncoderFactory::CreateInternalVideoEncoder(
   return nullptr;
 }
 
+const VideoEncoderConfig* SoraVideoEncoderFactory::FindVideoEncoderConfig(
+    const webrtc::SdpVideoFormat& format) const {
+  if (formats_.empty()) {
+    GetSupportedFormats();
+  }
+  for (size_t i = 0; i < config_.encoders.size() && i < formats_.size(); i++) {
+    for (const auto& f : formats_[i]) {
+      if (f.IsSameCodec(format)) {
+        return &config_.encoders[i];
+      }
+    }
+  }
+  return nullptr;
+}
+
 std::unique_ptr<webrtc::VideoEncoder> SoraVideoEncoderFactory::Create(
     const webrtc::Environment& env,
     const webrtc::SdpVideoFormat& format) {
@@ -148,8 +163,12 @@ std::unique_ptr<webrtc::VideoEncoder> SoraVideoEncoderFactory::Create(
       encoder = std::make_unique<I420EncoderAdapter>(std::move(encoder));
     }
 
-    encoder =
-        std::make_unique<AlignedEncoderAdapter>(std::move(encoder), 16, 16);
+    // 各レイヤーのエンコーダは internal_encoder_factory_ が同じ設定から作る
+    auto enc = FindVideoEncoderConfig(format);
+    bool strided_input = enc != nullptr && enc->factory == nullptr &&
+                         enc->strided_input;
+    encoder = std::make_unique<AlignedEncoderAdapter>(std::move(encoder), 16,
+                                                      16, strided_input);
     return encoder;
   }
 
@@ -170,9 +189,12 @@ std::unique_ptr<webrtc::VideoEncoder> SoraVideoEncoderFactory::Create(
   }
 
   // アライメント付きのエンコーダを利用する
+  auto enc = FindVideoEncoderConfig(format);
+  bool strided_input =
+      enc != nullptr && enc->factory == nullptr && enc->strided_input;
   return std::unique_ptr<webrtc::VideoEncoder>(new AlignedEncoderAdapter(
       std::shared_ptr<webrtc::VideoEncoder>(std::move(encoder)), alignment,
-      alignment));
+      alignment, strided_input));
 }
 
 SoraVideoEncoderFactoryConfig GetDefaultVideoEncoderFactoryConfig(
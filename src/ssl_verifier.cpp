@@ -1,9 +1,16 @@
 #include "sora/ssl_verifier.h"
 
+#include <chrono>
 #include <cstddef>
+#include <cstdint>
 #include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
+#include <unordered_map>
 #include <utility>
 
 // WebRTC
@@ -13,13 +20,138 @@
 // OpenSSL
 #include <openssl/base.h>
 #include <openssl/bio.h>
+#include <openssl/digest.h>
 #include <openssl/err.h>
 #include <openssl/pem.h>
+#include <openssl/sha.h>
 #include <openssl/stack.h>
 #include <openssl/x509.h>
 
 namespace sora {
 
+namespace {
+
+// 検証に成功した証明書チェーンを覚えておく数と時間
+constexpr size_t kVerifyCacheSize = 256;
+constexpr std::chrono::minutes kVerifyCacheTtl(10);
+
+struct SharedState {
+  std::mutex mutex;
+  // キーは ca_cert で、std::nullopt はデフォルトのルート証明書を使う場合
+  std::map<std::optional<std::string>, std::shared_ptr<X509_STORE>> stores;
+
+  // 検証に成功した証明書チェーンの LRU。先頭が最後に使ったもの
+  struct Entry {
+    std::string key;
+    std::chrono::steady_clock::time_point expires_at;
+  };
+  std::list<Entry> verified;
+  std::unordered_map<std::string, std::list<Entry>::iterator> verified_index;
+};
+
+SharedState& GetSharedState() {
+  static SharedState state;
+  return state;
+}
+
+bool AppendDigest(X509* x509, std::string& out) {
+  unsigned char md[EVP_MAX_MD_SIZE];
+  unsigned int len = 0;
+  if (X509_digest(x509, EVP_sha256(), md, &len) == 0) {
+    return false;
+  }
+  out.append(reinterpret_cast<const char*>(md), len);
+  return true;
+}
+
+void AppendSHA256(const std::string& data, std::string& out) {
+  unsigned char md[SHA256_DIGEST_LENGTH];
+  SHA256(reinterpret_cast<const uint8_t*>(data.data()), data.size(), md);
+  out.append(reinterpret_cast<const char*>(md), sizeof(md));
+}
+
+// 検証結果のキャッシュのキー。
+// ca_cert のハッシュ、証明書のフィンガープリント、チェーン全体のハッシュを繋げたもの
+std::optional<std::string> CreateVerifyCacheKey(
+    const std::optional<std::string>& ca_cert,
+    X509* x509,
+    STACK_OF(X509) * chain) {
+  std::string key;
+  if (ca_cert) {
+    key += '1';
+    AppendSHA256(*ca_cert, key);
+  } else {
+    key += '0';
+  }
+  if (!AppendDigest(x509, key)) {
+    return std::nullopt;
+  }
+  if (chain != nullptr) {
+    std::string digests;
+    int n = sk_X509_num(chain);
+    for (int i = 0; i < n; i++) {
+      if (!AppendDigest(sk_X509_value(chain, i), digests)) {
+        return std::nullopt;
+      }
+    }
+    AppendSHA256(digests, key);
+  }
+  return key;
+}
+
+// キャッシュした後に有効期限が切れた証明書を通さないように確認する
+bool IsWithinValidity(X509* x509, STACK_OF(X509) * chain) {
+  if (X509_cmp_current_time(X509_get0_notAfter(x509)) <= 0) {
+    return false;
+  }
+  if (chain != nullptr) {
+    int n = sk_X509_num(chain);
+    for (int i = 0; i < n; i++) {
+      if (X509_cmp_current_time(X509_get0_notAfter(sk_X509_value(chain, i))) <=
+          0) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool FindVerified(const std::string& key) {
+  auto& state = GetSharedState();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  auto it = state.verified_index.find(key);
+  if (it == state.verified_index.end()) {
+    return false;
+  }
+  if (std::chrono::steady_clock::now() >= it->second->expires_at) {
+    state.verified.erase(it->second);
+    state.verified_index.erase(it);
+    return false;
+  }
+  state.verified.splice(state.verified.begin(), state.verified, it->second);
+  return true;
+}
+
+void AddVerified(const std::string& key) {
+  auto& state = GetSharedState();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  auto expires_at = std::chrono::steady_clock::now() + kVerifyCacheTtl;
+  auto it = state.verified_index.find(key);
+  if (it != state.verified_index.end()) {
+    it->second->expires_at = expires_at;
+    state.verified.splice(state.verified.begin(), state.verified, it->second);
+    return;
+  }
+  state.verified.push_front({key, expires_at});
+  state.verified_index[key] = state.verified.begin();
+  if (state.verified.size() > kVerifyCacheSize) {
+    state.verified_index.erase(state.verified.back().key);
+    state.verified.pop_back();
+  }
+}
+
+}  // namespace
+
 const char isrg_root[] = R"(
 # Issuer: CN=ISRG Root X1 O=Internet Security Research Group
 # Subject: CN=ISRG Root X1 O=Internet Security Research Group
@@ -146,6 +278,73 @@ bool SSLVerifier::LoadBuiltinSSLRootCertificates(X509_STORE* store) {
   return count_of_added_certs > 0;
 }
 
+std::shared_ptr<X509_STORE> SSLVerifier::CreateStore(
+    const std::optional<std::string>& ca_cert) {
+  std::shared_ptr<X509_STORE> store(X509_STORE_new(), X509_STORE_free);
+  if (store == nullptr) {
+    RTC_LOG(LS_ERROR) << "X509_STORE_new failed";
+    return nullptr;
+  }
+  int r = X509_STORE_set_flags(store.get(), X509_V_FLAG_TRUSTED_FIRST);
+  if (r == 0) {
+    RTC_LOG(LS_ERROR) << "X509_STORE_set_flags failed";
+    return nullptr;
+  }
+
+  if (!ca_cert) {
+    // Let's Encrypt の証明書を追加
+    if (!AddCert(isrg_root, store.get())) {
+      return nullptr;
+    }
+    if (!AddCert(lets_encrypt_r3, store.get())) {
+      return nullptr;
+    }
+
+    // WebRTC が用意しているルート証明書の設定
+    LoadBuiltinSSLRootCertificates(store.get());
+    // デフォルト証明書のパスの設定
+    X509_STORE_set_default_paths(store.get());
+    RTC_LOG(LS_INFO) << "default cert file: " << X509_get_default_cert_file();
+  } else {
+    // ルート証明書が指定されている場合、その証明書以外は読み込まない
+    if (!AddCert(*ca_cert, store.get())) {
+      RTC_LOG(LS_ERROR) << "Failed to add ca_cert: ca_cert_length="
+                        << ca_cert->size();
+      return nullptr;
+    }
+  }
+  return store;
+}
+
+std::shared_ptr<X509_STORE> SSLVerifier::GetStore(
+    const std::optional<std::string>& ca_cert) {
+  auto& state = GetSharedState();
+  {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    auto it = state.stores.find(ca_cert);
+    if (it != state.stores.end()) {
+      return it->second;
+    }
+  }
+
+  // 証明書の読み込みは重いのでロックの外で行う。
+  // 同時に作った場合は先に登録された方を使う。
+  auto store = CreateStore(ca_cert);
+  if (store == nullptr) {
+    return nullptr;
+  }
+  std::lock_guard<std::mutex> lock(state.mutex);
+  return state.stores.insert(std::make_pair(ca_cert, store)).first->second;
+}
+
+void SSLVerifier::ClearCache() {
+  auto& state = GetSharedState();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  state.stores.clear();
+  state.verified.clear();
+  state.verified_index.clear();
+}
+
 bool SSLVerifier::VerifyX509(X509* x509,
                              STACK_OF(X509) * chain,
                              const std::optional<std::string>& ca_cert) {
@@ -170,7 +369,19 @@ bool SSLVerifier::VerifyX509(X509* x509,
     }
   }
 
-  X509_STORE* store = nullptr;
+  // X509_STORE は検証中に変更しないので、複数のスレッドから同時に使っても問題ない
+  std::shared_ptr<X509_STORE> store = GetStore(ca_cert);
+  if (store == nullptr) {
+    return false;
+  }
+
+  std::optional<std::string> cache_key =
+      CreateVerifyCacheKey(ca_cert, x509, chain);
+  if (cache_key && FindVerified(*cache_key) && IsWithinValidity(x509, chain)) {
+    RTC_LOG(LS_INFO) << "X509_verify_cert skipped: verified recently";
+    return true;
+  }
+
   X509_STORE_CTX* ctx = nullptr;
 
   struct Guard {
@@ -181,49 +392,14 @@ bool SSLVerifier::VerifyX509(X509* x509,
   Guard guard([&]() {
     // nullptr を渡しても何もしない
     X509_STORE_CTX_free(ctx);
-    X509_STORE_free(store);
   });
 
-  store = X509_STORE_new();
-  if (store == nullptr) {
-    RTC_LOG(LS_ERROR) << "X509_STORE_new failed";
-    return false;
-  }
-  int r;
-  r = X509_STORE_set_flags(store, X509_V_FLAG_TRUSTED_FIRST);
-  if (r == 0) {
-    RTC_LOG(LS_ERROR) << "X509_STORE_set_flags failed";
-    return false;
-  }
-
-  if (!ca_cert) {
-    // Let's Encrypt の証明書を追加
-    if (!AddCert(isrg_root, store)) {
-      return false;
-    }
-    if (!AddCert(lets_encrypt_r3, store)) {
-      return false;
-    }
-
-    // WebRTC が用意しているルート証明書の設定
-    LoadBuiltinSSLRootCertificates(store);
-    // デフォルト証明書のパスの設定
-    X509_STORE_set_default_paths(store);
-    RTC_LOG(LS_INFO) << "default cert file: " << X509_get_default_cert_file();
-  } else {
-    // ルート証明書が指定されている場合、その証明書以外は読み込まない
-    if (!AddCert(*ca_cert, store)) {
-      RTC_LOG(LS_ERROR) << "Failed to add ca_cert: ca_cert_length="
-                        << ca_cert->size();
-      return false;
-    }
-  }
   ctx = X509_STORE_CTX_new();
   if (ctx == nullptr) {
     RTC_LOG(LS_ERROR) << "X509_STORE_CTX_new failed";
     return false;
   }
-  r = X509_STORE_CTX_init(ctx, store, x509, chain);
+  int r = X509_STORE_CTX_init(ctx, store.get(), x509, chain);
   if (r == 0) {
     RTC_LOG(LS_ERROR) << "X509_STORE_CTX_init failed";
     return false;
@@ -235,6 +411,9 @@ bool SSLVerifier::VerifyX509(X509* x509,
                             X509_STORE_CTX_get_error(ctx));
     return false;
   }
+  if (cache_key) {
+    AddVerified(*cache_key);
+  }
   return true;
 }
 
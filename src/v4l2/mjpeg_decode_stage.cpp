@@ -0,0 +1,179 @@
+#include "sora/v4l2/mjpeg_decode_stage.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+// WebRTC
+#include <api/scoped_refptr.h>
+#include <api/video/i420_buffer.h>
+#include <api/video/video_frame.h>
+#include <api/video/video_rotation.h>
+#include <rtc_base/logging.h>
+
+// libyuv
+#include <libyuv/convert.h>
+
+namespace sora {
+
+// 後段でフレームが保持されている間はバッファが返ってこないので、多めに確保できるようにしておく
+static const size_t kMaxPooledBuffers = 16;
+
+MJPEGDecodeStage::MJPEGDecodeStage(const MJPEGDecodeStageConfig& config,
+                                   on_frame_t on_frame)
+    : config_(config),
+      on_frame_(std::move(on_frame)),
+      buffer_pool_(false, kMaxPooledBuffers) {
+  config_.threads = std::max(config_.threads, 1);
+  config_.max_pending_frames = std::max(config_.max_pending_frames, 1);
+  for (int i = 0; i < config_.threads; i++) {
+    threads_.push_back(std::thread([this]() { DecodeThread(); }));
+  }
+}
+
+MJPEGDecodeStage::~MJPEGDecodeStage() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+    pending_.clear();
+  }
+  cond_.notify_all();
+  for (auto& th : threads_) {
+    th.join();
+  }
+}
+
+void MJPEGDecodeStage::Submit(const uint8_t* data,
+                              size_t size,
+                              int width,
+                              int height,
+                              int64_t timestamp_us) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (stop_) {
+    return;
+  }
+  stats_.frames_submitted++;
+
+  // デコードが追いついていないので、古いフレームから捨てる
+  while (pending_.size() >= (size_t)config_.max_pending_frames) {
+    Job& job = pending_.front();
+    results_[job.sequence] = std::nullopt;
+    free_data_.push_back(std::move(job.data));
+    pending_.pop_front();
+    stats_.frames_dropped++;
+  }
+
+  Job job;
+  job.sequence = next_sequence_++;
+  if (!free_data_.empty()) {
+    job.data = std::move(free_data_.back());
+    free_data_.pop_back();
+  }
+  job.data.assign(data, data + size);
+  job.width = width;
+  job.height = height;
+  job.timestamp_us = timestamp_us;
+  pending_.push_back(std::move(job));
+  lock.unlock();
+  cond_.notify_one();
+}
+
+void MJPEGDecodeStage::Flush() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_cond_.wait(lock, [this]() {
+    return stop_ || (next_deliver_ == next_sequence_ && !delivering_);
+  });
+}
+
+MJPEGDecodeStage::Stats MJPEGDecodeStage::GetStats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+void MJPEGDecodeStage::DecodeThread() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    cond_.wait(lock, [this]() { return stop_ || !pending_.empty(); });
+    if (stop_) {
+      return;
+    }
+    Job job = std::move(pending_.front());
+    pending_.pop_front();
+
+    lock.unlock();
+    auto buffer = Decode(job);
+    lock.lock();
+
+    if (buffer) {
+      stats_.frames_decoded++;
+      results_[job.sequence] = webrtc::VideoFrame::Builder()
+                                   .set_video_frame_buffer(buffer)
+                                   .set_timestamp_rtp(0)
+                                   .set_timestamp_us(job.timestamp_us)
+                                   .set_rotation(webrtc::kVideoRotation_0)
+                                   .build();
+    } else {
+      stats_.frames_failed++;
+      results_[job.sequence] = std::nullopt;
+    }
+    free_data_.push_back(std::move(job.data));
+    Deliver(lock);
+  }
+}
+
+webrtc::scoped_refptr<webrtc::I420Buffer> MJPEGDecodeStage::Decode(
+    const Job& job) {
+  webrtc::scoped_refptr<webrtc::I420Buffer> buffer;
+  {
+    // VideoFrameBufferPool はスレッドセーフではない
+    std::lock_guard<std::mutex> lock(mutex_);
+    buffer = buffer_pool_.CreateI420Buffer(job.width, job.height);
+  }
+  if (!buffer) {
+    buffer = webrtc::I420Buffer::Create(job.width, job.height);
+  }
+  if (config_.decode) {
+    if (!config_.decode(job.data.data(), job.data.size(), buffer.get())) {
+      return nullptr;
+    }
+    return buffer;
+  }
+  // libwebrtc の libyuv は libjpeg-turbo でデコードする
+  if (libyuv::MJPGToI420(job.data.data(), job.data.size(),
+                         buffer->MutableDataY(), buffer->StrideY(),
+                         buffer->MutableDataU(), buffer->StrideU(),
+                         buffer->MutableDataV(), buffer->StrideV(), job.width,
+                         job.height, job.width, job.height) < 0) {
+    RTC_LOG(LS_WARNING) << "MJPGToI420 Failed";
+    return nullptr;
+  }
+  return buffer;
+}
+
+void MJPEGDecodeStage::Deliver(std::unique_lock<std::mutex>& lock) {
+  // 別のスレッドが渡している場合は、そのスレッドがこのフレームも渡す
+  if (delivering_) {
+    return;
+  }
+  delivering_ = true;
+  while (true) {
+    auto it = results_.find(next_deliver_);
+    if (it == results_.end()) {
+      break;
+    }
+    std::optional<webrtc::VideoFrame> frame = std::move(it->second);
+    results_.erase(it);
+    next_deliver_++;
+    if (frame) {
+      lock.unlock();
+      on_frame_(*frame);
+      lock.lock();
+    }
+  }
+  delivering_ = false;
+  done_cond_.notify_all();
+}
+
+}  // namespace sora
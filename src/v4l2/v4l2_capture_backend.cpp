@@ -0,0 +1,51 @@
+#include "sora/v4l2/v4l2_capture_backend.h"
+
+#include <errno.h>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Linux
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "sora/v4l2/v4l2_device.h"
+
+namespace sora {
+
+namespace {
+
+class DefaultV4L2CaptureBackend : public V4L2CaptureBackend {
+ public:
+  std::optional<std::vector<V4L2Device>> EnumDevices() override {
+    return EnumV4L2CaptureDevices();
+  }
+  int Open(const std::string& path) override {
+    return open(path.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC, 0);
+  }
+  int Close(int fd) override { return close(fd); }
+  int Ioctl(int fd, unsigned long request, void* arg) override {
+    int r;
+    do {
+      r = ioctl(fd, request, arg);
+    } while (r == -1 && errno == EINTR);
+    return r;
+  }
+  void* Mmap(int fd, size_t length, off_t offset) override {
+    return mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, offset);
+  }
+  int Munmap(void* addr, size_t length) override {
+    return munmap(addr, length);
+  }
+};
+
+}  // namespace
+
+std::shared_ptr<V4L2CaptureBackend> CreateV4L2CaptureBackend() {
+  return std::make_shared<DefaultV4L2CaptureBackend>();
+}
+
+}  // namespace sora
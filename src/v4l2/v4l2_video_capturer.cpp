@@ -17,6 +17,7 @@
 #include <functional>
 #include <optional>
 #include <string>
+#include <memory>
 #include <vector>
 
 // Linux
@@ -24,8 +25,9 @@
 #include <fcntl.h>
 #include <linux/videodev2.h>
 #include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/mman.h>
-#include <sys/select.h>
 #include <unistd.h>
 
 // WebRTC
@@ -36,7 +38,7 @@
 #include <api/video/video_frame.h>
 #include <api/video/video_frame_buffer.h>
 #include <api/video/video_rotation.h>
-#include <bits/types/struct_timeval.h>
+#include <common_video/include/video_frame_buffer_pool.h>
 #include <common_video/libyuv/include/webrtc_libyuv.h>
 #include <media/base/video_common.h>
 #include <rtc_base/logging.h>
@@ -56,6 +58,191 @@
 
 namespace sora {
 
+// zero_copy の場合に使う V4L2 のバッファ。
+//
+// フレームとして貸し出したバッファは、フレームが破棄された時に Queue() でデバイスに戻す。
+// フレームはキャプチャを止めた後も残っていることがあるので、
+// mmap したメモリはこのオブジェクトが破棄されるまで解放しない。
+class V4L2BufferRing {
+ public:
+  V4L2BufferRing(std::shared_ptr<V4L2CaptureBackend> backend,
+                 int fd,
+                 int max_buffers)
+      : backend_(backend), fd_(fd), max_buffers_(max_buffers) {}
+  ~V4L2BufferRing() {
+    for (const auto& buffer : buffers_) {
+      backend_->Munmap(buffer.start, buffer.length);
+    }
+  }
+
+  bool Allocate(int count) {
+    webrtc::MutexLock lock(&mutex_);
+    struct v4l2_requestbuffers rbuffer;
+    memset(&rbuffer, 0, sizeof(v4l2_requestbuffers));
+    rbuffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    rbuffer.memory = V4L2_MEMORY_MMAP;
+    rbuffer.count = count;
+    if (backend_->Ioctl(fd_, VIDIOC_REQBUFS, &rbuffer) < 0) {
+      RTC_LOG(LS_INFO) << "Could not get buffers from device. errno = "
+                       << errno;
+      return false;
+    }
+    for (unsigned int i = 0; i < rbuffer.count; i++) {
+      if (!MapAndQueue(i)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // VIDIOC_CREATE_BUFS でバッファを 1 つ追加してデバイスに渡す。
+  // max_buffers に達しているか、ドライバが対応していない場合は false を返す。
+  bool Grow() {
+    webrtc::MutexLock lock(&mutex_);
+    if (grow_failed_ || buffers_.size() >= (size_t)max_buffers_) {
+      return false;
+    }
+    struct v4l2_create_buffers create;
+    memset(&create, 0, sizeof(create));
+    create.count = 1;
+    create.memory = V4L2_MEMORY_MMAP;
+    create.format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (backend_->Ioctl(fd_, VIDIOC_G_FMT, &create.format) < 0 ||
+        backend_->Ioctl(fd_, VIDIOC_CREATE_BUFS, &create) < 0 ||
+        create.count == 0) {
+      RTC_LOG(LS_WARNING) << "VIDIOC_CREATE_BUFS failed. errno = " << errno;
+      grow_failed_ = true;
+      return false;
+    }
+    if (!MapAndQueue(create.index)) {
+      grow_failed_ = true;
+      return false;
+    }
+    RTC_LOG(LS_INFO) << "V4L2 buffers increased to " << buffers_.size();
+    return true;
+  }
+
+  // バッファをデバイスに戻す。Stop() の後は何もしない
+  void Queue(uint32_t index) {
+    webrtc::MutexLock lock(&mutex_);
+    if (stopped_) {
+      return;
+    }
+    struct v4l2_buffer buf;
+    memset(&buf, 0, sizeof(struct v4l2_buffer));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = index;
+    if (backend_->Ioctl(fd_, VIDIOC_QBUF, &buf) < 0) {
+      RTC_LOG(LS_INFO) << __FUNCTION__ << " Failed to enqueue capture buffer";
+      return;
+    }
+    queued_++;
+  }
+
+  // VIDIOC_DQBUF でバッファを取り出した時に呼ぶ
+  void OnDequeued() {
+    webrtc::MutexLock lock(&mutex_);
+    queued_--;
+  }
+  // デバイスに渡しているバッファの数
+  int queued() {
+    webrtc::MutexLock lock(&mutex_);
+    return queued_;
+  }
+  uint8_t* data(uint32_t index) {
+    webrtc::MutexLock lock(&mutex_);
+    return static_cast<uint8_t*>(buffers_[index].start);
+  }
+  void Stop() {
+    webrtc::MutexLock lock(&mutex_);
+    stopped_ = true;
+  }
+
+ private:
+  bool MapAndQueue(uint32_t index) RTC_EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+    struct v4l2_buffer buffer;
+    memset(&buffer, 0, sizeof(v4l2_buffer));
+    buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buffer.memory = V4L2_MEMORY_MMAP;
+    buffer.index = index;
+    if (backend_->Ioctl(fd_, VIDIOC_QUERYBUF, &buffer) < 0) {
+      return false;
+    }
+    void* start = backend_->Mmap(fd_, buffer.length, buffer.m.offset);
+    if (start == MAP_FAILED) {
+      return false;
+    }
+    if (buffers_.size() <= index) {
+      buffers_.resize(index + 1);
+    }
+    buffers_[index].start = start;
+    buffers_[index].length = buffer.length;
+    if (backend_->Ioctl(fd_, VIDIOC_QBUF, &buffer) < 0) {
+      return false;
+    }
+    queued_++;
+    return true;
+  }
+
+  struct Buffer {
+    void* start = nullptr;
+    size_t length = 0;
+  };
+
+  std::shared_ptr<V4L2CaptureBackend> backend_;
+  int fd_;
+  int max_buffers_;
+  webrtc::Mutex mutex_;
+  std::vector<Buffer> buffers_ RTC_GUARDED_BY(mutex_);
+  int queued_ RTC_GUARDED_BY(mutex_) = 0;
+  bool grow_failed_ RTC_GUARDED_BY(mutex_) = false;
+  bool stopped_ RTC_GUARDED_BY(mutex_) = false;
+};
+
+// V4L2 のバッファをそのまま参照する NV12 のバッファ。
+// 破棄された時にバッファをデバイスに戻す。
+class V4L2LentNV12Buffer : public webrtc::NV12BufferInterface {
+ public:
+  V4L2LentNV12Buffer(std::shared_ptr<V4L2BufferRing> ring,
+                     uint32_t index,
+                     int width,
+                     int height,
+                     int stride)
+      : ring_(ring),
+        index_(index),
+        data_(ring->data(index)),
+        width_(width),
+        height_(height),
+        stride_(stride) {}
+  ~V4L2LentNV12Buffer() override { ring_->Queue(index_); }
+
+  int width() const override { return width_; }
+  int height() const override { return height_; }
+  const uint8_t* DataY() const override { return data_; }
+  const uint8_t* DataUV() const override { return data_ + stride_ * height_; }
+  int StrideY() const override { return stride_; }
+  int StrideUV() const override { return stride_; }
+
+  webrtc::scoped_refptr<webrtc::I420BufferInterface> ToI420() override {
+    auto i420_buffer = webrtc::I420Buffer::Create(width_, height_);
+    libyuv::NV12ToI420(DataY(), StrideY(), DataUV(), StrideUV(),
+                       i420_buffer->MutableDataY(), i420_buffer->StrideY(),
+                       i420_buffer->MutableDataU(), i420_buffer->StrideU(),
+                       i420_buffer->MutableDataV(), i420_buffer->StrideV(),
+                       width_, height_);
+    return i420_buffer;
+  }
+
+ private:
+  std::shared_ptr<V4L2BufferRing> ring_;
+  uint32_t index_;
+  const uint8_t* data_;
+  int width_;
+  int height_;
+  int stride_;
+};
+
 webrtc::scoped_refptr<V4L2VideoCapturer> V4L2VideoCapturer::Create(
     const V4L2VideoCapturerConfig& config) {
   auto capturer = webrtc::make_ref_counted<V4L2VideoCapturer>(config);
@@ -73,6 +260,7 @@ webrtc::scoped_refptr<V4L2VideoCapturer> V4L2VideoCapturer::Create(
 V4L2VideoCapturer::V4L2VideoCapturer(const V4L2VideoCapturerConfig& config)
     : ScalableVideoTrackSource(config),
       config_(config),
+      backend_(config.backend ? config.backend : CreateV4L2CaptureBackend()),
       _deviceFd(-1),
       _buffersAllocatedByDevice(-1),
       _currentWidth(-1),
@@ -81,10 +269,11 @@ V4L2VideoCapturer::V4L2VideoCapturer(const V4L2VideoCapturerConfig& config)
       _useNative(false),
       _captureStarted(false),
       _captureVideoType(webrtc::VideoType::kI420),
-      _pool(NULL) {}
+      _pool(NULL),
+      capture_buffer_pool_(false, 8 /* max_number_of_buffers*/) {}
 
 int32_t V4L2VideoCapturer::Init() {
-  auto devices = EnumV4L2CaptureDevices();
+  auto devices = backend_->EnumDevices();
   if (!devices) {
     RTC_LOG(LS_ERROR) << "Failed to enumerate V4L2 devices";
     return -1;
@@ -122,7 +311,7 @@ int32_t V4L2VideoCapturer::Init() {
 V4L2VideoCapturer::~V4L2VideoCapturer() {
   StopCapture();
   if (_deviceFd != -1)
-    close(_deviceFd);
+    backend_->Close(_deviceFd);
 }
 
 int32_t V4L2VideoCapturer::StartCapture() {
@@ -132,7 +321,7 @@ int32_t V4L2VideoCapturer::StartCapture() {
 
   webrtc::MutexLock lock(&capture_lock_);
   // first open /dev/video device
-  if ((_deviceFd = open(device_.path.c_str(), O_RDWR | O_NONBLOCK, 0)) < 0) {
+  if ((_deviceFd = backend_->Open(device_.path)) < 0) {
     RTC_LOG(LS_INFO) << "error in opening " << device_.path
                      << " errono = " << errno;
     return -1;
@@ -197,7 +386,7 @@ int32_t V4L2VideoCapturer::StartCapture() {
   video_fmt.fmt.pix.height = config_.height;
   video_fmt.fmt.pix.pixelformat = *found_format;
 
-  if (ioctl(_deviceFd, VIDIOC_S_FMT, &video_fmt) < 0) {
+  if (backend_->Ioctl(_deviceFd, VIDIOC_S_FMT, &video_fmt) < 0) {
     RTC_LOG(LS_INFO) << "error in VIDIOC_S_FMT, errno = " << errno;
     return -1;
   }
@@ -220,13 +409,20 @@ int32_t V4L2VideoCapturer::StartCapture() {
   // 現在の幅と高さを保存しておく
   _currentWidth = video_fmt.fmt.pix.width;
   _currentHeight = video_fmt.fmt.pix.height;
+  // 1 行のバイト数はドライバによってはパディングされているので、その値を使う
+  bytes_per_line_ = video_fmt.fmt.pix.bytesperline;
+  if (bytes_per_line_ == 0) {
+    bytes_per_line_ = _captureVideoType == webrtc::VideoType::kYUY2
+                          ? _currentWidth * 2
+                          : _currentWidth;
+  }
 
   // Trying to set frame rate, before check driver capability.
   bool driver_framerate_support = true;
   struct v4l2_streamparm streamparms;
   memset(&streamparms, 0, sizeof(streamparms));
   streamparms.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-  if (ioctl(_deviceFd, VIDIOC_G_PARM, &streamparms) < 0) {
+  if (backend_->Ioctl(_deviceFd, VIDIOC_G_PARM, &streamparms) < 0) {
     RTC_LOG(LS_INFO) << "error in VIDIOC_G_PARM errno = " << errno;
     driver_framerate_support = false;
     // continue
@@ -238,7 +434,7 @@ int32_t V4L2VideoCapturer::StartCapture() {
       streamparms.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
       streamparms.parm.capture.timeperframe.numerator = 1;
       streamparms.parm.capture.timeperframe.denominator = config_.framerate;
-      if (ioctl(_deviceFd, VIDIOC_S_PARM, &streamparms) < 0) {
+      if (backend_->Ioctl(_deviceFd, VIDIOC_S_PARM, &streamparms) < 0) {
         RTC_LOG(LS_INFO) << "Failed to set the framerate. errno=" << errno;
         driver_framerate_support = false;
       } else {
@@ -262,11 +458,52 @@ int32_t V4L2VideoCapturer::StartCapture() {
                    << " size: " << _currentWidth << "x" << _currentHeight
                    << " fps: " << _currentFrameRate;
 
+  if (config_.zero_copy) {
+    if (_captureVideoType == webrtc::VideoType::kNV12) {
+      ring_ = std::make_shared<V4L2BufferRing>(backend_, _deviceFd,
+                                               config_.max_buffers);
+    } else {
+      // NV12 以外はコピーが必要なので、変換先のバッファを使い回すだけにする
+      RTC_LOG(LS_INFO) << "zero_copy is only supported for NV12";
+    }
+  }
+
+  if (_captureVideoType == webrtc::VideoType::kMJPEG &&
+      config_.mjpeg_decode_threads > 0) {
+    MJPEGDecodeStageConfig stage_config;
+    stage_config.threads = config_.mjpeg_decode_threads;
+    stage_config.max_pending_frames = config_.mjpeg_max_pending_frames;
+    mjpeg_decode_stage_.reset(new MJPEGDecodeStage(
+        stage_config,
+        [this](const webrtc::VideoFrame& frame) { OnCapturedFrame(frame); }));
+  }
+
   if (!AllocateVideoBuffers()) {
     RTC_LOG(LS_INFO) << "failed to allocate video capture buffers";
     return -1;
   }
 
+  // デバイスと停止の通知を epoll で待つ
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  stop_event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (epoll_fd_ < 0 || stop_event_fd_ < 0) {
+    RTC_LOG(LS_ERROR) << "Failed to create epoll. errno = " << errno;
+    return -1;
+  }
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.fd = _deviceFd;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, _deviceFd, &ev) < 0) {
+    RTC_LOG(LS_ERROR) << "Failed to add device to epoll. errno = " << errno;
+    return -1;
+  }
+  ev.data.fd = stop_event_fd_;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, stop_event_fd_, &ev) < 0) {
+    RTC_LOG(LS_ERROR) << "Failed to add eventfd to epoll. errno = " << errno;
+    return -1;
+  }
+
   // start capture thread;
   if (_captureThread.empty()) {
     quit_ = false;
@@ -278,7 +515,7 @@ int32_t V4L2VideoCapturer::StartCapture() {
   // Needed to start UVC camera - from the uvcview application
   enum v4l2_buf_type type;
   type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-  if (ioctl(_deviceFd, VIDIOC_STREAMON, &type) == -1) {
+  if (backend_->Ioctl(_deviceFd, VIDIOC_STREAMON, &type) == -1) {
     RTC_LOG(LS_INFO) << "Failed to turn on stream";
     return -1;
   }
@@ -294,6 +531,11 @@ int32_t V4L2VideoCapturer::StopCapture() {
       webrtc::MutexLock lock(&capture_lock_);
       quit_ = true;
     }
+    // epoll_wait で待っているキャプチャスレッドを起こす
+    uint64_t value = 1;
+    if (write(stop_event_fd_, &value, sizeof(value)) < 0) {
+      RTC_LOG(LS_WARNING) << "Failed to notify stop. errno = " << errno;
+    }
     _captureThread.Finalize();
   }
 
@@ -302,9 +544,19 @@ int32_t V4L2VideoCapturer::StopCapture() {
     _captureStarted = false;
 
     DeAllocateVideoBuffers();
-    close(_deviceFd);
+    backend_->Close(_deviceFd);
     _deviceFd = -1;
   }
+  // デコード中のフレームを渡し終わるまで待つ
+  mjpeg_decode_stage_.reset();
+  if (epoll_fd_ != -1) {
+    close(epoll_fd_);
+    epoll_fd_ = -1;
+  }
+  if (stop_event_fd_ != -1) {
+    close(stop_event_fd_);
+    stop_event_fd_ = -1;
+  }
 
   return 0;
 }
@@ -312,6 +564,10 @@ int32_t V4L2VideoCapturer::StopCapture() {
 // critical section protected by the caller
 
 bool V4L2VideoCapturer::AllocateVideoBuffers() {
+  if (ring_ != nullptr) {
+    return ring_->Allocate(kNoOfV4L2Bufffers);
+  }
+
   struct v4l2_requestbuffers rbuffer;
   memset(&rbuffer, 0, sizeof(v4l2_requestbuffers));
 
@@ -319,7 +575,7 @@ bool V4L2VideoCapturer::AllocateVideoBuffers() {
   rbuffer.memory = V4L2_MEMORY_MMAP;
   rbuffer.count = kNoOfV4L2Bufffers;
 
-  if (ioctl(_deviceFd, VIDIOC_REQBUFS, &rbuffer) < 0) {
+  if (backend_->Ioctl(_deviceFd, VIDIOC_REQBUFS, &rbuffer) < 0) {
     RTC_LOG(LS_INFO) << "Could not get buffers from device. errno = " << errno;
     return false;
   }
@@ -339,22 +595,22 @@ bool V4L2VideoCapturer::AllocateVideoBuffers() {
     buffer.memory = V4L2_MEMORY_MMAP;
     buffer.index = i;
 
-    if (ioctl(_deviceFd, VIDIOC_QUERYBUF, &buffer) < 0) {
+    if (backend_->Ioctl(_deviceFd, VIDIOC_QUERYBUF, &buffer) < 0) {
       return false;
     }
 
-    _pool[i].start = mmap(NULL, buffer.length, PROT_READ | PROT_WRITE,
-                          MAP_SHARED, _deviceFd, buffer.m.offset);
+    _pool[i].start =
+        backend_->Mmap(_deviceFd, buffer.length, buffer.m.offset);
 
     if (MAP_FAILED == _pool[i].start) {
       for (unsigned int j = 0; j < i; j++)
-        munmap(_pool[j].start, _pool[j].length);
+        backend_->Munmap(_pool[j].start, _pool[j].length);
       return false;
     }
 
     _pool[i].length = buffer.length;
 
-    if (ioctl(_deviceFd, VIDIOC_QBUF, &buffer) < 0) {
+    if (backend_->Ioctl(_deviceFd, VIDIOC_QBUF, &buffer) < 0) {
       return false;
     }
   }
@@ -362,16 +618,23 @@ bool V4L2VideoCapturer::AllocateVideoBuffers() {
 }
 
 bool V4L2VideoCapturer::DeAllocateVideoBuffers() {
-  // unmap buffers
-  for (int i = 0; i < _buffersAllocatedByDevice; i++)
-    munmap(_pool[i].start, _pool[i].length);
+  if (ring_ != nullptr) {
+    // 貸し出し中のバッファはフレームが破棄された時に解放される
+    ring_->Stop();
+    ring_.reset();
+  } else {
+    // unmap buffers
+    for (int i = 0; i < _buffersAllocatedByDevice; i++)
+      backend_->Munmap(_pool[i].start, _pool[i].length);
 
-  delete[] _pool;
+    delete[] _pool;
+    _pool = NULL;
+  }
 
   // turn off stream
   enum v4l2_buf_type type;
   type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-  if (ioctl(_deviceFd, VIDIOC_STREAMOFF, &type) < 0) {
+  if (backend_->Ioctl(_deviceFd, VIDIOC_STREAMOFF, &type) < 0) {
     RTC_LOG(LS_INFO) << "VIDIOC_STREAMOFF error. errno: " << errno;
   }
 
@@ -385,29 +648,27 @@ void V4L2VideoCapturer::CaptureThread(void* obj) {
 }
 
 bool V4L2VideoCapturer::CaptureProcess() {
-  int retVal = 0;
-  fd_set rSet;
-  struct timeval timeout;
-
-  FD_ZERO(&rSet);
-  FD_SET(_deviceFd, &rSet);
-  timeout.tv_sec = 1;
-  timeout.tv_usec = 0;
+  struct epoll_event events[2];
 
-  // _deviceFd written only in StartCapture, when this thread isn't running.
-  retVal = select(_deviceFd + 1, &rSet, NULL, NULL, &timeout);
+  // 停止する時は stop_event_fd_ に書き込まれるので、タイムアウトせずに待つ。
+  // _deviceFd と epoll_fd_ はこのスレッドが動いている間は変更されない。
+  int retVal = epoll_wait(epoll_fd_, events, 2, -1);
   {
     webrtc::MutexLock lock(&capture_lock_);
 
     if (quit_) {
       return false;
-    } else if (retVal < 0 && errno != EINTR /* continue if interrupted */) {
-      // select failed
-      return false;
-    } else if (retVal == 0) {
-      // select timed out
-      return true;
-    } else if (!FD_ISSET(_deviceFd, &rSet)) {
+    } else if (retVal < 0) {
+      // 割り込まれた場合は待ち直す
+      return errno == EINTR;
+    }
+    bool readable = false;
+    for (int i = 0; i < retVal; i++) {
+      if (events[i].data.fd == _deviceFd) {
+        readable = true;
+      }
+    }
+    if (!readable) {
       // not event on camera handle
       return true;
     }
@@ -418,12 +679,20 @@ bool V4L2VideoCapturer::CaptureProcess() {
       buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
       buf.memory = V4L2_MEMORY_MMAP;
       // dequeue a buffer - repeat until dequeued properly!
-      while (ioctl(_deviceFd, VIDIOC_DQBUF, &buf) < 0) {
-        if (errno != EINTR) {
-          RTC_LOG(LS_INFO) << "could not sync on a buffer on device "
-                           << strerror(errno);
-          return true;
+      if (backend_->Ioctl(_deviceFd, VIDIOC_DQBUF, &buf) < 0) {
+        RTC_LOG(LS_INFO) << "could not sync on a buffer on device "
+                         << strerror(errno);
+        return true;
+      }
+
+      if (ring_ != nullptr) {
+        ring_->OnDequeued();
+        if (!OnCapturedZeroCopy(buf.index, buf.bytesused)) {
+          // 貸し出せない場合はコピーしてすぐにデバイスに戻す
+          OnCaptured(ring_->data(buf.index), buf.bytesused);
+          ring_->Queue(buf.index);
         }
+        return true;
       }
 
       uint8_t* data = (uint8_t*)_pool[buf.index].start;
@@ -456,7 +725,7 @@ bool V4L2VideoCapturer::CaptureProcess() {
       }
 
       // enqueue the buffer again
-      if (ioctl(_deviceFd, VIDIOC_QBUF, &buf) == -1) {
+      if (backend_->Ioctl(_deviceFd, VIDIOC_QBUF, &buf) == -1) {
         RTC_LOG(LS_INFO) << __FUNCTION__ << " Failed to enqueue capture buffer";
       }
     }
@@ -465,17 +734,65 @@ bool V4L2VideoCapturer::CaptureProcess() {
   return true;
 }
 
+std::optional<MJPEGDecodeStage::Stats>
+V4L2VideoCapturer::GetMJPEGDecodeStats() {
+  webrtc::MutexLock lock(&capture_lock_);
+  if (mjpeg_decode_stage_ == nullptr) {
+    return std::nullopt;
+  }
+  return mjpeg_decode_stage_->GetStats();
+}
+
+bool V4L2VideoCapturer::OnCapturedZeroCopy(uint32_t index,
+                                           uint32_t bytesused) {
+  const int chroma_height = (_currentHeight + 1) / 2;
+  if (bytesused <
+      (uint32_t)(bytes_per_line_ * (_currentHeight + chroma_height))) {
+    return false;
+  }
+  // デバイスに渡しているバッファが少なすぎるとフレームが落ちるので、
+  // バッファを増やせない場合はコピーする
+  if (ring_->queued() < kMinQueuedBuffers && !ring_->Grow()) {
+    return false;
+  }
+
+  auto buffer = webrtc::make_ref_counted<V4L2LentNV12Buffer>(
+      ring_, index, _currentWidth, _currentHeight, bytes_per_line_);
+  webrtc::VideoFrame video_frame = webrtc::VideoFrame::Builder()
+                                       .set_video_frame_buffer(buffer)
+                                       .set_timestamp_rtp(0)
+                                       .set_timestamp_ms(webrtc::TimeMillis())
+                                       .set_timestamp_us(webrtc::TimeMicros())
+                                       .set_rotation(webrtc::kVideoRotation_0)
+                                       .build();
+  OnCapturedFrame(video_frame);
+  return true;
+}
+
+webrtc::scoped_refptr<webrtc::NV12Buffer>
+V4L2VideoCapturer::CreateNV12Buffer() {
+  if (config_.zero_copy) {
+    // 全ての領域を上書きするので初期化は不要
+    auto buffer =
+        capture_buffer_pool_.CreateNV12Buffer(_currentWidth, _currentHeight);
+    if (buffer) {
+      return buffer;
+    }
+  }
+  auto buffer = webrtc::NV12Buffer::Create(_currentWidth, _currentHeight);
+  buffer->InitializeData();
+  return buffer;
+}
+
 void V4L2VideoCapturer::OnCaptured(uint8_t* data, uint32_t bytesused) {
   webrtc::scoped_refptr<webrtc::VideoFrameBuffer> dst_buffer = nullptr;
 
   if (_captureVideoType == webrtc::VideoType::kNV12) {
     // NV12 の場合はそのまま使用
-    webrtc::scoped_refptr<webrtc::NV12Buffer> nv12_buffer =
-        webrtc::NV12Buffer::Create(_currentWidth, _currentHeight);
-    nv12_buffer->InitializeData();
+    webrtc::scoped_refptr<webrtc::NV12Buffer> nv12_buffer = CreateNV12Buffer();
     const uint8_t* src_y = data;
-    const uint8_t* src_uv = data + _currentWidth * _currentHeight;
-    if (libyuv::NV12Copy(src_y, _currentWidth, src_uv, _currentWidth,
+    const uint8_t* src_uv = data + bytes_per_line_ * _currentHeight;
+    if (libyuv::NV12Copy(src_y, bytes_per_line_, src_uv, bytes_per_line_,
                          nv12_buffer->MutableDataY(), nv12_buffer->StrideY(),
                          nv12_buffer->MutableDataUV(), nv12_buffer->StrideUV(),
                          _currentWidth, _currentHeight) < 0) {
@@ -485,10 +802,8 @@ void V4L2VideoCapturer::OnCaptured(uint8_t* data, uint32_t bytesused) {
     }
   } else if (_captureVideoType == webrtc::VideoType::kYUY2) {
     // YUY2 の場合は NV12 に変換
-    webrtc::scoped_refptr<webrtc::NV12Buffer> nv12_buffer =
-        webrtc::NV12Buffer::Create(_currentWidth, _currentHeight);
-    nv12_buffer->InitializeData();
-    if (libyuv::YUY2ToNV12(data, _currentWidth * 2, nv12_buffer->MutableDataY(),
+    webrtc::scoped_refptr<webrtc::NV12Buffer> nv12_buffer = CreateNV12Buffer();
+    if (libyuv::YUY2ToNV12(data, bytes_per_line_, nv12_buffer->MutableDataY(),
                            nv12_buffer->StrideY(), nv12_buffer->MutableDataUV(),
                            nv12_buffer->StrideUV(), _currentWidth,
                            _currentHeight) < 0) {
@@ -496,6 +811,13 @@ void V4L2VideoCapturer::OnCaptured(uint8_t* data, uint32_t bytesused) {
     } else {
       dst_buffer = nv12_buffer;
     }
+  } else if (_captureVideoType == webrtc::VideoType::kMJPEG &&
+             mjpeg_decode_stage_ != nullptr) {
+    // 圧縮されたデータをコピーしてデコードするスレッドに渡すので、
+    // キャプチャスレッドはデコードを待たずにバッファをデバイスに戻せる
+    mjpeg_decode_stage_->Submit(data, bytesused, _currentWidth, _currentHeight,
+                                webrtc::TimeMicros());
+    return;
   } else {
     // それ以外の場合は I420 に変換
     webrtc::scoped_refptr<webrtc::I420Buffer> i420_buffer(
@@ -3,6 +3,7 @@
 #include <cstddef>
 #include <functional>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
 #include <utility>
@@ -32,6 +33,7 @@
 #include <boost/beast/http/impl/write.hpp>
 #include <boost/beast/http/message_fwd.hpp>
 #include <boost/beast/http/parser_fwd.hpp>
+#include <boost/beast/http/rfc7230.hpp>
 #include <boost/beast/http/string_body_fwd.hpp>
 #include <boost/beast/http/verb.hpp>
 #include <boost/beast/websocket/rfc6455.hpp>
@@ -53,54 +55,17 @@
 #include "sora/ssl_verifier.h"
 #include "sora/url_parts.h"
 #include "sora/version.h"
+#include "sora/websocket_connection_cache.h"
 
 namespace sora {
 
-static std::shared_ptr<boost::asio::ssl::context> CreateSSLContext(
-    const std::optional<std::string>& client_cert,
-    const std::optional<std::string>& client_key) {
-  // TLS 1.2 と 1.3 のみ対応
-  SSL_CTX* handle = ::SSL_CTX_new(::TLS_method());
-  SSL_CTX_set_min_proto_version(handle, TLS1_2_VERSION);
-  SSL_CTX_set_max_proto_version(handle, TLS1_3_VERSION);
-  auto ctx = std::make_shared<boost::asio::ssl::context>(handle);
-  //ctx.set_default_verify_paths();
-  ctx->set_options(boost::asio::ssl::context::default_workarounds |
-                   boost::asio::ssl::context::no_sslv2 |
-                   boost::asio::ssl::context::no_sslv3 |
-                   boost::asio::ssl::context::single_dh_use);
-  if (client_cert) {
-    boost::system::error_code ec;
-    ctx->use_certificate(boost::asio::buffer(*client_cert),
-                         boost::asio::ssl::context_base::file_format::pem, ec);
-    if (ec) {
-      RTC_LOG(LS_WARNING) << "client_cert is set, but use_certificate failed: "
-                          << ec.message();
-    } else {
-      RTC_LOG(LS_INFO) << "client_cert is set";
-    }
-  }
-  if (client_key) {
-    boost::system::error_code ec;
-    ctx->use_private_key(boost::asio::buffer(*client_key),
-                         boost::asio::ssl::context_base::file_format::pem, ec);
-    if (ec) {
-      RTC_LOG(LS_WARNING) << "client_key is set, but use_private_key failed: "
-                          << ec.message();
-    } else {
-      RTC_LOG(LS_INFO) << "client_key is set";
-    }
-  }
-  return ctx;
-}
-
 Websocket::Websocket(boost::asio::io_context& ioc)
     : ws_(new websocket_t(ioc)),
-      resolver_(new boost::asio::ip::tcp::resolver(ioc)),
       strand_(ws_->get_executor()),
       close_timeout_timer_(ioc),
       user_agent_(Version::GetDefaultUserAgent()) {
   ws_->write_buffer_bytes(8192);
+  InitTrafficCounter(ws_->next_layer());
 }
 Websocket::Websocket(Websocket::ssl_tag,
                      boost::asio::io_context& ioc,
@@ -108,15 +73,16 @@ Websocket::Websocket(Websocket::ssl_tag,
                      const std::optional<std::string>& client_cert,
                      const std::optional<std::string>& client_key,
                      const std::optional<std::string>& ca_cert)
-    : resolver_(new boost::asio::ip::tcp::resolver(ioc)),
-      strand_(ioc.get_executor()),
+    : strand_(ioc.get_executor()),
       close_timeout_timer_(ioc),
       insecure_(insecure),
       user_agent_(Version::GetDefaultUserAgent()),
       ca_cert_(ca_cert) {
-  ssl_ctx_ = CreateSSLContext(client_cert, client_key);
+  ssl_ctx_ = WebsocketConnectionCache::Instance().GetSSLContext(client_cert,
+                                                                client_key);
   wss_.reset(new ssl_websocket_t(ioc, *ssl_ctx_));
   InitWss(wss_.get(), insecure, ca_cert);
+  InitTrafficCounter(wss_->next_layer().next_layer());
 }
 Websocket::Websocket(boost::asio::ip::tcp::socket socket)
     : ws_(new websocket_t(std::move(socket))),
@@ -124,6 +90,7 @@ Websocket::Websocket(boost::asio::ip::tcp::socket socket)
       close_timeout_timer_(ws_->get_executor()),
       user_agent_(Version::GetDefaultUserAgent()) {
   ws_->write_buffer_bytes(8192);
+  InitTrafficCounter(ws_->next_layer());
 }
 Websocket::Websocket(https_proxy_tag,
                      boost::asio::io_context& ioc,
@@ -134,8 +101,7 @@ Websocket::Websocket(https_proxy_tag,
                      std::string proxy_url,
                      std::string proxy_username,
                      std::string proxy_password)
-    : resolver_(new boost::asio::ip::tcp::resolver(ioc)),
-      strand_(ioc.get_executor()),
+    : strand_(ioc.get_executor()),
       close_timeout_timer_(ioc),
       insecure_(insecure),
       ca_cert_(ca_cert),
@@ -145,7 +111,8 @@ Websocket::Websocket(https_proxy_tag,
       proxy_username_(std::move(proxy_username)),
       proxy_password_(std::move(proxy_password)),
       user_agent_(Version::GetDefaultUserAgent()) {
-  ssl_ctx_ = CreateSSLContext(client_cert, client_key);
+  ssl_ctx_ = WebsocketConnectionCache::Instance().GetSSLContext(client_cert,
+                                                                client_key);
 }
 
 Websocket::~Websocket() {
@@ -156,6 +123,36 @@ void Websocket::SetUserAgent(http_header_value user_agent) {
   user_agent_ = user_agent;
 }
 
+void Websocket::SetPermessageDeflate(
+    const boost::beast::websocket::permessage_deflate& pmd) {
+  pmd_ = pmd;
+}
+
+Websocket::Stats Websocket::GetStats() const {
+  Stats stats;
+  stats.permessage_deflate = pmd_negotiated_.load();
+  stats.sent_payload_bytes = sent_payload_bytes_.load();
+  stats.received_payload_bytes = received_payload_bytes_.load();
+  stats.sent_wire_bytes = traffic_->written_bytes.load();
+  stats.received_wire_bytes = traffic_->read_bytes.load();
+  return stats;
+}
+
+void Websocket::InitTrafficCounter(tcp_stream_t& stream) {
+  stream.rate_policy().counters = traffic_;
+}
+
+void Websocket::ApplyPermessageDeflate() {
+  if (!pmd_) {
+    return;
+  }
+  if (IsSSL()) {
+    wss_->set_option(*pmd_);
+  } else {
+    ws_->set_option(*pmd_);
+  }
+}
+
 bool Websocket::IsSSL() const {
   return https_proxy_ || wss_ != nullptr;
 }
@@ -226,6 +223,9 @@ void Websocket::Connect(const std::string& url, connect_callback_t on_connect) {
       on_connect(ec);
       return;
     }
+    // 前回の接続の TLS セッションがあれば再開する
+    WebsocketConnectionCache::Instance().ApplyTLSSession(
+        wss_->next_layer().native_handle(), parts_.host, insecure_, ca_cert_);
   }
 
   // ヘッダーの設定
@@ -241,12 +241,13 @@ void Websocket::Connect(const std::string& url, connect_callback_t on_connect) {
     ws_->set_option(
         boost::beast::websocket::stream_base::decorator(set_headers));
   }
+  ApplyPermessageDeflate();
 
   on_connect_ = std::move(on_connect);
 
   // DNS ルックアップ
-  resolver_->async_resolve(
-      parts_.host, parts_.GetPort(),
+  WebsocketConnectionCache::Instance().Resolve(
+      strand_.get_inner_executor(), parts_.host, parts_.GetPort(),
       std::bind(&Websocket::OnResolve, this, parts_.host, parts_.GetPort(),
                 std::placeholders::_1, std::placeholders::_2));
 }
@@ -269,18 +270,20 @@ void Websocket::OnResolve(
 
   // DNS ルックアップで得られたエンドポイントに対して接続する
   if (IsSSL()) {
-    boost::asio::async_connect(
-        wss_->next_layer().next_layer(), results.begin(), results.end(),
+    wss_->next_layer().next_layer().async_connect(
+        results,
         std::bind(&Websocket::OnSSLConnect, this, std::placeholders::_1));
   } else {
-    boost::asio::async_connect(
-        ws_->next_layer(), results.begin(), results.end(),
-        std::bind(&Websocket::OnConnect, this, std::placeholders::_1));
+    ws_->next_layer().async_connect(
+        results, std::bind(&Websocket::OnConnect, this, std::placeholders::_1));
   }
 }
 
 void Websocket::OnSSLConnect(boost::system::error_code ec) {
   if (ec) {
+    // 解決済みのアドレスが古い可能性があるので、次は DNS に問い合わせる
+    WebsocketConnectionCache::Instance().InvalidateResolve(parts_.host,
+                                                           parts_.GetPort());
     auto on_connect = std::move(on_connect_);
     on_connect(ec);
     return;
@@ -293,6 +296,8 @@ void Websocket::OnSSLConnect(boost::system::error_code ec) {
 }
 
 void Websocket::OnSSLHandshake(boost::system::error_code ec) {
+  WebsocketConnectionCache::Instance().OnTLSHandshake(
+      wss_->next_layer().native_handle(), ec);
   if (ec) {
     auto on_connect = std::move(on_connect_);
     on_connect(ec);
@@ -301,12 +306,14 @@ void Websocket::OnSSLHandshake(boost::system::error_code ec) {
 
   // Websocket のハンドシェイク
   wss_->async_handshake(
-      parts_.host, parts_.path_query_fragment,
+      handshake_response_, parts_.host, parts_.path_query_fragment,
       std::bind(&Websocket::OnHandshake, this, std::placeholders::_1));
 }
 
 void Websocket::OnConnect(boost::system::error_code ec) {
   if (ec) {
+    WebsocketConnectionCache::Instance().InvalidateResolve(parts_.host,
+                                                           parts_.GetPort());
     auto on_connect = std::move(on_connect_);
     on_connect(ec);
     return;
@@ -314,11 +321,27 @@ void Websocket::OnConnect(boost::system::error_code ec) {
 
   // Websocket のハンドシェイク
   ws_->async_handshake(
-      parts_.host, parts_.path_query_fragment,
+      handshake_response_, parts_.host, parts_.path_query_fragment,
       std::bind(&Websocket::OnHandshake, this, std::placeholders::_1));
 }
 
 void Websocket::OnHandshake(boost::system::error_code ec) {
+  if (!ec && pmd_) {
+    // Sec-WebSocket-Extensions は拡張をカンマで区切ったリストで、パラメータが付くこともあるので、
+    // 拡張の名前ごとに比較する
+    bool negotiated = false;
+    auto range = handshake_response_.equal_range(
+        boost::beast::http::field::sec_websocket_extensions);
+    for (auto it = range.first; it != range.second; ++it) {
+      if (boost::beast::http::ext_list(it->value())
+              .exists("permessage-deflate")) {
+        negotiated = true;
+        break;
+      }
+    }
+    pmd_negotiated_ = negotiated;
+    RTC_LOG(LS_INFO) << "permessage-deflate negotiated=" << pmd_negotiated_;
+  }
   auto on_connect = std::move(on_connect_);
   on_connect(ec);
 }
@@ -327,6 +350,7 @@ void Websocket::Accept(
     boost::beast::http::request<boost::beast::http::string_body> req,
     connect_callback_t on_connect) {
   on_connect_ = std::move(on_connect);
+  ApplyPermessageDeflate();
   ws_->async_accept(
       req, std::bind(&Websocket::OnAccept, this, std::placeholders::_1));
 }
@@ -389,8 +413,8 @@ void Websocket::ConnectProxy(const std::string& url,
   on_connect_ = std::move(on_connect);
 
   // proxy サーバーの DNS 解決を行う
-  resolver_->async_resolve(
-      proxy_parts_.host, proxy_parts_.GetPort(),
+  WebsocketConnectionCache::Instance().Resolve(
+      strand_.get_inner_executor(), proxy_parts_.host, proxy_parts_.GetPort(),
       std::bind(&Websocket::OnResolveProxy, this, proxy_parts_.host,
                 proxy_parts_.GetPort(), std::placeholders::_1,
                 std::placeholders::_2));
@@ -419,6 +443,8 @@ void Websocket::OnResolveProxy(
 
 void Websocket::OnConnectProxy(boost::system::error_code ec) {
   if (ec) {
+    WebsocketConnectionCache::Instance().InvalidateResolve(
+        proxy_parts_.host, proxy_parts_.GetPort());
     auto on_connect = std::move(on_connect_);
     on_connect(ec);
     return;
@@ -470,6 +496,8 @@ void Websocket::OnReadProxy(boost::system::error_code ec,
   // wss を作って、あとは普通の SSL ハンドシェイクを行う
   wss_.reset(new ssl_websocket_t(std::move(*proxy_socket_), *ssl_ctx_));
   InitWss(wss_.get(), insecure_, ca_cert_);
+  InitTrafficCounter(wss_->next_layer().next_layer());
+  ApplyPermessageDeflate();
 
   // SNI の設定を行う
   if (!SSL_set_tlsext_host_name(wss_->next_layer().native_handle(),
@@ -480,6 +508,8 @@ void Websocket::OnReadProxy(boost::system::error_code ec,
     on_connect(ec);
     return;
   }
+  WebsocketConnectionCache::Instance().ApplyTLSSession(
+      wss_->next_layer().native_handle(), parts_.host, insecure_, ca_cert_);
 
   wss_->next_layer().async_handshake(
       boost::asio::ssl::stream_base::client,
@@ -498,6 +528,7 @@ void Websocket::OnRead(read_callback_t on_read,
 
   std::string text;
   if (!ec) {
+    received_payload_bytes_ += bytes_transferred;
     text = boost::beast::buffers_to_string(read_buffer_.data());
     read_buffer_.consume(read_buffer_.size());
   }
@@ -506,39 +537,48 @@ void Websocket::OnRead(read_callback_t on_read,
 }
 
 void Websocket::WriteText(std::string text, write_callback_t on_write) {
-  boost::asio::post(strand_, std::bind(&Websocket::DoWriteText, this,
-                                       std::move(text), std::move(on_write)));
-}
-
-void Websocket::DoWriteText(std::string text, write_callback_t on_write) {
-  bool empty = write_data_.empty();
-  boost::beast::flat_buffer buffer;
-
-  const auto n = boost::asio::buffer_copy(buffer.prepare(text.size()),
-                                          boost::asio::buffer(text));
-  buffer.commit(n);
-
-  write_data_.emplace_back(
-      new WriteData{std::move(buffer), std::move(on_write), true});
-
-  if (empty) {
-    DoWrite();
+  // 書き込みループが止まっている時だけ strand に post して、
+  // それ以外はキューに積むだけにする
+  bool start = false;
+  {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    write_queue_.push_back(WriteData{std::move(text), std::move(on_write)});
+    if (!writing_) {
+      writing_ = true;
+      start = true;
+    }
+  }
+  if (start) {
+    boost::asio::post(strand_, std::bind(&Websocket::DoWrite, this));
   }
 }
+
 void Websocket::DoWrite() {
-  auto& data = write_data_.front();
+  if (write_index_ >= write_batch_.size()) {
+    // 取り出したデータを書き終わったので、キューに溜まったデータをまとめて取り出す。
+    // swap するので、どちらのバッファも確保済みの容量を使い回せる。
+    write_batch_.clear();
+    write_index_ = 0;
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    if (write_queue_.empty()) {
+      writing_ = false;
+      return;
+    }
+    write_batch_.swap(write_queue_);
+  }
 
-  RTC_LOG(LS_VERBOSE) << __FUNCTION__ << ": "
-                      << boost::beast::buffers_to_string(data->buffer.data());
+  auto& data = write_batch_[write_index_];
+
+  RTC_LOG(LS_VERBOSE) << __FUNCTION__ << ": " << data.text;
 
   if (IsSSL()) {
-    wss_->text(data->text);
-    wss_->async_write(data->buffer.data(),
+    wss_->text(true);
+    wss_->async_write(boost::asio::buffer(data.text),
                       std::bind(&Websocket::OnWrite, this,
                                 std::placeholders::_1, std::placeholders::_2));
   } else {
-    ws_->text(data->text);
-    ws_->async_write(data->buffer.data(),
+    ws_->text(true);
+    ws_->async_write(boost::asio::buffer(data.text),
                      std::bind(&Websocket::OnWrite, this, std::placeholders::_1,
                                std::placeholders::_2));
   }
@@ -557,16 +597,17 @@ void Websocket::OnWrite(boost::system::error_code ec,
     return;
   }
 
-  auto& data = write_data_.front();
-  if (data->callback) {
-    std::move(data->callback)(ec, bytes_transferred);
+  if (!ec) {
+    sent_payload_bytes_ += bytes_transferred;
   }
 
-  write_data_.erase(write_data_.begin());
-
-  if (!write_data_.empty()) {
-    DoWrite();
+  auto& data = write_batch_[write_index_];
+  if (data.callback) {
+    std::move(data.callback)(ec, bytes_transferred);
   }
+  ++write_index_;
+
+  DoWrite();
 }
 
 void Websocket::Close(close_callback_t on_close, int timeout_seconds) {
@@ -576,9 +617,9 @@ void Websocket::Close(close_callback_t on_close, int timeout_seconds) {
 
 void Websocket::CloseSocket(boost::system::error_code& ec) {
   if (IsSSL()) {
-    wss_->next_layer().next_layer().close(ec);
+    wss_->next_layer().next_layer().socket().close(ec);
   } else {
-    ws_->next_layer().close(ec);
+    ws_->next_layer().socket().close(ec);
   }
 }
 
@@ -621,9 +662,9 @@ void Websocket::OnClose(close_callback_t on_close,
 void Websocket::Cancel() {
   boost::system::error_code ec;
   if (IsSSL()) {
-    wss_->next_layer().next_layer().cancel(ec);
+    wss_->next_layer().next_layer().socket().cancel(ec);
   } else {
-    ws_->next_layer().cancel(ec);
+    ws_->next_layer().socket().cancel(ec);
   }
 }
 
@@ -0,0 +1,360 @@
+#include "sora/websocket_connection_cache.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+// WebRTC
+#include <rtc_base/logging.h>
+
+// Boost
+#include <boost/asio/any_io_executor.hpp>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/execution/context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/query.hpp>
+#include <boost/asio/ssl/context.hpp>
+#include <boost/asio/ssl/context_base.hpp>
+#include <boost/system/detail/error_code.hpp>
+
+// OpenSSL
+#include <openssl/base.h>
+#include <openssl/ex_data.h>
+#include <openssl/sha.h>
+#include <openssl/ssl.h>
+
+namespace sora {
+
+static std::shared_ptr<boost::asio::ssl::context> CreateSSLContext(
+    const std::optional<std::string>& client_cert,
+    const std::optional<std::string>& client_key) {
+  // TLS 1.2 と 1.3 のみ対応
+  SSL_CTX* handle = ::SSL_CTX_new(::TLS_method());
+  SSL_CTX_set_min_proto_version(handle, TLS1_2_VERSION);
+  SSL_CTX_set_max_proto_version(handle, TLS1_3_VERSION);
+  auto ctx = std::make_shared<boost::asio::ssl::context>(handle);
+  //ctx.set_default_verify_paths();
+  ctx->set_options(boost::asio::ssl::context::default_workarounds |
+                   boost::asio::ssl::context::no_sslv2 |
+                   boost::asio::ssl::context::no_sslv3 |
+                   boost::asio::ssl::context::single_dh_use);
+  if (client_cert) {
+    boost::system::error_code ec;
+    ctx->use_certificate(boost::asio::buffer(*client_cert),
+                         boost::asio::ssl::context_base::file_format::pem, ec);
+    if (ec) {
+      RTC_LOG(LS_WARNING) << "client_cert is set, but use_certificate failed: "
+                          << ec.message();
+    } else {
+      RTC_LOG(LS_INFO) << "client_cert is set";
+    }
+  }
+  if (client_key) {
+    boost::system::error_code ec;
+    ctx->use_private_key(boost::asio::buffer(*client_key),
+                         boost::asio::ssl::context_base::file_format::pem, ec);
+    if (ec) {
+      RTC_LOG(LS_WARNING) << "client_key is set, but use_private_key failed: "
+                          << ec.message();
+    } else {
+      RTC_LOG(LS_INFO) << "client_key is set";
+    }
+  }
+  return ctx;
+}
+
+static bool IsSessionExpired(const SSL_SESSION* session) {
+  uint64_t expires_at = static_cast<uint64_t>(SSL_SESSION_get_time(session)) +
+                        SSL_SESSION_get_timeout(session);
+  return expires_at <= static_cast<uint64_t>(std::time(nullptr));
+}
+
+// セッションを使い回せる接続かどうかを区別するためのキー。
+// ca_cert はそのまま持つと大きいのでハッシュにする
+static std::string MakeSessionKey(const std::string& host,
+                                  bool insecure,
+                                  const std::optional<std::string>& ca_cert) {
+  if (insecure) {
+    return host + "|insecure";
+  }
+  if (!ca_cert) {
+    return host + "|default";
+  }
+  uint8_t digest[SHA256_DIGEST_LENGTH];
+  SHA256(reinterpret_cast<const uint8_t*>(ca_cert->data()), ca_cert->size(),
+         digest);
+  std::string key = host + "|ca:";
+  for (uint8_t c : digest) {
+    char hex[3];
+    std::snprintf(hex, sizeof(hex), "%02x", c);
+    key += hex;
+  }
+  return key;
+}
+
+static void FreeSessionKey(void* parent,
+                           void* ptr,
+                           CRYPTO_EX_DATA* ad,
+                           int index,
+                           long argl,
+                           void* argp) {
+  delete static_cast<std::string*>(ptr);
+}
+
+// OnNewSession では SSL しか受け取れないので、セッションのキーは SSL に持たせておく
+static int GetSessionKeyIndex() {
+  static int index =
+      SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, &FreeSessionKey);
+  return index;
+}
+
+WebsocketConnectionCache& WebsocketConnectionCache::Instance() {
+  static WebsocketConnectionCache instance;
+  return instance;
+}
+
+void WebsocketConnectionCache::SetConfig(const Config& config) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  config_ = config;
+}
+
+WebsocketConnectionCache::Config WebsocketConnectionCache::GetConfig() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return config_;
+}
+
+WebsocketConnectionCache::Stats WebsocketConnectionCache::GetStats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+void WebsocketConnectionCache::Clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  ssl_contexts_.clear();
+  sessions_.clear();
+  dns_.clear();
+  // 解決中の問い合わせは、完了したら呼び出し元に結果を返す必要があるので残す
+}
+
+std::shared_ptr<boost::asio::ssl::context>
+WebsocketConnectionCache::GetSSLContext(
+    const std::optional<std::string>& client_cert,
+    const std::optional<std::string>& client_key) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!config_.ssl_context_cache) {
+    stats_.ssl_contexts_created++;
+    return CreateSSLContext(client_cert, client_key);
+  }
+
+  // 証明書が設定されていない場合と空文字の場合は区別する
+  auto key = std::make_pair(client_cert ? "1" + *client_cert : "0",
+                            client_key ? "1" + *client_key : "0");
+  auto it = ssl_contexts_.find(key);
+  if (it != ssl_contexts_.end()) {
+    return it->second;
+  }
+
+  stats_.ssl_contexts_created++;
+  auto ctx = CreateSSLContext(client_cert, client_key);
+  if (config_.tls_session_resumption) {
+    // セッションは OnNewSession で自前で保持する。
+    // TLS 1.3 ではハンドシェイクの後にチケットが送られてくるので、
+    // ハンドシェイクの直後に SSL_get1_session で取り出すのではなくコールバックで受け取る。
+    SSL_CTX_set_session_cache_mode(
+        ctx->native_handle(),
+        SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx->native_handle(),
+                            &WebsocketConnectionCache::OnNewSession);
+  }
+  ssl_contexts_.insert(std::make_pair(key, ctx));
+  return ctx;
+}
+
+const std::string* WebsocketConnectionCache::GetSessionKey(SSL* ssl) {
+  return static_cast<const std::string*>(
+      SSL_get_ex_data(ssl, GetSessionKeyIndex()));
+}
+
+int WebsocketConnectionCache::OnNewSession(SSL* ssl, SSL_SESSION* session) {
+  // ApplyTLSSession を呼んでいない接続は、検証の設定が分からないので保持しない
+  const std::string* key = GetSessionKey(ssl);
+  if (key == nullptr) {
+    return 0;
+  }
+  // 1 を返すとセッションの参照を受け取ったことになる
+  Instance().AddTLSSession(SSL_get_SSL_CTX(ssl), *key, session);
+  return 1;
+}
+
+void WebsocketConnectionCache::AddTLSSession(SSL_CTX* ctx,
+                                             const std::string& session_key,
+                                             SSL_SESSION* session) {
+  session_ptr p(session);
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto& sessions = sessions_[std::make_pair(ctx, session_key)];
+  sessions.push_back(std::move(p));
+  // 古いものから捨てる
+  while (!sessions.empty() &&
+         (sessions.size() > (size_t)config_.max_sessions_per_host ||
+          IsSessionExpired(sessions.front().get()))) {
+    sessions.erase(sessions.begin());
+  }
+}
+
+void WebsocketConnectionCache::ApplyTLSSession(
+    SSL* ssl,
+    const std::string& host,
+    bool insecure,
+    const std::optional<std::string>& ca_cert) {
+  auto key = MakeSessionKey(host, insecure, ca_cert);
+  delete static_cast<std::string*>(SSL_get_ex_data(ssl, GetSessionKeyIndex()));
+  SSL_set_ex_data(ssl, GetSessionKeyIndex(), new std::string(key));
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = sessions_.find(std::make_pair(SSL_get_SSL_CTX(ssl), key));
+  if (it == sessions_.end()) {
+    return;
+  }
+  auto& sessions = it->second;
+  while (!sessions.empty()) {
+    SSL_SESSION* session = sessions.back().get();
+    if (IsSessionExpired(session)) {
+      sessions.pop_back();
+      continue;
+    }
+    // SSL_set_session は参照カウントを増やすので、ここで解放しても問題ない
+    SSL_set_session(ssl, session);
+    // TLS 1.3 のチケットは使い回すとプライバシー上の問題があるので 1 回だけ使う
+    if (SSL_SESSION_should_be_single_use(session)) {
+      sessions.pop_back();
+    }
+    break;
+  }
+  if (sessions.empty()) {
+    sessions_.erase(it);
+  }
+}
+
+void WebsocketConnectionCache::OnTLSHandshake(SSL* ssl,
+                                              boost::system::error_code ec) {
+  const std::string* key = GetSessionKey(ssl);
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (ec) {
+    if (key != nullptr) {
+      sessions_.erase(std::make_pair(SSL_get_SSL_CTX(ssl), *key));
+    }
+    return;
+  }
+  if (SSL_session_reused(ssl)) {
+    stats_.tls_sessions_resumed++;
+  } else {
+    stats_.tls_full_handshakes++;
+  }
+}
+
+void WebsocketConnectionCache::Resolve(const boost::asio::any_io_executor& ex,
+                                       const std::string& host,
+                                       const std::string& port,
+                                       resolve_callback_t on_resolve) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  bool use_cache = config_.dns_ttl.count() > 0;
+  if (use_cache) {
+    auto it = dns_.find(std::make_pair(host, port));
+    if (it != dns_.end()) {
+      if (std::chrono::steady_clock::now() < it->second.expires_at) {
+        stats_.dns_cache_hits++;
+        auto results = it->second.results;
+        lock.unlock();
+        // キャッシュがあっても呼び出し元に同期的にコールバックしない
+        boost::asio::post(ex, [on_resolve = std::move(on_resolve), results]() {
+          on_resolve(boost::system::error_code(), results);
+        });
+        return;
+      }
+      dns_.erase(it);
+    }
+  }
+  stats_.dns_cache_misses++;
+
+  // 別の io_context の問い合わせに相乗りすると、その io_context が止まった時に
+  // 完了しなくなるので、同じ io_context の場合だけまとめる
+  void* context = &boost::asio::query(ex, boost::asio::execution::context);
+  auto key = std::make_tuple(host, port, context);
+  auto it = pending_resolves_.find(key);
+  if (it != pending_resolves_.end()) {
+    stats_.dns_coalesced++;
+    it->second.callbacks.push_back(std::move(on_resolve));
+    return;
+  }
+
+  PendingResolve& pending = pending_resolves_[key];
+  pending.id = ++next_resolve_id_;
+  pending.callbacks.push_back(std::move(on_resolve));
+
+  // resolver と pending_resolves_ のエントリはハンドラに持たせる。
+  // io_context が先に破棄された場合はハンドラが呼ばれずに破棄されるので、
+  // その時にエントリを削除して、同じアドレスに作られた別の io_context が相乗りしないようにする。
+  struct ResolveGuard {
+    WebsocketConnectionCache* cache;
+    std::tuple<std::string, std::string, void*> key;
+    uint64_t id;
+    ~ResolveGuard() { cache->RemovePendingResolve(key, id); }
+  };
+  auto guard =
+      std::make_shared<ResolveGuard>(ResolveGuard{this, key, pending.id});
+  auto resolver = std::make_shared<boost::asio::ip::tcp::resolver>(ex);
+  lock.unlock();
+
+  resolver->async_resolve(
+      host, port,
+      [this, resolver, guard, use_cache](
+          boost::system::error_code ec,
+          boost::asio::ip::tcp::resolver::results_type results) {
+        const auto& key = guard->key;
+        std::vector<resolve_callback_t> callbacks;
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          auto it = pending_resolves_.find(key);
+          if (it != pending_resolves_.end() && it->second.id == guard->id) {
+            callbacks = std::move(it->second.callbacks);
+            pending_resolves_.erase(it);
+          }
+          if (!ec && use_cache) {
+            DnsEntry entry;
+            entry.results = results;
+            entry.expires_at = std::chrono::steady_clock::now() + config_.dns_ttl;
+            dns_[std::make_pair(std::get<0>(key), std::get<1>(key))] = entry;
+          }
+        }
+        for (auto& callback : callbacks) {
+          callback(ec, results);
+        }
+      });
+}
+
+void WebsocketConnectionCache::RemovePendingResolve(
+    const std::tuple<std::string, std::string, void*>& key,
+    uint64_t id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = pending_resolves_.find(key);
+  if (it != pending_resolves_.end() && it->second.id == id) {
+    pending_resolves_.erase(it);
+  }
+}
+
+void WebsocketConnectionCache::InvalidateResolve(const std::string& host,
+                                                 const std::string& port) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  dns_.erase(std::make_pair(host, port));
+}
+
+}  // namespace sora
@@ -1,16 +1,34 @@
 #include "sora/zlib_helper.h"
 
 #include <zlib.h>
+#include <algorithm>
 #include <cstddef>
 #include <cstdint>
 #include <exception>
+#include <functional>
+#include <limits>
+#include <new>
 #include <string>
 
 // zlib
 #include <chromeconf.h>
 
+// WebRTC
+#include <rtc_base/copy_on_write_buffer.h>
+
 namespace sora {
 
+namespace {
+
+// z_stream の avail_in/avail_out は uInt なので、それを超えるサイズは分割して渡す
+constexpr size_t kMaxChunkSize = std::numeric_limits<uInt>::max();
+
+uInt ChunkSize(size_t size) {
+  return (uInt)std::min(size, kMaxChunkSize);
+}
+
+}  // namespace
+
 std::string ZlibHelper::Compress(const std::string& input, int level) {
   return Compress((const uint8_t*)input.data(), input.size(), level);
 }
@@ -18,50 +36,205 @@ std::string ZlibHelper::Compress(const std::string& input, int level) {
 std::string ZlibHelper::Compress(const uint8_t* input_buf,
                                  size_t input_size,
                                  int level) {
-  std::string output;
-  output.resize(16 * 1024);
-  uLongf output_size;
+  ZlibCompressor compressor(level);
+  return compressor.Compress(input_buf, input_size);
+}
+
+std::string ZlibHelper::Uncompress(const std::string& input) {
+  return Uncompress((const uint8_t*)input.data(), input.size());
+}
+
+std::string ZlibHelper::Uncompress(const uint8_t* input_buf,
+                                   size_t input_size) {
+  ZlibUncompressor uncompressor;
+  return uncompressor.Uncompress(input_buf, input_size);
+}
+
+// --------------------------------
+// ZlibCompressor
+// --------------------------------
+
+ZlibCompressor::ZlibCompressor(int level) {
+  stream_.zalloc = Z_NULL;
+  stream_.zfree = Z_NULL;
+  stream_.opaque = Z_NULL;
+  int ret = deflateInit(&stream_, level);
+  if (ret == Z_MEM_ERROR) {
+    throw std::bad_alloc();
+  }
+  if (ret != Z_OK) {
+    throw std::exception();
+  }
+}
+
+ZlibCompressor::~ZlibCompressor() {
+  deflateEnd(&stream_);
+}
+
+size_t ZlibCompressor::CompressBound(size_t input_size) {
+  return deflateBound(&stream_, (uLong)input_size);
+}
+
+size_t ZlibCompressor::Compress(const uint8_t* input_buf,
+                                size_t input_size,
+                                uint8_t* output_buf,
+                                size_t output_size) {
+  if (deflateReset(&stream_) != Z_OK) {
+    throw std::exception();
+  }
+
+  size_t input_offset = 0;
+  size_t output_offset = 0;
   while (true) {
-    output_size = output.size();
-    int ret = compress2((Bytef*)output.data(), &output_size, input_buf,
-                        input_size, level);
-    if (ret == Z_BUF_ERROR) {
-      output.resize(output.size() * 2);
-      continue;
+    size_t input_remain = input_size - input_offset;
+    stream_.next_in = (Bytef*)(input_buf + input_offset);
+    stream_.avail_in = ChunkSize(input_remain);
+    stream_.next_out = (Bytef*)(output_buf + output_offset);
+    stream_.avail_out = ChunkSize(output_size - output_offset);
+    uInt avail_in = stream_.avail_in;
+    uInt avail_out = stream_.avail_out;
+    int flush = input_remain > kMaxChunkSize ? Z_NO_FLUSH : Z_FINISH;
+    int ret = deflate(&stream_, flush);
+    input_offset += avail_in - stream_.avail_in;
+    output_offset += avail_out - stream_.avail_out;
+    if (ret == Z_STREAM_END) {
+      break;
     }
-    if (ret != Z_OK) {
+    if (ret != Z_OK && ret != Z_BUF_ERROR) {
+      throw std::exception();
+    }
+    // 出力バッファが足りない
+    if (output_offset == output_size) {
       throw std::exception();
     }
-    break;
   }
-  output.resize(output_size);
-  return output;
+  return output_offset;
 }
 
-std::string ZlibHelper::Uncompress(const std::string& input) {
-  return Uncompress((const uint8_t*)input.data(), input.size());
+void ZlibCompressor::Compress(const uint8_t* input_buf,
+                              size_t input_size,
+                              std::string& output) {
+  // deflateBound は入力全体を圧縮するのに十分なサイズを返すので、
+  // バッファの拡張もやり直しも発生しない
+  output.resize(CompressBound(input_size));
+  size_t size = Compress(input_buf, input_size, (uint8_t*)output.data(),
+                         output.size());
+  output.resize(size);
 }
 
-std::string ZlibHelper::Uncompress(const uint8_t* input_buf,
-                                   size_t input_size) {
+std::string ZlibCompressor::Compress(const uint8_t* input_buf,
+                                     size_t input_size) {
   std::string output;
-  output.resize(16 * 1024);
-  uLongf output_size;
+  Compress(input_buf, input_size, output);
+  return output;
+}
+
+std::string ZlibCompressor::Compress(const std::string& input) {
+  return Compress((const uint8_t*)input.data(), input.size());
+}
+
+// --------------------------------
+// ZlibUncompressor
+// --------------------------------
+
+ZlibUncompressor::ZlibUncompressor() {
+  stream_.zalloc = Z_NULL;
+  stream_.zfree = Z_NULL;
+  stream_.opaque = Z_NULL;
+  stream_.next_in = Z_NULL;
+  stream_.avail_in = 0;
+  int ret = inflateInit(&stream_);
+  if (ret == Z_MEM_ERROR) {
+    throw std::bad_alloc();
+  }
+  if (ret != Z_OK) {
+    throw std::exception();
+  }
+}
+
+ZlibUncompressor::~ZlibUncompressor() {
+  inflateEnd(&stream_);
+}
+
+size_t ZlibUncompressor::Inflate(
+    const uint8_t* input_buf,
+    size_t input_size,
+    size_t capacity,
+    const std::function<uint8_t*(size_t size)>& resize) {
+  if (inflateReset(&stream_) != Z_OK) {
+    throw std::exception();
+  }
+
+  // 同じラベルに流れるメッセージはサイズが近いことが多いので、
+  // 直前のメッセージのサイズを初期サイズにする
+  size_t output_size =
+      std::max<size_t>({16 * 1024, last_output_size_, input_size * 2, capacity});
+  uint8_t* output = resize(output_size);
+
+  size_t input_offset = 0;
+  size_t output_offset = 0;
   while (true) {
-    output_size = output.size();
-    int ret =
-        uncompress((Bytef*)output.data(), &output_size, input_buf, input_size);
-    if (ret == Z_BUF_ERROR) {
-      output.resize(output.size() * 2);
-      continue;
+    if (output_offset == output_size) {
+      // 最初からやり直さずに、拡張した部分に続きを展開する
+      output_size *= 2;
+      output = resize(output_size);
     }
-    if (ret != Z_OK) {
-      throw std::exception();
+    stream_.next_in = (Bytef*)(input_buf + input_offset);
+    stream_.avail_in = ChunkSize(input_size - input_offset);
+    stream_.next_out = (Bytef*)output + output_offset;
+    stream_.avail_out = ChunkSize(output_size - output_offset);
+    uInt avail_in = stream_.avail_in;
+    uInt avail_out = stream_.avail_out;
+    int ret = inflate(&stream_, Z_NO_FLUSH);
+    input_offset += avail_in - stream_.avail_in;
+    output_offset += avail_out - stream_.avail_out;
+    if (ret == Z_STREAM_END) {
+      break;
     }
-    break;
+    if (ret == Z_OK || ret == Z_BUF_ERROR) {
+      // 入力を使い切ったのにストリームが終わっていない
+      if (input_offset == input_size && stream_.avail_out != 0) {
+        throw std::exception();
+      }
+      continue;
+    }
+    throw std::exception();
   }
-  output.resize(output_size);
+  last_output_size_ = output_offset;
+  return output_offset;
+}
+
+void ZlibUncompressor::Uncompress(const uint8_t* input_buf,
+                                  size_t input_size,
+                                  std::string& output) {
+  size_t size = Inflate(input_buf, input_size, output.capacity(),
+                        [&output](size_t size) {
+                          output.resize(size);
+                          return (uint8_t*)output.data();
+                        });
+  output.resize(size);
+}
+
+void ZlibUncompressor::Uncompress(const uint8_t* input_buf,
+                                  size_t input_size,
+                                  webrtc::CopyOnWriteBuffer& output) {
+  size_t size = Inflate(input_buf, input_size, output.capacity(),
+                        [&output](size_t size) {
+                          output.SetSize(size);
+                          return output.MutableData();
+                        });
+  output.SetSize(size);
+}
+
+std::string ZlibUncompressor::Uncompress(const uint8_t* input_buf,
+                                         size_t input_size) {
+  std::string output;
+  Uncompress(input_buf, input_size, output);
   return output;
 }
 
+std::string ZlibUncompressor::Uncompress(const std::string& input) {
+  return Uncompress((const uint8_t*)input.data(), input.size());
+}
+
 }  // namespace sora
@@ -0,0 +1,163 @@
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// WebRTC
+#include <api/scoped_refptr.h>
+#include <api/video/i420_buffer.h>
+#include <api/video/nv12_buffer.h>
+#include <api/video/video_frame.h>
+#include <api/video/video_frame_buffer.h>
+#include <api/video_codecs/video_codec.h>
+#include <api/video_codecs/video_encoder.h>
+#include <modules/video_coding/include/video_error_codes.h>
+
+// Catch2
+#include <catch2/catch_test_macros.hpp>
+
+// Sora C++ SDK
+#include <sora/aligned_encoder_adapter.h>
+
+namespace {
+
+// 渡されたフレームを保持するだけのエンコーダ
+class FrameCapturingEncoder : public webrtc::VideoEncoder {
+ public:
+  int InitEncode(const webrtc::VideoCodec* codec_settings,
+                 const webrtc::VideoEncoder::Settings& settings) override {
+    return WEBRTC_VIDEO_CODEC_OK;
+  }
+  int32_t RegisterEncodeCompleteCallback(
+      webrtc::EncodedImageCallback* callback) override {
+    return WEBRTC_VIDEO_CODEC_OK;
+  }
+  int32_t Release() override { return WEBRTC_VIDEO_CODEC_OK; }
+  int32_t Encode(
+      const webrtc::VideoFrame& frame,
+      const std::vector<webrtc::VideoFrameType>* frame_types) override {
+    frames.push_back(frame);
+    return WEBRTC_VIDEO_CODEC_OK;
+  }
+  void SetRates(const RateControlParameters& parameters) override {}
+
+  std::vector<webrtc::VideoFrame> frames;
+};
+
+webrtc::VideoFrame CreateFrame(
+    webrtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer) {
+  return webrtc::VideoFrame::Builder()
+      .set_video_frame_buffer(buffer)
+      .set_timestamp_us(0)
+      .build();
+}
+
+// 画素の位置が分かるように、行ごとに値を変えた I420 のバッファを作る
+webrtc::scoped_refptr<webrtc::I420Buffer> CreatePatternI420(int width,
+                                                             int height) {
+  auto buffer = webrtc::I420Buffer::Create(width, height);
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      buffer->MutableDataY()[y * buffer->StrideY() + x] = (uint8_t)(y + x);
+    }
+  }
+  for (int y = 0; y < buffer->ChromaHeight(); y++) {
+    for (int x = 0; x < buffer->ChromaWidth(); x++) {
+      buffer->MutableDataU()[y * buffer->StrideU() + x] = (uint8_t)y;
+      buffer->MutableDataV()[y * buffer->StrideV() + x] = (uint8_t)(y + 1);
+    }
+  }
+  return buffer;
+}
+
+std::shared_ptr<FrameCapturingEncoder> InitAdapter(
+    std::unique_ptr<sora::AlignedEncoderAdapter>& adapter,
+    bool allow_crop_view) {
+  auto encoder = std::make_shared<FrameCapturingEncoder>();
+  adapter.reset(
+      new sora::AlignedEncoderAdapter(encoder, 16, 16, allow_crop_view));
+  webrtc::VideoCodec codec;
+  codec.width = 1920;
+  codec.height = 1080;
+  codec.numberOfSimulcastStreams = 0;
+  webrtc::VideoEncoder::Settings settings(
+      webrtc::VideoEncoder::Capabilities(false), 1, 0);
+  REQUIRE(adapter->InitEncode(&codec, settings) == WEBRTC_VIDEO_CODEC_OK);
+  return encoder;
+}
+
+}  // namespace
+
+TEST_CASE("AlignedEncoderAdapter は切り出しだけの場合に元のバッファを参照する") {
+  std::unique_ptr<sora::AlignedEncoderAdapter> adapter;
+  auto encoder = InitAdapter(adapter, true);
+
+  auto src = CreatePatternI420(1920, 1080);
+  REQUIRE(adapter->Encode(CreateFrame(src), nullptr) == WEBRTC_VIDEO_CODEC_OK);
+  REQUIRE(encoder->frames.size() == 1);
+
+  auto buffer = encoder->frames[0].video_frame_buffer();
+  REQUIRE(buffer->type() == webrtc::VideoFrameBuffer::Type::kI420);
+  REQUIRE(buffer->width() == 1920);
+  REQUIRE(buffer->height() == 1072);
+  auto i420 = buffer->GetI420();
+  // 1080 -> 1072 なので中央の 4 行目から切り出す
+  REQUIRE(i420->DataY() == src->DataY() + src->StrideY() * 4);
+  REQUIRE(i420->DataU() == src->DataU() + src->StrideU() * 2);
+  REQUIRE(i420->StrideY() == src->StrideY());
+  REQUIRE(i420->DataY()[0] == 4);
+  REQUIRE(i420->DataU()[0] == 2);
+  REQUIRE(i420->DataV()[0] == 3);
+
+  auto stats = adapter->GetStats();
+  REQUIRE(stats.crop_view_frames == 1);
+  REQUIRE(stats.pooled_scale_frames == 0);
+}
+
+TEST_CASE("AlignedEncoderAdapter は allow_crop_view が無効なら詰めたバッファに切り出す") {
+  std::unique_ptr<sora::AlignedEncoderAdapter> adapter;
+  auto encoder = InitAdapter(adapter, false);
+
+  auto src = CreatePatternI420(1920, 1080);
+  REQUIRE(adapter->Encode(CreateFrame(src), nullptr) == WEBRTC_VIDEO_CODEC_OK);
+  REQUIRE(encoder->frames.size() == 1);
+
+  auto buffer = encoder->frames[0].video_frame_buffer();
+  REQUIRE(buffer->type() == webrtc::VideoFrameBuffer::Type::kI420);
+  auto i420 = buffer->GetI420();
+  REQUIRE(i420->width() == 1920);
+  REQUIRE(i420->height() == 1072);
+  // 元のバッファとは別のメモリで、各プレーンが連続している
+  REQUIRE(i420->DataY() != src->DataY() + src->StrideY() * 4);
+  REQUIRE(i420->StrideY() == 1920);
+  REQUIRE(i420->DataU() == i420->DataY() + i420->StrideY() * 1072);
+  REQUIRE(i420->DataY()[0] == 4);
+  REQUIRE(i420->DataU()[0] == 2);
+
+  auto stats = adapter->GetStats();
+  REQUIRE(stats.crop_view_frames == 0);
+  REQUIRE(stats.pooled_scale_frames == 1);
+}
+
+TEST_CASE("AlignedEncoderAdapter は NV12 の切り出しでも UV プレーンの位置を合わせる") {
+  std::unique_ptr<sora::AlignedEncoderAdapter> adapter;
+  auto encoder = InitAdapter(adapter, true);
+
+  auto src = webrtc::NV12Buffer::Create(1920, 1080);
+  for (int y = 0; y < src->ChromaHeight(); y++) {
+    src->MutableDataUV()[y * src->StrideUV()] = (uint8_t)y;
+  }
+  REQUIRE(adapter->Encode(CreateFrame(src), nullptr) == WEBRTC_VIDEO_CODEC_OK);
+  REQUIRE(encoder->frames.size() == 1);
+
+  auto buffer = encoder->frames[0].video_frame_buffer();
+  REQUIRE(buffer->type() == webrtc::VideoFrameBuffer::Type::kNV12);
+  auto nv12 = buffer->GetNV12();
+  REQUIRE(nv12->height() == 1072);
+  REQUIRE(nv12->StrideUV() == src->StrideUV());
+  REQUIRE(nv12->DataUV()[0] == 2);
+
+  // ToI420 も切り出した範囲を変換する
+  auto i420 = buffer->ToI420();
+  REQUIRE(i420->height() == 1072);
+  REQUIRE(i420->DataU()[0] == 2);
+}
@@ -0,0 +1,67 @@
+#include "bench_util.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <vector>
+
+#if defined(__linux__)
+#include <unistd.h>
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#endif
+
+// WebRTC
+#include <api/video/video_frame.h>
+
+// Sora C++ SDK
+#include <sora/boost_json_iwyu.h>
+
+int64_t GetResidentMemoryBytes() {
+#if defined(__linux__)
+  std::ifstream ifs("/proc/self/statm");
+  int64_t size = 0;
+  int64_t resident = 0;
+  if (!(ifs >> size >> resident)) {
+    return 0;
+  }
+  return resident * sysconf(_SC_PAGESIZE);
+#elif defined(__APPLE__)
+  mach_task_basic_info info;
+  mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+  if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info,
+                &count) != KERN_SUCCESS) {
+    return 0;
+  }
+  return info.resident_size;
+#else
+  return 0;
+#endif
+}
+
+double Percentile(std::vector<double> values, double p) {
+  if (values.empty()) {
+    return 0;
+  }
+  std::sort(values.begin(), values.end());
+  return values[static_cast<size_t>(p * (values.size() - 1))];
+}
+
+boost::json::value Summarize(const std::vector<double>& values) {
+  if (values.empty()) {
+    return nullptr;
+  }
+  return boost::json::object{
+      {"count", values.size()},
+      {"p50", Percentile(values, 0.50)},
+      {"p95", Percentile(values, 0.95)},
+      {"p99", Percentile(values, 0.99)},
+      {"max", Percentile(values, 1.0)},
+  };
+}
+
+void FirstFrameSink::OnFrame(const webrtc::VideoFrame& frame) {
+  if (!received.exchange(true) && on_frame) {
+    on_frame();
+  }
+}
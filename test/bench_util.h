@@ -0,0 +1,34 @@
+#ifndef TEST_BENCH_UTIL_H_
+#define TEST_BENCH_UTIL_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// WebRTC
+#include <api/video/video_frame.h>
+#include <api/video/video_sink_interface.h>
+
+// Sora C++ SDK
+#include <sora/boost_json_iwyu.h>
+
+// ベンチマークのツールで共通して使う処理
+
+// プロセスの常駐メモリのバイト数。取得できない環境では 0 を返す
+int64_t GetResidentMemoryBytes();
+
+// values を小さい順に並べた時に p (0.0 〜 1.0) の位置にある値。values が空の場合は 0 を返す
+double Percentile(std::vector<double> values, double p);
+
+// values の個数と p50, p95, p99, max をまとめた JSON。values が空の場合は null を返す
+boost::json::value Summarize(const std::vector<double>& values);
+
+// 最初のフレームを受け取った時に 1 回だけ on_frame を呼ぶシンク
+struct FirstFrameSink : webrtc::VideoSinkInterface<webrtc::VideoFrame> {
+  std::atomic<bool> received{false};
+  std::function<void()> on_frame;
+  void OnFrame(const webrtc::VideoFrame& frame) override;
+};
+
+#endif
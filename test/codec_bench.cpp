@@ -0,0 +1,767 @@
+// SoraVideoEncoderFactory と SoraVideoDecoderFactory で作ったエンコーダ/デコーダの性能を計測する
+//
+// codec_bench <param.json>
+//
+// param.json の例:
+// {
+//   "openh264": "/path/to/libopenh264.so",
+//   "yuv_file": "input_1280x720.yuv",  // 省略時は FakeVideoCapturer の映像を使う
+//   "frames": 300,
+//   "fps": 30,
+//   "quality": true,                     // PSNR/SSIM を計算する
+//   "output": "codec_bench.json",
+//   "cases": [
+//     {
+//       "implementation": "internal",
+//       "codec_type": "VP8",
+//       "width": 1280,
+//       "height": 720,
+//       "bitrate": 2500,                 // kbps
+//       "simulcast_layers": 3,
+//     },
+//   ],
+// }
+//
+// yuv_file は I420 の生データで、解像度は各 case の width, height として扱う。
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// WebRTC
+#include <api/environment/environment.h>
+#include <api/environment/environment_factory.h>
+#include <api/scoped_refptr.h>
+#include <api/video/encoded_image.h>
+#include <api/video/i420_buffer.h>
+#include <api/video/video_bitrate_allocation.h>
+#include <api/video/video_codec_type.h>
+#include <api/video/video_frame.h>
+#include <api/video/video_frame_buffer.h>
+#include <api/video/video_frame_type.h>
+#include <api/video/video_sink_interface.h>
+#include <api/video/video_source_interface.h>
+#include <api/video_codecs/sdp_video_format.h>
+#include <api/video_codecs/video_codec.h>
+#include <api/video_codecs/video_decoder.h>
+#include <api/video_codecs/video_encoder.h>
+#include <modules/video_coding/include/video_error_codes.h>
+#include <rtc_base/logging.h>
+
+#ifdef _WIN32
+#include <rtc_base/win/scoped_com_initializer.h>
+#endif
+
+// libyuv
+#include <libyuv/compare.h>
+
+// Sora C++ SDK
+#include <sora/boost_json_iwyu.h>
+#include <sora/capturer/fake_video_capturer.h>
+#include <sora/sora_video_codec.h>
+#include <sora/sora_video_codec_factory.h>
+
+#include "bench_util.h"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+struct BenchCase {
+  sora::VideoCodecImplementation implementation =
+      sora::VideoCodecImplementation::kInternal;
+  webrtc::VideoCodecType codec_type = webrtc::kVideoCodecVP8;
+  int width = 1280;
+  int height = 720;
+  int bitrate_kbps = 2500;
+  int simulcast_layers = 1;
+};
+
+struct BenchConfig {
+  std::optional<std::string> openh264;
+  std::optional<std::string> yuv_file;
+  int frames = 300;
+  int fps = 30;
+  bool quality = false;
+  std::string output = "codec_bench.json";
+  std::vector<BenchCase> cases;
+};
+
+double ElapsedMs(Clock::time_point start, Clock::time_point end) {
+  return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+// エンコーダに入力するフレームを用意する
+class FrameSource {
+ public:
+  virtual ~FrameSource() = default;
+  // index 番目のフレームを返す。用意できなかった場合は nullptr
+  virtual webrtc::scoped_refptr<webrtc::I420BufferInterface> GetFrame(
+      int index) = 0;
+};
+
+// FakeVideoCapturer の映像を最初に 1 秒分だけ集めて、それを繰り返し使う。
+// エンコーダの速度がキャプチャの速度に制限されないようにするため。
+class FakeFrameSource : public FrameSource,
+                        public webrtc::VideoSinkInterface<webrtc::VideoFrame> {
+ public:
+  static std::unique_ptr<FakeFrameSource> Create(int width,
+                                                 int height,
+                                                 int fps) {
+    std::unique_ptr<FakeFrameSource> source(new FakeFrameSource(fps));
+    sora::FakeVideoCapturerConfig config;
+    config.width = width;
+    config.height = height;
+    config.fps = fps;
+    config.load_generation = true;
+    config.pre_render_frames = fps;
+    auto capturer = sora::FakeVideoCapturer::Create(config);
+    if (capturer == nullptr) {
+      return nullptr;
+    }
+    capturer->AddOrUpdateSink(source.get(), webrtc::VideoSinkWants());
+    bool ok;
+    {
+      std::unique_lock<std::mutex> lock(source->mutex_);
+      ok = source->cond_.wait_for(
+          lock, std::chrono::seconds(10), [&source]() {
+            return source->frames_.size() >= source->max_frames_;
+          });
+    }
+    capturer->RemoveSink(source.get());
+    capturer->StopCapture();
+    if (!ok) {
+      std::cerr << "Failed to capture frames" << std::endl;
+      return nullptr;
+    }
+    return source;
+  }
+
+  void OnFrame(const webrtc::VideoFrame& frame) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (frames_.size() >= max_frames_) {
+      return;
+    }
+    frames_.push_back(frame.video_frame_buffer()->ToI420());
+    if (frames_.size() >= max_frames_) {
+      cond_.notify_all();
+    }
+  }
+
+  webrtc::scoped_refptr<webrtc::I420BufferInterface> GetFrame(
+      int index) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return frames_[index % frames_.size()];
+  }
+
+ private:
+  explicit FakeFrameSource(int fps) : max_frames_(std::max(fps, 1)) {}
+
+  size_t max_frames_;
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::vector<webrtc::scoped_refptr<webrtc::I420BufferInterface>> frames_;
+};
+
+// I420 の生データのファイルからフレームを読む。
+// ファイルの終端まで読んだら先頭に戻る。
+class YuvFileFrameSource : public FrameSource {
+ public:
+  static std::unique_ptr<YuvFileFrameSource> Create(const std::string& path,
+                                                    int width,
+                                                    int height) {
+    std::unique_ptr<YuvFileFrameSource> source(
+        new YuvFileFrameSource(width, height));
+    source->ifs_.open(path, std::ios::binary);
+    if (!source->ifs_) {
+      std::cerr << "Failed to open " << path << std::endl;
+      return nullptr;
+    }
+    source->ifs_.seekg(0, std::ios::end);
+    source->frame_count_ =
+        static_cast<int>(source->ifs_.tellg() / source->frame_size_);
+    if (source->frame_count_ == 0) {
+      std::cerr << "No frames in " << path << std::endl;
+      return nullptr;
+    }
+    return source;
+  }
+
+  webrtc::scoped_refptr<webrtc::I420BufferInterface> GetFrame(
+      int index) override {
+    auto buffer = webrtc::I420Buffer::Create(width_, height_);
+    ifs_.seekg(static_cast<std::streamoff>(index % frame_count_) *
+               frame_size_);
+    int chroma_width = (width_ + 1) / 2;
+    int chroma_height = (height_ + 1) / 2;
+    if (!ReadPlane(buffer->MutableDataY(), buffer->StrideY(), width_,
+                   height_) ||
+        !ReadPlane(buffer->MutableDataU(), buffer->StrideU(), chroma_width,
+                   chroma_height) ||
+        !ReadPlane(buffer->MutableDataV(), buffer->StrideV(), chroma_width,
+                   chroma_height)) {
+      return nullptr;
+    }
+    return buffer;
+  }
+
+ private:
+  YuvFileFrameSource(int width, int height)
+      : width_(width),
+        height_(height),
+        frame_size_(static_cast<size_t>(width) * height +
+                    2 * static_cast<size_t>((width + 1) / 2) *
+                        ((height + 1) / 2)) {}
+
+  bool ReadPlane(uint8_t* data, int stride, int width, int height) {
+    for (int y = 0; y < height; y++) {
+      if (!ifs_.read(reinterpret_cast<char*>(data + y * stride), width)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  int width_;
+  int height_;
+  size_t frame_size_;
+  int frame_count_ = 0;
+  std::ifstream ifs_;
+};
+
+struct LayerResult {
+  int width = 0;
+  int height = 0;
+  int encoded_frames = 0;
+  uint64_t encoded_bytes = 0;
+  int decoded_frames = 0;
+  // Decode() が WEBRTC_VIDEO_CODEC_OK 以外を返した回数
+  int decode_errors = 0;
+  double decode_elapsed_ms = 0;
+  std::vector<double> decode_latencies_ms;
+  double psnr_sum = 0;
+  double ssim_sum = 0;
+  int quality_frames = 0;
+};
+
+// エンコード結果を受け取って、レイヤーごとに保持する
+class EncodedCollector : public webrtc::EncodedImageCallback {
+ public:
+  explicit EncodedCollector(int layers) : images_(layers) {}
+
+  Result OnEncodedImage(
+      const webrtc::EncodedImage& encoded_image,
+      const webrtc::CodecSpecificInfo* codec_specific_info) override {
+    auto now = Clock::now();
+    std::lock_guard<std::mutex> lock(mutex_);
+    int layer = encoded_image.SimulcastIndex().value_or(0);
+    if (layer < static_cast<int>(images_.size())) {
+      // エンコーダによっては出力バッファを使い回すので、コピーして保持する
+      webrtc::EncodedImage image = encoded_image;
+      image.SetEncodedData(webrtc::EncodedImageBuffer::Create(
+          encoded_image.data(), encoded_image.size()));
+      images_[layer].push_back(std::move(image));
+    }
+    // 全レイヤーのうち最初に出てきた時刻をそのフレームのエンコード完了時刻とする
+    uint32_t rtp_timestamp = encoded_image.RtpTimestamp();
+    auto it = start_times_.find(rtp_timestamp);
+    if (it != start_times_.end()) {
+      latencies_ms_.push_back(ElapsedMs(it->second, now));
+      start_times_.erase(it);
+    }
+    encoded_count_++;
+    cond_.notify_all();
+    return Result(Result::OK);
+  }
+
+  void OnEncodeStart(uint32_t rtp_timestamp) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    start_times_[rtp_timestamp] = Clock::now();
+  }
+
+  // ハードウェアエンコーダは非同期にコールバックを呼ぶので、出力が止まるまで待つ
+  void WaitIdle() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      int count = encoded_count_;
+      if (!cond_.wait_for(lock, std::chrono::milliseconds(500),
+                          [&]() { return encoded_count_ != count; })) {
+        break;
+      }
+    }
+  }
+
+  std::vector<std::vector<webrtc::EncodedImage>> images_;
+  std::vector<double> latencies_ms_;
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::map<uint32_t, Clock::time_point> start_times_;
+  int encoded_count_ = 0;
+};
+
+// デコード結果を受け取って、遅延と画質を計算する
+class DecodedCollector : public webrtc::DecodedImageCallback {
+ public:
+  DecodedCollector(LayerResult* result,
+                   FrameSource* source,
+                   bool quality,
+                   uint32_t rtp_step)
+      : result_(result),
+        source_(source),
+        quality_(quality),
+        rtp_step_(rtp_step) {}
+
+  int32_t Decoded(webrtc::VideoFrame& frame) override {
+    auto now = Clock::now();
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = start_times_.find(frame.rtp_timestamp());
+    if (it != start_times_.end()) {
+      result_->decode_latencies_ms.push_back(ElapsedMs(it->second, now));
+      start_times_.erase(it);
+    }
+    result_->decoded_frames++;
+    last_decoded_ = now;
+
+    if (quality_) {
+      int index = static_cast<int>(frame.rtp_timestamp() / rtp_step_);
+      auto reference = source_->GetFrame(index);
+      auto decoded = frame.video_frame_buffer()->ToI420();
+      if (reference != nullptr && decoded != nullptr) {
+        // サイマルキャストの下位レイヤーは、元のフレームを縮小したものと比較する
+        if (reference->width() != decoded->width() ||
+            reference->height() != decoded->height()) {
+          auto scaled =
+              webrtc::I420Buffer::Create(decoded->width(), decoded->height());
+          scaled->ScaleFrom(*reference);
+          reference = scaled;
+        }
+        result_->psnr_sum += libyuv::I420Psnr(
+            reference->DataY(), reference->StrideY(), reference->DataU(),
+            reference->StrideU(), reference->DataV(), reference->StrideV(),
+            decoded->DataY(), decoded->StrideY(), decoded->DataU(),
+            decoded->StrideU(), decoded->DataV(), decoded->StrideV(),
+            decoded->width(), decoded->height());
+        result_->ssim_sum += libyuv::I420Ssim(
+            reference->DataY(), reference->StrideY(), reference->DataU(),
+            reference->StrideU(), reference->DataV(), reference->StrideV(),
+            decoded->DataY(), decoded->StrideY(), decoded->DataU(),
+            decoded->StrideU(), decoded->DataV(), decoded->StrideV(),
+            decoded->width(), decoded->height());
+        result_->quality_frames++;
+      }
+    }
+    return WEBRTC_VIDEO_CODEC_OK;
+  }
+
+  void OnDecodeStart(uint32_t rtp_timestamp) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    start_times_[rtp_timestamp] = Clock::now();
+  }
+
+  int decoded_frames() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return result_->decoded_frames;
+  }
+
+  Clock::time_point last_decoded() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return last_decoded_;
+  }
+
+ private:
+  LayerResult* result_;
+  FrameSource* source_;
+  bool quality_;
+  uint32_t rtp_step_;
+  std::mutex mutex_;
+  std::map<uint32_t, Clock::time_point> start_times_;
+  Clock::time_point last_decoded_;
+};
+
+std::optional<webrtc::SdpVideoFormat> FindFormat(
+    const std::vector<webrtc::SdpVideoFormat>& formats,
+    webrtc::VideoCodecType codec_type) {
+  std::string name = webrtc::CodecTypeToPayloadString(codec_type);
+  for (const auto& format : formats) {
+    if (format.name == name) {
+      return format;
+    }
+  }
+  return std::nullopt;
+}
+
+webrtc::VideoCodec CreateCodecSettings(const BenchCase& c, int fps) {
+  webrtc::VideoCodec codec;
+  codec.codecType = c.codec_type;
+  codec.width = c.width;
+  codec.height = c.height;
+  codec.maxFramerate = fps;
+  codec.startBitrate = c.bitrate_kbps;
+  codec.maxBitrate = c.bitrate_kbps;
+  codec.minBitrate = 30;
+  codec.qpMax = 56;
+  switch (c.codec_type) {
+    case webrtc::kVideoCodecVP8:
+      *codec.VP8() = webrtc::VideoEncoder::GetDefaultVp8Settings();
+      break;
+    case webrtc::kVideoCodecVP9:
+      *codec.VP9() = webrtc::VideoEncoder::GetDefaultVp9Settings();
+      break;
+    case webrtc::kVideoCodecH264:
+      *codec.H264() = webrtc::VideoEncoder::GetDefaultH264Settings();
+      break;
+    default:
+      break;
+  }
+
+  // 下位レイヤーから順に、縦横 1/2 ずつのレイヤーを作る
+  int layers = std::max(c.simulcast_layers, 1);
+  if (layers > 1) {
+    codec.numberOfSimulcastStreams = layers;
+    int total_pixels = 0;
+    for (int i = 0; i < layers; i++) {
+      int shift = layers - 1 - i;
+      total_pixels += (c.width >> shift) * (c.height >> shift);
+    }
+    for (int i = 0; i < layers; i++) {
+      int shift = layers - 1 - i;
+      auto& stream = codec.simulcastStream[i];
+      stream.width = c.width >> shift;
+      stream.height = c.height >> shift;
+      stream.maxFramerate = fps;
+      stream.numberOfTemporalLayers = 1;
+      stream.maxBitrate = static_cast<unsigned int>(
+          static_cast<int64_t>(c.bitrate_kbps) * stream.width * stream.height /
+          total_pixels);
+      stream.targetBitrate = stream.maxBitrate;
+      stream.minBitrate = std::min(30u, stream.maxBitrate);
+      stream.qpMax = codec.qpMax;
+      stream.active = true;
+    }
+  }
+  return codec;
+}
+
+webrtc::VideoBitrateAllocation CreateAllocation(
+    const webrtc::VideoCodec& codec) {
+  webrtc::VideoBitrateAllocation allocation;
+  if (codec.numberOfSimulcastStreams <= 1) {
+    allocation.SetBitrate(0, 0, codec.maxBitrate * 1000);
+    return allocation;
+  }
+  for (int i = 0; i < codec.numberOfSimulcastStreams; i++) {
+    allocation.SetBitrate(i, 0, codec.simulcastStream[i].maxBitrate * 1000);
+  }
+  return allocation;
+}
+
+// 1 つの case を実行して、結果を JSON で返す
+std::optional<boost::json::object> RunCase(const BenchConfig& config,
+                                           const BenchCase& c,
+                                           FrameSource* source) {
+  const webrtc::Environment env = webrtc::CreateEnvironment();
+
+  sora::SoraVideoCodecFactoryConfig factory_config;
+  if (config.openh264) {
+    factory_config.capability_config.openh264_path = *config.openh264;
+  }
+  auto capability =
+      sora::GetVideoCodecCapability(factory_config.capability_config);
+  factory_config.preference =
+      sora::CreateVideoCodecPreferenceFromImplementation(capability,
+                                                         c.implementation);
+  // 計測したいのはエンコーダそのものなので、I420 への変換は行わない
+  factory_config.encoder_factory_config.force_i420_conversion = false;
+  auto factory = sora::CreateVideoCodecFactory(factory_config);
+  if (!factory) {
+    std::cerr << "Failed to create video codec factory" << std::endl;
+    return std::nullopt;
+  }
+
+  auto encoder_format =
+      FindFormat(factory->encoder_factory->GetSupportedFormats(), c.codec_type);
+  auto decoder_format =
+      FindFormat(factory->decoder_factory->GetSupportedFormats(), c.codec_type);
+  if (!encoder_format || !decoder_format) {
+    std::cerr << "Codec not supported by this implementation" << std::endl;
+    return std::nullopt;
+  }
+
+  webrtc::VideoCodec codec = CreateCodecSettings(c, config.fps);
+  int layers = std::max<int>(codec.numberOfSimulcastStreams, 1);
+  uint32_t rtp_step = 90000 / config.fps;
+
+  // エンコード
+  EncodedCollector encoded(layers);
+  double encode_elapsed_ms = 0;
+  // Encode() が WEBRTC_VIDEO_CODEC_OK 以外を返した回数
+  int encode_errors = 0;
+  {
+    auto encoder = factory->encoder_factory->Create(env, *encoder_format);
+    if (encoder == nullptr) {
+      std::cerr << "Failed to create encoder" << std::endl;
+      return std::nullopt;
+    }
+    encoder->RegisterEncodeCompleteCallback(&encoded);
+    webrtc::VideoEncoder::Settings settings(
+        webrtc::VideoEncoder::Capabilities(false), 1, 1200);
+    if (encoder->InitEncode(&codec, settings) != WEBRTC_VIDEO_CODEC_OK) {
+      std::cerr << "Failed to initialize encoder" << std::endl;
+      return std::nullopt;
+    }
+    encoder->SetRates(webrtc::VideoEncoder::RateControlParameters(
+        CreateAllocation(codec), config.fps));
+
+    auto start = Clock::now();
+    for (int i = 0; i < config.frames; i++) {
+      auto buffer = source->GetFrame(i);
+      if (buffer == nullptr) {
+        std::cerr << "Failed to read frame " << i << std::endl;
+        return std::nullopt;
+      }
+      auto frame = webrtc::VideoFrame::Builder()
+                       .set_video_frame_buffer(buffer)
+                       .set_rtp_timestamp(i * rtp_step)
+                       .set_timestamp_us(i * 1000000LL / config.fps)
+                       .build();
+      std::vector<webrtc::VideoFrameType> frame_types(
+          layers, i == 0 ? webrtc::VideoFrameType::kVideoFrameKey
+                         : webrtc::VideoFrameType::kVideoFrameDelta);
+      encoded.OnEncodeStart(frame.rtp_timestamp());
+      int ret = encoder->Encode(frame, &frame_types);
+      if (ret != WEBRTC_VIDEO_CODEC_OK) {
+        std::cerr << "Failed to encode frame " << i << ": ret=" << ret
+                  << std::endl;
+        encode_errors++;
+      }
+    }
+    encoded.WaitIdle();
+    encode_elapsed_ms = ElapsedMs(start, Clock::now());
+    encoder->Release();
+  }
+
+  // レイヤーごとにデコード
+  std::vector<LayerResult> results(layers);
+  for (int layer = 0; layer < layers; layer++) {
+    LayerResult& result = results[layer];
+    const auto& images = encoded.images_[layer];
+    result.encoded_frames = static_cast<int>(images.size());
+    for (const auto& image : images) {
+      result.encoded_bytes += image.size();
+      result.width = std::max<int>(result.width, image._encodedWidth);
+      result.height = std::max<int>(result.height, image._encodedHeight);
+    }
+    if (images.empty()) {
+      continue;
+    }
+
+    auto decoder = factory->decoder_factory->Create(env, *decoder_format);
+    if (decoder == nullptr) {
+      std::cerr << "Failed to create decoder" << std::endl;
+      return std::nullopt;
+    }
+    DecodedCollector decoded(&result, source, config.quality, rtp_step);
+    decoder->RegisterDecodeCompleteCallback(&decoded);
+    webrtc::VideoDecoder::Settings settings;
+    settings.set_codec_type(c.codec_type);
+    settings.set_max_render_resolution({c.width, c.height});
+    settings.set_number_of_cores(1);
+    if (!decoder->Configure(settings)) {
+      std::cerr << "Failed to configure decoder" << std::endl;
+      return std::nullopt;
+    }
+
+    auto start = Clock::now();
+    for (const auto& image : images) {
+      decoded.OnDecodeStart(image.RtpTimestamp());
+      int ret = decoder->Decode(image, false, 0);
+      if (ret != WEBRTC_VIDEO_CODEC_OK) {
+        std::cerr << "Failed to decode frame on layer " << layer
+                  << ": ret=" << ret << std::endl;
+        result.decode_errors++;
+      }
+    }
+    // 非同期なデコーダの出力が止まるまで待つ
+    int decoded_frames = -1;
+    while (decoded_frames != decoded.decoded_frames()) {
+      decoded_frames = decoded.decoded_frames();
+      std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    }
+    decoder->Release();
+    if (decoded_frames > 0) {
+      result.decode_elapsed_ms = ElapsedMs(start, decoded.last_decoded());
+    }
+  }
+
+  double duration_sec = static_cast<double>(config.frames) / config.fps;
+  boost::json::array layers_json;
+  for (const auto& result : results) {
+    boost::json::object obj{
+        {"width", result.width},
+        {"height", result.height},
+        {"encoded_frames", result.encoded_frames},
+        {"bitrate_kbps", result.encoded_bytes * 8 / duration_sec / 1000},
+        {"decoded_frames", result.decoded_frames},
+        {"decode_errors", result.decode_errors},
+        {"decode_fps", result.decode_elapsed_ms > 0
+                           ? result.decoded_frames * 1000.0 /
+                                 result.decode_elapsed_ms
+                           : 0.0},
+        {"decode_latency_ms", Summarize(result.decode_latencies_ms)},
+    };
+    if (config.quality && result.quality_frames > 0) {
+      obj["psnr"] = result.psnr_sum / result.quality_frames;
+      obj["ssim"] = result.ssim_sum / result.quality_frames;
+    }
+    layers_json.push_back(std::move(obj));
+  }
+
+  return boost::json::object{
+      {"implementation", boost::json::value_from(c.implementation)},
+      {"codec_type", boost::json::value_from(c.codec_type)},
+      {"width", c.width},
+      {"height", c.height},
+      {"bitrate", c.bitrate_kbps},
+      {"simulcast_layers", layers},
+      {"frames", config.frames},
+      {"encode_errors", encode_errors},
+      {"encode_fps", encode_elapsed_ms > 0
+                         ? config.frames * 1000.0 / encode_elapsed_ms
+                         : 0.0},
+      {"encode_latency_ms", Summarize(encoded.latencies_ms_)},
+      {"layers", std::move(layers_json)},
+  };
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    std::cout << argv[0] << " <param.json>" << std::endl;
+    return -1;
+  }
+
+#ifdef _WIN32
+  webrtc::ScopedCOMInitializer com_initializer(
+      webrtc::ScopedCOMInitializer::kMTA);
+  if (!com_initializer.Succeeded()) {
+    std::cerr << "CoInitializeEx failed" << std::endl;
+    return 1;
+  }
+#endif
+
+  webrtc::LogMessage::LogToDebug(webrtc::LS_WARNING);
+  webrtc::LogMessage::LogTimestamps();
+  webrtc::LogMessage::LogThreads();
+
+  boost::json::value v;
+  {
+    std::ifstream ifs(argv[1]);
+    std::ostringstream oss;
+    oss << ifs.rdbuf();
+    std::string js = oss.str();
+    boost::json::parse_options opt;
+    opt.allow_comments = true;
+    opt.allow_trailing_commas = true;
+    v = boost::json::parse(js, {}, opt);
+  }
+
+  boost::json::value x;
+  auto get = [](const boost::json::value& v, const char* key,
+                boost::json::value& x) -> bool {
+    if (auto it = v.as_object().find(key);
+        it != v.as_object().end() && !it->value().is_null()) {
+      x = it->value();
+      return true;
+    }
+    return false;
+  };
+
+  BenchConfig config;
+  if (get(v, "openh264", x)) {
+    config.openh264 = x.as_string().c_str();
+  }
+  if (get(v, "yuv_file", x)) {
+    config.yuv_file = x.as_string().c_str();
+  }
+  if (get(v, "frames", x)) {
+    config.frames = x.to_number<int>();
+  }
+  if (get(v, "fps", x)) {
+    config.fps = x.to_number<int>();
+  }
+  if (get(v, "quality", x)) {
+    config.quality = x.as_bool();
+  }
+  if (get(v, "output", x)) {
+    config.output = x.as_string().c_str();
+  }
+  for (auto&& cv : v.as_object().at("cases").as_array()) {
+    BenchCase c;
+    if (get(cv, "implementation", x)) {
+      c.implementation =
+          boost::json::value_to<sora::VideoCodecImplementation>(x);
+    }
+    if (get(cv, "codec_type", x)) {
+      c.codec_type = boost::json::value_to<webrtc::VideoCodecType>(x);
+    }
+    if (get(cv, "width", x)) {
+      c.width = x.to_number<int>();
+    }
+    if (get(cv, "height", x)) {
+      c.height = x.to_number<int>();
+    }
+    if (get(cv, "bitrate", x)) {
+      c.bitrate_kbps = x.to_number<int>();
+    }
+    if (get(cv, "simulcast_layers", x)) {
+      c.simulcast_layers = x.to_number<int>();
+    }
+    config.cases.push_back(c);
+  }
+
+  boost::json::array results;
+  int failed = 0;
+  for (const auto& c : config.cases) {
+    std::cout << "Running: " << boost::json::value_from(c.implementation)
+              << " " << boost::json::value_from(c.codec_type) << " " << c.width
+              << "x" << c.height << " layers=" << c.simulcast_layers
+              << std::endl;
+    std::unique_ptr<FrameSource> source;
+    if (config.yuv_file) {
+      source = YuvFileFrameSource::Create(*config.yuv_file, c.width, c.height);
+    } else {
+      source = FakeFrameSource::Create(c.width, c.height, config.fps);
+    }
+    if (source == nullptr) {
+      failed++;
+      continue;
+    }
+    auto result = RunCase(config, c, source.get());
+    if (!result) {
+      failed++;
+      continue;
+    }
+    std::cout << boost::json::serialize(*result) << std::endl;
+    results.push_back(std::move(*result));
+  }
+
+  std::ofstream ofs(config.output);
+  ofs << boost::json::serialize(boost::json::object{{"results", results}})
+      << std::endl;
+
+  return failed == 0 ? 0 : 1;
+}
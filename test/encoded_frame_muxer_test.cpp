@@ -0,0 +1,232 @@
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// WebRTC
+#include <api/array_view.h>
+
+// Catch2
+#include <catch2/catch_test_macros.hpp>
+
+// Sora C++ SDK
+#include <sora/recorder/encoded_frame_muxer.h>
+
+namespace {
+
+uint64_t GetLE(const std::string& s, size_t offset, int bytes) {
+  uint64_t v = 0;
+  for (int i = 0; i < bytes; i++) {
+    v |= static_cast<uint64_t>(static_cast<uint8_t>(s[offset + i])) << (i * 8);
+  }
+  return v;
+}
+
+sora::EncodedFrameMuxer::Frame CreateFrame(const std::vector<uint8_t>& data,
+                                           uint32_t rtp_timestamp,
+                                           const std::string& mime_type,
+                                           bool key_frame) {
+  sora::EncodedFrameMuxer::Frame frame;
+  frame.data = webrtc::ArrayView<const uint8_t>(data);
+  frame.rtp_timestamp = rtp_timestamp;
+  frame.mime_type = mime_type;
+  frame.key_frame = key_frame;
+  if (key_frame) {
+    frame.width = 640;
+    frame.height = 480;
+  }
+  return frame;
+}
+
+struct OggPage {
+  uint8_t header_type;
+  uint64_t granule;
+  uint32_t serial;
+  uint32_t sequence;
+  std::vector<uint8_t> lacing;
+  std::string body;
+  bool crc_ok;
+};
+
+// data の先頭から Ogg のページを全て読み込む
+std::vector<OggPage> ParseOggPages(const std::string& data) {
+  std::vector<OggPage> pages;
+  size_t offset = 0;
+  while (offset < data.size()) {
+    REQUIRE(data.size() - offset >= 27);
+    REQUIRE(data.compare(offset, 4, "OggS") == 0);
+    OggPage page;
+    page.header_type = static_cast<uint8_t>(data[offset + 5]);
+    page.granule = GetLE(data, offset + 6, 8);
+    page.serial = static_cast<uint32_t>(GetLE(data, offset + 14, 4));
+    page.sequence = static_cast<uint32_t>(GetLE(data, offset + 18, 4));
+    uint32_t crc = static_cast<uint32_t>(GetLE(data, offset + 22, 4));
+    size_t segments = static_cast<uint8_t>(data[offset + 26]);
+    size_t body_size = 0;
+    for (size_t i = 0; i < segments; i++) {
+      uint8_t v = static_cast<uint8_t>(data[offset + 27 + i]);
+      page.lacing.push_back(v);
+      body_size += v;
+    }
+    size_t header_size = 27 + segments;
+    REQUIRE(data.size() - offset >= header_size + body_size);
+    page.body = data.substr(offset + header_size, body_size);
+    // CRC はフィールドを 0 にしたページ全体に対して計算する
+    std::string raw = data.substr(offset, header_size + body_size);
+    raw.replace(22, 4, 4, '\0');
+    page.crc_ok = sora::OggOpusMuxer::Crc(raw) == crc;
+    pages.push_back(page);
+    offset += header_size + body_size;
+  }
+  return pages;
+}
+
+// CELT 20ms のモノラルのパケット (1 パケット 960 サンプル)
+std::vector<uint8_t> CreateOpusPacket(size_t size, uint8_t fill) {
+  std::vector<uint8_t> packet(size, fill);
+  packet[0] = 31 << 3;
+  return packet;
+}
+
+}  // namespace
+
+TEST_CASE("IvfMuxer は最初のキーフレームでファイルヘッダーを書き込む") {
+  sora::IvfMuxer muxer;
+  std::vector<uint8_t> key = {1, 2, 3};
+  std::vector<uint8_t> delta = {4, 5};
+
+  std::string out;
+  REQUIRE(muxer.Mux(CreateFrame(key, 1000, "video/VP8", true), out));
+  REQUIRE(out.size() == 32 + 12 + 3);
+  REQUIRE(out.compare(0, 4, "DKIF") == 0);
+  REQUIRE(GetLE(out, 4, 2) == 0);
+  REQUIRE(GetLE(out, 6, 2) == 32);
+  REQUIRE(out.compare(8, 4, "VP80") == 0);
+  REQUIRE(GetLE(out, 12, 2) == 640);
+  REQUIRE(GetLE(out, 14, 2) == 480);
+  REQUIRE(GetLE(out, 16, 4) == 90000);
+  REQUIRE(GetLE(out, 20, 4) == 1);
+  REQUIRE(GetLE(out, 24, 4) == 0);
+  REQUIRE(GetLE(out, 28, 4) == 0);
+  // フレームヘッダーはサイズと、最初のフレームからの経過時間
+  REQUIRE(GetLE(out, 32, 4) == 3);
+  REQUIRE(GetLE(out, 36, 8) == 0);
+  REQUIRE(out.compare(44, 3, "\x01\x02\x03") == 0);
+
+  // 2 フレーム目以降はファイルヘッダーを書かない
+  out.clear();
+  REQUIRE(muxer.Mux(CreateFrame(delta, 4000, "video/VP8", false), out));
+  REQUIRE(out.size() == 12 + 2);
+  REQUIRE(GetLE(out, 0, 4) == 2);
+  REQUIRE(GetLE(out, 4, 8) == 3000);
+
+  // RTP タイムスタンプが一周しても経過時間は増え続ける
+  sora::IvfMuxer wrap;
+  out.clear();
+  REQUIRE(wrap.Mux(CreateFrame(key, 0xffffff00, "video/VP9", true), out));
+  REQUIRE(out.compare(8, 4, "VP90") == 0);
+  out.clear();
+  REQUIRE(wrap.Mux(CreateFrame(delta, 0x100, "video/VP9", false), out));
+  REQUIRE(GetLE(out, 4, 8) == 0x200);
+}
+
+TEST_CASE("IvfMuxer はキーフレームまでのフレームと、捨てた後の次のキーフレームまでのフレームを書き込まない") {
+  sora::IvfMuxer muxer;
+  std::vector<uint8_t> data = {1, 2, 3};
+
+  std::string out;
+  REQUIRE(!muxer.Mux(CreateFrame(data, 0, "video/VP8", false), out));
+  REQUIRE(out.empty());
+  REQUIRE(muxer.Mux(CreateFrame(data, 3000, "video/VP8", true), out));
+  REQUIRE(muxer.Mux(CreateFrame(data, 6000, "video/VP8", false), out));
+
+  // 捨てた後のデルタフレームは参照先が無いので書き込まない
+  muxer.OnDropped();
+  out.clear();
+  REQUIRE(!muxer.Mux(CreateFrame(data, 9000, "video/VP8", false), out));
+  REQUIRE(out.empty());
+  REQUIRE(muxer.Mux(CreateFrame(data, 12000, "video/VP8", true), out));
+  // ファイルヘッダーは書き直さない
+  REQUIRE(out.size() == 12 + 3);
+  REQUIRE(GetLE(out, 4, 8) == 9000);
+  REQUIRE(muxer.Mux(CreateFrame(data, 15000, "video/VP8", false), out));
+
+  // 対応していないコーデックは書き込まない
+  sora::IvfMuxer unsupported;
+  out.clear();
+  REQUIRE(!unsupported.Mux(CreateFrame(data, 0, "video/unknown", true), out));
+  REQUIRE(out.empty());
+}
+
+TEST_CASE("OggOpusMuxer の CRC は Ogg の仕様通りに計算する") {
+  // 多項式 0x04c11db7, 初期値 0, 反転無し, 最後の XOR 無し
+  REQUIRE(sora::OggOpusMuxer::Crc("123456789") == 0x89a1897f);
+  REQUIRE(sora::OggOpusMuxer::Crc("") == 0);
+}
+
+TEST_CASE("OggOpusMuxer は 255 バイトを超えるパケットを複数のセグメントに分ける") {
+  sora::OggOpusMuxer muxer(0x12345678);
+  auto first = CreateOpusPacket(600, 0xaa);
+  auto second = CreateOpusPacket(510, 0xbb);
+
+  std::string out;
+  REQUIRE(muxer.Mux(CreateFrame(first, 1000, "audio/opus", false), out));
+  REQUIRE(muxer.Mux(CreateFrame(second, 1960, "audio/opus", false), out));
+  muxer.Finish(out);
+
+  auto pages = ParseOggPages(out);
+  REQUIRE(pages.size() == 4);
+  for (size_t i = 0; i < pages.size(); i++) {
+    REQUIRE(pages[i].crc_ok);
+    REQUIRE(pages[i].serial == 0x12345678);
+    REQUIRE(pages[i].sequence == i);
+  }
+
+  // OpusHead と OpusTags
+  REQUIRE(pages[0].header_type == sora::OggOpusMuxer::kBeginOfStream);
+  REQUIRE(pages[0].body.compare(0, 8, "OpusHead") == 0);
+  REQUIRE(pages[0].body[9] == 1);
+  REQUIRE(pages[0].granule == 0);
+  REQUIRE(pages[1].header_type == 0);
+  REQUIRE(pages[1].body.compare(0, 8, "OpusTags") == 0);
+
+  // 600 = 255 + 255 + 90
+  REQUIRE(pages[2].header_type == 0);
+  REQUIRE(pages[2].lacing == std::vector<uint8_t>{255, 255, 90});
+  REQUIRE(pages[2].body == std::string(first.begin(), first.end()));
+  REQUIRE(pages[2].granule == 960);
+
+  // 255 の倍数の場合は、パケットの終わりを示す 0 のセグメントが続く
+  REQUIRE(pages[3].lacing == std::vector<uint8_t>{255, 255, 0});
+  REQUIRE(pages[3].body == std::string(second.begin(), second.end()));
+  REQUIRE(pages[3].granule == 1920);
+  REQUIRE(pages[3].header_type == sora::OggOpusMuxer::kEndOfStream);
+}
+
+TEST_CASE("OggOpusMuxer は Finish を呼ぶまで最後のパケットを書き込まずに EOS を付けて書き込む") {
+  sora::OggOpusMuxer muxer(1);
+  auto packet = CreateOpusPacket(100, 0xcc);
+
+  std::string out;
+  REQUIRE(muxer.Mux(CreateFrame(packet, 0, "audio/opus", false), out));
+  // ヘッダーの 2 ページだけが書き込まれる
+  REQUIRE(ParseOggPages(out).size() == 2);
+
+  std::string last;
+  muxer.Finish(last);
+  auto pages = ParseOggPages(last);
+  REQUIRE(pages.size() == 1);
+  REQUIRE(pages[0].crc_ok);
+  REQUIRE(pages[0].header_type == sora::OggOpusMuxer::kEndOfStream);
+  REQUIRE(pages[0].body == std::string(packet.begin(), packet.end()));
+
+  // 何も書き込んでいない場合は EOS のページも書かない
+  sora::OggOpusMuxer empty(2);
+  std::string none;
+  empty.Finish(none);
+  REQUIRE(none.empty());
+
+  // Opus 以外は書き込まない
+  sora::OggOpusMuxer unsupported(3);
+  REQUIRE(!unsupported.Mux(CreateFrame(packet, 0, "audio/PCMU", false), none));
+  REQUIRE(none.empty());
+}
@@ -0,0 +1,184 @@
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// WebRTC
+#include <api/make_ref_counted.h>
+#include <api/scoped_refptr.h>
+#include <api/video/i420_buffer.h>
+#include <api/video/video_bitrate_allocation.h>
+#include <api/video/video_frame.h>
+#include <api/video/video_frame_buffer.h>
+#include <api/video_codecs/video_codec.h>
+#include <api/video_codecs/video_encoder.h>
+#include <modules/video_coding/include/video_error_codes.h>
+
+// Catch2
+#include <catch2/catch_test_macros.hpp>
+
+// Sora C++ SDK
+#include <sora/convert_once_i420_buffer.h>
+#include <sora/i420_encoder_adapter.h>
+
+namespace {
+
+// ToI420 が呼ばれた回数を数える kNative なバッファ
+class CountingNativeBuffer : public webrtc::VideoFrameBuffer {
+ public:
+  CountingNativeBuffer(int width, int height) : width_(width), height_(height) {}
+
+  Type type() const override { return Type::kNative; }
+  int width() const override { return width_; }
+  int height() const override { return height_; }
+  webrtc::scoped_refptr<webrtc::I420BufferInterface> ToI420() override {
+    to_i420_count++;
+    auto buffer = webrtc::I420Buffer::Create(width_, height_);
+    webrtc::I420Buffer::SetBlack(buffer.get());
+    return buffer;
+  }
+
+  std::atomic<int> to_i420_count{0};
+
+ private:
+  int width_;
+  int height_;
+};
+
+// 渡されたフレームを保持するだけのエンコーダ
+class FrameCapturingEncoder : public webrtc::VideoEncoder {
+ public:
+  int InitEncode(const webrtc::VideoCodec* codec_settings,
+                 const webrtc::VideoEncoder::Settings& settings) override {
+    return WEBRTC_VIDEO_CODEC_OK;
+  }
+  int32_t RegisterEncodeCompleteCallback(
+      webrtc::EncodedImageCallback* callback) override {
+    return WEBRTC_VIDEO_CODEC_OK;
+  }
+  int32_t Release() override { return WEBRTC_VIDEO_CODEC_OK; }
+  int32_t Encode(
+      const webrtc::VideoFrame& frame,
+      const std::vector<webrtc::VideoFrameType>* frame_types) override {
+    frames.push_back(frame);
+    return WEBRTC_VIDEO_CODEC_OK;
+  }
+  void SetRates(const RateControlParameters& parameters) override {}
+
+  std::vector<webrtc::VideoFrame> frames;
+};
+
+webrtc::VideoCodec CreateCodec(int simulcast_streams, int active_streams) {
+  webrtc::VideoCodec codec;
+  codec.width = 640;
+  codec.height = 480;
+  codec.numberOfSimulcastStreams = simulcast_streams;
+  for (int i = 0; i < simulcast_streams; i++) {
+    codec.simulcastStream[i].active = i < active_streams;
+  }
+  return codec;
+}
+
+webrtc::VideoEncoder::RateControlParameters CreateRates(int layers) {
+  webrtc::VideoBitrateAllocation allocation;
+  for (int i = 0; i < layers; i++) {
+    allocation.SetBitrate(i, 0, 100000);
+  }
+  return webrtc::VideoEncoder::RateControlParameters(allocation, 30);
+}
+
+// アダプタに kNative のフレームを渡して、エンコーダに渡ったバッファを返す
+webrtc::scoped_refptr<webrtc::VideoFrameBuffer> EncodeNative(
+    sora::I420EncoderAdapter& adapter,
+    FrameCapturingEncoder& encoder) {
+  auto native = webrtc::make_ref_counted<CountingNativeBuffer>(640, 480);
+  auto frame = webrtc::VideoFrame::Builder()
+                   .set_video_frame_buffer(native)
+                   .set_timestamp_us(0)
+                   .build();
+  REQUIRE(adapter.Encode(frame, nullptr) == WEBRTC_VIDEO_CODEC_OK);
+  REQUIRE(!encoder.frames.empty());
+  return encoder.frames.back().video_frame_buffer();
+}
+
+void InitAdapter(sora::I420EncoderAdapter& adapter,
+                 const webrtc::VideoCodec& codec) {
+  webrtc::VideoEncoder::Settings settings(
+      webrtc::VideoEncoder::Capabilities(false), 1, 0);
+  REQUIRE(adapter.InitEncode(&codec, settings) == WEBRTC_VIDEO_CODEC_OK);
+}
+
+}  // namespace
+
+TEST_CASE("ConvertOnceI420Buffer は複数のレイヤーから読まれても 1 回だけ変換する") {
+  auto native = webrtc::make_ref_counted<CountingNativeBuffer>(640, 480);
+  auto buffer = sora::ConvertOnceI420Buffer::Create(native);
+  REQUIRE(buffer->width() == 640);
+  REQUIRE(buffer->height() == 480);
+  // 画素を読むまでは変換しない
+  REQUIRE(!buffer->converted());
+  REQUIRE(native->to_i420_count == 0);
+
+  // サイマルキャストの各レイヤーのエンコーダが別々のスレッドで読む
+  // Catch2 の REQUIRE は別のスレッドから呼べないので、読んだ結果だけを記録しておく
+  const int kLayers = 3;
+  std::vector<const uint8_t*> data_y(kLayers);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kLayers; i++) {
+    threads.push_back(std::thread(
+        [buffer, &data_y, i]() { data_y[i] = buffer->DataY(); }));
+  }
+  for (auto& th : threads) {
+    th.join();
+  }
+  for (int i = 0; i < kLayers; i++) {
+    REQUIRE(data_y[i] != nullptr);
+    REQUIRE(data_y[i] == data_y[0]);
+  }
+  REQUIRE(buffer->converted());
+  REQUIRE(native->to_i420_count == 1);
+  REQUIRE(buffer->DataY()[0] == 0);
+  REQUIRE(native->to_i420_count == 1);
+}
+
+TEST_CASE("I420EncoderAdapter は InitEncode で有効なサイマルキャストのストリームが複数の場合だけ包む") {
+  auto encoder = std::make_shared<FrameCapturingEncoder>();
+  sora::I420EncoderAdapter adapter(encoder);
+
+  InitAdapter(adapter, CreateCodec(3, 3));
+  auto buffer = EncodeNative(adapter, *encoder);
+  REQUIRE(buffer->type() == webrtc::VideoFrameBuffer::Type::kI420);
+
+  // 有効なストリームが 1 つだけなら元のバッファをそのまま渡す
+  InitAdapter(adapter, CreateCodec(3, 1));
+  buffer = EncodeNative(adapter, *encoder);
+  REQUIRE(buffer->type() == webrtc::VideoFrameBuffer::Type::kNative);
+}
+
+TEST_CASE("I420EncoderAdapter はレイヤーが無効になったら SetRates に合わせて包むのをやめる") {
+  auto encoder = std::make_shared<FrameCapturingEncoder>();
+  sora::I420EncoderAdapter adapter(encoder);
+  InitAdapter(adapter, CreateCodec(3, 3));
+
+  // ビットレートが割り当てられたのが 1 レイヤーだけなら包まない
+  adapter.SetRates(CreateRates(1));
+  auto buffer = EncodeNative(adapter, *encoder);
+  REQUIRE(buffer->type() == webrtc::VideoFrameBuffer::Type::kNative);
+
+  // 2 レイヤーに戻ったら包む
+  adapter.SetRates(CreateRates(2));
+  buffer = EncodeNative(adapter, *encoder);
+  REQUIRE(buffer->type() == webrtc::VideoFrameBuffer::Type::kI420);
+}
+
+TEST_CASE("I420EncoderAdapter はサイマルキャストでなければ SVC の空間レイヤーを数えない") {
+  auto encoder = std::make_shared<FrameCapturingEncoder>();
+  sora::I420EncoderAdapter adapter(encoder);
+  InitAdapter(adapter, CreateCodec(1, 1));
+
+  // 3 つの空間レイヤーにビットレートが割り当てられても、入力は 1 つのストリーム
+  adapter.SetRates(CreateRates(3));
+  auto buffer = EncodeNative(adapter, *encoder);
+  REQUIRE(buffer->type() == webrtc::VideoFrameBuffer::Type::kNative);
+}
@@ -0,0 +1,283 @@
+// 録画した MJPEG のファイルを MJPEGDecodeStage に流して、デコードの性能を計測する
+//
+// mjpeg_decode_bench <param.json>
+//
+// param.json の例:
+// {
+//   // JPEG を連結したファイル（ffmpeg -f mjpeg や v4l2-ctl --stream-to で作れる）
+//   "mjpeg_file": "input_1920x1080.mjpeg",
+//   // カメラがフレームを送ってくる間隔。0 の場合は待たずに流す
+//   "fps": 60,
+//   // ファイルを繰り返す回数
+//   "loops": 10,
+//   // 0 の場合は MJPEGDecodeStage を使わずに、キャプチャスレッドでデコードする
+//   "threads": [0, 1, 2, 4],
+//   "max_pending_frames": 4,
+//   "output": "mjpeg_decode_bench.json",
+// }
+//
+// fps を指定した場合、フレームを渡すのが次のフレームの時刻に間に合わなかった時は、
+// ドライバでフレームが落ちたとみなして driver_dropped に数える。
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// WebRTC
+#include <api/video/i420_buffer.h>
+#include <api/video/video_frame.h>
+#include <rtc_base/logging.h>
+#include <rtc_base/time_utils.h>
+
+// libyuv
+#include <libyuv/convert.h>
+
+// Sora C++ SDK
+#include <sora/boost_json_iwyu.h>
+#include <sora/v4l2/mjpeg_decode_stage.h>
+
+#include "bench_util.h"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+struct BenchConfig {
+  std::string mjpeg_file;
+  int fps = 0;
+  int loops = 1;
+  std::vector<int> threads = {0, 2};
+  int max_pending_frames = 4;
+  std::string output = "mjpeg_decode_bench.json";
+};
+
+// JPEG の先頭 (SOI マーカーに続くマーカー) で区切る
+std::vector<std::string> SplitFrames(const std::string& data) {
+  std::vector<size_t> starts;
+  for (size_t i = 0; i + 2 < data.size(); i++) {
+    if ((uint8_t)data[i] == 0xff && (uint8_t)data[i + 1] == 0xd8 &&
+        (uint8_t)data[i + 2] == 0xff) {
+      starts.push_back(i);
+    }
+  }
+  std::vector<std::string> frames;
+  for (size_t i = 0; i < starts.size(); i++) {
+    size_t end = i + 1 < starts.size() ? starts[i + 1] : data.size();
+    frames.push_back(data.substr(starts[i], end - starts[i]));
+  }
+  return frames;
+}
+
+boost::json::object RunCase(const BenchConfig& config,
+                            const std::vector<std::string>& frames,
+                            int width,
+                            int height,
+                            int threads) {
+  std::mutex mutex;
+  std::vector<double> latencies_ms;
+  uint64_t delivered = 0;
+  uint64_t order_violations = 0;
+  int64_t last_timestamp_us = -1;
+  auto on_frame = [&](const webrtc::VideoFrame& frame) {
+    int64_t now_us = webrtc::TimeMicros();
+    std::lock_guard<std::mutex> lock(mutex);
+    delivered++;
+    latencies_ms.push_back((now_us - frame.timestamp_us()) / 1000.0);
+    if (frame.timestamp_us() <= last_timestamp_us) {
+      order_violations++;
+    }
+    last_timestamp_us = frame.timestamp_us();
+  };
+
+  std::unique_ptr<sora::MJPEGDecodeStage> stage;
+  if (threads > 0) {
+    sora::MJPEGDecodeStageConfig stage_config;
+    stage_config.threads = threads;
+    stage_config.max_pending_frames = config.max_pending_frames;
+    stage.reset(new sora::MJPEGDecodeStage(stage_config, on_frame));
+  }
+  uint64_t inline_failed = 0;
+
+  // キャプチャスレッドがフレームの処理にかかった時間
+  std::vector<double> capture_ms;
+  uint64_t driver_dropped = 0;
+  const auto interval =
+      config.fps > 0 ? std::chrono::microseconds(1000000 / config.fps)
+                     : std::chrono::microseconds(0);
+  const size_t total = frames.size() * config.loops;
+  auto start = Clock::now();
+  for (size_t i = 0; i < total; i++) {
+    const std::string& data = frames[i % frames.size()];
+    if (config.fps > 0) {
+      auto due = start + interval * i;
+      auto now = Clock::now();
+      if (now < due) {
+        std::this_thread::sleep_until(due);
+      } else if (now >= due + interval) {
+        // 次のフレームの時刻を過ぎているので、このフレームは落ちている
+        driver_dropped++;
+        continue;
+      }
+    }
+
+    auto t = Clock::now();
+    int64_t timestamp_us = webrtc::TimeMicros();
+    if (stage) {
+      stage->Submit((const uint8_t*)data.data(), data.size(), width, height,
+                    timestamp_us);
+    } else {
+      auto buffer = webrtc::I420Buffer::Create(width, height);
+      if (libyuv::MJPGToI420((const uint8_t*)data.data(), data.size(),
+                             buffer->MutableDataY(), buffer->StrideY(),
+                             buffer->MutableDataU(), buffer->StrideU(),
+                             buffer->MutableDataV(), buffer->StrideV(), width,
+                             height, width, height) < 0) {
+        inline_failed++;
+      } else {
+        on_frame(webrtc::VideoFrame::Builder()
+                     .set_video_frame_buffer(buffer)
+                     .set_timestamp_us(timestamp_us)
+                     .build());
+      }
+    }
+    capture_ms.push_back(
+        std::chrono::duration<double, std::milli>(Clock::now() - t).count());
+  }
+  if (stage) {
+    stage->Flush();
+  }
+  double elapsed_s =
+      std::chrono::duration<double>(Clock::now() - start).count();
+
+  sora::MJPEGDecodeStage::Stats stats;
+  if (stage) {
+    stats = stage->GetStats();
+  } else {
+    stats.frames_submitted = total - driver_dropped;
+    stats.frames_decoded = delivered;
+    stats.frames_failed = inline_failed;
+  }
+  stage.reset();
+
+  std::lock_guard<std::mutex> lock(mutex);
+  return boost::json::object{
+      {"threads", threads},
+      {"frames", total},
+      {"driver_dropped", driver_dropped},
+      {"submitted", stats.frames_submitted},
+      {"decoded", stats.frames_decoded},
+      {"dropped", stats.frames_dropped},
+      {"failed", stats.frames_failed},
+      {"delivered", delivered},
+      {"order_violations", order_violations},
+      {"elapsed_s", elapsed_s},
+      {"delivered_fps", elapsed_s > 0 ? delivered / elapsed_s : 0.0},
+      {"capture_thread_ms", Summarize(capture_ms)},
+      {"latency_ms", Summarize(latencies_ms)},
+  };
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    std::cout << argv[0] << " <param.json>" << std::endl;
+    return -1;
+  }
+
+  webrtc::LogMessage::LogToDebug(webrtc::LS_WARNING);
+  webrtc::LogMessage::LogTimestamps();
+  webrtc::LogMessage::LogThreads();
+
+  boost::json::value v;
+  {
+    std::ifstream ifs(argv[1]);
+    std::ostringstream oss;
+    oss << ifs.rdbuf();
+    std::string js = oss.str();
+    boost::json::parse_options opt;
+    opt.allow_comments = true;
+    opt.allow_trailing_commas = true;
+    v = boost::json::parse(js, {}, opt);
+  }
+
+  boost::json::value x;
+  auto get = [](const boost::json::value& v, const char* key,
+                boost::json::value& x) -> bool {
+    if (auto it = v.as_object().find(key);
+        it != v.as_object().end() && !it->value().is_null()) {
+      x = it->value();
+      return true;
+    }
+    return false;
+  };
+
+  BenchConfig config;
+  if (get(v, "mjpeg_file", x)) {
+    config.mjpeg_file = x.as_string().c_str();
+  }
+  if (get(v, "fps", x)) {
+    config.fps = x.to_number<int>();
+  }
+  if (get(v, "loops", x)) {
+    config.loops = std::max(x.to_number<int>(), 1);
+  }
+  if (get(v, "threads", x)) {
+    config.threads.clear();
+    for (const auto& t : x.as_array()) {
+      config.threads.push_back(t.to_number<int>());
+    }
+  }
+  if (get(v, "max_pending_frames", x)) {
+    config.max_pending_frames = x.to_number<int>();
+  }
+  if (get(v, "output", x)) {
+    config.output = x.as_string().c_str();
+  }
+
+  std::ifstream ifs(config.mjpeg_file, std::ios::binary);
+  if (!ifs) {
+    std::cerr << "Failed to open " << config.mjpeg_file << std::endl;
+    return 1;
+  }
+  std::string data((std::istreambuf_iterator<char>(ifs)),
+                   std::istreambuf_iterator<char>());
+  auto frames = SplitFrames(data);
+  if (frames.empty()) {
+    std::cerr << "No JPEG frames found in " << config.mjpeg_file << std::endl;
+    return 1;
+  }
+  int width = 0;
+  int height = 0;
+  if (libyuv::MJPGSize((const uint8_t*)frames[0].data(), frames[0].size(),
+                       &width, &height) < 0) {
+    std::cerr << "Failed to parse the first JPEG frame" << std::endl;
+    return 1;
+  }
+  std::cout << "Frames: " << frames.size() << " size: " << width << "x"
+            << height << std::endl;
+
+  boost::json::array results;
+  for (int threads : config.threads) {
+    std::cout << "Running: threads=" << threads << std::endl;
+    auto result = RunCase(config, frames, width, height, threads);
+    std::cout << boost::json::serialize(result) << std::endl;
+    results.push_back(std::move(result));
+  }
+
+  std::ofstream ofs(config.output);
+  ofs << boost::json::serialize(boost::json::object{
+             {"width", width}, {"height", height}, {"results", results}})
+      << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,178 @@
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// WebRTC
+#include <api/video/i420_buffer.h>
+#include <api/video/video_frame.h>
+
+// Catch2
+#include <catch2/catch_test_macros.hpp>
+
+// Sora C++ SDK
+#include <sora/v4l2/mjpeg_decode_stage.h>
+
+namespace {
+
+// 先頭の 1 バイトでデコードの動作を変える偽のデコーダ
+const uint8_t kDecode = 0;
+// Release() を呼ぶまでデコードを終えない
+const uint8_t kBlock = 1;
+// デコードに失敗する
+const uint8_t kFail = 2;
+
+class FakeDecoder {
+ public:
+  bool Decode(const uint8_t* data, size_t size, webrtc::I420Buffer* buffer) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (data[0] == kBlock) {
+      blocked_++;
+      cond_.notify_all();
+      cond_.wait(lock, [this]() { return released_; });
+    }
+    return data[0] != kFail;
+  }
+  // kBlock のフレームが count 個デコードを始めるまで待つ
+  bool WaitBlocked(int count) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return cond_.wait_for(lock, std::chrono::seconds(5),
+                          [&]() { return blocked_ == count; });
+  }
+  void Release() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    released_ = true;
+    cond_.notify_all();
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  int blocked_ = 0;
+  bool released_ = false;
+};
+
+// on_frame に渡されたフレームのタイムスタンプを記録する
+class DeliveredFrames {
+ public:
+  void Add(const webrtc::VideoFrame& frame) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    timestamps_.push_back(frame.timestamp_us());
+  }
+  std::vector<int64_t> Get() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return timestamps_;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::vector<int64_t> timestamps_;
+};
+
+sora::MJPEGDecodeStageConfig CreateConfig(FakeDecoder& decoder,
+                                          int threads,
+                                          int max_pending_frames) {
+  sora::MJPEGDecodeStageConfig config;
+  config.threads = threads;
+  config.max_pending_frames = max_pending_frames;
+  config.decode = [&decoder](const uint8_t* data, size_t size,
+                             webrtc::I420Buffer* buffer) {
+    return decoder.Decode(data, size, buffer);
+  };
+  return config;
+}
+
+void Submit(sora::MJPEGDecodeStage& stage, uint8_t type, int64_t timestamp) {
+  uint8_t data[] = {type, 0xff, 0xd9};
+  stage.Submit(data, sizeof(data), 16, 16, timestamp);
+}
+
+// stats が条件を満たすまで待つ
+template <class F>
+bool WaitStats(sora::MJPEGDecodeStage& stage, F f) {
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (std::chrono::steady_clock::now() < deadline) {
+    if (f(stage.GetStats())) {
+      return true;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return false;
+}
+
+}  // namespace
+
+TEST_CASE("MJPEGDecodeStage は後から Submit したフレームが先にデコードされても Submit した順に渡す") {
+  FakeDecoder decoder;
+  DeliveredFrames delivered;
+  sora::MJPEGDecodeStage stage(
+      CreateConfig(decoder, 2, 4),
+      [&](const webrtc::VideoFrame& frame) { delivered.Add(frame); });
+
+  Submit(stage, kBlock, 0);
+  REQUIRE(decoder.WaitBlocked(1));
+  Submit(stage, kDecode, 1);
+  Submit(stage, kDecode, 2);
+  // 2 つ目のスレッドが後のフレームをデコードし終わっても、最初のフレームを待つ
+  REQUIRE(WaitStats(stage, [](const sora::MJPEGDecodeStage::Stats& stats) {
+    return stats.frames_decoded == 2;
+  }));
+  REQUIRE(delivered.Get().empty());
+
+  decoder.Release();
+  stage.Flush();
+  REQUIRE(delivered.Get() == std::vector<int64_t>{0, 1, 2});
+  auto stats = stage.GetStats();
+  REQUIRE(stats.frames_submitted == 3);
+  REQUIRE(stats.frames_decoded == 3);
+  REQUIRE(stats.frames_dropped == 0);
+  REQUIRE(stats.frames_failed == 0);
+}
+
+TEST_CASE("MJPEGDecodeStage はデコードを待っているフレームが上限を超えたら古いフレームから捨てる") {
+  FakeDecoder decoder;
+  DeliveredFrames delivered;
+  sora::MJPEGDecodeStage stage(
+      CreateConfig(decoder, 1, 2),
+      [&](const webrtc::VideoFrame& frame) { delivered.Add(frame); });
+
+  // 1 つしかないスレッドをデコード中にしておく
+  Submit(stage, kBlock, 0);
+  REQUIRE(decoder.WaitBlocked(1));
+  for (int i = 1; i <= 4; i++) {
+    Submit(stage, kDecode, i);
+  }
+  // 待てるのは 2 フレームまでなので、1 と 2 が捨てられる
+  auto stats = stage.GetStats();
+  REQUIRE(stats.frames_submitted == 5);
+  REQUIRE(stats.frames_dropped == 2);
+
+  decoder.Release();
+  stage.Flush();
+  REQUIRE(delivered.Get() == std::vector<int64_t>{0, 3, 4});
+  stats = stage.GetStats();
+  REQUIRE(stats.frames_decoded == 3);
+  REQUIRE(stats.frames_dropped == 2);
+  REQUIRE(stats.frames_failed == 0);
+}
+
+TEST_CASE("MJPEGDecodeStage はデコードに失敗したフレームを飛ばして順番を進める") {
+  FakeDecoder decoder;
+  DeliveredFrames delivered;
+  sora::MJPEGDecodeStage stage(
+      CreateConfig(decoder, 2, 4),
+      [&](const webrtc::VideoFrame& frame) { delivered.Add(frame); });
+
+  Submit(stage, kDecode, 0);
+  Submit(stage, kFail, 1);
+  Submit(stage, kDecode, 2);
+  stage.Flush();
+  REQUIRE(delivered.Get() == std::vector<int64_t>{0, 2});
+  auto stats = stage.GetStats();
+  REQUIRE(stats.frames_submitted == 3);
+  REQUIRE(stats.frames_decoded == 2);
+  REQUIRE(stats.frames_dropped == 0);
+  REQUIRE(stats.frames_failed == 1);
+}
@@ -0,0 +1,802 @@
+#include "mock_sora_server.h"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Boost
+#include <boost/asio/deadline_timer.hpp>
+#include <boost/asio/ip/address.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/beast/core/flat_buffer.hpp>
+#include <boost/beast/http/read.hpp>
+#include <boost/beast/http/string_body.hpp>
+#include <boost/beast/websocket/rfc6455.hpp>
+#include <boost/date_time/posix_time/posix_time_duration.hpp>
+#include <boost/system/detail/error_code.hpp>
+
+// WebRTC
+#include <api/data_channel_interface.h>
+#include <api/jsep.h>
+#include <api/media_stream_interface.h>
+#include <api/media_types.h>
+#include <api/peer_connection_interface.h>
+#include <api/rtp_transceiver_direction.h>
+#include <api/rtp_transceiver_interface.h>
+#include <api/scoped_refptr.h>
+#include <api/video/video_frame.h>
+#include <api/video/video_sink_interface.h>
+#include <api/video/video_source_interface.h>
+#include <rtc_base/crypto_random.h>
+#include <rtc_base/logging.h>
+
+// Sora C++ SDK
+#include <sora/boost_json_iwyu.h>
+#include <sora/data_channel.h>
+#include <sora/session_description.h>
+#include <sora/websocket.h>
+
+#include "bench_util.h"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+const char* const kSignalingPath = "/signaling";
+const char* const kRedirectedPath = "/redirected";
+
+double ElapsedMs(Clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start)
+      .count();
+}
+
+// Sora が作る DataChannel シグナリング用のラベル
+const char* const kDataChannelLabels[] = {"signaling", "notify", "push",
+                                          "stats"};
+
+}  // namespace
+
+// 1 つのクライアントとの接続。
+// WebSocket の受け付けから切断までを管理する。
+class MockSoraConnection
+    : public std::enable_shared_from_this<MockSoraConnection>,
+      public webrtc::PeerConnectionObserver,
+      public sora::DataChannelObserver {
+ public:
+  MockSoraConnection(std::weak_ptr<MockSoraServer> server,
+                     const MockSoraServerConfig& config,
+                     boost::asio::ip::tcp::socket socket,
+                     std::string connection_id)
+      : server_(server),
+        config_(config),
+        socket_(std::move(socket)),
+        ping_timer_(*config.io_context) {
+    stats_.connection_id = std::move(connection_id);
+  }
+
+  ~MockSoraConnection() {
+    RTC_LOG(LS_INFO) << "MockSoraConnection dtor: connection_id="
+                     << stats_.connection_id;
+  }
+
+  void Start() {
+    // WebSocket のハンドシェイクの前に HTTP のリクエストを読む
+    boost::beast::http::async_read(
+        socket_, http_buffer_, http_req_,
+        [self = shared_from_this()](boost::system::error_code ec, std::size_t) {
+          self->OnReadRequest(ec);
+        });
+  }
+
+  // 接続を閉じて、サーバの接続一覧から取り除く
+  void Close() {
+    if (stats_.disconnected) {
+      Remove();
+      return;
+    }
+    boost::system::error_code ec;
+    ping_timer_.cancel(ec);
+    if (video_track_ != nullptr) {
+      video_track_->RemoveSink(&sink_);
+      video_track_ = nullptr;
+    }
+    if (pc_ != nullptr) {
+      pc_->Close();
+      pc_ = nullptr;
+    }
+    dc_ = nullptr;
+    stats_.disconnected = true;
+    ReportStats();
+    if (ws_ != nullptr && ws_connected_) {
+      ws_connected_ = false;
+      ws_->Close(
+          [self = shared_from_this()](boost::system::error_code) {
+            boost::asio::post(*self->config_.io_context,
+                              [self]() { self->Remove(); });
+          },
+          3);
+    } else {
+      Remove();
+    }
+  }
+
+ private:
+  void OnReadRequest(boost::system::error_code ec) {
+    if (ec) {
+      RTC_LOG(LS_WARNING) << "Failed to read HTTP request: " << ec.message();
+      Remove();
+      return;
+    }
+    std::string target(http_req_.target());
+    if (target != kSignalingPath && target != kRedirectedPath) {
+      RTC_LOG(LS_WARNING) << "Unknown path: " << target;
+      Remove();
+      return;
+    }
+
+    ws_.reset(new sora::Websocket(std::move(socket_)));
+    ws_->Accept(std::move(http_req_),
+                [self = shared_from_this()](boost::system::error_code ec) {
+                  boost::asio::post(*self->config_.io_context, [self, ec]() {
+                    self->OnAccept(ec);
+                  });
+                });
+  }
+
+  void OnAccept(boost::system::error_code ec) {
+    if (ec) {
+      RTC_LOG(LS_WARNING) << "Failed to accept WebSocket: " << ec.message();
+      Remove();
+      return;
+    }
+    ws_connected_ = true;
+    DoRead();
+  }
+
+  void DoRead() {
+    ws_->Read([self = shared_from_this()](boost::system::error_code ec,
+                                          std::size_t, std::string text) {
+      boost::asio::post(*self->config_.io_context,
+                        [self, ec, text = std::move(text)]() {
+                          self->OnRead(ec, std::move(text));
+                        });
+    });
+  }
+
+  void OnRead(boost::system::error_code ec, std::string text) {
+    if (ec) {
+      ws_connected_ = false;
+      // ignore_disconnect_websocket で WebSocket だけ切断された場合は接続を続ける
+      if (switched_ && ignore_disconnect_websocket_ && pc_ != nullptr) {
+        return;
+      }
+      Close();
+      return;
+    }
+
+    boost::system::error_code pec;
+    auto m = boost::json::parse(text, pec);
+    if (pec || !m.is_object()) {
+      RTC_LOG(LS_WARNING) << "Invalid message: " << text;
+      DoRead();
+      return;
+    }
+    if (!HandleMessage(m)) {
+      return;
+    }
+    DoRead();
+  }
+
+  // false を返した場合は以降の読み込みを行わない
+  bool HandleMessage(const boost::json::value& m) {
+    const std::string type = m.at("type").as_string().c_str();
+    if (type == "connect") {
+      return OnConnectMessage(m);
+    } else if (type == "answer") {
+      SetAnswer(m.at("sdp").as_string().c_str(), false);
+    } else if (type == "re-answer") {
+      SetAnswer(m.at("sdp").as_string().c_str(), true);
+    } else if (type == "candidate") {
+      AddCandidate(m.at("candidate").as_string().c_str());
+    } else if (type == "pong") {
+      if (ping_sent_) {
+        stats_.ping_rtt_ms =
+            std::chrono::duration<double, std::milli>(Clock::now() -
+                                                      *ping_sent_)
+                .count();
+        ping_sent_ = std::nullopt;
+        ReportStats();
+      }
+    } else if (type == "disconnect") {
+      Close();
+      return false;
+    }
+    return true;
+  }
+
+  bool OnConnectMessage(const boost::json::value& m) {
+    connect_time_ = Clock::now();
+    const auto& obj = m.as_object();
+
+    bool redirected = false;
+    if (auto it = obj.find("redirect"); it != obj.end()) {
+      redirected = it->value().as_bool();
+    }
+    if (config_.redirect && !redirected) {
+      auto server = server_.lock();
+      if (server == nullptr) {
+        return false;
+      }
+      boost::json::value r = {
+          {"type", "redirect"},
+          {"location", "ws://127.0.0.1:" + std::to_string(server->port()) +
+                           kRedirectedPath}};
+      ws_->WriteText(boost::json::serialize(r));
+      // クライアントはリダイレクト先に繋ぎ直すので、この接続は閉じる
+      ws_connected_ = false;
+      ws_->Close(
+          [self = shared_from_this()](boost::system::error_code) {
+            boost::asio::post(*self->config_.io_context,
+                              [self]() { self->Remove(); });
+          },
+          3);
+      return false;
+    }
+    stats_.redirected = redirected;
+
+    role_ = obj.at("role").as_string().c_str();
+    if (auto it = obj.find("client_id"); it != obj.end()) {
+      client_id_ = it->value().as_string().c_str();
+    }
+    bool video = true;
+    bool audio = true;
+    if (auto it = obj.find("video"); it != obj.end()) {
+      video = !it->value().is_bool() || it->value().as_bool();
+    }
+    if (auto it = obj.find("audio"); it != obj.end()) {
+      audio = !it->value().is_bool() || it->value().as_bool();
+    }
+    if (auto it = obj.find("data_channel_signaling"); it != obj.end()) {
+      data_channel_signaling_ = it->value().as_bool();
+    }
+    if (auto it = obj.find("ignore_disconnect_websocket"); it != obj.end()) {
+      ignore_disconnect_websocket_ = it->value().as_bool();
+    }
+    std::vector<std::string> user_labels;
+    if (auto it = obj.find("data_channels"); it != obj.end()) {
+      for (const auto& d : it->value().as_array()) {
+        user_labels.push_back(d.at("label").as_string().c_str());
+      }
+    }
+    stats_.data_channel_signaling = data_channel_signaling_;
+
+    if (!CreatePeerConnection(video, audio, user_labels)) {
+      Close();
+      return false;
+    }
+    CreateOffer(false);
+    return true;
+  }
+
+  bool CreatePeerConnection(bool video,
+                            bool audio,
+                            const std::vector<std::string>& user_labels) {
+    webrtc::PeerConnectionInterface::RTCConfiguration rtc_config;
+    rtc_config.sdp_semantics = webrtc::SdpSemantics::kUnifiedPlan;
+    webrtc::PeerConnectionDependencies dependencies(this);
+    auto connection = config_.pc_factory->CreatePeerConnectionOrError(
+        rtc_config, std::move(dependencies));
+    if (!connection.ok()) {
+      RTC_LOG(LS_ERROR) << "CreatePeerConnection failed: "
+                        << connection.error().message();
+      return false;
+    }
+    pc_ = connection.value();
+
+    // クライアントの role から、サーバ側の送受信の向きを決める
+    bool client_sends = role_ == "sendonly" || role_ == "sendrecv";
+    bool client_recvs = role_ == "recvonly" || role_ == "sendrecv";
+    auto direction = [](bool send, bool recv) {
+      if (send && recv) {
+        return webrtc::RtpTransceiverDirection::kSendRecv;
+      } else if (send) {
+        return webrtc::RtpTransceiverDirection::kSendOnly;
+      } else if (recv) {
+        return webrtc::RtpTransceiverDirection::kRecvOnly;
+      }
+      return webrtc::RtpTransceiverDirection::kInactive;
+    };
+
+    if (audio && client_sends) {
+      webrtc::RtpTransceiverInit init;
+      init.direction = direction(false, true);
+      auto r = pc_->AddTransceiver(webrtc::MediaType::AUDIO, init);
+      if (r.ok()) {
+        audio_transceiver_ = r.value();
+      }
+    }
+    bool server_sends_video = client_recvs && config_.video_source != nullptr;
+    if (video && (client_sends || server_sends_video)) {
+      webrtc::RtpTransceiverInit init;
+      init.direction = direction(server_sends_video, client_sends);
+      init.stream_ids = {stats_.connection_id};
+      webrtc::RTCErrorOr<webrtc::scoped_refptr<webrtc::RtpTransceiverInterface>>
+          r;
+      if (server_sends_video) {
+        auto track = config_.pc_factory->CreateVideoTrack(
+            config_.video_source, webrtc::CreateRandomString(16));
+        r = pc_->AddTransceiver(track, init);
+      } else {
+        r = pc_->AddTransceiver(webrtc::MediaType::VIDEO, init);
+      }
+      if (r.ok()) {
+        video_transceiver_ = r.value();
+      }
+    }
+
+    if (data_channel_signaling_) {
+      dc_.reset(new sora::DataChannel(*config_.io_context, weak_from_this()));
+      std::vector<std::string> labels(std::begin(kDataChannelLabels),
+                                      std::end(kDataChannelLabels));
+      labels.insert(labels.end(), user_labels.begin(), user_labels.end());
+      for (const auto& label : labels) {
+        webrtc::DataChannelInit init;
+        auto r = pc_->CreateDataChannelOrError(label, &init);
+        if (!r.ok()) {
+          RTC_LOG(LS_ERROR) << "CreateDataChannel failed: label=" << label;
+          return false;
+        }
+        dc_labels_.push_back(label);
+        dc_->AddDataChannel(r.value());
+      }
+    }
+    return true;
+  }
+
+  void CreateOffer(bool re_offer) {
+    if (pc_ == nullptr) {
+      return;
+    }
+    auto on_failure = [self = shared_from_this()](webrtc::RTCError error) {
+      boost::asio::post(*self->config_.io_context, [self]() { self->Close(); });
+    };
+    // 完了のコールバックは signaling スレッドで呼ばれ、その間に ioc のスレッドで
+    // Close() が pc_ を破棄することがあるので、pc は値で持っておく
+    auto pc = pc_;
+    pc->CreateOffer(
+        sora::CreateSessionDescriptionThunk::Create(
+            [self = shared_from_this(), pc, re_offer,
+             on_failure](webrtc::SessionDescriptionInterface* desc) {
+              pc->SetLocalDescription(
+                  sora::SetSessionDescriptionThunk::Create(
+                      [self, re_offer]() {
+                        boost::asio::post(
+                            *self->config_.io_context, [self, re_offer]() {
+                              self->OnSetLocalOffer(re_offer);
+                            });
+                      },
+                      on_failure)
+                      .get(),
+                  desc);
+            },
+            on_failure)
+            .get(),
+        webrtc::PeerConnectionInterface::RTCOfferAnswerOptions());
+  }
+
+  void OnSetLocalOffer(bool re_offer) {
+    if (pc_ == nullptr) {
+      return;
+    }
+    if (re_offer) {
+      SendOffer(true);
+      return;
+    }
+    // Sora と同じく候補を SDP に含めて送るので、収集が終わるまで待つ
+    if (pc_->ice_gathering_state() ==
+        webrtc::PeerConnectionInterface::kIceGatheringComplete) {
+      SendOffer(false);
+    } else {
+      waiting_gathering_ = true;
+    }
+  }
+
+  void SendOffer(bool re_offer) {
+    std::string sdp;
+    pc_->local_description()->ToString(&sdp);
+
+    if (re_offer) {
+      re_offer_sent_ = Clock::now();
+      SendSignaling(
+          boost::json::serialize(boost::json::value{{"type", "re-offer"},
+                                                    {"sdp", sdp}}));
+      return;
+    }
+
+    boost::json::object m = {
+        {"type", "offer"},
+        {"sdp", sdp},
+        {"client_id",
+         client_id_.empty() ? stats_.connection_id : client_id_},
+        {"connection_id", stats_.connection_id},
+        {"config", {{"iceServers", boost::json::array()}}},
+        {"multistream", true},
+        {"simulcast", false},
+    };
+    boost::json::object mid;
+    if (audio_transceiver_ != nullptr && audio_transceiver_->mid()) {
+      mid["audio"] = *audio_transceiver_->mid();
+    }
+    if (video_transceiver_ != nullptr && video_transceiver_->mid()) {
+      mid["video"] = *video_transceiver_->mid();
+    }
+    m["mid"] = std::move(mid);
+    if (data_channel_signaling_) {
+      boost::json::array data_channels;
+      for (const auto& label : dc_labels_) {
+        data_channels.push_back({{"label", label}, {"compress", false}});
+      }
+      m["data_channels"] = std::move(data_channels);
+      m["data_channel_signaling"] = true;
+      m["ignore_disconnect_websocket"] = ignore_disconnect_websocket_;
+    }
+    ws_->WriteText(boost::json::serialize(m));
+    stats_.offer_sent_ms = ElapsedMs(connect_time_);
+    ReportStats();
+  }
+
+  void SetAnswer(const std::string& sdp, bool re_answer) {
+    if (pc_ == nullptr) {
+      return;
+    }
+    if (re_answer) {
+      if (re_offer_sent_) {
+        stats_.re_offer_rtt_ms = std::chrono::duration<double, std::milli>(
+                                     Clock::now() - *re_offer_sent_)
+                                     .count();
+        re_offer_sent_ = std::nullopt;
+        ReportStats();
+      }
+    } else {
+      stats_.answer_received_ms = ElapsedMs(connect_time_);
+      ReportStats();
+    }
+    sora::SessionDescription::SetAnswer(
+        pc_.get(), sdp, []() {}, [self = shared_from_this()](webrtc::RTCError) {
+          boost::asio::post(*self->config_.io_context,
+                            [self]() { self->Close(); });
+        });
+  }
+
+  void AddCandidate(const std::string& candidate) {
+    if (pc_ == nullptr || pc_->remote_description() == nullptr) {
+      return;
+    }
+    // クライアントは mid を送ってこないが、BUNDLE しているので最初の m-line に追加すれば良い
+    const auto& contents = pc_->remote_description()->description()->contents();
+    if (contents.empty()) {
+      return;
+    }
+    webrtc::SdpParseError error;
+    std::unique_ptr<webrtc::IceCandidateInterface> c(
+        webrtc::CreateIceCandidate(contents[0].mid(), 0, candidate, &error));
+    if (c == nullptr) {
+      RTC_LOG(LS_WARNING) << "Failed to parse candidate: "
+                          << error.description;
+      return;
+    }
+    pc_->AddIceCandidate(c.get());
+  }
+
+  // switched を送った後は DataChannel、それまでは WebSocket で送る
+  void SendSignaling(std::string text) {
+    if (switched_ && dc_ != nullptr && dc_->IsOpen("signaling")) {
+      dc_->Send("signaling", webrtc::DataBuffer(text));
+    } else if (ws_connected_) {
+      ws_->WriteText(std::move(text));
+    }
+  }
+
+  void OnConnected() {
+    stats_.connected_ms = ElapsedMs(connect_time_);
+    ReportStats();
+
+    auto server = server_.lock();
+    if (config_.notify && server != nullptr) {
+      boost::json::value m = {
+          {"type", "notify"},
+          {"event_type", "connection.created"},
+          {"role", role_},
+          {"client_id", client_id_},
+          {"connection_id", stats_.connection_id},
+          {"channel_connections", server->ConnectionCount()},
+      };
+      std::string text = boost::json::serialize(m);
+      if (switched_ && dc_ != nullptr && dc_->IsOpen("notify")) {
+        dc_->Send("notify", webrtc::DataBuffer(text));
+      } else if (ws_connected_) {
+        ws_->WriteText(std::move(text));
+      }
+    }
+    if (config_.re_offer && !data_channel_signaling_) {
+      CreateOffer(true);
+    }
+    if (config_.ping_interval_seconds > 0) {
+      DoPing();
+    }
+  }
+
+  void OnSwitched() {
+    switched_ = true;
+    boost::json::value m = {
+        {"type", "switched"},
+        {"ignore_disconnect_websocket", ignore_disconnect_websocket_}};
+    if (ws_connected_) {
+      ws_->WriteText(boost::json::serialize(m));
+    }
+    stats_.switched_ms = ElapsedMs(connect_time_);
+    ReportStats();
+    // DataChannel シグナリングでは re-offer も DataChannel で送る
+    if (config_.re_offer) {
+      CreateOffer(true);
+    }
+  }
+
+  void DoPing() {
+    ping_timer_.expires_from_now(
+        boost::posix_time::seconds(config_.ping_interval_seconds));
+    ping_timer_.async_wait(
+        [self = shared_from_this()](boost::system::error_code ec) {
+          if (ec || self->pc_ == nullptr) {
+            return;
+          }
+          if (self->switched_ && self->dc_ != nullptr &&
+              self->dc_->IsOpen("stats")) {
+            // DataChannel シグナリングでは stats ラベルで統計情報を要求する
+            if (self->config_.ping_stats) {
+              self->dc_->Send(
+                  "stats", webrtc::DataBuffer(R"({"type":"req-stats"})"));
+            }
+          } else if (self->ws_connected_) {
+            self->ping_sent_ = Clock::now();
+            boost::json::value m = {{"type", "ping"},
+                                    {"stats", self->config_.ping_stats}};
+            self->ws_->WriteText(boost::json::serialize(m));
+          }
+          self->DoPing();
+        });
+  }
+
+  void ReportStats() {
+    if (auto server = server_.lock()) {
+      server->UpdateStats(stats_);
+    }
+  }
+
+  void Remove() {
+    if (auto server = server_.lock()) {
+      server->RemoveConnection(this);
+    }
+  }
+
+  // webrtc::PeerConnectionObserver
+  void OnSignalingChange(
+      webrtc::PeerConnectionInterface::SignalingState new_state) override {}
+  void OnDataChannel(
+      webrtc::scoped_refptr<webrtc::DataChannelInterface> data_channel)
+      override {}
+  void OnIceGatheringChange(
+      webrtc::PeerConnectionInterface::IceGatheringState new_state) override {
+    if (new_state != webrtc::PeerConnectionInterface::kIceGatheringComplete) {
+      return;
+    }
+    boost::asio::post(*config_.io_context, [self = shared_from_this()]() {
+      if (self->waiting_gathering_ && self->pc_ != nullptr) {
+        self->waiting_gathering_ = false;
+        self->SendOffer(false);
+      }
+    });
+  }
+  void OnIceCandidate(const webrtc::IceCandidateInterface* candidate) override {
+  }
+  void OnConnectionChange(
+      webrtc::PeerConnectionInterface::PeerConnectionState new_state) override {
+    if (new_state !=
+        webrtc::PeerConnectionInterface::PeerConnectionState::kConnected) {
+      return;
+    }
+    boost::asio::post(*config_.io_context, [self = shared_from_this()]() {
+      if (self->pc_ != nullptr && !self->stats_.connected_ms) {
+        self->OnConnected();
+      }
+    });
+  }
+  void OnTrack(webrtc::scoped_refptr<webrtc::RtpTransceiverInterface>
+                   transceiver) override {
+    auto track = transceiver->receiver()->track();
+    if (track->kind() != webrtc::MediaStreamTrackInterface::kVideoKind) {
+      return;
+    }
+    boost::asio::post(*config_.io_context, [self = shared_from_this(),
+                                            track]() {
+      if (self->pc_ == nullptr || self->video_track_ != nullptr) {
+        return;
+      }
+      self->video_track_ = webrtc::scoped_refptr<webrtc::VideoTrackInterface>(
+          static_cast<webrtc::VideoTrackInterface*>(track.get()));
+      self->sink_.on_frame = [weak = self->weak_from_this()]() {
+        auto self = weak.lock();
+        if (self == nullptr) {
+          return;
+        }
+        boost::asio::post(*self->config_.io_context, [self]() {
+          self->stats_.first_frame_ms = ElapsedMs(self->connect_time_);
+          self->ReportStats();
+        });
+      };
+      self->video_track_->AddOrUpdateSink(&self->sink_,
+                                          webrtc::VideoSinkWants());
+    });
+  }
+
+  // sora::DataChannelObserver
+  void OnStateChange(webrtc::scoped_refptr<webrtc::DataChannelInterface>
+                         data_channel) override {
+    if (switched_ || dc_ == nullptr) {
+      return;
+    }
+    for (const auto& label : dc_labels_) {
+      if (!dc_->IsOpen(label)) {
+        return;
+      }
+    }
+    OnSwitched();
+  }
+  void OnMessage(
+      webrtc::scoped_refptr<webrtc::DataChannelInterface> data_channel,
+      const webrtc::DataBuffer& buffer) override {
+    if (data_channel->label() != "signaling") {
+      return;
+    }
+    std::string text((const char*)buffer.data.cdata(),
+                     (const char*)buffer.data.cdata() + buffer.size());
+    boost::system::error_code ec;
+    auto m = boost::json::parse(text, ec);
+    if (ec || !m.is_object()) {
+      return;
+    }
+    HandleMessage(m);
+  }
+
+ private:
+  std::weak_ptr<MockSoraServer> server_;
+  MockSoraServerConfig config_;
+  boost::asio::ip::tcp::socket socket_;
+  boost::beast::flat_buffer http_buffer_;
+  boost::beast::http::request<boost::beast::http::string_body> http_req_;
+  std::shared_ptr<sora::Websocket> ws_;
+  bool ws_connected_ = false;
+
+  Clock::time_point connect_time_;
+  std::string role_;
+  std::string client_id_;
+  bool data_channel_signaling_ = false;
+  bool ignore_disconnect_websocket_ = false;
+  bool waiting_gathering_ = false;
+  bool switched_ = false;
+
+  webrtc::scoped_refptr<webrtc::PeerConnectionInterface> pc_;
+  webrtc::scoped_refptr<webrtc::RtpTransceiverInterface> audio_transceiver_;
+  webrtc::scoped_refptr<webrtc::RtpTransceiverInterface> video_transceiver_;
+  std::shared_ptr<sora::DataChannel> dc_;
+  std::vector<std::string> dc_labels_;
+  webrtc::scoped_refptr<webrtc::VideoTrackInterface> video_track_;
+  FirstFrameSink sink_;
+
+  boost::asio::deadline_timer ping_timer_;
+  std::optional<Clock::time_point> ping_sent_;
+  std::optional<Clock::time_point> re_offer_sent_;
+
+  MockSoraConnectionStats stats_;
+};
+
+std::shared_ptr<MockSoraServer> MockSoraServer::Create(
+    MockSoraServerConfig config) {
+  return std::shared_ptr<MockSoraServer>(new MockSoraServer(config));
+}
+
+MockSoraServer::MockSoraServer(MockSoraServerConfig config)
+    : config_(config), acceptor_(*config.io_context) {
+  boost::asio::ip::tcp::endpoint endpoint(
+      boost::asio::ip::make_address("127.0.0.1"), config_.port);
+  acceptor_.open(endpoint.protocol());
+  acceptor_.set_option(boost::asio::socket_base::reuse_address(true));
+  acceptor_.bind(endpoint);
+  acceptor_.listen(boost::asio::socket_base::max_listen_connections);
+  port_ = acceptor_.local_endpoint().port();
+}
+
+MockSoraServer::~MockSoraServer() {
+  RTC_LOG(LS_INFO) << "MockSoraServer dtor";
+}
+
+void MockSoraServer::Start() {
+  boost::asio::post(*config_.io_context,
+                    [self = shared_from_this()]() { self->DoAccept(); });
+}
+
+void MockSoraServer::Stop() {
+  boost::asio::post(*config_.io_context, [self = shared_from_this()]() {
+    boost::system::error_code ec;
+    self->acceptor_.close(ec);
+    auto connections = std::move(self->connections_);
+    for (auto& c : connections) {
+      c->Close();
+    }
+  });
+}
+
+std::string MockSoraServer::GetSignalingURL() const {
+  return "ws://127.0.0.1:" + std::to_string(port_) + kSignalingPath;
+}
+
+std::vector<MockSoraConnectionStats> MockSoraServer::GetConnectionStats()
+    const {
+  std::lock_guard<std::mutex> lock(stats_mutex_);
+  std::vector<MockSoraConnectionStats> r;
+  for (const auto& kv : stats_) {
+    r.push_back(kv.second);
+  }
+  return r;
+}
+
+void MockSoraServer::DoAccept() {
+  acceptor_.async_accept(
+      [self = shared_from_this()](boost::system::error_code ec,
+                                  boost::asio::ip::tcp::socket socket) {
+        self->OnAccept(ec, std::move(socket));
+      });
+}
+
+void MockSoraServer::OnAccept(boost::system::error_code ec,
+                              boost::asio::ip::tcp::socket socket) {
+  if (ec) {
+    // Stop() で acceptor が閉じられた
+    return;
+  }
+  std::string connection_id = "MOCK" + std::to_string(next_connection_id_++) +
+                              webrtc::CreateRandomString(8);
+  auto connection = std::make_shared<MockSoraConnection>(
+      weak_from_this(), config_, std::move(socket), connection_id);
+  connections_.push_back(connection);
+  connection->Start();
+  DoAccept();
+}
+
+void MockSoraServer::UpdateStats(const MockSoraConnectionStats& stats) {
+  // リダイレクトで閉じるだけの接続は計測しない
+  if (!stats.offer_sent_ms) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(stats_mutex_);
+  stats_[stats.connection_id] = stats;
+}
+
+void MockSoraServer::RemoveConnection(MockSoraConnection* connection) {
+  connections_.erase(
+      std::remove_if(connections_.begin(), connections_.end(),
+                     [connection](const std::shared_ptr<MockSoraConnection>&
+                                      c) { return c.get() == connection; }),
+      connections_.end());
+}
+
+int MockSoraServer::ConnectionCount() const {
+  return static_cast<int>(connections_.size());
+}
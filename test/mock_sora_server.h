@@ -0,0 +1,116 @@
+#ifndef TEST_MOCK_SORA_SERVER_H_
+#define TEST_MOCK_SORA_SERVER_H_
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Boost
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/system/detail/error_code.hpp>
+
+// WebRTC
+#include <api/media_stream_interface.h>
+#include <api/peer_connection_interface.h>
+#include <api/scoped_refptr.h>
+
+struct MockSoraServerConfig {
+  boost::asio::io_context* io_context = nullptr;
+  // サーバ側の PeerConnection を作るためのファクトリ。
+  // クライアントとは別の SoraClientContext から作ったものを渡すのが望ましい。
+  webrtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> pc_factory;
+  // 待ち受けるポート。0 の場合は空いているポートを使う
+  int port = 0;
+
+  // redirect: true の付いていない connect に対して、自分自身へのリダイレクトを返す
+  bool redirect = false;
+  // 接続後に connection.created の notify を送る
+  bool notify = true;
+  // 接続後に re-offer を送る
+  bool re_offer = false;
+  // ping を送る間隔。0 の場合は送らない
+  int ping_interval_seconds = 0;
+  // ping で統計情報を要求する
+  bool ping_stats = false;
+  // クライアントに送る映像。nullptr の場合は映像を送らない
+  webrtc::scoped_refptr<webrtc::VideoTrackSourceInterface> video_source;
+};
+
+// 1 つの接続で計測した時間。
+// 全て connect を受信した時刻からの経過時間で、起きなかったものは std::nullopt になる。
+struct MockSoraConnectionStats {
+  std::string connection_id;
+  bool redirected = false;
+  bool data_channel_signaling = false;
+  // offer を送るまで（ICE の候補の収集を含む）
+  std::optional<double> offer_sent_ms;
+  // answer を受信するまで
+  std::optional<double> answer_received_ms;
+  // サーバ側の PeerConnection が connected になるまで
+  std::optional<double> connected_ms;
+  // switched を送るまで
+  std::optional<double> switched_ms;
+  // クライアントの映像の最初のフレームを受信するまで
+  std::optional<double> first_frame_ms;
+  // re-offer を送ってから re-answer を受信するまで
+  std::optional<double> re_offer_rtt_ms;
+  // ping を送ってから pong を受信するまで（最後の値）
+  std::optional<double> ping_rtt_ms;
+  bool disconnected = false;
+};
+
+class MockSoraConnection;
+
+// Sora のシグナリングを模倣するサーバ。
+//
+// Websocket のサーバモードで connect を受け付けて、本物の PeerConnection を作って offer を送る。
+// redirect, re-offer, notify, ping (stats), DataChannel シグナリングへの switched に対応しているので、
+// 実際の Sora が無くても SoraSignaling の接続やリダイレクト、DataChannel への切り替えの時間を計測できる。
+//
+// 全ての処理は config.io_context 上で行う。
+class MockSoraServer : public std::enable_shared_from_this<MockSoraServer> {
+ public:
+  static std::shared_ptr<MockSoraServer> Create(MockSoraServerConfig config);
+  ~MockSoraServer();
+
+  void Start();
+  void Stop();
+
+  int port() const { return port_; }
+  // SoraSignalingConfig::signaling_urls に指定する URL
+  std::string GetSignalingURL() const;
+
+  // 任意のスレッドから呼び出せる
+  std::vector<MockSoraConnectionStats> GetConnectionStats() const;
+
+ private:
+  friend class MockSoraConnection;
+
+  MockSoraServer(MockSoraServerConfig config);
+
+  void DoAccept();
+  void OnAccept(boost::system::error_code ec,
+                boost::asio::ip::tcp::socket socket);
+
+  // MockSoraConnection から呼ばれる
+  void UpdateStats(const MockSoraConnectionStats& stats);
+  void RemoveConnection(MockSoraConnection* connection);
+  int ConnectionCount() const;
+
+ private:
+  MockSoraServerConfig config_;
+  boost::asio::ip::tcp::acceptor acceptor_;
+  int port_ = 0;
+  int next_connection_id_ = 0;
+  std::vector<std::shared_ptr<MockSoraConnection>> connections_;
+
+  mutable std::mutex stats_mutex_;
+  std::map<std::string, MockSoraConnectionStats> stats_;
+};
+
+#endif
@@ -0,0 +1,445 @@
+// MockSoraServer を使って、Sora 無しで SoraSignaling の接続にかかる時間を計測する
+//
+// signaling_bench [param.json]
+//
+// param.json の例（全て省略可能）:
+// {
+//   "connections": 10,
+//   "redirect": true,
+//   "data_channel_signaling": true,
+//   "ignore_disconnect_websocket": false,
+//   "re_offer": true,
+//   "ping_interval_seconds": 1,
+//   "hold_seconds": 3,
+//   "output": "signaling_bench.json",
+// }
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Boost
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/post.hpp>
+
+// WebRTC
+#include <api/media_stream_interface.h>
+#include <api/peer_connection_interface.h>
+#include <api/rtp_receiver_interface.h>
+#include <api/rtp_transceiver_interface.h>
+#include <api/scoped_refptr.h>
+#include <api/video/video_frame.h>
+#include <api/video/video_sink_interface.h>
+#include <api/video/video_source_interface.h>
+#include <rtc_base/crypto_random.h>
+#include <rtc_base/logging.h>
+
+#ifdef _WIN32
+#include <rtc_base/win/scoped_com_initializer.h>
+#endif
+
+// Sora C++ SDK
+#include <sora/boost_json_iwyu.h>
+#include <sora/capturer/fake_video_capturer.h>
+#include <sora/sora_client_context.h>
+#include <sora/sora_signaling.h>
+
+#include "bench_util.h"
+#include "mock_sora_server.h"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+struct BenchConfig {
+  int connections = 10;
+  bool redirect = false;
+  bool data_channel_signaling = false;
+  bool ignore_disconnect_websocket = false;
+  bool re_offer = false;
+  int ping_interval_seconds = 0;
+  int hold_seconds = 3;
+  std::string output = "signaling_bench.json";
+};
+
+// 1 つの SoraSignaling の接続と、クライアント側で計測した時間
+class BenchClient : public std::enable_shared_from_this<BenchClient>,
+                    public sora::SoraSignalingObserver {
+ public:
+  struct Stats {
+    // Connect() を呼んでからの経過時間
+    std::optional<double> offer_ms;
+    std::optional<double> switched_ms;
+    std::optional<double> first_frame_ms;
+    bool disconnected = false;
+    std::string disconnect_message;
+  };
+
+  BenchClient(boost::asio::io_context& ioc,
+              webrtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface>
+                  pc_factory,
+              webrtc::scoped_refptr<webrtc::VideoTrackSourceInterface> source,
+              std::function<void()> on_update)
+      : ioc_(ioc),
+        pc_factory_(pc_factory),
+        source_(source),
+        on_update_(std::move(on_update)) {}
+
+  ~BenchClient() {
+    if (remote_track_ != nullptr) {
+      remote_track_->RemoveSink(&sink_);
+    }
+  }
+
+  void Connect(const BenchConfig& bench_config, const std::string& url) {
+    video_track_ = pc_factory_->CreateVideoTrack(
+        source_, webrtc::CreateRandomString(16));
+
+    sora::SoraSignalingConfig config;
+    config.pc_factory = pc_factory_;
+    config.io_context = &ioc_;
+    config.observer = shared_from_this();
+    config.signaling_urls.push_back(url);
+    config.channel_id = "signaling_bench";
+    config.role = "sendrecv";
+    config.video = true;
+    config.audio = false;
+    config.multistream = true;
+    if (bench_config.data_channel_signaling) {
+      config.data_channel_signaling = true;
+      config.ignore_disconnect_websocket =
+          bench_config.ignore_disconnect_websocket;
+    }
+    conn_ = sora::SoraSignaling::Create(config);
+    start_ = Clock::now();
+    conn_->Connect();
+  }
+
+  void Disconnect() { conn_->Disconnect(); }
+
+  Stats GetStats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+  }
+
+  void OnSetOffer(std::string offer) override {
+    Update([this](Stats& stats) { stats.offer_ms = ElapsedMs(); });
+    conn_->GetPeerConnection()->AddTrack(video_track_,
+                                         {webrtc::CreateRandomString(16)});
+  }
+  void OnDisconnect(sora::SoraSignalingErrorCode ec,
+                    std::string message) override {
+    Update([&message](Stats& stats) {
+      stats.disconnected = true;
+      stats.disconnect_message = message;
+    });
+  }
+  void OnNotify(std::string text) override {}
+  void OnPush(std::string text) override {}
+  void OnMessage(std::string label, std::string data) override {}
+  void OnSwitched(std::string text) override {
+    Update([this](Stats& stats) { stats.switched_ms = ElapsedMs(); });
+  }
+  void OnTrack(webrtc::scoped_refptr<webrtc::RtpTransceiverInterface>
+                   transceiver) override {
+    auto track = transceiver->receiver()->track();
+    if (track->kind() != webrtc::MediaStreamTrackInterface::kVideoKind ||
+        remote_track_ != nullptr) {
+      return;
+    }
+    remote_track_ = webrtc::scoped_refptr<webrtc::VideoTrackInterface>(
+        static_cast<webrtc::VideoTrackInterface*>(track.get()));
+    sink_.on_frame = [this]() {
+      Update([this](Stats& stats) {
+        if (!stats.first_frame_ms) {
+          stats.first_frame_ms = ElapsedMs();
+        }
+      });
+    };
+    remote_track_->AddOrUpdateSink(&sink_, webrtc::VideoSinkWants());
+  }
+  void OnRemoveTrack(
+      webrtc::scoped_refptr<webrtc::RtpReceiverInterface> receiver) override {}
+  void OnDataChannel(std::string label) override {}
+
+ private:
+  double ElapsedMs() const {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start_)
+        .count();
+  }
+
+  void Update(std::function<void(Stats&)> f) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      f(stats_);
+    }
+    on_update_();
+  }
+
+  boost::asio::io_context& ioc_;
+  webrtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> pc_factory_;
+  webrtc::scoped_refptr<webrtc::VideoTrackSourceInterface> source_;
+  std::function<void()> on_update_;
+  webrtc::scoped_refptr<webrtc::VideoTrackInterface> video_track_;
+  webrtc::scoped_refptr<webrtc::VideoTrackInterface> remote_track_;
+  FirstFrameSink sink_;
+  std::shared_ptr<sora::SoraSignaling> conn_;
+  Clock::time_point start_;
+  std::mutex mutex_;
+  Stats stats_;
+};
+
+std::shared_ptr<sora::SoraClientContext> CreateContext() {
+  sora::SoraClientContextConfig config;
+  config.use_audio_device = false;
+  auto context = sora::SoraClientContext::Create(config);
+  // ループバックのインターフェースで接続できるようにする
+  webrtc::PeerConnectionFactoryInterface::Options options;
+  options.network_ignore_mask = 0;
+  context->peer_connection_factory()->SetOptions(options);
+  return context;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+#ifdef _WIN32
+  webrtc::ScopedCOMInitializer com_initializer(
+      webrtc::ScopedCOMInitializer::kMTA);
+  if (!com_initializer.Succeeded()) {
+    std::cerr << "CoInitializeEx failed" << std::endl;
+    return 1;
+  }
+#endif
+
+  webrtc::LogMessage::LogToDebug(webrtc::LS_WARNING);
+  webrtc::LogMessage::LogTimestamps();
+  webrtc::LogMessage::LogThreads();
+
+  BenchConfig config;
+  if (argc >= 2) {
+    boost::json::value v;
+    {
+      std::ifstream ifs(argv[1]);
+      std::ostringstream oss;
+      oss << ifs.rdbuf();
+      std::string js = oss.str();
+      boost::json::parse_options opt;
+      opt.allow_comments = true;
+      opt.allow_trailing_commas = true;
+      v = boost::json::parse(js, {}, opt);
+    }
+    boost::json::value x;
+    auto get = [](const boost::json::value& v, const char* key,
+                  boost::json::value& x) -> bool {
+      if (auto it = v.as_object().find(key);
+          it != v.as_object().end() && !it->value().is_null()) {
+        x = it->value();
+        return true;
+      }
+      return false;
+    };
+    if (get(v, "connections", x)) {
+      config.connections = x.to_number<int>();
+    }
+    if (get(v, "redirect", x)) {
+      config.redirect = x.as_bool();
+    }
+    if (get(v, "data_channel_signaling", x)) {
+      config.data_channel_signaling = x.as_bool();
+    }
+    if (get(v, "ignore_disconnect_websocket", x)) {
+      config.ignore_disconnect_websocket = x.as_bool();
+    }
+    if (get(v, "re_offer", x)) {
+      config.re_offer = x.as_bool();
+    }
+    if (get(v, "ping_interval_seconds", x)) {
+      config.ping_interval_seconds = x.to_number<int>();
+    }
+    if (get(v, "hold_seconds", x)) {
+      config.hold_seconds = x.to_number<int>();
+    }
+    if (get(v, "output", x)) {
+      config.output = x.as_string().c_str();
+    }
+  }
+
+  // サーバ側とクライアント側で別のスレッドを使うように、コンテキストを分ける
+  auto server_context = CreateContext();
+  auto client_context = CreateContext();
+
+  sora::FakeVideoCapturerConfig fake_config;
+  fake_config.width = 320;
+  fake_config.height = 240;
+  fake_config.fps = 30;
+  auto server_source = sora::FakeVideoCapturer::Create(fake_config);
+  auto client_source = sora::FakeVideoCapturer::Create(fake_config);
+
+  boost::asio::io_context ioc(1);
+  auto work_guard = boost::asio::make_work_guard(ioc);
+  std::thread ioc_thread([&ioc]() { ioc.run(); });
+
+  MockSoraServerConfig server_config;
+  server_config.io_context = &ioc;
+  server_config.pc_factory = server_context->peer_connection_factory();
+  server_config.redirect = config.redirect;
+  server_config.re_offer = config.re_offer;
+  server_config.ping_interval_seconds = config.ping_interval_seconds;
+  server_config.ping_stats = config.ping_interval_seconds > 0;
+  server_config.video_source = server_source;
+  auto server = MockSoraServer::Create(server_config);
+  server->Start();
+
+  std::mutex mutex;
+  std::condition_variable cond;
+  auto on_update = [&mutex, &cond]() {
+    std::lock_guard<std::mutex> lock(mutex);
+    cond.notify_all();
+  };
+
+  int64_t memory_before = GetResidentMemoryBytes();
+  auto start = Clock::now();
+
+  std::vector<std::shared_ptr<BenchClient>> clients;
+  for (int i = 0; i < config.connections; i++) {
+    auto client = std::make_shared<BenchClient>(
+        ioc, client_context->peer_connection_factory(), client_source,
+        on_update);
+    clients.push_back(client);
+    boost::asio::post(ioc,
+                      [client, &config, url = server->GetSignalingURL()]() {
+                        client->Connect(config, url);
+                      });
+  }
+
+  // 全ての接続で映像を受信するか切断されるまで待つ
+  auto all_ready = [&clients, &config]() {
+    for (auto& client : clients) {
+      auto stats = client->GetStats();
+      if (stats.disconnected) {
+        continue;
+      }
+      if (!stats.first_frame_ms) {
+        return false;
+      }
+      if (config.data_channel_signaling && !stats.switched_ms) {
+        return false;
+      }
+    }
+    return true;
+  };
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!cond.wait_for(lock, std::chrono::seconds(30), all_ready)) {
+      std::cerr << "Timed out waiting for connections" << std::endl;
+    }
+  }
+  double connect_all_ms =
+      std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+  int64_t memory_after = GetResidentMemoryBytes();
+
+  // re-offer や ping の計測のために、しばらく接続を維持する
+  std::this_thread::sleep_for(std::chrono::seconds(config.hold_seconds));
+
+  for (auto& client : clients) {
+    boost::asio::post(ioc, [client]() { client->Disconnect(); });
+  }
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    cond.wait_for(lock, std::chrono::seconds(10), [&clients]() {
+      for (auto& client : clients) {
+        if (!client->GetStats().disconnected) {
+          return false;
+        }
+      }
+      return true;
+    });
+  }
+
+  std::vector<double> client_offer, client_switched, client_first_frame;
+  int failed = 0;
+  for (auto& client : clients) {
+    auto stats = client->GetStats();
+    if (stats.offer_ms) {
+      client_offer.push_back(*stats.offer_ms);
+    }
+    if (stats.switched_ms) {
+      client_switched.push_back(*stats.switched_ms);
+    }
+    if (stats.first_frame_ms) {
+      client_first_frame.push_back(*stats.first_frame_ms);
+    } else {
+      failed++;
+    }
+  }
+  std::vector<double> server_offer, server_connected, server_first_frame,
+      re_offer_rtt, ping_rtt;
+  for (const auto& stats : server->GetConnectionStats()) {
+    if (stats.offer_sent_ms) {
+      server_offer.push_back(*stats.offer_sent_ms);
+    }
+    if (stats.connected_ms) {
+      server_connected.push_back(*stats.connected_ms);
+    }
+    if (stats.first_frame_ms) {
+      server_first_frame.push_back(*stats.first_frame_ms);
+    }
+    if (stats.re_offer_rtt_ms) {
+      re_offer_rtt.push_back(*stats.re_offer_rtt_ms);
+    }
+    if (stats.ping_rtt_ms) {
+      ping_rtt.push_back(*stats.ping_rtt_ms);
+    }
+  }
+
+  boost::json::object result = {
+      {"connections", config.connections},
+      {"failed", failed},
+      {"redirect", config.redirect},
+      {"data_channel_signaling", config.data_channel_signaling},
+      {"connect_all_ms", connect_all_ms},
+      // サーバとクライアントが同じプロセスにいるので、両方の分を含む
+      {"memory_per_connection_bytes",
+       config.connections > 0
+           ? (memory_after - memory_before) / config.connections
+           : 0},
+      {"client",
+       {
+           {"offer_ms", Summarize(client_offer)},
+           {"switched_ms", Summarize(client_switched)},
+           {"first_frame_ms", Summarize(client_first_frame)},
+       }},
+      {"server",
+       {
+           {"offer_sent_ms", Summarize(server_offer)},
+           {"connected_ms", Summarize(server_connected)},
+           {"first_frame_ms", Summarize(server_first_frame)},
+           {"re_offer_rtt_ms", Summarize(re_offer_rtt)},
+           {"ping_rtt_ms", Summarize(ping_rtt)},
+       }},
+  };
+  std::cout << boost::json::serialize(result) << std::endl;
+  std::ofstream ofs(config.output);
+  ofs << boost::json::serialize(result) << std::endl;
+
+  server->Stop();
+  // タイマーなどが残っていても終了できるように、Stop の後に io_context を止める
+  boost::asio::post(ioc, [&ioc]() { ioc.stop(); });
+  ioc_thread.join();
+  clients.clear();
+  server.reset();
+
+  return failed == 0 ? 0 : 1;
+}
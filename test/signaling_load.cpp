@@ -0,0 +1,636 @@
+// 1 つの SoraClientContext と 1 つの io_context を共有して、多数の SoraSignaling を接続する負荷試験
+//
+// signaling_load [param.json]
+//
+// param.json の例（全て省略可能）:
+// {
+//   // 省略した場合はプロセス内の MockSoraServer に接続する
+//   "signaling_urls": ["wss://sora.example.com/signaling"],
+//   "channel_id": "signaling_load",
+//   "metadata": {"access_token": "xxx"},
+//   "insecure": false,
+//   "connections": 100,
+//   // 1 接続ごとに待つ時間
+//   "ramp_up_interval_ms": 20,
+//   "role": "recvonly",
+//   "video_codec_type": "VP8",
+//   // false にすると SoraSignalingConfig::signaling_thread を設定しない
+//   "use_signaling_thread": true,
+//   // 全ての接続を始めた後、接続を維持する時間
+//   "hold_seconds": 10,
+//   // io_context の待ち時間を計測する間隔
+//   "probe_interval_ms": 10,
+//   "output": "signaling_load.json",
+// }
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__APPLE__)
+#include <mach/mach.h>
+#endif
+
+// Boost
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/post.hpp>
+
+// WebRTC
+#include <api/media_stream_interface.h>
+#include <api/peer_connection_interface.h>
+#include <api/rtp_receiver_interface.h>
+#include <api/rtp_transceiver_interface.h>
+#include <api/scoped_refptr.h>
+#include <api/video/video_frame.h>
+#include <api/video/video_sink_interface.h>
+#include <api/video/video_source_interface.h>
+#include <rtc_base/crypto_random.h>
+#include <rtc_base/logging.h>
+
+#ifdef _WIN32
+#include <rtc_base/win/scoped_com_initializer.h>
+#endif
+
+// Sora C++ SDK
+#include <sora/boost_json_iwyu.h>
+#include <sora/capturer/fake_video_capturer.h>
+#include <sora/sora_client_context.h>
+#include <sora/sora_signaling.h>
+#include <sora/websocket_connection_cache.h>
+
+#include "bench_util.h"
+#include "mock_sora_server.h"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+struct LoadConfig {
+  std::vector<std::string> signaling_urls;
+  std::string channel_id = "signaling_load";
+  boost::json::value metadata;
+  bool insecure = false;
+  int connections = 100;
+  int ramp_up_interval_ms = 20;
+  std::string role = "recvonly";
+  std::string video_codec_type;
+  bool use_signaling_thread = true;
+  int hold_seconds = 10;
+  int probe_interval_ms = 10;
+  std::string output = "signaling_load.json";
+};
+
+// プロセスのスレッド数。取得できない環境では 0 を返す
+int GetThreadCount() {
+#if defined(__linux__)
+  std::ifstream ifs("/proc/self/status");
+  std::string line;
+  while (std::getline(ifs, line)) {
+    if (line.rfind("Threads:", 0) == 0) {
+      return std::stoi(line.substr(8));
+    }
+  }
+  return 0;
+#elif defined(__APPLE__)
+  thread_act_array_t threads;
+  mach_msg_type_number_t count = 0;
+  if (task_threads(mach_task_self(), &threads, &count) != KERN_SUCCESS) {
+    return 0;
+  }
+  for (mach_msg_type_number_t i = 0; i < count; i++) {
+    mach_port_deallocate(mach_task_self(), threads[i]);
+  }
+  vm_deallocate(mach_task_self(), (vm_address_t)threads,
+                count * sizeof(thread_act_t));
+  return static_cast<int>(count);
+#else
+  return 0;
+#endif
+}
+
+// io_context に一定間隔でタスクを投げて、実行されるまでの待ち時間を計測する。
+// 接続数が増えた時に io_context のスレッドがどれだけ詰まっているかが分かる。
+class QueueDelayProbe {
+ public:
+  QueueDelayProbe(boost::asio::io_context& ioc, int interval_ms)
+      : ioc_(ioc), interval_ms_(interval_ms) {}
+  ~QueueDelayProbe() { Stop(); }
+
+  void Start() {
+    thread_ = std::thread([this]() {
+      while (!stopped_) {
+        auto posted = Clock::now();
+        boost::asio::post(ioc_, [this, posted]() {
+          double delay_ms =
+              std::chrono::duration<double, std::milli>(Clock::now() - posted)
+                  .count();
+          std::lock_guard<std::mutex> lock(mutex_);
+          delays_.push_back(delay_ms);
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(interval_ms_));
+      }
+    });
+  }
+  void Stop() {
+    stopped_ = true;
+    if (thread_.joinable()) {
+      thread_.join();
+    }
+  }
+
+  // 前回呼び出してからの計測値を取り出す
+  std::vector<double> Take() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<double> delays;
+    delays.swap(delays_);
+    return delays;
+  }
+
+ private:
+  boost::asio::io_context& ioc_;
+  int interval_ms_;
+  std::atomic<bool> stopped_{false};
+  std::thread thread_;
+  std::mutex mutex_;
+  std::vector<double> delays_;
+};
+
+// 1 つの SoraSignaling の接続と、計測した時間
+class LoadClient : public std::enable_shared_from_this<LoadClient>,
+                   public sora::SoraSignalingObserver {
+ public:
+  struct Stats {
+    // Connect() を呼んでからの経過時間
+    std::optional<double> offer_ms;
+    std::optional<double> first_frame_ms;
+    bool disconnected = false;
+    std::string disconnect_message;
+  };
+
+  LoadClient(boost::asio::io_context& ioc,
+             std::shared_ptr<sora::SoraClientContext> context,
+             webrtc::scoped_refptr<webrtc::VideoTrackSourceInterface> source,
+             std::function<void()> on_update)
+      : ioc_(ioc),
+        context_(context),
+        source_(source),
+        on_update_(std::move(on_update)) {}
+
+  ~LoadClient() {
+    if (remote_track_ != nullptr) {
+      remote_track_->RemoveSink(&sink_);
+    }
+  }
+
+  void Connect(const LoadConfig& load_config) {
+    sora::SoraSignalingConfig config;
+    config.pc_factory = context_->peer_connection_factory();
+    config.io_context = &ioc_;
+    config.observer = shared_from_this();
+    config.signaling_urls = load_config.signaling_urls;
+    config.channel_id = load_config.channel_id;
+    config.metadata = load_config.metadata;
+    config.insecure = load_config.insecure;
+    config.role = load_config.role;
+    config.video = true;
+    config.audio = false;
+    config.video_codec_type = load_config.video_codec_type;
+    config.multistream = true;
+    if (load_config.use_signaling_thread) {
+      config.signaling_thread = context_->signaling_thread();
+    }
+    conn_ = sora::SoraSignaling::Create(config);
+    start_ = Clock::now();
+    conn_->Connect();
+  }
+
+  void Disconnect() {
+    if (conn_ != nullptr) {
+      conn_->Disconnect();
+    }
+  }
+
+  Stats GetStats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+  }
+
+  void OnSetOffer(std::string offer) override {
+    Update([this](Stats& stats) { stats.offer_ms = ElapsedMs(); });
+    if (source_ != nullptr) {
+      auto pc_factory = context_->peer_connection_factory();
+      auto track = pc_factory->CreateVideoTrack(
+          source_, webrtc::CreateRandomString(16));
+      conn_->GetPeerConnection()->AddTrack(track,
+                                           {webrtc::CreateRandomString(16)});
+    }
+  }
+  void OnDisconnect(sora::SoraSignalingErrorCode ec,
+                    std::string message) override {
+    Update([&message](Stats& stats) {
+      stats.disconnected = true;
+      stats.disconnect_message = message;
+    });
+  }
+  void OnNotify(std::string text) override {}
+  void OnPush(std::string text) override {}
+  void OnMessage(std::string label, std::string data) override {}
+  void OnTrack(webrtc::scoped_refptr<webrtc::RtpTransceiverInterface>
+                   transceiver) override {
+    auto track = transceiver->receiver()->track();
+    if (track->kind() != webrtc::MediaStreamTrackInterface::kVideoKind ||
+        remote_track_ != nullptr) {
+      return;
+    }
+    remote_track_ = webrtc::scoped_refptr<webrtc::VideoTrackInterface>(
+        static_cast<webrtc::VideoTrackInterface*>(track.get()));
+    sink_.on_frame = [this]() {
+      Update([this](Stats& stats) {
+        if (!stats.first_frame_ms) {
+          stats.first_frame_ms = ElapsedMs();
+        }
+      });
+    };
+    remote_track_->AddOrUpdateSink(&sink_, webrtc::VideoSinkWants());
+  }
+  void OnRemoveTrack(
+      webrtc::scoped_refptr<webrtc::RtpReceiverInterface> receiver) override {}
+  void OnDataChannel(std::string label) override {}
+
+ private:
+  double ElapsedMs() const {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start_)
+        .count();
+  }
+
+  void Update(std::function<void(Stats&)> f) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      f(stats_);
+    }
+    on_update_();
+  }
+
+  boost::asio::io_context& ioc_;
+  std::shared_ptr<sora::SoraClientContext> context_;
+  webrtc::scoped_refptr<webrtc::VideoTrackSourceInterface> source_;
+  std::function<void()> on_update_;
+  webrtc::scoped_refptr<webrtc::VideoTrackInterface> remote_track_;
+  FirstFrameSink sink_;
+  std::shared_ptr<sora::SoraSignaling> conn_;
+  Clock::time_point start_;
+  std::mutex mutex_;
+  Stats stats_;
+};
+
+std::shared_ptr<sora::SoraClientContext> CreateContext(bool loopback) {
+  sora::SoraClientContextConfig config;
+  config.use_audio_device = false;
+  auto context = sora::SoraClientContext::Create(config);
+  if (loopback) {
+    // ループバックのインターフェースで接続できるようにする
+    webrtc::PeerConnectionFactoryInterface::Options options;
+    options.network_ignore_mask = 0;
+    context->peer_connection_factory()->SetOptions(options);
+  }
+  return context;
+}
+
+bool ReceivesVideo(const std::string& role) {
+  return role == "recvonly" || role == "sendrecv";
+}
+
+bool SendsVideo(const std::string& role) {
+  return role == "sendonly" || role == "sendrecv";
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+#ifdef _WIN32
+  webrtc::ScopedCOMInitializer com_initializer(
+      webrtc::ScopedCOMInitializer::kMTA);
+  if (!com_initializer.Succeeded()) {
+    std::cerr << "CoInitializeEx failed" << std::endl;
+    return 1;
+  }
+#endif
+
+  webrtc::LogMessage::LogToDebug(webrtc::LS_WARNING);
+  webrtc::LogMessage::LogTimestamps();
+  webrtc::LogMessage::LogThreads();
+
+  LoadConfig config;
+  if (argc >= 2) {
+    boost::json::value v;
+    {
+      std::ifstream ifs(argv[1]);
+      std::ostringstream oss;
+      oss << ifs.rdbuf();
+      std::string js = oss.str();
+      boost::json::parse_options opt;
+      opt.allow_comments = true;
+      opt.allow_trailing_commas = true;
+      v = boost::json::parse(js, {}, opt);
+    }
+    boost::json::value x;
+    auto get = [](const boost::json::value& v, const char* key,
+                  boost::json::value& x) -> bool {
+      if (auto it = v.as_object().find(key);
+          it != v.as_object().end() && !it->value().is_null()) {
+        x = it->value();
+        return true;
+      }
+      return false;
+    };
+    if (get(v, "signaling_urls", x)) {
+      for (const auto& url : x.as_array()) {
+        config.signaling_urls.push_back(url.as_string().c_str());
+      }
+    }
+    if (get(v, "channel_id", x)) {
+      config.channel_id = x.as_string().c_str();
+    }
+    if (get(v, "metadata", x)) {
+      config.metadata = x;
+    }
+    if (get(v, "insecure", x)) {
+      config.insecure = x.as_bool();
+    }
+    if (get(v, "connections", x)) {
+      config.connections = x.to_number<int>();
+    }
+    if (get(v, "ramp_up_interval_ms", x)) {
+      config.ramp_up_interval_ms = x.to_number<int>();
+    }
+    if (get(v, "role", x)) {
+      config.role = x.as_string().c_str();
+    }
+    if (get(v, "video_codec_type", x)) {
+      config.video_codec_type = x.as_string().c_str();
+    }
+    if (get(v, "use_signaling_thread", x)) {
+      config.use_signaling_thread = x.as_bool();
+    }
+    if (get(v, "hold_seconds", x)) {
+      config.hold_seconds = x.to_number<int>();
+    }
+    if (get(v, "probe_interval_ms", x)) {
+      config.probe_interval_ms = x.to_number<int>();
+    }
+    if (get(v, "output", x)) {
+      config.output = x.as_string().c_str();
+    }
+  }
+
+  bool local = config.signaling_urls.empty();
+
+  sora::FakeVideoCapturerConfig fake_config;
+  fake_config.width = 320;
+  fake_config.height = 240;
+  fake_config.fps = 30;
+
+  // ローカルのサーバは、計測対象の io_context やスレッドと混ざらないように
+  // 別のコンテキストと io_context で動かす
+  std::shared_ptr<sora::SoraClientContext> server_context;
+  std::unique_ptr<boost::asio::io_context> server_ioc;
+  std::thread server_ioc_thread;
+  std::shared_ptr<MockSoraServer> server;
+  if (local) {
+    server_context = CreateContext(true);
+    server_ioc.reset(new boost::asio::io_context(1));
+    MockSoraServerConfig server_config;
+    server_config.io_context = server_ioc.get();
+    server_config.pc_factory = server_context->peer_connection_factory();
+    if (ReceivesVideo(config.role)) {
+      server_config.video_source = sora::FakeVideoCapturer::Create(fake_config);
+    }
+    server = MockSoraServer::Create(server_config);
+    server->Start();
+    config.signaling_urls.push_back(server->GetSignalingURL());
+    server_ioc_thread = std::thread([&server_ioc]() { server_ioc->run(); });
+  }
+
+  int threads_before_context = GetThreadCount();
+  auto client_context = CreateContext(local);
+  webrtc::scoped_refptr<webrtc::VideoTrackSourceInterface> client_source;
+  if (SendsVideo(config.role)) {
+    client_source = sora::FakeVideoCapturer::Create(fake_config);
+  }
+
+  boost::asio::io_context ioc(1);
+  auto work_guard = boost::asio::make_work_guard(ioc);
+  std::thread ioc_thread([&ioc]() { ioc.run(); });
+
+  QueueDelayProbe probe(ioc, config.probe_interval_ms);
+  probe.Start();
+
+  std::mutex mutex;
+  std::condition_variable cond;
+  auto on_update = [&mutex, &cond]() {
+    std::lock_guard<std::mutex> lock(mutex);
+    cond.notify_all();
+  };
+
+  int threads_before_connect = GetThreadCount();
+  int64_t memory_before = GetResidentMemoryBytes();
+  auto start = Clock::now();
+
+  // 接続中の状態を 1 秒ごとに記録する
+  boost::json::array timeline;
+  auto last_sample = Clock::now();
+  std::vector<std::shared_ptr<LoadClient>> clients;
+  auto count_connected = [&clients, &config]() {
+    int n = 0;
+    for (auto& client : clients) {
+      auto stats = client->GetStats();
+      if (stats.disconnected) {
+        continue;
+      }
+      if (ReceivesVideo(config.role) ? stats.first_frame_ms.has_value()
+                                     : stats.offer_ms.has_value()) {
+        n++;
+      }
+    }
+    return n;
+  };
+  // 接続中と接続を維持している間の io_context の待ち時間を分けて集計する
+  std::vector<double> ramp_up_delays;
+  std::vector<double> hold_delays;
+  std::vector<double>* delays_out = &ramp_up_delays;
+  auto sample = [&]() {
+    auto delays = probe.Take();
+    delays_out->insert(delays_out->end(), delays.begin(), delays.end());
+    timeline.push_back(boost::json::object{
+        {"elapsed_ms", std::chrono::duration<double, std::milli>(
+                           Clock::now() - start)
+                           .count()},
+        {"started", clients.size()},
+        {"connected", count_connected()},
+        {"memory_bytes", GetResidentMemoryBytes()},
+        {"threads", GetThreadCount()},
+        {"io_context_delay_ms", Summarize(delays)},
+    });
+    last_sample = Clock::now();
+  };
+
+  for (int i = 0; i < config.connections; i++) {
+    auto client = std::make_shared<LoadClient>(ioc, client_context,
+                                               client_source, on_update);
+    clients.push_back(client);
+    boost::asio::post(ioc, [client, &config]() { client->Connect(config); });
+    std::this_thread::sleep_for(
+        std::chrono::milliseconds(config.ramp_up_interval_ms));
+    if (Clock::now() - last_sample >= std::chrono::seconds(1)) {
+      sample();
+    }
+  }
+
+  // 全ての接続が終わるか切断されるまで待つ
+  auto all_ready = [&clients, &config]() {
+    for (auto& client : clients) {
+      auto stats = client->GetStats();
+      if (stats.disconnected) {
+        continue;
+      }
+      if (ReceivesVideo(config.role) ? !stats.first_frame_ms
+                                     : !stats.offer_ms) {
+        return false;
+      }
+    }
+    return true;
+  };
+  while (true) {
+    std::unique_lock<std::mutex> lock(mutex);
+    bool ready = cond.wait_for(lock, std::chrono::seconds(1), all_ready);
+    lock.unlock();
+    sample();
+    if (ready || Clock::now() - start >=
+                     std::chrono::milliseconds(config.connections *
+                                               config.ramp_up_interval_ms) +
+                         std::chrono::seconds(60)) {
+      break;
+    }
+  }
+  double connect_all_ms =
+      std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+  int connected = count_connected();
+  int64_t memory_after = GetResidentMemoryBytes();
+  int threads_after_connect = GetThreadCount();
+
+  delays_out = &hold_delays;
+  for (int i = 0; i < config.hold_seconds; i++) {
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    sample();
+  }
+
+  for (auto& client : clients) {
+    boost::asio::post(ioc, [client]() { client->Disconnect(); });
+  }
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    cond.wait_for(lock, std::chrono::seconds(10), [&clients]() {
+      for (auto& client : clients) {
+        if (!client->GetStats().disconnected) {
+          return false;
+        }
+      }
+      return true;
+    });
+  }
+  probe.Stop();
+
+  std::vector<double> offer, first_frame;
+  for (auto& client : clients) {
+    auto stats = client->GetStats();
+    if (stats.offer_ms) {
+      offer.push_back(*stats.offer_ms);
+    }
+    if (stats.first_frame_ms) {
+      first_frame.push_back(*stats.first_frame_ms);
+    }
+  }
+  int failed = config.connections - connected;
+  std::vector<double> server_connected;
+  if (server != nullptr) {
+    for (const auto& stats : server->GetConnectionStats()) {
+      if (stats.connected_ms) {
+        server_connected.push_back(*stats.connected_ms);
+      }
+    }
+  }
+
+  boost::json::object result = {
+      {"server", local ? "local" : config.signaling_urls[0]},
+      {"connections", config.connections},
+      {"connected", connected},
+      {"failed", failed},
+      {"role", config.role},
+      {"video_codec_type", config.video_codec_type},
+      {"ramp_up_interval_ms", config.ramp_up_interval_ms},
+      {"use_signaling_thread", config.use_signaling_thread},
+      {"connect_all_ms", connect_all_ms},
+      {"connect_latency",
+       {
+           {"offer_ms", Summarize(offer)},
+           {"first_frame_ms", Summarize(first_frame)},
+           // ローカルのサーバで connect を受信してから connected になるまで
+           {"server_connected_ms", Summarize(server_connected)},
+       }},
+      // ローカルのサーバを使う場合はサーバ側の分も含む
+      {"memory_per_connection_bytes",
+       connected > 0 ? (memory_after - memory_before) / connected : 0},
+      {"threads",
+       {
+           {"before_context", threads_before_context},
+           {"before_connect", threads_before_connect},
+           {"after_connect", threads_after_connect},
+       }},
+      {"io_context_delay_ms",
+       {
+           {"ramp_up", Summarize(ramp_up_delays)},
+           {"hold", Summarize(hold_delays)},
+       }},
+      {"timeline", timeline},
+  };
+  {
+    auto stats = sora::WebsocketConnectionCache::Instance().GetStats();
+    result["websocket_connection_cache"] = {
+        {"dns_cache_hits", stats.dns_cache_hits},
+        {"dns_cache_misses", stats.dns_cache_misses},
+        {"dns_coalesced", stats.dns_coalesced},
+        {"ssl_contexts_created", stats.ssl_contexts_created},
+        {"tls_sessions_resumed", stats.tls_sessions_resumed},
+        {"tls_full_handshakes", stats.tls_full_handshakes},
+    };
+  }
+  std::cout << boost::json::serialize(result) << std::endl;
+  std::ofstream ofs(config.output);
+  ofs << boost::json::serialize(result) << std::endl;
+
+  // タイマーなどが残っていても終了できるように、io_context を止める
+  boost::asio::post(ioc, [&ioc]() { ioc.stop(); });
+  ioc_thread.join();
+  clients.clear();
+  if (server != nullptr) {
+    boost::asio::post(*server_ioc, [server]() { server->Stop(); });
+    boost::asio::post(*server_ioc, [&server_ioc]() { server_ioc->stop(); });
+    server_ioc_thread.join();
+    server.reset();
+  }
+
+  return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,284 @@
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Linux
+#include <errno.h>
+#include <linux/videodev2.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// WebRTC
+#include <api/scoped_refptr.h>
+#include <api/video/video_frame.h>
+#include <api/video/video_frame_buffer.h>
+#include <api/video/video_sink_interface.h>
+#include <api/video/video_source_interface.h>
+
+// Catch2
+#include <catch2/catch_test_macros.hpp>
+
+// Sora C++ SDK
+#include <sora/v4l2/v4l2_capture_backend.h>
+#include <sora/v4l2/v4l2_device.h>
+#include <sora/v4l2/v4l2_video_capturer.h>
+
+namespace {
+
+const int kWidth = 64;
+const int kHeight = 48;
+// ドライバによっては 1 行がパディングされるので、幅より大きくしておく
+const int kBytesPerLine = 80;
+const size_t kFrameSize = kBytesPerLine * kHeight * 3 / 2;
+
+// カメラの代わりに、Produce() を呼んだ時にフレームを 1 つ書き込むバックエンド。
+// デバイスの fd の代わりに eventfd を返して、取り出せるバッファがある間は読み込み可能にする。
+class FakeV4L2CaptureBackend : public sora::V4L2CaptureBackend {
+ public:
+  FakeV4L2CaptureBackend()
+      : event_fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC | EFD_SEMAPHORE)) {}
+  ~FakeV4L2CaptureBackend() override { close(event_fd_); }
+
+  std::optional<std::vector<sora::V4L2Device>> EnumDevices() override {
+    sora::V4L2FormatDescription format;
+    format.index = 0;
+    format.pixel_format = V4L2_PIX_FMT_NV12;
+    format.description = "NV12";
+    sora::V4L2Device device;
+    device.index = 0;
+    device.path = "/dev/video-fake";
+    device.card = "fake";
+    device.bus_info = "fake";
+    device.format_descriptions.push_back(format);
+    return std::vector<sora::V4L2Device>{device};
+  }
+  int Open(const std::string& path) override { return event_fd_; }
+  // eventfd はこのオブジェクトが破棄される時に閉じる
+  int Close(int fd) override { return 0; }
+  int Ioctl(int fd, unsigned long request, void* arg) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    switch (request) {
+      case VIDIOC_S_FMT:
+      case VIDIOC_G_FMT: {
+        auto fmt = static_cast<v4l2_format*>(arg);
+        fmt->fmt.pix.width = kWidth;
+        fmt->fmt.pix.height = kHeight;
+        fmt->fmt.pix.pixelformat = V4L2_PIX_FMT_NV12;
+        fmt->fmt.pix.bytesperline = kBytesPerLine;
+        fmt->fmt.pix.sizeimage = kFrameSize;
+        return 0;
+      }
+      case VIDIOC_G_PARM:
+        // フレームレートの変更には対応しない
+        return 0;
+      case VIDIOC_REQBUFS: {
+        auto req = static_cast<v4l2_requestbuffers*>(arg);
+        buffers_.resize(req->count);
+        return 0;
+      }
+      case VIDIOC_CREATE_BUFS: {
+        auto create = static_cast<v4l2_create_buffers*>(arg);
+        create->index = buffers_.size();
+        buffers_.resize(buffers_.size() + create->count);
+        return 0;
+      }
+      case VIDIOC_QUERYBUF: {
+        auto buf = static_cast<v4l2_buffer*>(arg);
+        buf->length = kFrameSize;
+        buf->m.offset = buf->index * kFrameSize;
+        return 0;
+      }
+      case VIDIOC_QBUF: {
+        auto buf = static_cast<v4l2_buffer*>(arg);
+        queued_.push_back(buf->index);
+        cond_.notify_all();
+        return 0;
+      }
+      case VIDIOC_DQBUF: {
+        uint64_t value;
+        if (read(event_fd_, &value, sizeof(value)) < 0 || filled_.empty()) {
+          errno = EAGAIN;
+          return -1;
+        }
+        auto buf = static_cast<v4l2_buffer*>(arg);
+        buf->index = filled_.front();
+        buf->bytesused = kFrameSize;
+        filled_.pop_front();
+        return 0;
+      }
+      case VIDIOC_STREAMON:
+      case VIDIOC_STREAMOFF:
+        return 0;
+    }
+    errno = EINVAL;
+    return -1;
+  }
+  void* Mmap(int fd, size_t length, off_t offset) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t index = offset / kFrameSize;
+    if (index >= buffers_.size()) {
+      return MAP_FAILED;
+    }
+    buffers_[index].resize(length);
+    return buffers_[index].data();
+  }
+  // メモリはこのオブジェクトが破棄されるまで解放しない
+  int Munmap(void* addr, size_t length) override { return 0; }
+
+  // デバイスに渡されているバッファにフレームを書き込んで、取り出せるようにする
+  bool Produce(uint8_t value) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (queued_.empty()) {
+      return false;
+    }
+    uint32_t index = queued_.front();
+    queued_.pop_front();
+    std::fill(buffers_[index].begin(), buffers_[index].end(), value);
+    filled_.push_back(index);
+    uint64_t one = 1;
+    return write(event_fd_, &one, sizeof(one)) == sizeof(one);
+  }
+  // デバイスに渡されているバッファが count 個になるまで待つ
+  bool WaitQueued(size_t count) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return cond_.wait_for(lock, std::chrono::seconds(5),
+                          [&]() { return queued_.size() == count; });
+  }
+  bool IsMapped(const uint8_t* p) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& buffer : buffers_) {
+      if (p >= buffer.data() && p < buffer.data() + buffer.size()) {
+        return true;
+      }
+    }
+    return false;
+  }
+  size_t buffer_count() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return buffers_.size();
+  }
+
+ private:
+  int event_fd_;
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::vector<std::vector<uint8_t>> buffers_;
+  std::deque<uint32_t> queued_;
+  std::deque<uint32_t> filled_;
+};
+
+// 受け取ったフレームを Clear() されるまで保持するシンク
+class FrameHolder : public webrtc::VideoSinkInterface<webrtc::VideoFrame> {
+ public:
+  void OnFrame(const webrtc::VideoFrame& frame) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    frames_.push_back(frame);
+    cond_.notify_all();
+  }
+  // frames 個のフレームを受け取るまで待って、index 番目のバッファを返す
+  webrtc::scoped_refptr<webrtc::VideoFrameBuffer> Wait(size_t frames,
+                                                       size_t index) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!cond_.wait_for(lock, std::chrono::seconds(5),
+                        [&]() { return frames_.size() >= frames; })) {
+      return nullptr;
+    }
+    return frames_[index].video_frame_buffer();
+  }
+  void Clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    frames_.clear();
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::vector<webrtc::VideoFrame> frames_;
+};
+
+webrtc::scoped_refptr<sora::V4L2VideoCapturer> CreateCapturer(
+    std::shared_ptr<FakeV4L2CaptureBackend> backend,
+    int max_buffers) {
+  sora::V4L2VideoCapturerConfig config;
+  config.width = kWidth;
+  config.height = kHeight;
+  config.force_nv12 = true;
+  config.zero_copy = true;
+  config.max_buffers = max_buffers;
+  config.backend = backend;
+  return sora::V4L2VideoCapturer::Create(config);
+}
+
+}  // namespace
+
+TEST_CASE("V4L2VideoCapturer は貸し出したバッファをフレームの破棄時にデバイスに戻す") {
+  auto backend = std::make_shared<FakeV4L2CaptureBackend>();
+  // 最初に確保する 4 個から増やさない
+  auto capturer = CreateCapturer(backend, 4);
+  REQUIRE(capturer != nullptr);
+  FrameHolder holder;
+  capturer->AddOrUpdateSink(&holder, webrtc::VideoSinkWants());
+  REQUIRE(backend->WaitQueued(4));
+
+  // デバイスに 2 個 (kMinQueuedBuffers) 残る間はコピーせずに貸し出す
+  for (int i = 0; i < 2; i++) {
+    REQUIRE(backend->Produce(i + 1));
+    auto buffer = holder.Wait(i + 1, i);
+    REQUIRE(buffer != nullptr);
+    REQUIRE(buffer->type() == webrtc::VideoFrameBuffer::Type::kNV12);
+    auto nv12 = buffer->GetNV12();
+    REQUIRE(backend->IsMapped(nv12->DataY()));
+    REQUIRE(nv12->StrideY() == kBytesPerLine);
+    REQUIRE(nv12->DataUV() == nv12->DataY() + kBytesPerLine * kHeight);
+    REQUIRE(nv12->DataY()[0] == i + 1);
+  }
+  REQUIRE(backend->WaitQueued(2));
+
+  // 残りが 2 個を下回る場合はバッファを増やせないので、コピーしてすぐに戻す
+  REQUIRE(backend->Produce(3));
+  auto copied = holder.Wait(3, 2);
+  REQUIRE(copied != nullptr);
+  REQUIRE(!backend->IsMapped(copied->GetNV12()->DataY()));
+  REQUIRE(copied->GetNV12()->DataY()[0] == 3);
+  copied = nullptr;
+  REQUIRE(backend->WaitQueued(2));
+  REQUIRE(backend->buffer_count() == 4);
+
+  // 保持していたフレームを破棄すると、貸し出したバッファがデバイスに戻る
+  holder.Clear();
+  REQUIRE(backend->WaitQueued(4));
+
+  capturer->RemoveSink(&holder);
+}
+
+TEST_CASE("V4L2VideoCapturer はデバイスのバッファが足りない場合に max_buffers まで増やす") {
+  auto backend = std::make_shared<FakeV4L2CaptureBackend>();
+  auto capturer = CreateCapturer(backend, 5);
+  REQUIRE(capturer != nullptr);
+  FrameHolder holder;
+  capturer->AddOrUpdateSink(&holder, webrtc::VideoSinkWants());
+  REQUIRE(backend->WaitQueued(4));
+
+  // 3 個目で残りが 2 個を下回るので、VIDIOC_CREATE_BUFS で 1 個増やしてから貸し出す
+  for (int i = 0; i < 3; i++) {
+    REQUIRE(backend->Produce(i + 1));
+    auto buffer = holder.Wait(i + 1, i);
+    REQUIRE(buffer != nullptr);
+    REQUIRE(backend->IsMapped(buffer->GetNV12()->DataY()));
+  }
+  REQUIRE(backend->buffer_count() == 5);
+  REQUIRE(backend->WaitQueued(2));
+
+  holder.Clear();
+  REQUIRE(backend->WaitQueued(5));
+
+  capturer->RemoveSink(&holder);
+}